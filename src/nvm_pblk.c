@@ -1,635 +1,582 @@
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <errno.h>
 #include <stdio.h>
-#include <zlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <liblightnvm_cli.h>
+#include <pblk.h>
+#include <pblk_out.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-#define PBLK_META_VER 0x1
-#define PBLK_META_IDENT 0x70626c6b
-
-// NOTE: These limits are used to reduce memory dynamic memory management
-#define PBLK_MAX_LINES 4096
-#define PBLK_MAX_LUNS 512
-#define PBLK_MAX_INSTS 64
-
-enum pblk_line_type {
-	PBLK_LINETYPE_FREE = 0,
-	PBLK_LINETYPE_LOG = 1,
-	PBLK_LINETYPE_DATA = 2,
-};
-
-const char *pblk_line_type_str(int ltype)
-{
-	switch (ltype) {
-	case PBLK_LINETYPE_FREE:
-		return "PBLK_LINETYPE_FREE";
-	case PBLK_LINETYPE_LOG:
-		return "PBLK_LINETYPE_LOG";
-	case PBLK_LINETYPE_DATA:
-		return "PBLK_LINETYPE_DATA";
-	default:
-		return "PBLK_LINETYPE_UNDEF";
-	}
-}
-
-struct pblk_line_header {
-	uint32_t crc;
-	uint32_t identifier;
-	uint32_t uuid[4];
-	uint16_t type;
-	uint16_t version;
-	uint32_t id;
-};
-
-struct pblk_line_smeta {
-	struct pblk_line_header header;
-	uint32_t crc;
-	uint32_t prev_id;
-	uint64_t seq_nr;
-	uint32_t window_wr_lun;
-	uint32_t rsvd[2];
-};
-
-struct pblk_line_emeta {
-	struct pblk_line_header header;
-	uint32_t crc;
-	uint32_t prev_id;
-	uint64_t seq_nr;
-	uint32_t window_wr_lun;
-	uint32_t next_id;
-	uint64_t nr_lbas;
-	uint64_t lbas[];
+/**
+ * Options handled by nvm_pblk itself, these are removed from argv before it is
+ * handed to the liblightnvm CLI
+ */
+struct pblk_opts {
+	int jobs;				///< Number of scan workers
+	int qd;					///< Reads in-flight per LUN
+	int lat_us;				///< Latency added to reads
+	const char *bbt_cache;			///< bbt cache dir, or NULL
+	const char *snapshot;			///< Scan snapshot path, or NULL
+	const char *lines;			///< Lines to wipe, or NULL
+	const char *format;			///< Line dump format, or NULL
+	const char *discovery;			///< Discovery mode, or NULL
+	int discovery_only;			///< Stop after discovery
+	const char *listen;			///< Exporter address, or NULL
+	int interval;				///< Seconds between exporter scans
+	int scans;				///< Exporter scans, 0: unbounded
+	const char *out;			///< Metadump or data path, or NULL
+	int no_chunk_rprt;			///< Read lines despite a report
+	const char *lbas;			///< LBAs to read, or NULL
+	int ra;					///< LBAs read ahead of a miss
+	int cache_mb;				///< MiB of LBAs cached
 };
 
-enum pblk_line_state {
-	PBLK_LINE_STATE_UNKNOWN = 0x0,
-	PBLK_LINE_STATE_OPEN = 0x1,
-	PBLK_LINE_STATE_CLOSED = 0x1 << 2,
-	PBLK_LINE_STATE_BAD = 0x1 << 3,
+static struct pblk_opts opts = {
+	.jobs = 1,
+	.qd = 1,
+	.lat_us = 0,
+	.bbt_cache = NULL,
+	.snapshot = NULL,
+	.lines = NULL,
+	.format = NULL,
+	.discovery = NULL,
+	.discovery_only = 0,
+	.listen = NULL,
+	.interval = 60,
+	.scans = 0,
+	.out = NULL,
+	.no_chunk_rprt = 0,
+	.lbas = NULL,
+	.ra = 1024,
+	.cache_mb = 64,
 };
 
-const char *pblk_line_state_str(int lstate)
+static int pblk_opts_parse_int(const char *arg, long min, long max, int *val)
 {
-	switch (lstate) {
-	case PBLK_LINE_STATE_OPEN:
-		return "PBLK_LINE_STATE_OPEN";
-	case PBLK_LINE_STATE_CLOSED:
-		return "PBLK_LINE_STATE_CLOSED";
-	case PBLK_LINE_STATE_BAD:
-		return "PBLK_LINE_STATE_BAD";
-	case PBLK_LINE_STATE_UNKNOWN:
-		return "PBLK_LINE_STATE_UNKNOWN";
-	default:
-		return "PBLK_LINE_STATE_UNDEF";
-	}
-}
-
-struct pblk_line {
-	int id;
-	enum pblk_line_state state;
-
-	struct pblk_line_smeta smeta;
-	struct nvm_addr smeta_addr;
-	struct nvm_ret smeta_ret;
-
-	struct pblk_line_emeta emeta;
-	struct nvm_addr emeta_addr;
-	struct nvm_ret emeta_ret;
-};
-
-struct pblk_inst {
-	int lun_bgn;				///< LUN range begin
-	int lun_end;				///< LUN range end
-	int nluns;				///< Number of LUNs
-	struct nvm_addr luns[PBLK_MAX_LUNS];	///< LUNs addresses
-	const struct nvm_bbt *bbts[PBLK_MAX_LUNS];	///< bbts in stripe order
-	int nlines;				///< Number of lines
-	struct pblk_line lines[PBLK_MAX_LINES];	///< Array of lines
-};
+	char *end = NULL;
+	long num;
 
-struct pblk {
-	struct nvm_dev *dev;
-	int tluns;				///< Total number of luns
-	int ninsts;				///< Number of pblk instances
-	struct pblk_inst insts[PBLK_MAX_INSTS];	///< pblk instances
-};
-
-void pblk_instance_pr(const struct pblk_inst *inst)
-{
-	if (!inst) {
-		printf("pblk_instance: ~\n");
-		return;
+	errno = 0;
+	num = strtol(arg, &end, 10);
+	if (errno || (end == arg) || (*end != '\0') || (num < min) ||
+	    (num > max)) {
+		errno = EINVAL;
+		return -1;
 	}
 
-	printf("pblk_instance:\n");
-	printf("  lun_bgn: %d\n", inst->lun_bgn);
-	printf("  lun_end: %d\n", inst->lun_end);
-	printf("  nluns: %d\n", inst->nluns);
-}
-
-/**
- * Compute CRC of the given line_header
- */
-static inline uint32_t pblk_line_header_crc(struct pblk_line_header *hdr)
-{
-	return crc32(0, ((unsigned char *)hdr) + sizeof(hdr->crc),
-		     sizeof(*hdr) - sizeof(hdr->crc)
-	) ^ (~(uint32_t)0);
-}
+	*val = num;
 
-/**
- * Compute CRC of the given smeta
- */
-static inline uint32_t pblk_line_smeta_crc(struct pblk_line_smeta *smeta,
-					   size_t len)
-{
-	return crc32(0, ((unsigned char *)smeta) +
-			sizeof(smeta->header) + sizeof(smeta->crc),
-			len -
-			sizeof(smeta->header) - sizeof(smeta->crc)
-	) ^ (~(uint32_t)0);
+	return 0;
 }
 
 /**
- * Compute CRC of the given emeta
+ * Parse and remove nvm_pblk options from the given argv
+ *
+ * Supported options:
+ *  --jobs N	Number of worker threads used for scanning
+ *  --qd N	Number of reads in-flight per LUN, N > 1 reads asynchronously
+ *  --lat-us N	Microseconds added to every read command, for emulated devices
+ *  --bbt-cache DIR	Cache the bbts of the device in DIR, and use the cache
+ *			on later runs instead of fetching the bbts
+ *  --snapshot PATH	Save the scanned lines to PATH, and on later runs only
+ *			rescan lines which may have changed since
+ *  --lines A-B	Lines to wipe, default is line 0
+ *  --format FMT	Format of line dumps: yaml, jsonl or bin
+ *  --discovery MODE	Instance discovery: fast, skipping LUNs covered by
+ *			instances found, or full, probing every LUN
+ *  --discovery-only	Stop after instance discovery and report its cost
+ *  --listen ADDR	Exporter address: unix:PATH or tcp:[HOST:]PORT
+ *  --interval N	Seconds between the scans of the exporter
+ *  --scans N	Scans of the exporter before it stops, 0 never stops
+ *  --out PATH	Path of the metadump written by metadump, or of the data
+ *			written by read_lba
+ *  --no-chunk-rprt	Classify lines by reading them, also when the device
+ *			has a chunk report
+ *  --lbas A-B	LBAs to read, default is every LBA up to the last mapped
+ *  --ra N	LBAs read ahead of a read missing the cache
+ *  --cache-mb N	MiB of LBAs cached by read_lba
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
  */
-static inline uint32_t pblk_line_emeta_crc(struct pblk_line_emeta *emeta,
-					   size_t len)
-{
-	return crc32(0, ((unsigned char *)emeta) +
-			sizeof(emeta->header) + sizeof(emeta->crc),
-			len -
-			sizeof(emeta->header) - sizeof(emeta->crc)
-	) ^ (~(uint32_t)0);
-}
-
-void pblk_line_header_pr(const struct pblk_line_header *header)
-{
-	if (!header) {
-		printf("  header: ~\n");
-		return;
-	}
-
-	printf("  header:\n");
-	printf("    crc: 0x%04x\n", header->crc);
-	printf("    identifier: 0x%04x\n", header->identifier);
-	printf("    uuid: [0x%04x, 0x%04x, 0x%04x, 0x%04x]\n",
-	       header->uuid[0], header->uuid[1],
-	       header->uuid[2], header->uuid[3]);
-	printf("    type: %s\n", pblk_line_type_str(header->type));
-	printf("    version: %02x\n", header->version);
-	printf("    id: %04u\n", header->id);
-}
-
-void pblk_line_smeta_pr(const struct pblk_line_smeta *smeta)
-{
-	if (!smeta) {
-		printf("smeta: ~\n");
-		return;
-	}
-
-	printf("smeta:\n");
-	pblk_line_header_pr(&smeta->header);
-	printf("  crc: 0x%04x\n", smeta->crc);
-	printf("  prev_id: %04u\n", smeta->prev_id);
-	printf("  seq_nr: %04lu\n", smeta->seq_nr);
-	printf("  window_wr_lun: %08u\n", smeta->window_wr_lun);
-}
-
-void pblk_line_emeta_pr(const struct pblk_line_emeta *emeta)
-{
-	if (!emeta) {
-		printf("emeta: ~\n");
-		return;
-	}
-
-	printf("emeta:\n");
-	pblk_line_header_pr(&emeta->header);
-	printf("  crc: 0x%04x\n", emeta->crc);
-	printf("  prev_id: %04u\n", emeta->prev_id);
-	printf("  seq_nr: %04lu\n", emeta->seq_nr);
-	printf("  window_wr_lun: %08u\n", emeta->window_wr_lun);
-	printf("  next_id: %04u\n", emeta->next_id);
-	printf("  nr_lbas: %04lu\n", emeta->nr_lbas);
-}
-
-void pblk_line_pr(const struct pblk_line *line)
+int pblk_opts_parse(struct pblk_opts *opts, int *argc, char **argv)
 {
-	int smeta_read = !(line->smeta_ret.status || line->smeta_ret.result);
-	int emeta_read = !(line->emeta_ret.status || line->emeta_ret.result);
-
-	printf("line_%04d:\n", line->id);
-	printf("  id: %04d:\n", line->id);
-	printf("  state: %s\n", pblk_line_state_str(line->state));
-	if (line->state == PBLK_LINE_STATE_BAD)
-		return;
-
-	printf("  smeta_"); nvm_addr_pr(line->smeta_addr);
-	printf("  emeta_"); nvm_addr_pr(line->emeta_addr);
-
-	if (smeta_read) {
-		printf("  smeta_nvm_ret: ~\n");
-	} else {
-		printf("  smeta_");
-		nvm_ret_pr(&line->smeta_ret);
-	}
-
-	if (emeta_read) {
-		printf("  emeta_nvm_ret: ~\n");
-	} else {
-		printf("  emeta_");
-		nvm_ret_pr(&line->emeta_ret);
-	}
+	struct {
+		const char *name;
+		int *val;
+		long min;
+		long max;
+		const char **str;		///< Set for string options
+		int flag;			///< Takes no value, sets val
+	} vopts[] = {
+		{ "--jobs", &opts->jobs, 1, 4096, NULL },
+		{ "--qd", &opts->qd, 1, 4096, NULL },
+		{ "--lat-us", &opts->lat_us, 0, 10000000, NULL },
+		{ "--bbt-cache", NULL, 0, 0, &opts->bbt_cache },
+		{ "--snapshot", NULL, 0, 0, &opts->snapshot },
+		{ "--lines", NULL, 0, 0, &opts->lines },
+		{ "--format", NULL, 0, 0, &opts->format },
+		{ "--discovery", NULL, 0, 0, &opts->discovery },
+		{ "--discovery-only", &opts->discovery_only, 0, 1, NULL, 1 },
+		{ "--listen", NULL, 0, 0, &opts->listen },
+		{ "--interval", &opts->interval, 1, 86400, NULL },
+		{ "--scans", &opts->scans, 0, 1000000, NULL },
+		{ "--out", NULL, 0, 0, &opts->out },
+		{ "--no-chunk-rprt", &opts->no_chunk_rprt, 0, 1, NULL, 1 },
+		{ "--lbas", NULL, 0, 0, &opts->lbas },
+		{ "--ra", &opts->ra, 0, 1 << 20, NULL },
+		{ "--cache-mb", &opts->cache_mb, 1, 1 << 16, NULL },
+	};
+	const int nvopts = sizeof(vopts) / sizeof(vopts[0]);
+	int nargs = 1;
+
+	for (int i = 1; i < *argc; ++i) {
+		const char *val = NULL;
+		int opt = -1;
+
+		for (int j = 0; j < nvopts; ++j) {
+			const size_t len = strlen(vopts[j].name);
+
+			if (strncmp(argv[i], vopts[j].name, len))
+				continue;
 
-	if (smeta_read) {
-		printf("line%04i_", line->id);
-		pblk_line_smeta_pr(&line->smeta);
-	}
-	if (emeta_read) {
-		printf("line%04i_", line->id);
-		pblk_line_emeta_pr(&line->emeta);
-	}
-}
+			if (vopts[j].flag) {
+				if (argv[i][len] != '\0')
+					continue;
+				val = "1";
+			} else if (argv[i][len] == '=') {
+				val = argv[i] + len + 1;
+			} else if (argv[i][len] != '\0') {
+				continue;
+			} else if (i + 1 < *argc) {
+				val = argv[++i];
+			} else {
+				errno = EINVAL;
+				return -1;
+			}
 
-int pblk_line_smeta_from_buf(char *buf, struct pblk_line_smeta *smeta)
-{
-	if ((!buf) || (!smeta)) {
-		errno = EINVAL;
-		return -1;
-	}
+			opt = j;
+			break;
+		}
 
-	memcpy(smeta, buf, sizeof(*smeta));
+		if (opt < 0) {
+			argv[nargs++] = argv[i];
+			continue;
+		}
 
-	return 0;
-}
+		if (vopts[opt].str) {
+			*vopts[opt].str = val;
+			continue;
+		}
 
-int pblk_line_emeta_from_buf(char *buf, struct pblk_line_emeta *emeta)
-{
-	if ((!buf) || (!emeta)) {
-		errno = EINVAL;
-		return -1;
+		if (pblk_opts_parse_int(val, vopts[opt].min, vopts[opt].max,
+					vopts[opt].val))
+			return -1;
 	}
 
-	memcpy(emeta, buf, sizeof(*emeta));
+	argv[nargs] = NULL;
+	*argc = nargs;
 
 	return 0;
 }
 
 /**
- * Compute and update the smeta-address for the given line given on the given
- * device
+ * Allocate and initialize pblk for the device of the given cli, with scan
+ * parameters given by nvm_pblk options
  *
- * @returns On success, 0 is returned. On error, -1 is returned, `err` set to
- * indicate the error. Error occurs if all blocks in the line are bad.
+ * The device is the one opened by the liblightnvm CLI, or when emulated, the
+ * one given by the device path.
  */
-int pblk_line_smeta_addr_calc(struct pblk_line *line, struct pblk_inst *inst,
-			      const struct nvm_geo *geo)
+static struct pblk *_pblk_init_cli(struct nvm_cli *cli)
 {
-	for (int lun = 0; lun < inst->nluns; ++lun) {
-		const struct nvm_bbt *bbt = inst->bbts[lun];
-		const size_t blk_off = line->id * geo->nplanes;
-		const size_t blk_lim = blk_off + geo->nplanes;
-
-		int broken = 0;
-
-		for (size_t blk = blk_off; blk < blk_lim; ++blk)
-			broken |= bbt->blks[blk];
+	struct pblk_dev *dev = NULL;
+	struct pblk *pblk = NULL;
 
-		if (broken)
-			continue;
+	if (cli->args.dev)
+		dev = pblk_dev_wrap(cli->args.dev);
+	else
+		dev = pblk_dev_open(cli->args.dev_path);
+	if (!dev) {
+		nvm_cli_perror("pblk_dev_open");
+		return NULL;
+	}
+	pblk_dev_set_lat(dev, opts.lat_us);
 
-		line->smeta_addr.ppa = 0;
-		line->smeta_addr.g.blk = line->id;
-		line->smeta_addr.g.ch = bbt->addr.g.ch;
-		line->smeta_addr.g.lun = bbt->addr.g.lun;
-		return 0;
+	pblk = pblk_init(dev, 0x0);
+	if (!pblk) {
+		nvm_cli_perror("pblk_init");
+		pblk_dev_close(dev);
+		return NULL;
 	}
 
-	return -1;
+	pblk->jobs = opts.jobs;
+	pblk->qd = opts.qd;
+	pblk->bbt_cache = opts.bbt_cache;
+	pblk->chunk_rprt = !opts.no_chunk_rprt;
+
+	return pblk;
 }
 
 /**
- * Compute and update the emeta-address for the given given on the given device
+ * Scan for line meta of all instances, incrementally when a usable snapshot
+ * is given, fully otherwise
  */
-int pblk_line_emeta_addr_calc(struct pblk_line *line, struct pblk_inst *inst,
-			      const struct nvm_geo *geo)
+static void _pblk_init_lines_cli(struct pblk *pblk)
 {
-	for (int lun = 0; lun < inst->nluns; ++lun) {
-		const struct nvm_bbt *bbt = inst->bbts[lun];
-		const size_t blk_off = line->id * geo->nplanes;
-		const size_t blk_lim = blk_off + geo->nplanes;
+	struct pblk_snap snap;
+	int nreused = 0;
 
-		int broken = 0;
+	if (!opts.snapshot) {
+		if (pblk_init_lines(pblk))
+			nvm_cli_perror("pblk_init_lines: failed");
+		goto rprt_pr;
+	}
 
-		for (size_t blk = blk_off; blk < blk_lim; ++blk)
-			broken |= bbt->blks[blk];
+	if (pblk_snap_open(&snap, opts.snapshot, pblk)) {
+		nvm_cli_info_pr("No usable snapshot(%s): %s, scanning all lines",
+				opts.snapshot, strerror(errno));
+		if (pblk_init_lines(pblk))
+			nvm_cli_perror("pblk_init_lines: failed");
+		goto rprt_pr;
+	}
 
-		if (broken)
-			continue;
+	if (pblk_init_lines_incr(pblk, &snap, &nreused))
+		nvm_cli_perror("pblk_init_lines_incr: failed");
+	else
+		nvm_cli_info_pr("Reused %d lines from snapshot(%s)", nreused,
+				opts.snapshot);
 
-		line->emeta_addr.ppa = 0;
-		line->emeta_addr.g.blk = line->id;
-		line->emeta_addr.g.ch = bbt->addr.g.ch;
-		line->emeta_addr.g.lun = bbt->addr.g.lun;
-		line->emeta_addr.g.pg = geo->npages - 1;
-		return 0;
-	}
+	pblk_snap_close(&snap);
 
-	return -1;
+rprt_pr:
+	if (pblk->chunks)
+		nvm_cli_info_pr("Lines classified by the chunk report");
 }
 
 /**
- * Check whether the given smeta has a valid header
- *
- * @returns 0 When valid, some value otherwise
+ * Save the lines of all instances to the snapshot, when enabled and lines
+ * were scanned
  */
-static inline int pblk_line_smeta_hdr_check(struct pblk_line_smeta *smeta)
+static void _pblk_snap_save_cli(struct pblk *pblk)
 {
-	uint32_t crc = pblk_line_header_crc(&smeta->header);
+	int nscanned = 0;
 
-	if (smeta->header.identifier != PBLK_META_IDENT)
-		return -1;
+	if (!(opts.snapshot && pblk))
+		return;
 
-	if (smeta->header.version != PBLK_META_VER)
-		return -1;
+	for (int i = 0; i < pblk->ninsts; ++i)
+		nscanned += !!pblk->insts[i].lines;
+	if (!nscanned)
+		return;
 
-	if (smeta->header.crc != crc)
-		return -1;
+	if (pblk_snap_save(pblk, opts.snapshot))
+		nvm_cli_perror("pblk_snap_save");
+}
 
-	return 0;
+static void _pblk_term_cli(struct pblk *pblk)
+{
+	struct pblk_dev *dev = pblk ? pblk->dev : NULL;
+
+	_pblk_snap_save_cli(pblk);
+	pblk_term(pblk);
+	pblk_dev_close(dev);
 }
 
 /**
- * Check whether the given smeta has a valid "first" header
+ * Discover the instances of the device, in the mode given by --discovery or
+ * else by the given flags, reporting the cost when --discovery-only is given
  *
- * @returns 0 When valid, some value otherwise
+ * @returns 0 to continue, 1 when stopping after discovery, and -1 on error.
  */
-static inline int pblk_line_smeta_hdrf_check(struct pblk_line_smeta *smeta)
+static int _pblk_init_instances_cli(struct pblk *pblk, int flags)
 {
-	if (pblk_line_smeta_hdr_check(smeta))
-		return -1;
+	double t_bgn, t_disc;
 
-	if (smeta->header.id != 0)
+	if (opts.discovery && (!strcmp(opts.discovery, "full"))) {
+		flags |= PBLK_INSTANCES_PROBE_ALL;
+	} else if (opts.discovery && (!strcmp(opts.discovery, "fast"))) {
+		flags &= ~PBLK_INSTANCES_PROBE_ALL;
+	} else if (opts.discovery) {
+		errno = EINVAL;
+		nvm_cli_perror("invalid --discovery, expected fast or full");
 		return -1;
+	}
 
-	if (smeta->prev_id != ~(uint32_t)0)
+	nvm_cli_info_pr("Scanning device for pblk instances");
+	t_bgn = pblk_ts();
+	if (pblk_init_instances(pblk, flags)) {
+		nvm_cli_info_pr("Scanning failed");
 		return -1;
+	}
+	t_disc = pblk_ts() - t_bgn;
+	nvm_cli_info_pr("Found %d instances", pblk->ninsts);
 
-	if (smeta->seq_nr != 0)
-		return -1;
+	if (!opts.discovery_only)
+		return 0;
 
-	return 0;
+	printf("discovery:\n");
+	printf("  mode: %s\n",
+	       flags & PBLK_INSTANCES_PROBE_ALL ? "full" : "fast");
+	printf("  ninsts: %d\n", pblk->ninsts);
+	printf("  nluns: %d\n", pblk->tluns);
+	printf("  nluns_probed: %d\n", pblk->nprobes);
+	printf("  sec: %.6f\n", t_disc);
+
+	return 1;
 }
 
 /**
- * Scan for line meta of the given pbkl instance
- *
- * @param dev Device handle obtained with `nvm_dev_open`
- * @param lun_bgn First lun in flattened range
- * @param lun_end Last lun in flattened range
+ * Verify the CRC over the complete smeta of all lines with a readable smeta,
+ * and over the complete emeta, including the lba-list, of all closed lines
  *
- * @returns On success, a pointer to array of 'struct line'. On error, NULL is
- * returned and errno set to indicate the error.
+ * Lines taken from a snapshot in which their CRC was verified are not read,
+ * their result is reported from the snapshot.
  */
-int pblk_init_instance_lines(struct pblk *pblk, struct pblk_inst *inst)
+int _check_crc_inst(struct nvm_cli *cli, struct pblk *pblk,
+		    struct pblk_inst *inst)
 {
-	int err = 0;
-	struct nvm_dev *dev = pblk->dev;
-	const struct nvm_geo *geo = nvm_dev_get_geo(pblk->dev);
-	char *smeta_buf = NULL;
-	char *emeta_buf = NULL;
-	size_t smeta_buf_len;
-	size_t emeta_buf_len;
-
-	if (inst->lun_bgn > inst->lun_end) {
-		errno = ENOMEM;
-		err = -1;
-		goto scan_exit;
-	}
-
-	smeta_buf_len = geo->sector_nbytes;
-	emeta_buf_len = geo->sector_nbytes * geo->nsectors * geo->nplanes * \
-			inst->nluns;
-
-	// Allocate smeta read buffer
-	smeta_buf = nvm_buf_alloc(geo, smeta_buf_len);
-	if (!smeta_buf) {
-		errno = ENOMEM;
-		err = -1;
-		goto scan_exit;
-	}
-
-	// Allocate emeta read buffer
-	emeta_buf = nvm_buf_alloc(geo, emeta_buf_len);
-	if (!emeta_buf) {
-		errno = ENOMEM;
-		err = -1;
-		goto scan_exit;
-	}
-
-	inst->nlines = geo->nblocks;
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	struct pblk_meta_rd rd;
+	int nsmeta = 0, nsmeta_invalid = 0;
+	int nemeta = 0, nemeta_invalid = 0;
+	int nunreadable = 0;
+	int nreused = 0;
+	uint64_t nbytes = 0;
+	double t_crc = 0, t_bgn;
+
+	if (pblk_meta_rd_init(&rd, pblk, inst))
+		return -1;
 
-	// Fill lines with: id, state [and addresses]
-	for (size_t i = 0; i < inst->nlines; ++i) {
-		struct pblk_line *line = &inst->lines[i];
+	for (int i = 0; i < inst->nlines; ++i) {
+		const int state = inst->line_states[i];
+		const int flags = inst->line_flags[i];
+		struct pblk_smeta_view smeta;
+		struct pblk_emeta_view emeta;
+		int invalid;
 
-		line->id = i;
-		line->state = PBLK_LINE_STATE_UNKNOWN;
+		if (!(state & (PBLK_LINE_STATE_OPEN | PBLK_LINE_STATE_CLOSED)))
+			continue;
 
-		if (pblk_line_smeta_addr_calc(line, inst, geo))
-			line->state = PBLK_LINE_STATE_BAD;
+		if ((flags & PBLK_LINE_FLAG_CACHED) &&
+		    (flags & PBLK_LINE_FLAG_CRC_CHECKED)) {
+			++nreused;
 
-		if (pblk_line_emeta_addr_calc(line, inst, geo))
-			line->state = PBLK_LINE_STATE_BAD;
-	}
+			++nsmeta;
+			if (flags & PBLK_LINE_FLAG_SMETA_CRC_BAD) {
+				nvm_cli_info_pr("HAZARD: line %d, smeta crc mismatch",
+						i);
+				++nsmeta_invalid;
+			}
 
-	// Fill lines with smeta or read-err
-	for (size_t i = 0; i < inst->nlines; ++i) {
-		struct pblk_line *line = &inst->lines[i];
+			if (state != PBLK_LINE_STATE_CLOSED)
+				continue;
 
-		if (line->state == PBLK_LINE_STATE_BAD)
+			++nemeta;
+			if (flags & PBLK_LINE_FLAG_EMETA_CRC_BAD) {
+				nvm_cli_info_pr("HAZARD: line %d, emeta crc mismatch",
+						i);
+				++nemeta_invalid;
+			}
 			continue;
+		}
 
-		memset(smeta_buf, 0 , smeta_buf_len);
-		if (!nvm_addr_read(dev, &line->smeta_addr, 1, smeta_buf, NULL,
-				   0x0, &line->smeta_ret))
-			pblk_line_smeta_from_buf(smeta_buf, &line->smeta);
-	}
-
-	// Fill lines with emeta or read-err
-	for (size_t i = 0; i < inst->nlines; ++i) {
-		struct pblk_line *line = &inst->lines[i];
+		inst->line_flags[i] &= ~(PBLK_LINE_FLAG_CRC_CHECKED |
+					 PBLK_LINE_FLAG_SMETA_CRC_BAD |
+					 PBLK_LINE_FLAG_EMETA_CRC_BAD);
 
-		if (line->state == PBLK_LINE_STATE_BAD)
+		if (pblk_meta_rd_smeta(&rd, i, geo)) {
+			nvm_cli_info_pr("HAZARD: line %d, smeta read failed", i);
+			++nunreadable;
 			continue;
+		}
 
-		memset(emeta_buf, 0 , emeta_buf_len);
-		if (!nvm_addr_read(dev, &line->emeta_addr, 1, emeta_buf, NULL,
-				   0x0, &line->emeta_ret))
-			pblk_line_emeta_from_buf(emeta_buf, &line->emeta);
-	}
-
-	// Update pblk_line-state
-	for (size_t i = 0; i < inst->nlines; ++i) {
-		struct pblk_line *line = &inst->lines[i];
-		const int smeta_read = !(line->smeta_ret.status ||
-							line->smeta_ret.result);
-		const int emeta_read = !(line->emeta_ret.status ||
-							line->emeta_ret.result);
+		++nsmeta;
+		if (pblk_smeta_view_parse(&smeta, rd.buf, rd.nbytes, i)) {
+			nvm_cli_info_pr("HAZARD: line %d, invalid smeta", i);
+			inst->line_flags[i] |= PBLK_LINE_FLAG_SMETA_CRC_BAD;
+			++nsmeta_invalid;
+		} else {
+			t_bgn = pblk_ts();
+			invalid = pblk_line_smeta_crc_check(smeta.smeta,
+							    smeta.nbytes);
+			t_crc += pblk_ts() - t_bgn;
+			nbytes += smeta.nbytes;
+			pblk_smeta_view_put(&smeta);
+
+			if (invalid) {
+				nvm_cli_info_pr("HAZARD: line %d, smeta crc mismatch",
+						i);
+				inst->line_flags[i] |=
+					PBLK_LINE_FLAG_SMETA_CRC_BAD;
+				++nsmeta_invalid;
+			}
+		}
 
-		if (line->state == PBLK_LINE_STATE_BAD)
+		if (state != PBLK_LINE_STATE_CLOSED) {
+			inst->line_flags[i] |= PBLK_LINE_FLAG_CRC_CHECKED;
 			continue;
-
-		// TODO: Expand the state classification
-		if (smeta_read && emeta_read) {
-			line->state = PBLK_LINE_STATE_CLOSED;
-		} else if (smeta_read && (!emeta_read)) {
-			line->state = PBLK_LINE_STATE_OPEN;
 		}
-	}
-
-scan_exit:
-	free(smeta_buf);
-	free(emeta_buf);
-
-	return err;
-}
-
-int pblk_init_instance(struct pblk_inst *inst, int lun_bgn, int lun_end,
-		       struct pblk *pblk)
-{
-	const struct nvm_geo *geo = nvm_dev_get_geo(pblk->dev);
-	struct nvm_addr iaddr = { 0 };
 
-	iaddr.g.ch = lun_bgn / geo->nluns;
-
-	inst->nluns = (lun_end - lun_bgn) + 1;
-	inst->lun_bgn = lun_bgn;
-	inst->lun_end = lun_end;
-
-	size_t vnchannels = inst->nluns / geo->nluns;
+		if (pblk_meta_rd_emeta(&rd, i, geo)) {
+			nvm_cli_info_pr("HAZARD: line %d, emeta read failed", i);
+			++nunreadable;
+			continue;
+		}
 
-	if (!vnchannels) {
-		errno = EINVAL;
-		return -1;
+		++nemeta;
+		if (pblk_emeta_view_parse(&emeta, rd.buf, rd.nbytes, i,
+					  pblk_inst_sec_per_line(inst, geo))) {
+			nvm_cli_info_pr("HAZARD: line %d, invalid emeta", i);
+			inst->line_flags[i] |= PBLK_LINE_FLAG_EMETA_CRC_BAD;
+			++nemeta_invalid;
+		} else {
+			t_bgn = pblk_ts();
+			invalid = pblk_line_emeta_crc_check(emeta.emeta,
+							    emeta.nbytes);
+			t_crc += pblk_ts() - t_bgn;
+			nbytes += emeta.nbytes;
+			pblk_emeta_view_put(&emeta);
+
+			if (invalid) {
+				nvm_cli_info_pr("HAZARD: line %d, emeta crc mismatch",
+						i);
+				inst->line_flags[i] |=
+					PBLK_LINE_FLAG_EMETA_CRC_BAD;
+				++nemeta_invalid;
+			}
+		}
+		inst->line_flags[i] |= PBLK_LINE_FLAG_CRC_CHECKED;
 	}
 
-	for (int vlun = 0; vlun < inst->nluns; ++vlun) {
-		size_t ch = vlun % vnchannels;
-		size_t lun = (vlun / vnchannels) % geo->nluns;
+	printf("crc_check:\n");
+	printf("  impl: %s\n", pblk_crc32_impl()->name);
+	printf("  nlines_smeta: %d\n", nsmeta);
+	printf("  nlines_smeta_invalid: %d\n", nsmeta_invalid);
+	printf("  nlines_emeta: %d\n", nemeta);
+	printf("  nlines_emeta_invalid: %d\n", nemeta_invalid);
+	printf("  nlines_unreadable: %d\n", nunreadable);
+	printf("  nlines_reused: %d\n", nreused);
+	printf("  nbytes: %lu\n", (unsigned long)nbytes);
+	printf("  crc_sec: %.6f\n", t_crc);
+	printf("  crc_gbps: %.3f\n", t_crc > 0 ? nbytes / t_crc / 1e9 : 0.0);
 
-		inst->luns[vlun] = iaddr;
-		inst->luns[vlun].g.ch += ch;
-		inst->luns[vlun].g.lun = lun;
-
-		inst->bbts[vlun] = nvm_bbt_get(pblk->dev, inst->luns[vlun], NULL);
-		if (!inst->bbts[vlun])
-			return -1;
-	}
+	pblk_meta_rd_term(&rd);
 
 	return 0;
 }
 
 /**
- * Initialize a pblk struct by scanning given device for instances
- *
- * NOTE: This does not take bbt info into account
+ * Report the health of the lines of the given instance, by the number of LUNs
+ * on which the block of a line is good
  */
-int pblk_init_instances(struct pblk *pblk, int flags)
+void _check_health_inst(struct pblk_inst *inst)
 {
-	int err = 0;
-
-	struct nvm_dev *dev = pblk->dev;
-	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
-
-	struct pblk_line_smeta smeta = { 0 };
-	char *smeta_buf = NULL;
-	const size_t smeta_buf_len = geo->sector_nbytes * 20;
-
-	// Allocate smeta read buffer
-	smeta_buf = nvm_buf_alloc(geo, smeta_buf_len);
-	if (!smeta_buf) {
-		// errno: propagate from nvm_buf_alloc
-		err = -1;
-		goto scan_exit;
+	int ngood_min = inst->nluns, ngood_max = 0;
+	int nlines_full = 0, nlines_degraded = 0, nlines_bad = 0;
+	uint64_t ngood_sum = 0;
+
+	for (int i = 0; i < inst->nlines; ++i) {
+		const int ngood = pblk_inst_line_ngood(inst, i);
+
+		if (inst->line_states[i] == PBLK_LINE_STATE_BAD)
+			++nlines_bad;
+		else if (ngood == inst->nluns)
+			++nlines_full;
+		else
+			++nlines_degraded;
+
+		ngood_sum += ngood;
+		if (ngood < ngood_min)
+			ngood_min = ngood;
+		if (ngood > ngood_max)
+			ngood_max = ngood;
 	}
 
-	pblk->tluns = geo->nchannels * geo->nluns;
-
-	// TODO: This should account for bbt-info but it will only fail if all
-	// LUNs on the channel have died, due to the non-channel-sharing
-	// assumption of pblk-instances
-	for (size_t tlun = 0; tlun < pblk->tluns; ++tlun) {
-		struct nvm_ret ret = { 0 };
-		struct nvm_addr lun_addr = { 0 };
-		struct nvm_addr inst_addr = { 0 };
-		int lun_bgn, lun_end;
-
-		lun_addr.g.lun = tlun % geo->nluns;
-		lun_addr.g.ch = (tlun / geo->nluns) % geo->nchannels;
-
-		memset(smeta_buf, 0 , smeta_buf_len);
-		if (nvm_addr_read(dev, &lun_addr, 1, smeta_buf, NULL, 0x0, &ret))
-			continue;
-
-		pblk_line_smeta_from_buf(smeta_buf, &smeta);
-		if (pblk_line_smeta_hdrf_check(&smeta))
-			continue;
-
-		lun_bgn = (tlun / geo->nluns) * geo->nluns;
-		lun_end = (lun_bgn + smeta.window_wr_lun) - 1;
-		if (pblk_init_instance(&pblk->insts[pblk->ninsts], lun_bgn,
-				       lun_end, pblk))
-			continue;
+	printf("line_health:\n");
+	printf("  nlines: %d\n", inst->nlines);
+	printf("  nlines_full: %d\n", nlines_full);
+	printf("  nlines_degraded: %d\n", nlines_degraded);
+	printf("  nlines_bad: %d\n", nlines_bad);
+	printf("  nluns_good_min: %d\n", ngood_min);
+	printf("  nluns_good_max: %d\n", ngood_max);
+	printf("  nluns_good_avg: %.2f\n",
+	       inst->nlines ? (double)ngood_sum / inst->nlines : 0.0);
+}
 
-		++(pblk->ninsts);
+static void _check_chain_cb(int err, int line, int other, void *arg)
+{
+	switch (err) {
+	case PBLK_CHAIN_ERR_GAP:
+		nvm_cli_info_pr("chain: line %d, no line with the seq_nr before",
+				line);
+		break;
+	case PBLK_CHAIN_ERR_DUP:
+		nvm_cli_info_pr("HAZARD: line %d, seq_nr of line %d", line,
+				other);
+		break;
+	case PBLK_CHAIN_ERR_FORK:
+		nvm_cli_info_pr("HAZARD: line %d, prev_id of %d lines", line,
+				other);
+		break;
+	case PBLK_CHAIN_ERR_CYCLE:
+		nvm_cli_info_pr("HAZARD: line %d, on a cycle of prev_id", line);
+		break;
+	case PBLK_CHAIN_ERR_PREV:
+		nvm_cli_info_pr("HAZARD: line %d, prev_id is not line %d", line,
+				other);
+		break;
+	case PBLK_CHAIN_ERR_NEXT:
+		nvm_cli_info_pr("HAZARD: line %d, next_id is not line %d", line,
+				other);
+		break;
 	}
-
-scan_exit:
-	free(smeta_buf);
-
-	return err;
 }
 
 /**
- * Allocate and initialize dev, tluns, and bbts.
+ * Verify the prev_id, next_id and seq_nr chain of the lines of the given
+ * instance
  */
-struct pblk *pblk_init(struct nvm_dev *dev, int flags)
+void _check_chain_inst(struct pblk_inst *inst)
 {
-	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
-	const int tluns = geo->nchannels * geo->nluns;
-	struct pblk *pblk = NULL;
-
-	pblk = malloc(sizeof(*pblk));
-	if (!pblk)
-		return NULL;
-	memset(pblk, 0, sizeof(*pblk));
+	struct pblk_chain_stat stat;
 
-	pblk->dev = dev;
-	pblk->tluns = tluns;
+	if (pblk_inst_chain_check(inst, &stat, _check_chain_cb, NULL)) {
+		nvm_cli_perror("pblk_inst_chain_check");
+		return;
+	}
 
-	return pblk;
+	printf("line_chain:\n");
+	printf("  nlines: %d\n", stat.nlines);
+	printf("  seq_nr_min: %lu\n", (unsigned long)stat.seq_nr_min);
+	printf("  seq_nr_max: %lu\n", (unsigned long)stat.seq_nr_max);
+	printf("  newest: %d\n", stat.newest);
+	printf("  ngaps: %d\n", stat.ngaps);
+	printf("  ndups: %d\n", stat.ndups);
+	printf("  nforks: %d\n", stat.nforks);
+	printf("  ncycles: %d\n", stat.ncycles);
+	printf("  nprev_broken: %d\n", stat.nprev_broken);
+	printf("  nnext_broken: %d\n", stat.nnext_broken);
 }
 
-int check_assumptions(struct nvm_cli *cli)
+void _check_crc(struct nvm_cli *cli, struct pblk *pblk)
 {
-	const struct nvm_geo *geo = cli->args.geo;
-
-	if (PBLK_MAX_LINES < geo->nblocks) {
-		nvm_cli_info_pr("Device has more blocks than PBLK_MAX_LINES");
-		return -1;
-	}
-	if (PBLK_MAX_LUNS < (geo->nchannels * geo->nluns)) {
-		nvm_cli_info_pr("Device has more LUNs than PBLK_MAX_LUNS");
-		return -1;
-	}
-	if (PBLK_MAX_INSTS < (geo->nchannels)) {
-		nvm_cli_info_pr("Potentially more than PBLK_MAX_INSTS");
-		return -1;
+	for (int i = 0; i < pblk->ninsts; ++i) {
+		nvm_cli_info_pr("Verifying CRC of instance %d", i);
+		if (_check_crc_inst(cli, pblk, &pblk->insts[i]))
+			nvm_cli_perror("_check_crc_inst");
 	}
-
-	return 0;
 }
 
 int cmd_check_inst(struct nvm_cli *cli)
@@ -640,25 +587,21 @@ int cmd_check_inst(struct nvm_cli *cli)
 	int lun_bgn, lun_end;
 	
 	nvm_cli_info_pr("Initializing pblk...");
-	pblk = pblk_init(cli->args.dev, 0x0);
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
 
 	lun_bgn = cli->args.dec_vals[0];
 	lun_end = cli->args.dec_vals[1];
 
 	nvm_cli_info_pr("Initializing instance (%d, %d)", lun_bgn, lun_end);
-	if (pblk_init_instance(&pblk->insts[0], lun_bgn, lun_end, pblk)) {
-		nvm_cli_perror("pblk_init_instance: failed");
+	if (!pblk_add_instance(pblk, lun_bgn, lun_end)) {
+		nvm_cli_perror("pblk_add_instance: failed");
 		goto cmd_exit;
 	}
-	++pblk->ninsts;
 
 	nvm_cli_info_pr("Scanning device for pblk instance line-meta");
-	for (int i = 0; i < pblk->ninsts; ++i) {
-		struct pblk_inst *inst = &pblk->insts[i];
-
-		if (pblk_init_instance_lines(pblk, inst))
-			nvm_cli_info_pr("Failed for instance %d", i);
-	}
+	_pblk_init_lines_cli(pblk);
 
 	nvm_cli_info_pr("Checking meta data for %d instances", pblk->ninsts);
 	for (int i = 0; i < pblk->ninsts; ++i) {
@@ -667,30 +610,43 @@ int cmd_check_inst(struct nvm_cli *cli)
 		nvm_cli_info_pr("Checking instance %d", i);
 		pblk_instance_pr(&pblk->insts[i]);
 
-		uint32_t prev_id = ~(uint32_t)0;
-
-		for (size_t j = 0; j < inst->nlines; ++j) {
-			struct pblk_line *line = &inst->lines[j];
-
-			switch (line->state) {
+		for (int j = 0; j < inst->nlines; ++j) {
+			switch (inst->line_states[j]) {
 			case PBLK_LINE_STATE_OPEN:
 				printf("#\n");
 				nvm_cli_info_pr("HAZARD: found an open line");
-				pblk_line_pr(line);
+				pblk_line_pr(inst, j);
+				break;
+			case PBLK_LINE_STATE_CORRUPT:
+				printf("#\n");
+				nvm_cli_info_pr("HAZARD: line %d, corrupt smeta header",
+						j);
+				pblk_line_pr(inst, j);
+				break;
+			case PBLK_LINE_STATE_UNREADABLE:
+				printf("#\n");
+				nvm_cli_info_pr("HAZARD: line %d, smeta read failed",
+						j);
 				break;
 			}
 		}
+
+		_check_health_inst(inst);
+		_check_chain_inst(inst);
 	}
 
+	nvm_cli_info_pr("Verifying CRC of smeta and emeta");
+	_check_crc(cli, pblk);
+
 cmd_exit:
-	free(pblk);
+	_pblk_term_cli(pblk);
 	return res;
 
 }
 
 void _check_imbalance(struct pblk *pblk)
 {
-	const struct nvm_geo *geo = nvm_dev_get_geo(pblk->dev);
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
 
 	for (int i = 0; i < pblk->ninsts; ++i) {
 		struct pblk_inst *inst = &pblk->insts[i];
@@ -731,19 +687,21 @@ int cmd_check_all(struct nvm_cli *cli)
 {
 	int res = 0;
 	struct pblk *pblk = NULL;
-	struct nvm_dev *dev = cli->args.dev;
-	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
 	
 	nvm_cli_info_pr("Initializing pblk...");
-	pblk = pblk_init(dev, 0x0);
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
 
-	nvm_cli_info_pr("Scanning device for pblk instances");
-	if (pblk_init_instances(pblk, 0x0)) {
-		nvm_cli_info_pr("Scanning failed");
+	switch (_pblk_init_instances_cli(pblk, PBLK_INSTANCES_PROBE_ALL)) {
+	case 0:
+		break;
+	case 1:
+		goto cmd_exit;
+	default:
 		res = 1;
 		goto cmd_exit;
 	}
-	nvm_cli_info_pr("Found %d instances", pblk->ninsts);
 
 	nvm_cli_info_pr("Checking instance(s) for imbalance...");
 	_check_imbalance(pblk);
@@ -752,12 +710,7 @@ int cmd_check_all(struct nvm_cli *cli)
 	_check_overlap(pblk);
 
 	nvm_cli_info_pr("Scanning device for pblk instance line-meta");
-	for (int i = 0; i < pblk->ninsts; ++i) {
-		struct pblk_inst *inst = &pblk->insts[i];
-
-		if (pblk_init_instance_lines(pblk, inst))
-			nvm_cli_info_pr("Failed for instance %d", i);
-	}
+	_pblk_init_lines_cli(pblk);
 
 	nvm_cli_info_pr("Checking meta data for %d instances", pblk->ninsts);
 	for (int i = 0; i < pblk->ninsts; ++i) {
@@ -766,195 +719,1754 @@ int cmd_check_all(struct nvm_cli *cli)
 		nvm_cli_info_pr("Checking instance %d", i);
 		pblk_instance_pr(&pblk->insts[i]);
 
-		uint32_t prev_id = ~(uint32_t)0;
-
-		for (size_t j = 0; j < inst->nlines; ++j) {
-			struct pblk_line *line = &inst->lines[j];
-
-			switch (line->state) {
+		for (int j = 0; j < inst->nlines; ++j) {
+			switch (inst->line_states[j]) {
 			case PBLK_LINE_STATE_OPEN:
 				printf("#\n");
 				nvm_cli_info_pr("HAZARD: found an open line");
-				pblk_line_pr(line);
+				pblk_line_pr(inst, j);
+				break;
+			case PBLK_LINE_STATE_CORRUPT:
+				printf("#\n");
+				nvm_cli_info_pr("HAZARD: line %d, corrupt smeta header",
+						j);
+				pblk_line_pr(inst, j);
+				break;
+			case PBLK_LINE_STATE_UNREADABLE:
+				printf("#\n");
+				nvm_cli_info_pr("HAZARD: line %d, smeta read failed",
+						j);
 				break;
 			}
 		}
+
+		_check_health_inst(inst);
+		_check_chain_inst(inst);
 	}
 
+	nvm_cli_info_pr("Verifying CRC of smeta and emeta");
+	_check_crc(cli, pblk);
+
 cmd_exit:
-	free(pblk);
+	_pblk_term_cli(pblk);
 	return res;
 
 }
 
-int cmd_lines_inst(struct nvm_cli *cli)
+/**
+ * Set up the writer of line dumps in the format given by --format
+ *
+ * Records in machine-readable formats are written to stdout, and everything
+ * else printed by the command is moved to stderr, thus stdout holds records
+ * only.
+ */
+static int _lines_out_init(struct pblk_out *out)
 {
-	int res = 0;
-	struct pblk *pblk = NULL;
+	int fmt = pblk_out_fmt_parse(opts.format);
+	int fd = STDOUT_FILENO;
 
-	int lun_bgn, lun_end;
+	if (fmt < 0) {
+		nvm_cli_perror("invalid --format, expected yaml, jsonl or bin");
+		return -1;
+	}
+
+	if (fmt != PBLK_OUT_FMT_YAML) {
+		fflush(stdout);
+		fd = dup(STDOUT_FILENO);
+		if ((fd < 0) || (dup2(STDERR_FILENO, STDOUT_FILENO) < 0)) {
+			nvm_cli_perror("dup");
+			return -1;
+		}
+	}
+
+	if (pblk_out_init(out, fmt, fd)) {
+		nvm_cli_perror("pblk_out_init");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int _lines_out_term(struct pblk_out *out)
+{
+	int err = 0;
+
+	if (pblk_out_term(out)) {
+		nvm_cli_perror("pblk_out_term: writing records failed");
+		err = -1;
+	}
+	if (out->fd != STDOUT_FILENO)
+		close(out->fd);
+
+	return err;
+}
+
+/**
+ * Dump the lines of all instances, as YAML with the instance of the lines, or
+ * as a stream of records, one per line
+ */
+static int _lines_dump(struct nvm_cli *cli, struct pblk *pblk,
+		       struct pblk_out *out)
+{
+	for (int i = 0; i < pblk->ninsts; ++i) {
+		struct pblk_inst *inst = &pblk->insts[i];
+
+		if (out->fmt == PBLK_OUT_FMT_YAML) {
+			nvm_cli_info_pr("Meta for instance %d", i);
+			pblk_instance_pr(&pblk->insts[i]);
+		}
+
+		for (int j = 0; j < inst->nlines; ++j) {
+			if (cli->opts.brief &&
+			    ((inst->line_states[j] == PBLK_LINE_STATE_UNKNOWN) ||
+			     (inst->line_states[j] == PBLK_LINE_STATE_FREE)))
+				continue;
+
+			if (out->fmt == PBLK_OUT_FMT_YAML) {
+				printf("\n");
+				pblk_line_pr(inst, j);
+				continue;
+			}
+
+			pblk_out_line(out, inst, j);
+		}
+	}
+
+	return pblk_out_flush(out);
+}
+
+int cmd_lines_inst(struct nvm_cli *cli)
+{
+	int res = 0;
+	struct pblk *pblk = NULL;
+	struct pblk_out out;
+
+	int lun_bgn, lun_end;
+	
+	if (_lines_out_init(&out))
+		return 1;
+
+	nvm_cli_info_pr("Initializing pblk...");
+	pblk = _pblk_init_cli(cli);
+	if (!pblk) {
+		_lines_out_term(&out);
+		return 1;
+	}
+
+	lun_bgn = cli->args.dec_vals[0];
+	lun_end = cli->args.dec_vals[1];
+
+	nvm_cli_info_pr("Initializing instance (%d, %d)", lun_bgn, lun_end);
+	if (!pblk_add_instance(pblk, lun_bgn, lun_end)) {
+		nvm_cli_perror("pblk_add_instance: failed");
+		goto cmd_exit;
+	}
+
+	nvm_cli_info_pr("Scanning device for pblk instance line-meta");
+	_pblk_init_lines_cli(pblk);
+
+	nvm_cli_info_pr("Dumping meta for %d instances", pblk->ninsts);
+	if (_lines_dump(cli, pblk, &out))
+		res = 1;
+
+cmd_exit:
+	_pblk_term_cli(pblk);
+	if (_lines_out_term(&out))
+		res = 1;
+	return res;
+}
+
+int cmd_lines_all(struct nvm_cli *cli)
+{
+	int res = 0;
+	struct pblk *pblk = NULL;
+	struct pblk_out out;
+	
+	if (_lines_out_init(&out))
+		return 1;
+
+	nvm_cli_info_pr("Initializing pblk...");
+	pblk = _pblk_init_cli(cli);
+	if (!pblk) {
+		_lines_out_term(&out);
+		return 1;
+	}
+
+	switch (_pblk_init_instances_cli(pblk, 0x0)) {
+	case 0:
+		break;
+	case 1:
+		goto cmd_exit;
+	default:
+		res = 1;
+		goto cmd_exit;
+	}
+
+	nvm_cli_info_pr("Scanning device for pblk instance line-meta");
+	_pblk_init_lines_cli(pblk);
+
+	nvm_cli_info_pr("Dumping meta for %d instances", pblk->ninsts);
+	if (_lines_dump(cli, pblk, &out))
+		res = 1;
+
+cmd_exit:
+	_pblk_term_cli(pblk);
+	if (_lines_out_term(&out))
+		res = 1;
+	return res;
+}
+
+int cmd_instances(struct nvm_cli *cli)
+{
+	int res = 0;
+	struct pblk *pblk = NULL;
 	
 	nvm_cli_info_pr("Initializing pblk...");
-	pblk = pblk_init(cli->args.dev, 0x0);
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
+
+	switch (_pblk_init_instances_cli(pblk, 0x0)) {
+	case 0:
+		break;
+	case 1:
+		goto cmd_exit;
+	default:
+		res = 1;
+		goto cmd_exit;
+	}
+
+	for (int i = 0; i < pblk->ninsts; ++i)
+		pblk_instance_pr(&pblk->insts[i]);
+
+cmd_exit:
+	_pblk_term_cli(pblk);
+	return res;
+}
+
+void pblk_l2p_line_stat_pr(const struct pblk_line_emeta *emeta,
+			   const struct pblk_l2p_line_stat *stat)
+{
+	printf("  - { id: %04u, seq_nr: %04lu, nr_lbas: %lu, nlbas: %lu, "
+	       "nupdated: %lu, nrange: %lu }\n", emeta->header.id,
+	       (unsigned long)emeta->seq_nr,
+	       (unsigned long)emeta->nr_lbas,
+	       (unsigned long)stat->nlbas, (unsigned long)stat->nupdated,
+	       (unsigned long)stat->nrange);
+}
+
+/**
+ * Rebuild the L2P of the given instance from the lba-lists in emeta of its
+ * closed lines, applied in seq_nr order such that later lines win
+ *
+ * The complete emeta of one line is read at a time, thus memory use is
+ * bounded by the table itself. The table is handed to the caller via `out`,
+ * when given, otherwise it is released.
+ */
+int _l2p_inst(struct nvm_cli *cli, struct pblk *pblk, struct pblk_inst *inst,
+	      struct pblk_l2p *out)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	int *lines = NULL;
+	struct pblk_meta_rd rd;
+	struct pblk_l2p l2p;
+	int nlines = 0;
+	int napplied = 0;
+	uint64_t nlbas = 0, nupdated = 0, nrange = 0;
+	double t_read = 0, t_apply = 0, t_bgn;
+	int err = 0;
+
+	lines = pblk_inst_lines_by_seq(inst, &nlines);
+	if (!lines)
+		return -1;
+
+	if (pblk_meta_rd_init(&rd, pblk, inst)) {
+		free(lines);
+		return -1;
+	}
+
+	if (pblk_l2p_init(&l2p, inst->nlines *
+				pblk_inst_sec_per_line(inst, geo))) {
+		pblk_meta_rd_term(&rd);
+		free(lines);
+		return -1;
+	}
+
+	printf("l2p_lines:\n");
+	for (int i = 0; i < nlines; ++i) {
+		const int line_id = lines[i];
+		struct pblk_l2p_line_stat stat;
+		struct pblk_emeta_view view;
+
+		t_bgn = pblk_ts();
+		if (pblk_meta_rd_emeta(&rd, line_id, geo)) {
+			t_read += pblk_ts() - t_bgn;
+			nvm_cli_info_pr("HAZARD: line %d, emeta read failed",
+					line_id);
+			continue;
+		}
+		t_read += pblk_ts() - t_bgn;
+
+		if (pblk_emeta_view_parse(&view, rd.buf, rd.nbytes, line_id,
+					  pblk_inst_sec_per_line(inst, geo))) {
+			nvm_cli_info_pr("HAZARD: line %d, invalid emeta",
+					line_id);
+			continue;
+		}
+		if (pblk_line_emeta_crc_check(view.emeta, view.nbytes)) {
+			nvm_cli_info_pr("HAZARD: line %d, emeta crc mismatch",
+					line_id);
+			pblk_emeta_view_put(&view);
+			continue;
+		}
+
+		t_bgn = pblk_ts();
+		err = pblk_l2p_apply(&l2p, inst, line_id, &view, geo, &stat);
+		t_apply += pblk_ts() - t_bgn;
+		if (err) {
+			nvm_cli_perror("pblk_l2p_apply");
+			pblk_emeta_view_put(&view);
+			break;
+		}
+
+		++napplied;
+		nlbas += stat.nlbas;
+		nupdated += stat.nupdated;
+		nrange += stat.nrange;
+
+		if (!cli->opts.brief)
+			pblk_l2p_line_stat_pr(view.emeta, &stat);
+		pblk_emeta_view_put(&view);
+	}
+
+	printf("l2p:\n");
+	printf("  nlines_closed: %d\n", nlines);
+	printf("  nlines_applied: %d\n", napplied);
+	printf("  nlbas_capacity: %lu\n", (unsigned long)l2p.nlbas);
+	printf("  nlbas_listed: %lu\n", (unsigned long)nlbas);
+	printf("  nlbas_updated: %lu\n", (unsigned long)nupdated);
+	printf("  nlbas_out_of_range: %lu\n", (unsigned long)nrange);
+	printf("  nlbas_mapped: %lu\n", (unsigned long)l2p.nmapped);
+	printf("  table_nbytes: %lu\n", (unsigned long)l2p.nbytes);
+	printf("  emeta_nbytes: %lu\n", (unsigned long)rd.nbytes);
+	printf("  emeta_read_sec: %.6f\n", t_read);
+	printf("  apply_sec: %.6f\n", t_apply);
+
+	if (out && !err)
+		*out = l2p;
+	else
+		pblk_l2p_term(&l2p);
+	pblk_meta_rd_term(&rd);
+	free(lines);
+
+	return err;
+}
+
+int cmd_l2p_inst(struct nvm_cli *cli)
+{
+	int res = 0;
+	struct pblk *pblk = NULL;
+	int lun_bgn, lun_end;
+	double t_bgn;
+
+	nvm_cli_info_pr("Initializing pblk...");
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
+
+	lun_bgn = cli->args.dec_vals[0];
+	lun_end = cli->args.dec_vals[1];
+
+	nvm_cli_info_pr("Initializing instance (%d, %d)", lun_bgn, lun_end);
+	if (!pblk_add_instance(pblk, lun_bgn, lun_end)) {
+		nvm_cli_perror("pblk_add_instance: failed");
+		res = 1;
+		goto cmd_exit;
+	}
+
+	t_bgn = pblk_ts();
+	nvm_cli_info_pr("Scanning device for pblk instance line-meta");
+	_pblk_init_lines_cli(pblk);
+
+	nvm_cli_info_pr("Rebuilding L2P");
+	pblk_instance_pr(&pblk->insts[0]);
+	if (_l2p_inst(cli, pblk, &pblk->insts[0], NULL))
+		res = 1;
+	nvm_cli_info_pr("Total: %.6f sec", pblk_ts() - t_bgn);
+
+cmd_exit:
+	_pblk_term_cli(pblk);
+	return res;
+}
+
+int cmd_l2p_all(struct nvm_cli *cli)
+{
+	int res = 0;
+	struct pblk *pblk = NULL;
+	double t_bgn;
+
+	nvm_cli_info_pr("Initializing pblk...");
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
+
+	t_bgn = pblk_ts();
+	switch (_pblk_init_instances_cli(pblk, 0x0)) {
+	case 0:
+		break;
+	case 1:
+		goto cmd_exit;
+	default:
+		res = 1;
+		goto cmd_exit;
+	}
+
+	nvm_cli_info_pr("Scanning device for pblk instance line-meta");
+	_pblk_init_lines_cli(pblk);
+
+	for (int i = 0; i < pblk->ninsts; ++i) {
+		nvm_cli_info_pr("Rebuilding L2P for instance %d", i);
+		pblk_instance_pr(&pblk->insts[i]);
+		if (_l2p_inst(cli, pblk, &pblk->insts[i], NULL))
+			res = 1;
+	}
+	nvm_cli_info_pr("Total: %.6f sec", pblk_ts() - t_bgn);
+
+cmd_exit:
+	_pblk_term_cli(pblk);
+	return res;
+}
+
+/**
+ * Print a write amplification, which is unbounded when all sectors are valid
+ */
+static void _wa_pr(const char *key, double wa)
+{
+	if (isinf(wa))
+		printf("  %s: .inf\n", key);
+	else
+		printf("  %s: %.3f\n", key, wa);
+}
+
+/**
+ * Compute the valid sectors of every closed line of the given instance from
+ * the lba-lists of their emeta, and from them the GC lists of pblk and the
+ * write amplification GC would cause
+ */
+int _vsc_inst(struct nvm_cli *cli, struct pblk *pblk, struct pblk_inst *inst)
+{
+	struct pblk_vsc vsc;
+	double t_bgn = pblk_ts();
+
+	if (pblk_inst_vsc(pblk, inst, &vsc)) {
+		nvm_cli_perror("pblk_inst_vsc");
+		return -1;
+	}
+
+	if (!cli->opts.brief) {
+		printf("vsc_lines:\n");
+		for (int i = 0; i < vsc.nlines; ++i) {
+			const struct pblk_vsc_line *vline = &vsc.lines[i];
+
+			printf("  - { id: %04d, seq_nr: %04lu, nsec: %lu, "
+			       "nlbas: %lu, vsc: %lu, gc: %s }\n", vline->id,
+			       (unsigned long)vline->seq_nr,
+			       (unsigned long)vline->nsec,
+			       (unsigned long)vline->nlbas,
+			       (unsigned long)vline->vsc,
+			       pblk_gc_bucket_str(vline->bucket));
+		}
+	}
+
+	for (int i = 0; i < vsc.nlines; ++i) {
+		if (vsc.lines[i].bucket < 0)
+			nvm_cli_info_pr("HAZARD: line %d, emeta unreadable",
+					vsc.lines[i].id);
+	}
+
+	printf("vsc:\n");
+	printf("  nlines_closed: %d\n", vsc.nlines);
+	printf("  nlines_unreadable: %d\n", vsc.nunreadable);
+	printf("  nlbas_capacity: %lu\n", (unsigned long)vsc.nlbas);
+	printf("  nlbas_out_of_range: %lu\n", (unsigned long)vsc.nrange);
+	printf("  nsec: %lu\n", (unsigned long)vsc.nsec);
+	printf("  vsc: %lu\n", (unsigned long)vsc.vsc);
+	printf("  utilization: %.4f\n",
+	       vsc.nsec ? (double)vsc.vsc / vsc.nsec : 0.0);
+	for (int i = 0; i < PBLK_GC_NBUCKETS; ++i)
+		printf("  gc_%s: %d\n", pblk_gc_bucket_str(i), vsc.nbuckets[i]);
+	_wa_pr("wa_mean", vsc.wa_mean);
+	_wa_pr("wa_greedy", vsc.wa_greedy);
+	printf("  bitmap_nbytes: %lu\n", (unsigned long)vsc.bitmap_nbytes);
+	printf("  sec: %.6f\n", pblk_ts() - t_bgn);
+
+	pblk_vsc_term(&vsc);
+
+	return 0;
+}
+
+int cmd_vsc_inst(struct nvm_cli *cli)
+{
+	int res = 0;
+	struct pblk *pblk = NULL;
+	int lun_bgn, lun_end;
+
+	nvm_cli_info_pr("Initializing pblk...");
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
+
+	lun_bgn = cli->args.dec_vals[0];
+	lun_end = cli->args.dec_vals[1];
+
+	nvm_cli_info_pr("Initializing instance (%d, %d)", lun_bgn, lun_end);
+	if (!pblk_add_instance(pblk, lun_bgn, lun_end)) {
+		nvm_cli_perror("pblk_add_instance: failed");
+		res = 1;
+		goto cmd_exit;
+	}
+
+	nvm_cli_info_pr("Scanning device for pblk instance line-meta");
+	_pblk_init_lines_cli(pblk);
+
+	pblk_instance_pr(&pblk->insts[0]);
+	if (_vsc_inst(cli, pblk, &pblk->insts[0]))
+		res = 1;
+
+cmd_exit:
+	_pblk_term_cli(pblk);
+	return res;
+}
+
+int cmd_vsc_all(struct nvm_cli *cli)
+{
+	int res = 0;
+	struct pblk *pblk = NULL;
+
+	nvm_cli_info_pr("Initializing pblk...");
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
+
+	switch (_pblk_init_instances_cli(pblk, 0x0)) {
+	case 0:
+		break;
+	case 1:
+		goto cmd_exit;
+	default:
+		res = 1;
+		goto cmd_exit;
+	}
+
+	nvm_cli_info_pr("Scanning device for pblk instance line-meta");
+	_pblk_init_lines_cli(pblk);
+
+	for (int i = 0; i < pblk->ninsts; ++i) {
+		nvm_cli_info_pr("Computing valid sectors for instance %d", i);
+		pblk_instance_pr(&pblk->insts[i]);
+		if (_vsc_inst(cli, pblk, &pblk->insts[i]))
+			res = 1;
+	}
+
+cmd_exit:
+	_pblk_term_cli(pblk);
+	return res;
+}
+
+/**
+ * Find how far every open line of the given instance was written, and the
+ * volume pblk recovery reads to scan them
+ */
+int _recov_inst(struct nvm_cli *cli, struct pblk *pblk, struct pblk_inst *inst)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	const uint64_t smeta_nsec = pblk_geo_smeta_nsec(geo);
+	struct pblk_recov recov;
+	double t_bgn = pblk_ts();
+
+	if (pblk_inst_recov(pblk, inst, &recov)) {
+		nvm_cli_perror("pblk_inst_recov");
+		return -1;
+	}
+
+	printf("recov_lines:\n");
+	for (int i = 0; i < recov.nlines; ++i) {
+		const struct pblk_recov_line *line = &recov.lines[i];
+		const uint64_t nsec = line->nsec > smeta_nsec ?
+				      line->nsec - smeta_nsec : 0;
+
+		printf("  - { id: %04d, seq_nr: %04lu, nluns: %d, wp_min: %u, "
+		       "wp_max: %u, nsec: %lu, fill: %.4f, nprobes: %lu",
+		       line->id, (unsigned long)line->seq_nr, line->nluns,
+		       line->wp_min, line->wp_max, (unsigned long)line->nsec,
+		       line->nsec_data ? (double)nsec / line->nsec_data : 0.0,
+		       (unsigned long)line->nprobes);
+		if (!cli->opts.brief) {
+			printf(", wps: [");
+			for (int j = 0; j < line->nluns; ++j)
+				printf("%s%u", j ? ", " : "", line->wps[j]);
+			printf("]");
+		}
+		printf(" }\n");
+	}
+
+	printf("recov:\n");
+	printf("  nlines_open: %d\n", recov.nlines);
+	printf("  nrounds: %d\n", recov.nrounds);
+	printf("  nprobes: %lu\n", (unsigned long)recov.nprobes);
+	printf("  nprobes_linear: %lu\n", (unsigned long)recov.nprobes_linear);
+	printf("  read_nsec: %lu\n", (unsigned long)recov.nsec);
+	printf("  read_nbytes: %lu\n", (unsigned long)recov.nbytes);
+	printf("  sec: %.6f\n", pblk_ts() - t_bgn);
+
+	pblk_recov_term(&recov);
+
+	return 0;
+}
+
+int cmd_recov_inst(struct nvm_cli *cli)
+{
+	int res = 0;
+	struct pblk *pblk = NULL;
+	int lun_bgn, lun_end;
+
+	nvm_cli_info_pr("Initializing pblk...");
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
+
+	lun_bgn = cli->args.dec_vals[0];
+	lun_end = cli->args.dec_vals[1];
+
+	nvm_cli_info_pr("Initializing instance (%d, %d)", lun_bgn, lun_end);
+	if (!pblk_add_instance(pblk, lun_bgn, lun_end)) {
+		nvm_cli_perror("pblk_add_instance: failed");
+		res = 1;
+		goto cmd_exit;
+	}
+
+	nvm_cli_info_pr("Scanning device for pblk instance line-meta");
+	_pblk_init_lines_cli(pblk);
+
+	pblk_instance_pr(&pblk->insts[0]);
+	if (_recov_inst(cli, pblk, &pblk->insts[0]))
+		res = 1;
+
+cmd_exit:
+	_pblk_term_cli(pblk);
+	return res;
+}
+
+int cmd_recov_all(struct nvm_cli *cli)
+{
+	int res = 0;
+	struct pblk *pblk = NULL;
+
+	nvm_cli_info_pr("Initializing pblk...");
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
+
+	switch (_pblk_init_instances_cli(pblk, 0x0)) {
+	case 0:
+		break;
+	case 1:
+		goto cmd_exit;
+	default:
+		res = 1;
+		goto cmd_exit;
+	}
+
+	nvm_cli_info_pr("Scanning device for pblk instance line-meta");
+	_pblk_init_lines_cli(pblk);
+
+	for (int i = 0; i < pblk->ninsts; ++i) {
+		nvm_cli_info_pr("Finding write pointers for instance %d", i);
+		pblk_instance_pr(&pblk->insts[i]);
+		if (_recov_inst(cli, pblk, &pblk->insts[i]))
+			res = 1;
+	}
+
+cmd_exit:
+	_pblk_term_cli(pblk);
+	return res;
+}
+
+/**
+ * Parse the lines to wipe, "A-B" or "A", from --lines
+ */
+static int _wipe_lines_parse(const char *arg, int nlines, int *line_bgn,
+			     int *line_end)
+{
+	char *end = NULL;
+	long bgn, last;
+
+	*line_bgn = 0;
+	*line_end = 0;
+	if (!arg)
+		return 0;
+
+	errno = 0;
+	bgn = strtol(arg, &end, 10);
+	if (errno || (end == arg))
+		goto parse_err;
+	last = bgn;
+
+	if (*end == '-') {
+		const char *arg_end = end + 1;
+
+		last = strtol(arg_end, &end, 10);
+		if (errno || (end == arg_end))
+			goto parse_err;
+	}
+
+	if ((*end != '\0') || (bgn < 0) || (bgn > last) || (last >= nlines))
+		goto parse_err;
+
+	*line_bgn = bgn;
+	*line_end = last;
+
+	return 0;
+
+parse_err:
+	errno = EINVAL;
+	return -1;
+}
+
+static void _wipe_lun_cb(const struct pblk_wipe_lun *lun, int ndone,
+			 int nluns, void *arg)
+{
+	struct nvm_cli *cli = arg;
+
+	if (cli->opts.brief)
+		return;
+
+	nvm_cli_info_pr("wiped lun %d (%d/%d)", lun->tlun, ndone, nluns);
+}
+
+/**
+ * Wipe lines on LUNs [lun_bgn, lun_end], the lines are given by --lines, and
+ * report the erases of every LUN
+ */
+static int _wipe_helper(struct nvm_cli *cli, struct pblk *pblk, int lun_bgn,
+			int lun_end)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	struct pblk_wipe_lun *luns = NULL;
+	int line_bgn, line_end, nluns;
+	int nblks = 0, nblks_bad = 0, nblks_failed = 0;
+	double t_bgn, t_wall;
+
+	if (_wipe_lines_parse(opts.lines, geo->nblocks, &line_bgn, &line_end)) {
+		nvm_cli_perror("invalid --lines");
+		return -1;
+	}
+
+	nluns = (lun_end - lun_bgn) + 1;
+	luns = calloc(nluns, sizeof(*luns));
+	if (!luns) {
+		nvm_cli_perror("calloc");
+		return -1;
+	}
+
+	// Wiped lines no longer match a snapshot
+	if (opts.snapshot && unlink(opts.snapshot) && (errno != ENOENT))
+		nvm_cli_perror("unlink: snapshot");
+
+	nvm_cli_info_pr("wiping: begin");
+	t_bgn = pblk_ts();
+	if (pblk_wipe(pblk, lun_bgn, lun_end, line_bgn, line_end, luns,
+		      _wipe_lun_cb, cli)) {
+		nvm_cli_perror("pblk_wipe");
+		free(luns);
+		return -1;
+	}
+	t_wall = pblk_ts() - t_bgn;
+	nvm_cli_info_pr("wiping: end");
+
+	if (!cli->opts.brief)
+		printf("wipe_luns:\n");
+	for (int i = 0; i < nluns; ++i) {
+		nblks += luns[i].nblks;
+		nblks_bad += luns[i].nblks_bad;
+		nblks_failed += luns[i].nblks_failed;
+
+		if (cli->opts.brief)
+			continue;
+
+		printf("  - { tlun: %03d, ch: %02d, lun: %02d, nblks: %d, "
+		       "nblks_bad: %d, nblks_failed: %d, sec: %.6f }\n",
+		       luns[i].tlun, luns[i].tlun / (int)geo->nluns,
+		       luns[i].tlun % (int)geo->nluns, luns[i].nblks,
+		       luns[i].nblks_bad, luns[i].nblks_failed,
+		       luns[i].t_sec);
+	}
+
+	printf("wipe:\n");
+	printf("  lun_bgn: %d\n", lun_bgn);
+	printf("  lun_end: %d\n", lun_end);
+	printf("  line_bgn: %d\n", line_bgn);
+	printf("  line_end: %d\n", line_end);
+	printf("  jobs: %d\n", pblk->jobs);
+	printf("  nblks_erased: %d\n", nblks);
+	printf("  nblks_bad: %d\n", nblks_bad);
+	printf("  nblks_failed: %d\n", nblks_failed);
+	printf("  wall_sec: %.6f\n", t_wall);
+	printf("  blks_per_sec: %.1f\n", t_wall > 0 ? nblks / t_wall : 0.0);
+
+	free(luns);
+
+	return nblks_failed ? -1 : 0;
+}
+
+int cmd_wipe(struct nvm_cli *cli)
+{
+	int res = 0;
+	struct pblk *pblk = NULL;
+
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
+
+	if (_wipe_helper(cli, pblk, 0, pblk->tluns - 1))
+		res = 1;
+
+	_pblk_term_cli(pblk);
+	return res;
+}
+
+int cmd_wipe_inst(struct nvm_cli *cli)
+{
+	int res = 0;
+	struct pblk *pblk = NULL;
+	int lun_bgn, lun_end;
+
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
+
+	lun_bgn = cli->args.dec_vals[0];
+	lun_end = cli->args.dec_vals[1];
+
+	if ((lun_bgn > lun_end) || (lun_end >= pblk->tluns)) {
+		errno = EINVAL;
+		nvm_cli_perror("invalid instance");
+		res = 1;
+		goto cmd_exit;
+	}
+
+	if (_wipe_helper(cli, pblk, lun_bgn, lun_end))
+		res = 1;
+
+cmd_exit:
+	_pblk_term_cli(pblk);
+	return res;
+}
+
+/**
+ * A device of a fleet scan, its report is formatted by the worker scanning
+ * the device and printed in device order once all devices are scanned
+ */
+struct fleet_dev {
+	const char *path;
+	char *report;				///< Per-instance report
+	size_t report_nbytes;
+	int err;				///< errno of a failure, or 0
+	const char *err_op;			///< Operation failing
+	int ninsts;
+	int nlines_closed;
+	int nlines_open;
+	int nlines_bad;
+	int nhazards;				///< Open lines and chain errors
+	double t_sec;
+};
+
+static void _fleet_report_inst(FILE *fp, struct fleet_dev *fdev,
+			       struct pblk_inst *inst)
+{
+	struct pblk_chain_stat chain;
+	int nclosed = 0, nopen = 0, nbad = 0, ndegraded = 0;
+	int nchain_errs = -1;
+
+	for (int i = 0; i < inst->nlines; ++i) {
+		switch (inst->line_states[i]) {
+		case PBLK_LINE_STATE_CLOSED:
+			++nclosed;
+			break;
+		case PBLK_LINE_STATE_OPEN:
+			++nopen;
+			break;
+		case PBLK_LINE_STATE_BAD:
+			++nbad;
+			continue;
+		}
+
+		if (pblk_inst_line_ngood(inst, i) != inst->nluns)
+			++ndegraded;
+	}
+
+	if (!pblk_inst_chain_check(inst, &chain, NULL, NULL))
+		nchain_errs = chain.ndups + chain.nforks + chain.ncycles +
+			      chain.nprev_broken + chain.nnext_broken;
+
+	fprintf(fp, "      - { lun_bgn: %d, lun_end: %d, nlines_closed: %d, "
+		"nlines_open: %d, nlines_bad: %d, nlines_degraded: %d, "
+		"seq_nr_max: %lu, nchain_errs: %d }\n", inst->lun_bgn,
+		inst->lun_end, nclosed, nopen, nbad, ndegraded,
+		nchain_errs < 0 ? 0UL : (unsigned long)chain.seq_nr_max,
+		nchain_errs);
+
+	fdev->nlines_closed += nclosed;
+	fdev->nlines_open += nopen;
+	fdev->nlines_bad += nbad;
+	fdev->nhazards += nopen + (nchain_errs > 0 ? nchain_errs : 0);
+}
+
+/**
+ * Buffers and I/O threads shared by the devices of a fleet, the buffer pool is
+ * of the geometry of the first device scanned, devices of another geometry use
+ * a pool of their own
+ */
+struct fleet_pools {
+	int bufs_init;				///< bufs is initialized
+	struct pblk_buf_pool bufs;
+	struct pblk_aio_pool *aio;		///< NULL when synchronous
+};
+
+static int _fleet_geo_eq(const struct nvm_geo *a, const struct nvm_geo *b)
+{
+	return (a->nchannels == b->nchannels) && (a->nluns == b->nluns) &&
+	       (a->nplanes == b->nplanes) && (a->nblocks == b->nblocks) &&
+	       (a->npages == b->npages) && (a->nsectors == b->nsectors) &&
+	       (a->sector_nbytes == b->sector_nbytes);
+}
+
+/**
+ * Get the shared buffer pool for a device of the given geometry, initializing
+ * it for the first device
+ *
+ * @returns The shared pool, or NULL when the device must use its own.
+ */
+static struct pblk_buf_pool *_fleet_bufs(struct fleet_pools *pools,
+					 const struct nvm_geo *geo)
+{
+	struct pblk_buf_pool *bufs = NULL;
+
+#ifdef _OPENMP
+	#pragma omp critical(fleet_bufs)
+#endif
+	{
+		if (!pools->bufs_init)
+			pools->bufs_init = !pblk_bufs_init(&pools->bufs, geo);
+		if (pools->bufs_init && _fleet_geo_eq(&pools->bufs.geo, geo))
+			bufs = &pools->bufs;
+	}
+
+	return bufs;
+}
+
+/**
+ * Discover the instances of a device of the fleet and scan their lines, with
+ * a single worker, as concurrency is across devices, and with the buffers and
+ * I/O threads of the fleet
+ */
+static void _fleet_scan_dev(struct fleet_dev *fdev, struct fleet_pools *pools)
+{
+	struct pblk_buf_pool *bufs = NULL;
+	struct pblk_dev *dev = NULL;
+	struct pblk *pblk = NULL;
+	double t_bgn = pblk_ts();
+	FILE *fp;
+
+	dev = pblk_dev_open(fdev->path);
+	if (!dev) {
+		fdev->err = errno;
+		fdev->err_op = "pblk_dev_open";
+		return;
+	}
+	pblk_dev_set_lat(dev, opts.lat_us);
+
+	pblk = pblk_init(dev, 0x0);
+	if (!pblk) {
+		fdev->err = errno;
+		fdev->err_op = "pblk_init";
+		pblk_dev_close(dev);
+		return;
+	}
+	pblk->chunk_rprt = !opts.no_chunk_rprt;
+	pblk->jobs = 1;
+	pblk->qd = opts.qd;
+	pblk->bbt_cache = opts.bbt_cache;
+	pblk->aio_pool = pools->aio;
+	bufs = _fleet_bufs(pools, pblk_dev_get_geo(dev));
+	if (bufs)
+		pblk->bufs = bufs;
+
+	if (pblk_init_instances(pblk, 0x0)) {
+		fdev->err = errno;
+		fdev->err_op = "pblk_init_instances";
+		goto fleet_exit;
+	}
+	fdev->ninsts = pblk->ninsts;
+
+	if (pblk_init_lines(pblk)) {
+		fdev->err = errno;
+		fdev->err_op = "pblk_init_lines";
+		goto fleet_exit;
+	}
+
+	fp = open_memstream(&fdev->report, &fdev->report_nbytes);
+	if (!fp) {
+		fdev->err = errno;
+		fdev->err_op = "open_memstream";
+		goto fleet_exit;
+	}
+	for (int i = 0; i < pblk->ninsts; ++i)
+		_fleet_report_inst(fp, fdev, &pblk->insts[i]);
+	fclose(fp);
+
+fleet_exit:
+	pblk_term(pblk);
+	pblk_dev_close(dev);
+	fdev->t_sec = pblk_ts() - t_bgn;
+}
+
+/**
+ * Scan the devices at the given paths, up to --jobs devices at a time, and
+ * print a report of every device, tagged by its path, and of the fleet
+ *
+ * The workers are one OpenMP team taking devices as they finish the previous
+ * one. They share one buffer pool, and with --qd N, N > 1, one pool of I/O
+ * threads reading at most PBLK_AIO_NCMDS_MAX commands at a time across all
+ * devices, thus neither memory nor threads grow with the number of devices or
+ * with --jobs.
+ */
+static int _fleet_main(int ndevs, char **paths)
+{
+	struct fleet_pools pools = { 0 };
+	struct fleet_dev *fdevs = NULL;
+	int jobs = opts.jobs;
+	int ndevs_failed = 0, ninsts = 0, nhazards = 0;
+	int nlines_closed = 0, nlines_open = 0, nlines_bad = 0;
+	double t_bgn;
+
+	if (ndevs < 1) {
+		printf("usage: nvm_pblk fleet <dev_path> [<dev_path>...] "
+		       "[--jobs N] [--qd N] [--bbt-cache DIR]\n");
+		return 1;
+	}
+
+	fdevs = calloc(ndevs, sizeof(*fdevs));
+	if (!fdevs) {
+		nvm_cli_perror("calloc");
+		return 1;
+	}
+	for (int i = 0; i < ndevs; ++i)
+		fdevs[i].path = paths[i];
+
+	if (jobs > ndevs)
+		jobs = ndevs;
+
+	if (opts.qd > 1) {
+		pools.aio = pblk_aio_pool_create(PBLK_AIO_NCMDS_MAX);
+		if (!pools.aio) {
+			nvm_cli_perror("pblk_aio_pool_create");
+			free(fdevs);
+			return 1;
+		}
+	}
+
+	t_bgn = pblk_ts();
+#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic, 1) num_threads(jobs)
+#endif
+	for (int i = 0; i < ndevs; ++i)
+		_fleet_scan_dev(&fdevs[i], &pools);
+
+	printf("fleet_devs:\n");
+	for (int i = 0; i < ndevs; ++i) {
+		struct fleet_dev *fdev = &fdevs[i];
+
+		printf("  - dev: %s\n", fdev->path);
+		if (fdev->err) {
+			printf("    err: \"%s: %s\"\n", fdev->err_op,
+			       strerror(fdev->err));
+			++ndevs_failed;
+		} else {
+			printf("    err: ~\n");
+		}
+		printf("    ninsts: %d\n", fdev->ninsts);
+		printf("    nhazards: %d\n", fdev->nhazards);
+		printf("    sec: %.6f\n", fdev->t_sec);
+		if (fdev->report) {
+			printf("    insts:\n");
+			fwrite(fdev->report, 1, fdev->report_nbytes, stdout);
+		}
+
+		ninsts += fdev->ninsts;
+		nhazards += fdev->nhazards;
+		nlines_closed += fdev->nlines_closed;
+		nlines_open += fdev->nlines_open;
+		nlines_bad += fdev->nlines_bad;
+		free(fdev->report);
+	}
+
+	printf("fleet:\n");
+	printf("  ndevs: %d\n", ndevs);
+	printf("  ndevs_failed: %d\n", ndevs_failed);
+	printf("  ninsts: %d\n", ninsts);
+	printf("  nlines_closed: %d\n", nlines_closed);
+	printf("  nlines_open: %d\n", nlines_open);
+	printf("  nlines_bad: %d\n", nlines_bad);
+	printf("  nhazards: %d\n", nhazards);
+	printf("  jobs: %d\n", jobs);
+	printf("  wall_sec: %.6f\n", pblk_ts() - t_bgn);
+	printf("  bufs_nbytes: %lu\n", (unsigned long)pools.bufs.nbytes);
+
+	pblk_aio_pool_destroy(pools.aio);
+	if (pools.bufs_init)
+		pblk_buf_pool_term(&pools.bufs);
+	free(fdevs);
+
+	return ndevs_failed ? 1 : 0;
+}
+
+#define EXPORT_LISTEN_DEFAULT "tcp:127.0.0.1:9477"
+#define EXPORT_REQ_NBYTES_MAX 4096
+
+static volatile sig_atomic_t export_stop;
+
+static void _export_sig(int sig)
+{
+	export_stop = 1;
+}
+
+/**
+ * Listen on the given address, unix:PATH or tcp:[HOST:]PORT, HOST defaults to
+ * 127.0.0.1 as metrics are served to a local agent
+ *
+ * @returns On success, the listening socket is returned. On error, -1 is
+ * returned and errno set to indicate the error.
+ */
+static int _export_listen(const char *addr)
+{
+	struct sockaddr_storage ss;
+	socklen_t ss_len;
+	int fd;
+
+	memset(&ss, 0, sizeof(ss));
+
+	if (!strncmp(addr, "unix:", 5)) {
+		struct sockaddr_un *sun = (struct sockaddr_un *)&ss;
+		const char *path = addr + 5;
+		struct stat st;
+
+		if ((!*path) || (strlen(path) >= sizeof(sun->sun_path))) {
+			errno = EINVAL;
+			return -1;
+		}
+		sun->sun_family = AF_UNIX;
+		strcpy(sun->sun_path, path);
+		ss_len = sizeof(*sun);
+
+		// A socket left by an exporter which did not stop cleanly
+		if ((!stat(path, &st)) && S_ISSOCK(st.st_mode))
+			unlink(path);
+	} else if (!strncmp(addr, "tcp:", 4)) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+		const char *port = strrchr(addr + 4, ':');
+		char host[INET_ADDRSTRLEN] = "127.0.0.1";
+		int port_nr;
+
+		if (port) {
+			const size_t len = port - (addr + 4);
+
+			if (len >= sizeof(host)) {
+				errno = EINVAL;
+				return -1;
+			}
+			memcpy(host, addr + 4, len);
+			host[len] = '\0';
+			++port;
+		} else {
+			port = addr + 4;
+		}
+
+		if (pblk_opts_parse_int(port, 1, 65535, &port_nr))
+			return -1;
+
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port_nr);
+		if (inet_pton(AF_INET, host, &sin->sin_addr) != 1) {
+			errno = EINVAL;
+			return -1;
+		}
+		ss_len = sizeof(*sin);
+	} else {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fd = socket(ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (ss.ss_family == AF_INET) {
+		const int one = 1;
+
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	}
+
+	if (bind(fd, (struct sockaddr *)&ss, ss_len) || listen(fd, 16)) {
+		const int err = errno;
+
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return fd;
+}
+
+static int _export_write(int fd, const char *buf, size_t nbytes)
+{
+	while (nbytes) {
+		const ssize_t ret = send(fd, buf, nbytes, MSG_NOSIGNAL);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		nbytes -= ret;
+	}
+
+	return 0;
+}
+
+/**
+ * Serve a request of the given connection: GET of /metrics is answered with
+ * the metrics formatted by the last scan, anything else with an error. The
+ * connection is closed after the response.
+ */
+static void _export_serve(int fd, const char *metrics, size_t metrics_nbytes)
+{
+	const struct timeval tmo = { .tv_sec = 1, .tv_usec = 0 };
+	char req[EXPORT_REQ_NBYTES_MAX];
+	size_t len = 0;
+	const char *status = "200 OK";
+	char hdr[256];
+	int hdr_len;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tmo, sizeof(tmo));
+
+	// The request line and headers, the request has no body
+	while (len < sizeof(req) - 1) {
+		const ssize_t ret = recv(fd, req + len, sizeof(req) - 1 - len,
+					 0);
+
+		if (ret <= 0)
+			break;
+		len += ret;
+		req[len] = '\0';
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+			break;
+	}
+	req[len] = '\0';
+
+	if (strncmp(req, "GET ", 4)) {
+		status = "405 Method Not Allowed";
+	} else if (strncmp(req + 4, "/metrics", 8) ||
+		   (!strchr(" ?", req[12]))) {
+		status = "404 Not Found";
+	} else if (!metrics) {
+		status = "503 Service Unavailable";
+	}
+	if (strcmp(status, "200 OK"))
+		metrics_nbytes = 0;
+
+	hdr_len = snprintf(hdr, sizeof(hdr), "HTTP/1.0 %s\r\n"
+			   "Content-Type: text/plain; version=0.0.4; "
+			   "charset=utf-8\r\n"
+			   "Content-Length: %zu\r\n"
+			   "Connection: close\r\n\r\n", status, metrics_nbytes);
+
+	if (!_export_write(fd, hdr, hdr_len) && metrics_nbytes)
+		_export_write(fd, metrics, metrics_nbytes);
+}
+
+/**
+ * Scan the lines of all instances, incrementally from the snapshot taken by
+ * the previous scan, and save the snapshot for the next one
+ */
+static void _export_scan(struct pblk *pblk, struct pblk_metrics *metrics,
+			 const char *snapshot)
+{
+	struct pblk_snap snap;
+	double t_bgn = pblk_ts();
+	int nreused = 0;
+	int err;
+
+	if (pblk_snap_open(&snap, snapshot, pblk)) {
+		err = pblk_init_lines(pblk);
+	} else {
+		err = pblk_init_lines_incr(pblk, &snap, &nreused);
+		pblk_snap_close(&snap);
+	}
+	if (err)
+		nvm_cli_perror("pblk_init_lines");
+
+	pblk_metrics_scanned(metrics, pblk, err, pblk_ts() - t_bgn, nreused);
+
+	if ((!err) && pblk_snap_save(pblk, snapshot))
+		nvm_cli_perror("pblk_snap_save");
+
+	nvm_cli_info_pr("Scanned lines in %.6f sec, reused %d lines",
+			metrics->scan_sec, nreused);
+}
+
+/**
+ * Serve metrics of the pblk instances of the device, rescanning the lines
+ * every --interval seconds, until SIGINT or SIGTERM, or --scans scans
+ *
+ * pblk, its instances and the bbts stay resident, thus a rescan reads only
+ * line meta, and only of lines which may have changed, by a snapshot kept at
+ * --snapshot, or else in a temporary file removed on exit. Requests are
+ * answered between scans from metrics formatted once per scan.
+ */
+int cmd_export(struct nvm_cli *cli)
+{
+	const char *listen_addr = opts.listen ? opts.listen :
+				  EXPORT_LISTEN_DEFAULT;
+	struct pblk_metrics metrics;
+	struct sigaction sa;
+	char snap_tmp[] = "/tmp/nvm_pblk_export.XXXXXX";
+	const char *snapshot = opts.snapshot;
+	char *buf = NULL;
+	size_t nbytes = 0;
+	struct pblk *pblk = NULL;
+	double t_next;
+	int lfd = -1;
+	int res = 0;
+
+	nvm_cli_info_pr("Initializing pblk...");
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
 
-	lun_bgn = cli->args.dec_vals[0];
-	lun_end = cli->args.dec_vals[1];
+	switch (_pblk_init_instances_cli(pblk, 0x0)) {
+	case 0:
+		break;
+	case 1:
+		goto cmd_exit;
+	default:
+		res = 1;
+		goto cmd_exit;
+	}
 
-	nvm_cli_info_pr("Initializing instance (%d, %d)", lun_bgn, lun_end);
-	if (pblk_init_instance(&pblk->insts[0], lun_bgn, lun_end, pblk)) {
-		nvm_cli_perror("pblk_init_instance: failed");
+	if (pblk_metrics_init(&metrics, pblk)) {
+		nvm_cli_perror("pblk_metrics_init");
+		res = 1;
 		goto cmd_exit;
 	}
-	++pblk->ninsts;
 
-	nvm_cli_info_pr("Scanning device for pblk instance line-meta");
-	for (int i = 0; i < pblk->ninsts; ++i) {
-		struct pblk_inst *inst = &pblk->insts[i];
+	if (!snapshot) {
+		const int fd = mkstemp(snap_tmp);
 
-		if (pblk_init_instance_lines(pblk, inst))
-			nvm_cli_info_pr("Failed for instance %d", i);
+		if (fd < 0) {
+			nvm_cli_perror("mkstemp");
+			res = 1;
+			goto metrics_exit;
+		}
+		close(fd);
+		snapshot = snap_tmp;
 	}
 
-	nvm_cli_info_pr("Dumping meta for %d instances", pblk->ninsts);
-	for (int i = 0; i < pblk->ninsts; ++i) {
-		struct pblk_inst *inst = &pblk->insts[i];
-	
-		nvm_cli_info_pr("Meta for instance %d", i);
-		pblk_instance_pr(&pblk->insts[i]);
+	lfd = _export_listen(listen_addr);
+	if (lfd < 0) {
+		nvm_cli_perror("_export_listen");
+		res = 1;
+		goto metrics_exit;
+	}
 
-		for (size_t j = 0; j < inst->nlines; ++j) {
-			struct pblk_line *line = &inst->lines[j];
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = _export_sig;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	nvm_cli_info_pr("Serving metrics on %s, every %d sec", listen_addr,
+			opts.interval);
+	printf("export_listen: %s\n", listen_addr);
+	fflush(stdout);
+
+	t_next = pblk_ts();
+	while (!export_stop) {
+		struct pollfd pfd = { .fd = lfd, .events = POLLIN };
+		double t_now = pblk_ts();
+		int cfd;
+
+		if (t_now >= t_next) {
+			if (opts.scans &&
+			    (metrics.nscans + metrics.nscans_failed >=
+			     (uint64_t)opts.scans))
+				break;
 
-			if (cli->opts.brief &&
-					line->state == PBLK_LINE_STATE_UNKNOWN)
-				continue;
+			_export_scan(pblk, &metrics, snapshot);
 
-			printf("\n");
-			pblk_line_pr(line);
+			free(buf);
+			buf = NULL;
+			if (pblk_metrics_fmt(&metrics, pblk, &buf, &nbytes))
+				nvm_cli_perror("pblk_metrics_fmt");
+			fflush(stdout);
+
+			t_now = pblk_ts();
+			t_next = t_now + opts.interval;
 		}
+
+		if (poll(&pfd, 1, (int)((t_next - t_now) * 1000) + 1) <= 0)
+			continue;
+
+		cfd = accept(lfd, NULL, NULL);
+		if (cfd < 0)
+			continue;
+		_export_serve(cfd, buf, buf ? nbytes : 0);
+		close(cfd);
 	}
 
+	printf("export:\n");
+	printf("  nscans: %lu\n", (unsigned long)metrics.nscans);
+	printf("  nscans_failed: %lu\n", (unsigned long)metrics.nscans_failed);
+	printf("  nread_errs: %lu\n", (unsigned long)metrics.nread_errs);
+	res = metrics.nscans_failed ? 1 : 0;
+
+	close(lfd);
+	if (!strncmp(listen_addr, "unix:", 5))
+		unlink(listen_addr + 5);
+
+metrics_exit:
+	if (snapshot == snap_tmp)
+		unlink(snap_tmp);
+	free(buf);
+	pblk_metrics_term(&metrics);
+
 cmd_exit:
-	free(pblk);
+	_pblk_term_cli(pblk);
 	return res;
 }
 
-int cmd_lines_all(struct nvm_cli *cli)
+/**
+ * Read every sector any command reads from the device: the first-LUN probes
+ * of instance discovery, the bbts of all LUNs, the chunk report, the smeta and
+ * the complete emeta of all lines, and the write-pointer probes of open lines
+ *
+ * Lines are scanned without the chunk report, thus replaying by reading lines
+ * finds all sectors it reads, and replaying by the report a subset.
+ */
+static int _metadump_read(struct pblk *pblk)
 {
-	int res = 0;
-	struct pblk *pblk = NULL;
-	
-	nvm_cli_info_pr("Initializing pblk...");
-	pblk = pblk_init(cli->args.dev, 0x0);
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	struct pblk_dev_chunk *chunks = NULL;
+
+	chunks = malloc(pblk->tluns * geo->nblocks * sizeof(*chunks));
+	if (!chunks) {
+		nvm_cli_perror("malloc");
+		return -1;
+	}
+	if (pblk_dev_chunk_rprt(pblk->dev, chunks, NULL))
+		nvm_cli_info_pr("No chunk report: %s", strerror(errno));
+	free(chunks);
+	pblk->chunk_rprt = 0;
+
+	for (size_t tlun = 0; tlun < geo->nchannels * geo->nluns; ++tlun) {
+		struct nvm_addr addr;
+
+		addr.ppa = 0;
+		addr.g.ch = tlun / geo->nluns;
+		addr.g.lun = tlun % geo->nluns;
+		if (!pblk_dev_bbt_get(pblk->dev, addr, NULL))
+			nvm_cli_info_pr("No bbt for ch: %d, lun: %d",
+					addr.g.ch, addr.g.lun);
+	}
 
 	nvm_cli_info_pr("Scanning device for pblk instances");
-	if (pblk_init_instances(pblk, 0x0)) {
-		nvm_cli_info_pr("Scanning failed");
-		res = 1;
-		goto cmd_exit;
+	if (pblk_init_instances(pblk, PBLK_INSTANCES_PROBE_ALL)) {
+		nvm_cli_perror("pblk_init_instances");
+		return -1;
 	}
 	nvm_cli_info_pr("Found %d instances", pblk->ninsts);
 
 	nvm_cli_info_pr("Scanning device for pblk instance line-meta");
-	for (int i = 0; i < pblk->ninsts; ++i) {
-		struct pblk_inst *inst = &pblk->insts[i];
-
-		if (pblk_init_instance_lines(pblk, inst))
-			nvm_cli_info_pr("Failed for instance %d", i);
+	if (pblk_init_lines(pblk)) {
+		nvm_cli_perror("pblk_init_lines");
+		return -1;
 	}
 
-	nvm_cli_info_pr("Dumping meta for %d instances", pblk->ninsts);
 	for (int i = 0; i < pblk->ninsts; ++i) {
 		struct pblk_inst *inst = &pblk->insts[i];
-	
-		nvm_cli_info_pr("Meta for instance %d", i);
-		pblk_instance_pr(&pblk->insts[i]);
+		struct pblk_meta_rd rd;
+		struct pblk_recov recov;
 
-		for (size_t j = 0; j < inst->nlines; ++j) {
-			struct pblk_line *line = &inst->lines[j];
+		if (pblk_meta_rd_init(&rd, pblk, inst)) {
+			nvm_cli_perror("pblk_meta_rd_init");
+			return -1;
+		}
 
-			if (cli->opts.brief &&
-					line->state == PBLK_LINE_STATE_UNKNOWN)
+		// Failing reads are captured as such, thus ignored
+		for (int id = 0; id < inst->nlines; ++id) {
+			if (!(inst->line_states[id] &
+			      (PBLK_LINE_STATE_OPEN | PBLK_LINE_STATE_CLOSED)))
 				continue;
 
-			printf("\n");
-			pblk_line_pr(line);
+			pblk_meta_rd_smeta(&rd, id, geo);
+			pblk_meta_rd_emeta(&rd, id, geo);
+		}
+		pblk_meta_rd_term(&rd);
+
+		if (pblk_inst_recov(pblk, inst, &recov)) {
+			nvm_cli_perror("pblk_inst_recov");
+			return -1;
 		}
+		pblk_recov_term(&recov);
 	}
 
-cmd_exit:
-	free(pblk);
-	return res;
+	return 0;
 }
 
-int cmd_instances(struct nvm_cli *cli)
+/**
+ * Capture all meta read by nvm_pblk into a metadump, which any command runs
+ * against when given as dump:PATH instead of the device
+ */
+int cmd_metadump(struct nvm_cli *cli)
 {
-	int res = 0;
+	struct pblk_dev_dump_stat stat;
 	struct pblk *pblk = NULL;
-	
+	double t_bgn = pblk_ts();
+	int res = 0;
+
+	if (!opts.out) {
+		errno = EINVAL;
+		nvm_cli_perror("metadump: missing --out PATH");
+		return 1;
+	}
+
 	nvm_cli_info_pr("Initializing pblk...");
-	pblk = pblk_init(cli->args.dev, 0x0);
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
 
-	nvm_cli_info_pr("Scanning device for pblk instances");
-	if (pblk_init_instances(pblk, 0x0)) {
-		nvm_cli_info_pr("Scanning failed");
+	// Every bbt must be read from the device to be captured
+	pblk->bbt_cache = NULL;
+
+	if (pblk_dev_dump_start(pblk->dev, opts.out)) {
+		nvm_cli_perror("pblk_dev_dump_start");
 		res = 1;
 		goto cmd_exit;
 	}
 
-	nvm_cli_info_pr("Found %d instances", pblk->ninsts);
-	for (int i = 0; i < pblk->ninsts; ++i)
-		pblk_instance_pr(&pblk->insts[i]);
+	if (_metadump_read(pblk)) {
+		pblk_dev_dump_abort(pblk->dev);
+		res = 1;
+		goto cmd_exit;
+	}
+
+	if (pblk_dev_dump_finish(pblk->dev, &stat)) {
+		nvm_cli_perror("pblk_dev_dump_finish");
+		res = 1;
+		goto cmd_exit;
+	}
+
+	printf("metadump:\n");
+	printf("  path: %s\n", opts.out);
+	printf("  ninsts: %d\n", pblk->ninsts);
+	printf("  nsecs: %lu\n", (unsigned long)stat.nsecs);
+	printf("  nsecs_failed: %lu\n", (unsigned long)stat.nsecs_failed);
+	printf("  nbbts: %lu\n", (unsigned long)stat.nbbts);
+	printf("  chunk_rprt: %d\n", stat.rprt);
+	printf("  nbytes_raw: %lu\n", (unsigned long)stat.nbytes_raw);
+	printf("  nbytes: %lu\n", (unsigned long)stat.nbytes);
+	printf("  sec: %.6f\n", pblk_ts() - t_bgn);
 
 cmd_exit:
-	free(pblk);
+	_pblk_term_cli(pblk);
 	return res;
 }
 
 /**
- * Erase the first block on all LUNs
+ * Parse the LBAs to read, "A-B" or "A", from --lbas, by default every LBA up
+ * to the last mapped, that is [0, lba_end)
  */
-int cmd_wipe(struct nvm_cli *cli)
+static int _read_lba_parse(const char *arg, uint64_t lba_end,
+			   uint64_t *lba_bgn, uint64_t *nlbas)
 {
-	int res = 0;
+	char *end = NULL;
+	unsigned long long bgn, last;
+
+	*lba_bgn = 0;
+	*nlbas = lba_end;
+	if (!arg)
+		return 0;
+
+	errno = 0;
+	bgn = strtoull(arg, &end, 10);
+	if (errno || (end == arg) || (*arg == '-'))
+		goto parse_err;
+	last = bgn;
+
+	if (*end == '-') {
+		const char *arg_end = end + 1;
+
+		last = strtoull(arg_end, &end, 10);
+		if (errno || (end == arg_end) || (*arg_end == '-'))
+			goto parse_err;
+	}
+
+	if ((*end != '\0') || (bgn > last))
+		goto parse_err;
+
+	*lba_bgn = bgn;
+	*nlbas = (last - bgn) + 1;
+
+	return 0;
+
+parse_err:
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * Copy LBAs of the instance on LUNs [begin, end] to --out, through the L2P
+ * rebuilt from emeta, without pblk running on the device
+ *
+ * LBAs are requested a few windows at a time, as a block-device client would,
+ * and served by the read-ahead and cache of the LBA reader. Unmapped LBAs and
+ * sectors failing to read are written as zeroes.
+ */
+int cmd_read_lba(struct nvm_cli *cli)
+{
+	const size_t req_nlbas = 2 * PBLK_LBA_WIN_NLBAS;
+	const struct nvm_geo *geo = NULL;
 	struct pblk *pblk = NULL;
-	struct nvm_dev *dev = cli->args.dev;
-	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
-	
-	pblk = pblk_init(dev, 0x0);
+	struct pblk_l2p l2p = { 0 };
+	struct pblk_lba_rd rd = { 0 };
+	uint64_t lba_bgn, nlbas, nreqs_failed = 0;
+	char *buf = NULL;
+	FILE *fp = NULL;
+	double t_bgn, t_read;
+	int lun_bgn, lun_end;
+	int res = 0;
 
-	nvm_cli_info_pr("wiping: begin");
-	for (size_t lun = 0; lun < pblk->tluns; ++lun) {
-		ssize_t err = 0;
-		struct nvm_vblk *vblk = NULL;
-		struct nvm_ret ret = { 0 };
-		struct nvm_addr addr = { 0 };
-
-		addr.g.lun = lun % geo->nluns;
-		addr.g.ch = (lun / geo->nluns) % geo->nchannels;
-
-		vblk = nvm_vblk_alloc(dev, &addr, 1);
-		if (!vblk) {
-			nvm_cli_perror("nvm_vblk_alloc");
-			continue;
-		}
+	if (!opts.out) {
+		errno = EINVAL;
+		nvm_cli_perror("read_lba: missing --out PATH");
+		return 1;
+	}
 
-		if (!cli->opts.brief) {
-			nvm_cli_info_pr("erasing %lu/%lu", lun, pblk->tluns);
-			nvm_vblk_pr(vblk);
-		}
+	nvm_cli_info_pr("Initializing pblk...");
+	pblk = _pblk_init_cli(cli);
+	if (!pblk)
+		return 1;
+	geo = pblk_dev_get_geo(pblk->dev);
+
+	lun_bgn = cli->args.dec_vals[0];
+	lun_end = cli->args.dec_vals[1];
+
+	nvm_cli_info_pr("Initializing instance (%d, %d)", lun_bgn, lun_end);
+	if (!pblk_add_instance(pblk, lun_bgn, lun_end)) {
+		nvm_cli_perror("pblk_add_instance: failed");
+		res = 1;
+		goto cmd_exit;
+	}
+
+	t_bgn = pblk_ts();
+	nvm_cli_info_pr("Scanning device for pblk instance line-meta");
+	_pblk_init_lines_cli(pblk);
+
+	nvm_cli_info_pr("Rebuilding L2P");
+	pblk_instance_pr(&pblk->insts[0]);
+	if (_l2p_inst(cli, pblk, &pblk->insts[0], &l2p)) {
+		res = 1;
+		goto cmd_exit;
+	}
+
+	if (_read_lba_parse(opts.lbas, pblk_l2p_lba_end(&l2p), &lba_bgn,
+			    &nlbas)) {
+		nvm_cli_perror("read_lba: invalid --lbas");
+		res = 1;
+		goto cmd_exit;
+	}
+
+	if (pblk_lba_rd_init(&rd, pblk, &l2p, opts.ra,
+			     (size_t)opts.cache_mb << 20)) {
+		nvm_cli_perror("pblk_lba_rd_init");
+		res = 1;
+		goto cmd_exit;
+	}
+
+	buf = malloc(req_nlbas * geo->sector_nbytes);
+	fp = fopen(opts.out, "wb");
+	if (!(buf && fp)) {
+		nvm_cli_perror(buf ? "fopen" : "malloc");
+		res = 1;
+		goto cmd_exit;
+	}
 
-		err = nvm_vblk_erase(vblk);
-		if ((err < 0) && (!cli->opts.brief)) {
-			nvm_cli_perror("nvm_vblk_erase: probably a bad block");
+	nvm_cli_info_pr("Reading %lu LBAs from %lu", (unsigned long)nlbas,
+			(unsigned long)lba_bgn);
+	t_read = pblk_ts();
+	for (uint64_t off = 0; off < nlbas; off += req_nlbas) {
+		const size_t n = nlbas - off < req_nlbas ? nlbas - off :
+							   req_nlbas;
+
+		if (pblk_lba_rd_read(&rd, lba_bgn + off, n, buf)) {
+			if (errno != EIO) {
+				nvm_cli_perror("pblk_lba_rd_read");
+				res = 1;
+				goto cmd_exit;
+			}
+			++nreqs_failed;
+			nvm_cli_info_pr("HAZARD: LBAs %lu-%lu, read failed",
+					(unsigned long)(lba_bgn + off),
+					(unsigned long)(lba_bgn + off + n - 1));
 		}
 
-		nvm_vblk_free(vblk);
+		if (fwrite(buf, geo->sector_nbytes, n, fp) != n) {
+			nvm_cli_perror("fwrite");
+			res = 1;
+			goto cmd_exit;
+		}
 	}
-	nvm_cli_info_pr("wiping: end");
+	t_read = pblk_ts() - t_read;
+
+	printf("read_lba:\n");
+	printf("  path: %s\n", opts.out);
+	printf("  lba_bgn: %lu\n", (unsigned long)lba_bgn);
+	printf("  nlbas: %lu\n", (unsigned long)nlbas);
+	printf("  nsecs_read: %lu\n", (unsigned long)rd.nsecs_read);
+	printf("  nsecs_failed: %lu\n", (unsigned long)rd.nsecs_failed);
+	printf("  nreqs_failed: %lu\n", (unsigned long)nreqs_failed);
+	printf("  ra_nlbas: %d\n", rd.ra_nwins * PBLK_LBA_WIN_NLBAS);
+	printf("  cache_nwins: %d\n", rd.nwins);
+	printf("  win_nhits: %lu\n", (unsigned long)rd.nhits);
+	printf("  win_nmisses: %lu\n", (unsigned long)rd.nmisses);
+	printf("  nflushes: %lu\n", (unsigned long)rd.nflushes);
+	printf("  ncmds: %lu\n", (unsigned long)rd.scan.ncmds);
+	printf("  read_sec: %.6f\n", t_read);
+	printf("  read_mbps: %.3f\n", t_read > 0 ? nlbas * geo->sector_nbytes /
+						    t_read / 1e6 : 0);
+	nvm_cli_info_pr("Total: %.6f sec", pblk_ts() - t_bgn);
 
 cmd_exit:
-	free(pblk);
+	if (fp && fclose(fp) && !res) {
+		nvm_cli_perror("fclose");
+		res = 1;
+	}
+	free(buf);
+	pblk_lba_rd_term(&rd);
+	pblk_l2p_term(&l2p);
+	_pblk_term_cli(pblk);
 	return res;
 }
 
@@ -988,6 +2500,42 @@ static struct nvm_cli_cmd cmds[] = {
 		NVM_CLI_ARG_DEV_PATH,
 		NVM_CLI_OPT_HELP | NVM_CLI_OPT_BRIEF
 	},
+	{
+		"l2p_inst",
+		cmd_l2p_inst,
+		NVM_CLI_ARG_DECVAL_BEGIN_END,
+		NVM_CLI_OPT_HELP | NVM_CLI_OPT_BRIEF
+	},
+	{
+		"l2p_all",
+		cmd_l2p_all,
+		NVM_CLI_ARG_DEV_PATH,
+		NVM_CLI_OPT_HELP | NVM_CLI_OPT_BRIEF
+	},
+	{
+		"vsc_inst",
+		cmd_vsc_inst,
+		NVM_CLI_ARG_DECVAL_BEGIN_END,
+		NVM_CLI_OPT_HELP | NVM_CLI_OPT_BRIEF
+	},
+	{
+		"vsc_all",
+		cmd_vsc_all,
+		NVM_CLI_ARG_DEV_PATH,
+		NVM_CLI_OPT_HELP | NVM_CLI_OPT_BRIEF
+	},
+	{
+		"recov_inst",
+		cmd_recov_inst,
+		NVM_CLI_ARG_DECVAL_BEGIN_END,
+		NVM_CLI_OPT_HELP | NVM_CLI_OPT_BRIEF
+	},
+	{
+		"recov_all",
+		cmd_recov_all,
+		NVM_CLI_ARG_DEV_PATH,
+		NVM_CLI_OPT_HELP | NVM_CLI_OPT_BRIEF
+	},
 	{	"instances",
 		cmd_instances,
 		NVM_CLI_ARG_DEV_PATH,
@@ -998,6 +2546,30 @@ static struct nvm_cli_cmd cmds[] = {
 		NVM_CLI_ARG_DEV_PATH,
 		NVM_CLI_OPT_HELP | NVM_CLI_OPT_BRIEF
 	},
+	{
+		"wipe_inst",
+		cmd_wipe_inst,
+		NVM_CLI_ARG_DECVAL_BEGIN_END,
+		NVM_CLI_OPT_HELP | NVM_CLI_OPT_BRIEF
+	},
+	{
+		"export",
+		cmd_export,
+		NVM_CLI_ARG_DEV_PATH,
+		NVM_CLI_OPT_HELP
+	},
+	{
+		"metadump",
+		cmd_metadump,
+		NVM_CLI_ARG_DEV_PATH,
+		NVM_CLI_OPT_HELP
+	},
+	{
+		"read_lba",
+		cmd_read_lba,
+		NVM_CLI_ARG_DECVAL_BEGIN_END,
+		NVM_CLI_OPT_HELP | NVM_CLI_OPT_BRIEF
+	},
 
 };
 
@@ -1010,22 +2582,110 @@ static struct nvm_cli cli = {
 	.ncmds = sizeof(cmds) / sizeof(cmds[0]),
 };
 
+/**
+ * Initialize the given cli for a device path which the liblightnvm CLI cannot
+ * open, that is, a device emulated by another pblk_dev backend
+ *
+ * Arguments are: <cmd> <dev_path> [<begin> <end>] [-b | --brief]
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+static int _cli_init_emulated(struct nvm_cli *cli, int argc, char **argv)
+{
+	int ndec_vals = 0;
+
+	memset(&cli->args, 0, sizeof(cli->args));
+	memset(&cli->opts, 0, sizeof(cli->opts));
+	cli->cmd = NULL;
+
+	for (int i = 0; i < cli->ncmds; ++i) {
+		if (!strcmp(argv[1], cli->cmds[i].name))
+			cli->cmd = &cli->cmds[i];
+	}
+	if (!cli->cmd) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	strncpy(cli->args.dev_path, argv[2], sizeof(cli->args.dev_path) - 1);
+
+	for (int i = 3; i < argc; ++i) {
+		char *end = NULL;
+		long val;
+
+		if ((!strcmp(argv[i], "-b")) || (!strcmp(argv[i], "--brief"))) {
+			cli->opts.brief = 1;
+			continue;
+		}
+
+		errno = 0;
+		val = strtol(argv[i], &end, 10);
+		if (errno || (end == argv[i]) || (*end != '\0') || (val < 0) ||
+		    (ndec_vals == 2)) {
+			errno = EINVAL;
+			return -1;
+		}
+		cli->args.dec_vals[ndec_vals++] = val;
+	}
+
+	switch (cli->cmd->arg_type) {
+	case NVM_CLI_ARG_DECVAL_BEGIN_END:
+		if (ndec_vals != 2) {
+			errno = EINVAL;
+			return -1;
+		}
+		break;
+
+	default:
+		if (ndec_vals) {
+			errno = EINVAL;
+			return -1;
+		}
+		break;
+	}
+
+	return 0;
+}
+
 /* Initialize and run */
 int main(int argc, char **argv)
 {
 	int res = 0;
 
-	if (nvm_cli_init(&cli, argc, argv) < 0) {
-		nvm_cli_perror("FAILED");
+	if (pblk_opts_parse(&opts, &argc, argv)) {
+		nvm_cli_perror("pblk_opts_parse: invalid option value");
 		return 1;
 	}
-	if (!cli.opts.help && check_assumptions(&cli)) {
-		goto exit;
+
+	// A fleet takes several devices, which the liblightnvm CLI cannot
+	if ((argc > 1) && (!strcmp(argv[1], "fleet")))
+		return _fleet_main(argc - 2, argv + 2);
+
+	// Emulated devices bypass the liblightnvm CLI, except for help
+	if ((argc > 2) && pblk_dev_emulated(argv[2])) {
+		int help = 0;
+
+		for (int i = 1; i < argc; ++i)
+			help |= (!strcmp(argv[i], "-h")) ||
+				(!strcmp(argv[i], "--help"));
+
+		if (!help) {
+			if (_cli_init_emulated(&cli, argc, argv)) {
+				nvm_cli_perror("FAILED");
+				return 1;
+			}
+
+			return cli.cmd->func(&cli);
+		}
 	}
 
+	if (nvm_cli_init(&cli, argc, argv) < 0) {
+		nvm_cli_perror("FAILED");
+		return 1;
+	}
 	res = nvm_cli_run(&cli);
 
-exit:
 	nvm_cli_destroy(&cli);
 
 	return res;
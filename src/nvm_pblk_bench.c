@@ -0,0 +1,515 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <zlib.h>
+#include <pblk.h>
+#include <pblk_crc.h>
+#include <pblk_mkimg.h>
+
+/**
+ * Returns monotonic time in seconds
+ */
+static inline double bench_ts(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Buffer sizes ranging from a line header to the emeta of large lines
+static const size_t crc_bench_nbytes[] = {
+	32, 4096, 32768, 65536, 1 << 20, 8 << 20
+};
+
+#define CRC_BENCH_SEC 0.25
+
+/**
+ * Measure single-core throughput of each CRC32 implementation supported by
+ * the CPU, and verify that they are bit-exact with zlib crc32
+ */
+int bench_crc(int argc, char **argv)
+{
+	const size_t nsizes = sizeof(crc_bench_nbytes) /
+			      sizeof(crc_bench_nbytes[0]);
+	const size_t buf_nbytes = crc_bench_nbytes[nsizes - 1];
+	unsigned char *buf;
+	int res = 0;
+
+	buf = malloc(buf_nbytes);
+	if (!buf) {
+		perror("malloc");
+		return 1;
+	}
+	srand(0x70626c6b);
+	for (size_t i = 0; i < buf_nbytes; ++i)
+		buf[i] = rand();
+
+	printf("crc_bench:\n");
+	printf("  selected: %s\n", pblk_crc32_impl()->name);
+	printf("  results:\n");
+	for (int i = 0; i < pblk_crc32_nimpls; ++i) {
+		const struct pblk_crc32_impl *impl = &pblk_crc32_impls[i];
+
+		if (!impl->supported())
+			continue;
+
+		for (size_t j = 0; j < nsizes; ++j) {
+			const size_t nbytes = crc_bench_nbytes[j];
+			uint32_t expected = crc32(0, buf, nbytes);
+			uint32_t crc = 0;
+			uint64_t niters = 0;
+			double t_bgn, t_run;
+
+			t_bgn = bench_ts();
+			do {
+				for (int k = 0; k < 16; ++k)
+					crc = impl->fn(crc, buf, nbytes);
+				niters += 16;
+				t_run = bench_ts() - t_bgn;
+			} while (t_run < CRC_BENCH_SEC);
+
+			// The last result must match zlib on the same input
+			crc = impl->fn(0, buf, nbytes);
+			if (crc != expected)
+				res = 1;
+
+			printf("    - { impl: %s, nbytes: %lu, niters: %lu, "
+			       "sec: %.6f, gbps: %.3f, exact: %s }\n",
+			       impl->name, (unsigned long)nbytes,
+			       (unsigned long)niters, t_run,
+			       (nbytes * niters) / t_run / 1e9,
+			       crc == expected ? "true" : "false");
+		}
+	}
+
+	free(buf);
+
+	return res;
+}
+
+/**
+ * Phases of a scan, in the order they run
+ */
+enum scan_phase_id {
+	SCAN_PHASE_OPEN = 0,		///< Open device and get geometry
+	SCAN_PHASE_BBT,			///< Fetch bbt of every LUN
+	SCAN_PHASE_INSTANCES,		///< Discover instances
+	SCAN_PHASE_LINES,		///< Read smeta/emeta headers
+	SCAN_PHASE_CLASSIFY,		///< Classify lines, part of the read
+	SCAN_PHASE_SMETA,		///< Read complete smeta of lines
+	SCAN_PHASE_EMETA,		///< Read complete emeta of closed lines
+	SCAN_NPHASES
+};
+
+static const char *scan_phase_names[] = {
+	"open", "bbt", "instances", "lines", "classify", "smeta", "emeta"
+};
+
+struct scan_phase {
+	double sec;				///< Wall-clock time of phase
+	uint64_t nlines;			///< Lines processed
+	struct pblk_dev_stat stat;		///< Commands of phase
+};
+
+struct scan_opts {
+	int jobs;
+	int qd;
+	int lat_us;
+	struct pblk_mkimg_opts img;		///< Template of images
+	const char *dir;			///< Where to create images
+};
+
+/**
+ * Parse a geometry given as CHxLUNxPLxBLKxPGxSEC, e.g. 4x4x2x64x16x4
+ */
+static int scan_geo_parse(const char *arg, struct nvm_geo *geo)
+{
+	unsigned long vals[6];
+	int nconsumed = 0;
+
+	if ((sscanf(arg, "%lux%lux%lux%lux%lux%lu%n", &vals[0], &vals[1],
+		    &vals[2], &vals[3], &vals[4], &vals[5], &nconsumed) != 6) ||
+	    (arg[nconsumed] != '\0')) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (int i = 0; i < 6; ++i) {
+		if (!vals[i]) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	geo->nchannels = vals[0];
+	geo->nluns = vals[1];
+	geo->nplanes = vals[2];
+	geo->nblocks = vals[3];
+	geo->npages = vals[4];
+	geo->nsectors = vals[5];
+
+	return 0;
+}
+
+static void scan_phase_pr(int id, const struct scan_phase *phase,
+			  const struct nvm_geo *geo)
+{
+	const struct pblk_hist *lat = id == SCAN_PHASE_BBT ?
+				      &phase->stat.bbt_lat :
+				      &phase->stat.rd_lat;
+	const uint64_t nbytes = phase->stat.rd_naddrs * geo->sector_nbytes;
+	const double sec = phase->sec;
+
+	printf("      - { phase: %s, sec: %.6f, nlines: %lu, "
+	       "lines_per_sec: %.1f, nbytes: %lu, mbps: %.3f, ncmds: %lu, "
+	       "lat_us: { p50: %.1f, p99: %.1f, p999: %.1f, max: %.1f } }\n",
+	       scan_phase_names[id], sec, (unsigned long)phase->nlines,
+	       sec > 0 ? phase->nlines / sec : 0.0, (unsigned long)nbytes,
+	       sec > 0 ? nbytes / sec / 1e6 : 0.0, (unsigned long)lat->n,
+	       pblk_hist_pct(lat, 50) / 1e3, pblk_hist_pct(lat, 99) / 1e3,
+	       pblk_hist_pct(lat, 99.9) / 1e3, lat->max / 1e3);
+}
+
+/**
+ * Read the complete smeta of readable lines, or the complete emeta of closed
+ * lines, of all instances
+ */
+static int scan_meta_rd(struct pblk *pblk, int emeta, uint64_t *nlines)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+
+	for (int i = 0; i < pblk->ninsts; ++i) {
+		struct pblk_inst *inst = &pblk->insts[i];
+		struct pblk_meta_rd rd;
+
+		if (pblk_meta_rd_init(&rd, pblk, inst))
+			return -1;
+
+		for (int id = 0; id < inst->nlines; ++id) {
+			const int state = inst->line_states[id];
+
+			if (emeta && (state != PBLK_LINE_STATE_CLOSED))
+				continue;
+			if (!(state & (PBLK_LINE_STATE_OPEN |
+				       PBLK_LINE_STATE_CLOSED)))
+				continue;
+
+			if (emeta)
+				pblk_meta_rd_emeta(&rd, id, geo);
+			else
+				pblk_meta_rd_smeta(&rd, id, geo);
+			++(*nlines);
+		}
+
+		pblk_meta_rd_term(&rd);
+	}
+
+	return 0;
+}
+
+/**
+ * Run all phases of a scan of the given device, phases are run in order as
+ * each depends on the previous
+ */
+static int scan_run(const char *dev_path, const struct scan_opts *opts,
+		    struct scan_phase *phases, struct nvm_geo *geo)
+{
+	struct pblk_dev *dev = NULL;
+	struct pblk *pblk = NULL;
+	struct scan_phase *phase;
+	double t_bgn;
+	int err = -1;
+
+	memset(phases, 0, SCAN_NPHASES * sizeof(*phases));
+
+	phase = &phases[SCAN_PHASE_OPEN];
+	t_bgn = pblk_ts();
+	dev = pblk_dev_open(dev_path);
+	phase->sec = pblk_ts() - t_bgn;
+	if (!dev)
+		return -1;
+	*geo = *pblk_dev_get_geo(dev);
+	pblk_dev_set_lat(dev, opts->lat_us);
+
+	phase = &phases[SCAN_PHASE_BBT];
+	pblk_dev_set_stat(dev, &phase->stat);
+	t_bgn = pblk_ts();
+	for (size_t tlun = 0; tlun < geo->nchannels * geo->nluns; ++tlun) {
+		struct nvm_addr addr = { 0 };
+		struct nvm_ret ret = { 0 };
+
+		addr.g.lun = tlun % geo->nluns;
+		addr.g.ch = tlun / geo->nluns;
+		if (!pblk_dev_bbt_get(dev, addr, &ret))
+			goto exit;
+	}
+	phase->sec = pblk_ts() - t_bgn;
+
+	pblk = pblk_init(dev, 0x0);
+	if (!pblk)
+		goto exit;
+	pblk->jobs = opts->jobs;
+	pblk->qd = opts->qd;
+
+	phase = &phases[SCAN_PHASE_INSTANCES];
+	pblk_dev_set_stat(dev, &phase->stat);
+	t_bgn = pblk_ts();
+	if (pblk_init_instances(pblk, 0x0))
+		goto exit;
+	phase->sec = pblk_ts() - t_bgn;
+
+	phase = &phases[SCAN_PHASE_LINES];
+	pblk_dev_set_stat(dev, &phase->stat);
+	t_bgn = pblk_ts();
+	if (pblk_init_lines(pblk))
+		goto exit;
+	for (int i = 0; i < pblk->ninsts; ++i)
+		phase->nlines += pblk->insts[i].nlines;
+
+	// pblk_init_lines classifies the lines it read, the time classifying is
+	// thus moved from the read to its own phase
+	phases[SCAN_PHASE_CLASSIFY].sec = pblk->classify_sec;
+	phases[SCAN_PHASE_CLASSIFY].nlines = phase->nlines;
+	phase->sec = pblk_ts() - t_bgn - pblk->classify_sec;
+
+	phase = &phases[SCAN_PHASE_SMETA];
+	pblk_dev_set_stat(dev, &phase->stat);
+	t_bgn = pblk_ts();
+	if (scan_meta_rd(pblk, 0, &phase->nlines))
+		goto exit;
+	phase->sec = pblk_ts() - t_bgn;
+
+	phase = &phases[SCAN_PHASE_EMETA];
+	pblk_dev_set_stat(dev, &phase->stat);
+	t_bgn = pblk_ts();
+	if (scan_meta_rd(pblk, 1, &phase->nlines))
+		goto exit;
+	phase->sec = pblk_ts() - t_bgn;
+
+	err = 0;
+
+exit:
+	pblk_dev_set_stat(dev, NULL);
+	pblk_term(pblk);
+	pblk_dev_close(dev);
+
+	return err;
+}
+
+static int scan_bench_dev(const char *dev_path, const struct scan_opts *opts)
+{
+	struct scan_phase *phases;
+	struct nvm_geo geo;
+	int err;
+
+	phases = malloc(SCAN_NPHASES * sizeof(*phases));
+	if (!phases) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	err = scan_run(dev_path, opts, phases, &geo);
+	if (!err) {
+		printf("  - dev: %s\n", dev_path);
+		printf("    geo: { nchannels: %lu, nluns: %lu, nplanes: %lu, "
+		       "nblocks: %lu, npages: %lu, nsectors: %lu }\n",
+		       (unsigned long)geo.nchannels, (unsigned long)geo.nluns,
+		       (unsigned long)geo.nplanes, (unsigned long)geo.nblocks,
+		       (unsigned long)geo.npages, (unsigned long)geo.nsectors);
+		printf("    jobs: %d\n", opts->jobs);
+		printf("    qd: %d\n", opts->qd);
+		printf("    lat_us: %d\n", opts->lat_us);
+		printf("    phases:\n");
+		for (int i = 0; i < SCAN_NPHASES; ++i)
+			scan_phase_pr(i, &phases[i], &geo);
+	}
+
+	free(phases);
+
+	return err;
+}
+
+/**
+ * Create an image with the given geometry and bench a scan of it
+ */
+static int scan_bench_geo(const char *arg, const struct scan_opts *opts)
+{
+	struct pblk_mkimg_opts img = opts->img;
+	struct pblk_mkimg_stat stat;
+	char path[4096], dev_path[4096 + 8];
+	int err;
+
+	if (scan_geo_parse(arg, &img.geo))
+		return -1;
+
+	snprintf(path, sizeof(path), "%s/nvm_pblk_bench.%d.img", opts->dir,
+		 (int)getpid());
+	snprintf(dev_path, sizeof(dev_path), "%s%s", PBLK_DEV_IMG_PREFIX,
+		 path);
+
+	if (pblk_mkimg(path, &img, &stat)) {
+		unlink(path);
+		return -1;
+	}
+
+	err = scan_bench_dev(dev_path, opts);
+	unlink(path);
+
+	return err;
+}
+
+// Geometries benched when neither geometries nor devices are given
+static const char *scan_bench_geos[] = {
+	"4x4x2x64x16x4", "8x4x2x128x32x4"
+};
+
+/**
+ * Measure each phase of scanning for instances and lines, on devices given
+ * by path and on emulated devices of the given geometries
+ */
+int bench_scan(int argc, char **argv)
+{
+	static const struct option longopts[] = {
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "qd", required_argument, NULL, 'q' },
+		{ "lat-us", required_argument, NULL, 'l' },
+		{ "geo", required_argument, NULL, 'g' },
+		{ "ninsts", required_argument, NULL, 'i' },
+		{ "nlines-closed", required_argument, NULL, 'C' },
+		{ "bad-pct", required_argument, NULL, 'B' },
+		{ "dir", required_argument, NULL, 'd' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct scan_opts opts;
+	const char **geos;
+	int ngeos = 0;
+	int res = 0;
+	int opt;
+
+	geos = calloc(argc + sizeof(scan_bench_geos) / sizeof(scan_bench_geos[0]),
+		      sizeof(*geos));
+	if (!geos) {
+		perror("calloc");
+		return 1;
+	}
+
+	memset(&opts, 0, sizeof(opts));
+	opts.jobs = 1;
+	opts.qd = 1;
+	opts.dir = "/tmp";
+	pblk_mkimg_opts_default(&opts.img);
+	opts.img.nlines_closed = 8;
+
+	while ((opt = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+		int val = optarg ? atoi(optarg) : 0;
+
+		switch (opt) {
+		case 'j':
+			opts.jobs = val;
+			break;
+		case 'q':
+			opts.qd = val;
+			break;
+		case 'l':
+			opts.lat_us = val;
+			break;
+		case 'g':
+			geos[ngeos++] = optarg;
+			break;
+		case 'i':
+			opts.img.ninsts = val;
+			break;
+		case 'C':
+			opts.img.nlines_closed = val;
+			break;
+		case 'B':
+			opts.img.bad_pct = val;
+			break;
+		case 'd':
+			opts.dir = optarg;
+			break;
+		default:
+			free(geos);
+			return 1;
+		}
+	}
+
+	if ((opts.jobs < 1) || (opts.qd < 1) || (opts.lat_us < 0)) {
+		fprintf(stderr, "scan: --jobs and --qd must be positive\n");
+		free(geos);
+		return 1;
+	}
+
+	if ((!ngeos) && (optind == argc)) {
+		ngeos = sizeof(scan_bench_geos) / sizeof(scan_bench_geos[0]);
+		memcpy(geos, scan_bench_geos, sizeof(scan_bench_geos));
+	}
+
+	printf("scan_bench:\n");
+	for (int i = 0; i < ngeos; ++i) {
+		if (scan_bench_geo(geos[i], &opts)) {
+			fprintf(stderr, "scan: geo(%s): %s\n", geos[i],
+				strerror(errno));
+			res = 1;
+		}
+	}
+	for (int i = optind; i < argc; ++i) {
+		if (scan_bench_dev(argv[i], &opts)) {
+			fprintf(stderr, "scan: dev(%s): %s\n", argv[i],
+				strerror(errno));
+			res = 1;
+		}
+	}
+
+	free(geos);
+
+	return res;
+}
+
+struct bench {
+	const char *name;
+	int (*func)(int argc, char **argv);
+	const char *descr;
+};
+
+static struct bench benches[] = {
+	{ "crc", bench_crc, "CRC32 throughput per core of each implementation" },
+	{ "scan", bench_scan, "Time and read latency of each phase of a scan, "
+	  "[--jobs N] [--qd N] [--lat-us N] [--geo CHxLUNxPLxBLKxPGxSEC]... "
+	  "[--ninsts N] [--nlines-closed N] [--bad-pct N] [--dir DIR] "
+	  "[dev_path]..." },
+};
+
+static const int nbenches = sizeof(benches) / sizeof(benches[0]);
+
+static void usage(const char *prog)
+{
+	printf("usage: %s <bench> [args]\n", prog);
+	printf("benches:\n");
+	for (int i = 0; i < nbenches; ++i)
+		printf("  %s: %s\n", benches[i].name, benches[i].descr);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (int i = 0; i < nbenches; ++i) {
+		if (strcmp(argv[1], benches[i].name))
+			continue;
+
+		return benches[i].func(argc - 1, argv + 1);
+	}
+
+	usage(argv[0]);
+
+	return 1;
+}
@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <liblightnvm.h>
+#include <pblk_dev.h>
+#include <pblk_mkimg.h>
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [options] <path>\n", prog);
+	printf("options:\n");
+	printf("  --nchannels N       (default: 4)\n");
+	printf("  --nluns N           LUNs per channel (default: 4)\n");
+	printf("  --nplanes N         (default: 2)\n");
+	printf("  --nblocks N         blocks per plane (default: 64)\n");
+	printf("  --npages N          pages per block (default: 16)\n");
+	printf("  --nsectors N        sectors per page (default: 4)\n");
+	printf("  --sector-nbytes N   (default: 4096)\n");
+	printf("  --read-naddrs-max N (default: 64)\n");
+	printf("  --ninsts N          pblk instances, dividing nchannels (default: 2)\n");
+	printf("  --nlines-closed N   closed lines per instance (default: 20)\n");
+	printf("  --nlines-open N     open lines per instance (default: 1)\n");
+	printf("  --bad-pct N         percentage of bad blocks (default: 0)\n");
+	printf("  --bad-next N        closed lines with a wrong next_id (default: 0)\n");
+	printf("  --seed N            (default: 1)\n");
+	printf("The image is used as device path 'file:<path>'\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option longopts[] = {
+		{ "nchannels", required_argument, NULL, 'c' },
+		{ "nluns", required_argument, NULL, 'l' },
+		{ "nplanes", required_argument, NULL, 'p' },
+		{ "nblocks", required_argument, NULL, 'b' },
+		{ "npages", required_argument, NULL, 'g' },
+		{ "nsectors", required_argument, NULL, 's' },
+		{ "sector-nbytes", required_argument, NULL, 'n' },
+		{ "read-naddrs-max", required_argument, NULL, 'r' },
+		{ "ninsts", required_argument, NULL, 'i' },
+		{ "nlines-closed", required_argument, NULL, 'C' },
+		{ "nlines-open", required_argument, NULL, 'O' },
+		{ "bad-pct", required_argument, NULL, 'B' },
+		{ "bad-next", required_argument, NULL, 'N' },
+		{ "seed", required_argument, NULL, 'S' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct pblk_mkimg_opts opts;
+	struct pblk_mkimg_stat stat;
+	int opt;
+
+	pblk_mkimg_opts_default(&opts);
+
+	while ((opt = getopt_long(argc, argv, "h", longopts, NULL)) != -1) {
+		char *end = NULL;
+		unsigned long val;
+
+		if (opt == 'h') {
+			usage(argv[0]);
+			return 0;
+		}
+		if (opt == '?') {
+			usage(argv[0]);
+			return 1;
+		}
+
+		errno = 0;
+		val = strtoul(optarg, &end, 10);
+		if (errno || (end == optarg) || (*end != '\0')) {
+			fprintf(stderr, "invalid value: '%s'\n", optarg);
+			return 1;
+		}
+
+		switch (opt) {
+		case 'c':
+			opts.geo.nchannels = val;
+			break;
+		case 'l':
+			opts.geo.nluns = val;
+			break;
+		case 'p':
+			opts.geo.nplanes = val;
+			break;
+		case 'b':
+			opts.geo.nblocks = val;
+			break;
+		case 'g':
+			opts.geo.npages = val;
+			break;
+		case 's':
+			opts.geo.nsectors = val;
+			break;
+		case 'n':
+			opts.geo.sector_nbytes = val;
+			break;
+		case 'r':
+			opts.read_naddrs_max = val;
+			break;
+		case 'i':
+			opts.ninsts = val;
+			break;
+		case 'C':
+			opts.nlines_closed = val;
+			break;
+		case 'O':
+			opts.nlines_open = val;
+			break;
+		case 'B':
+			opts.bad_pct = val;
+			break;
+		case 'N':
+			opts.nbad_next = val;
+			break;
+		case 'S':
+			opts.seed = val;
+			break;
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (pblk_mkimg(argv[optind], &opts, &stat)) {
+		perror("pblk_mkimg");
+		return 1;
+	}
+
+	printf("mkimg:\n");
+	printf("  path: %s%s\n", PBLK_DEV_IMG_PREFIX, argv[optind]);
+	printf("  geo: { nchannels: %lu, nluns: %lu, nplanes: %lu, "
+	       "nblocks: %lu, npages: %lu, nsectors: %lu, "
+	       "sector_nbytes: %lu }\n",
+	       (unsigned long)opts.geo.nchannels,
+	       (unsigned long)opts.geo.nluns,
+	       (unsigned long)opts.geo.nplanes,
+	       (unsigned long)opts.geo.nblocks,
+	       (unsigned long)opts.geo.npages,
+	       (unsigned long)opts.geo.nsectors,
+	       (unsigned long)opts.geo.sector_nbytes);
+	printf("  ninsts: %d\n", opts.ninsts);
+	printf("  nblocks_bad: %lu\n", (unsigned long)stat.nblocks_bad);
+	printf("  nlines_written: %lu\n", (unsigned long)stat.nlines);
+	printf("  nsectors_written: %lu\n", (unsigned long)stat.nsectors);
+	printf("  seed: %lu\n", (unsigned long)opts.seed);
+
+	return 0;
+}
@@ -0,0 +1,2187 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <liblightnvm.h>
+#include <pblk.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+const char *pblk_line_type_str(int ltype)
+{
+	switch (ltype) {
+	case PBLK_LINETYPE_FREE:
+		return "PBLK_LINETYPE_FREE";
+	case PBLK_LINETYPE_LOG:
+		return "PBLK_LINETYPE_LOG";
+	case PBLK_LINETYPE_DATA:
+		return "PBLK_LINETYPE_DATA";
+	default:
+		return "PBLK_LINETYPE_UNDEF";
+	}
+}
+
+const char *pblk_line_state_str(int lstate)
+{
+	switch (lstate) {
+	case PBLK_LINE_STATE_OPEN:
+		return "PBLK_LINE_STATE_OPEN";
+	case PBLK_LINE_STATE_CLOSED:
+		return "PBLK_LINE_STATE_CLOSED";
+	case PBLK_LINE_STATE_BAD:
+		return "PBLK_LINE_STATE_BAD";
+	case PBLK_LINE_STATE_FREE:
+		return "PBLK_LINE_STATE_FREE";
+	case PBLK_LINE_STATE_CORRUPT:
+		return "PBLK_LINE_STATE_CORRUPT";
+	case PBLK_LINE_STATE_UNREADABLE:
+		return "PBLK_LINE_STATE_UNREADABLE";
+	case PBLK_LINE_STATE_UNKNOWN:
+		return "PBLK_LINE_STATE_UNKNOWN";
+	default:
+		return "PBLK_LINE_STATE_UNDEF";
+	}
+}
+
+void pblk_instance_pr(const struct pblk_inst *inst)
+{
+	if (!inst) {
+		printf("pblk_instance: ~\n");
+		return;
+	}
+
+	printf("pblk_instance:\n");
+	printf("  lun_bgn: %d\n", inst->lun_bgn);
+	printf("  lun_end: %d\n", inst->lun_end);
+	printf("  nluns: %d\n", inst->nluns);
+}
+
+void pblk_line_header_pr(const struct pblk_line_header *header)
+{
+	if (!header) {
+		printf("  header: ~\n");
+		return;
+	}
+
+	printf("  header:\n");
+	printf("    crc: 0x%04x\n", header->crc);
+	printf("    identifier: 0x%04x\n", header->identifier);
+	printf("    uuid: [0x%04x, 0x%04x, 0x%04x, 0x%04x]\n",
+	       header->uuid[0], header->uuid[1],
+	       header->uuid[2], header->uuid[3]);
+	printf("    type: %s\n", pblk_line_type_str(header->type));
+	printf("    version: %02x\n", header->version);
+	printf("    id: %04u\n", header->id);
+}
+
+void pblk_line_smeta_pr(const struct pblk_line_smeta *smeta)
+{
+	if (!smeta) {
+		printf("smeta: ~\n");
+		return;
+	}
+
+	printf("smeta:\n");
+	pblk_line_header_pr(&smeta->header);
+	printf("  crc: 0x%04x\n", smeta->crc);
+	printf("  prev_id: %04u\n", smeta->prev_id);
+	printf("  seq_nr: %04lu\n", smeta->seq_nr);
+	printf("  window_wr_lun: %08u\n", smeta->window_wr_lun);
+}
+
+void pblk_line_emeta_pr(const struct pblk_line_emeta *emeta)
+{
+	if (!emeta) {
+		printf("emeta: ~\n");
+		return;
+	}
+
+	printf("emeta:\n");
+	pblk_line_header_pr(&emeta->header);
+	printf("  crc: 0x%04x\n", emeta->crc);
+	printf("  prev_id: %04u\n", emeta->prev_id);
+	printf("  seq_nr: %04lu\n", emeta->seq_nr);
+	printf("  window_wr_lun: %08u\n", emeta->window_wr_lun);
+	printf("  next_id: %04u\n", emeta->next_id);
+	printf("  nr_lbas: %04lu\n", emeta->nr_lbas);
+}
+
+void pblk_line_pr(const struct pblk_inst *inst, int id)
+{
+	const struct pblk_line *line = &inst->lines[id];
+	int smeta_read = pblk_inst_line_smeta_read(inst, id);
+	int emeta_read = pblk_inst_line_emeta_read(inst, id);
+	int smeta_skipped = inst->line_flags[id] & PBLK_LINE_FLAG_SMETA_SKIPPED;
+	int emeta_skipped = inst->line_flags[id] & PBLK_LINE_FLAG_EMETA_SKIPPED;
+
+	printf("line_%04d:\n", id);
+	printf("  id: %04d:\n", id);
+	printf("  state: %s\n", pblk_line_state_str(inst->line_states[id]));
+	if (inst->line_states[id] == PBLK_LINE_STATE_BAD)
+		return;
+
+	printf("  smeta_"); nvm_addr_pr(line->smeta_addr);
+	printf("  emeta_"); nvm_addr_pr(line->emeta_addr);
+
+	if (smeta_skipped) {
+		printf("  smeta_nvm_ret: skipped\n");
+	} else if (smeta_read) {
+		printf("  smeta_nvm_ret: ~\n");
+	} else {
+		printf("  smeta_");
+		nvm_ret_pr(&line->smeta_ret);
+	}
+
+	if (emeta_skipped) {
+		printf("  emeta_nvm_ret: skipped\n");
+	} else if (emeta_read) {
+		printf("  emeta_nvm_ret: ~\n");
+	} else {
+		printf("  emeta_");
+		nvm_ret_pr(&line->emeta_ret);
+	}
+
+	if (smeta_read) {
+		printf("line%04i_", id);
+		pblk_line_smeta_pr(&line->smeta);
+	}
+	if (emeta_read) {
+		printf("line%04i_", id);
+		pblk_line_emeta_pr(&line->emeta);
+	}
+}
+
+int pblk_line_smeta_from_buf(char *buf, struct pblk_line_smeta *smeta)
+{
+	if ((!buf) || (!smeta)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memcpy(smeta, buf, sizeof(*smeta));
+
+	return 0;
+}
+
+int pblk_line_emeta_from_buf(char *buf, struct pblk_line_emeta *emeta)
+{
+	if ((!buf) || (!emeta)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memcpy(emeta, buf, sizeof(*emeta));
+
+	return 0;
+}
+
+void pblk_smeta_view_put(struct pblk_smeta_view *view)
+{
+	pblk_buf_put(view->buf);
+	memset(view, 0, sizeof(*view));
+}
+
+void pblk_emeta_view_put(struct pblk_emeta_view *view)
+{
+	pblk_buf_put(view->buf);
+	memset(view, 0, sizeof(*view));
+}
+
+/**
+ * Check that `nbytes` of meta fit the given buffer, start aligned for its
+ * fields, and hold at least `nbytes_min`
+ */
+static int pblk_meta_view_bounds(const struct pblk_buf *buf, size_t nbytes,
+				 size_t nbytes_min)
+{
+	if ((!buf) || (nbytes > buf->nbytes) || (nbytes < nbytes_min) ||
+	    ((uintptr_t)buf->data % sizeof(uint64_t))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Parse the complete smeta of `nbytes` in the given buffer into a view,
+ * without copying it. The view takes a reference to the buffer.
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error. Errors are: EINVAL when the smeta does not fit the
+ * buffer or is misaligned, EBADMSG when its header is invalid or names
+ * another line than `line_id`.
+ */
+int pblk_smeta_view_parse(struct pblk_smeta_view *view, struct pblk_buf *buf,
+			  size_t nbytes, int line_id)
+{
+	struct pblk_line_smeta *smeta;
+
+	memset(view, 0, sizeof(*view));
+
+	if (pblk_meta_view_bounds(buf, nbytes, sizeof(*smeta)))
+		return -1;
+
+	smeta = (void *)buf->data;
+	if (pblk_line_smeta_hdr_check(smeta) ||
+	    (smeta->header.id != (uint32_t)line_id)) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	view->buf = pblk_buf_ref(buf);
+	view->smeta = smeta;
+	view->nbytes = nbytes;
+
+	return 0;
+}
+
+/**
+ * Parse the complete emeta of `nbytes` in the given buffer into a view,
+ * without copying it, its lba-list must hold `nlbas` entries. The view takes
+ * a reference to the buffer.
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error. Errors are: EINVAL when the emeta and its lba-list
+ * do not fit the buffer or are misaligned, EBADMSG when its header is invalid
+ * or names another line than `line_id`.
+ */
+int pblk_emeta_view_parse(struct pblk_emeta_view *view, struct pblk_buf *buf,
+			  size_t nbytes, int line_id, uint64_t nlbas)
+{
+	struct pblk_line_emeta *emeta;
+
+	memset(view, 0, sizeof(*view));
+
+	if ((nlbas > (SIZE_MAX - sizeof(*emeta)) / sizeof(uint64_t)) ||
+	    pblk_meta_view_bounds(buf, nbytes, sizeof(*emeta) +
+				  nlbas * sizeof(uint64_t)))
+		return -1;
+
+	emeta = (void *)buf->data;
+	if (pblk_line_emeta_hdr_check(emeta) ||
+	    (emeta->header.id != (uint32_t)line_id)) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	view->buf = pblk_buf_ref(buf);
+	view->emeta = emeta;
+	view->lbas = emeta->lbas;
+	view->nlbas = nlbas;
+	view->nbytes = nbytes;
+
+	return 0;
+}
+
+/**
+ * Compute and update the smeta-address for the given line given on the given
+ * device
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned, `err` set to
+ * indicate the error. Error occurs if all blocks in the line are bad.
+ */
+int pblk_line_smeta_addr_calc(struct pblk_inst *inst, int id,
+			      const struct nvm_geo *geo)
+{
+	const struct pblk_line_map *map = &inst->line_maps[id];
+
+	if (!map->nluns)
+		return -1;
+
+	inst->lines[id].smeta_addr = pblk_line_map_addr(map, 0, geo);
+
+	return 0;
+}
+
+/**
+ * Compute and update the emeta-address for the given line on the given device,
+ * that of the first emeta sector, which holds the emeta header
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned, this happens
+ * when the good blocks of the line cannot hold emeta.
+ */
+int pblk_line_emeta_addr_calc(struct pblk_inst *inst, int id,
+			      const struct nvm_geo *geo)
+{
+	const int64_t gsec = pblk_line_emeta_gsec(inst, id, geo);
+
+	if (gsec < 0)
+		return -1;
+
+	inst->lines[id].emeta_addr = pblk_line_map_addr(&inst->line_maps[id],
+							 gsec, geo);
+
+	return 0;
+}
+
+struct pblk_scan_ent {
+	struct nvm_ret *ret;			///< Per-address result
+	pblk_scan_cb cb;			///< Completion callback
+	void *arg;				///< Argument for callback
+};
+
+/**
+ * A vectored command of single-sector reads
+ */
+struct pblk_scan_cmd {
+	struct pblk_scan_cmd *next;		///< Queue linkage
+	int naddrs;				///< Number of gathered addresses
+	struct nvm_addr addrs[NVM_NADDR_MAX];	///< Gathered addresses
+	struct pblk_scan_ent ents[NVM_NADDR_MAX];	///< Their completions
+	size_t ncmds;				///< Commands issued to read it
+	struct pblk_buf *buf;			///< Buffer for the command
+	char *dst;				///< Read in place when set
+};
+
+struct pblk_aio_queue {
+	struct pblk_scan_cmd *head;		///< Commands waiting for the LUN
+	struct pblk_scan_cmd *tail;
+	int inflight;				///< Commands in-flight on the LUN
+};
+
+/**
+ * I/O threads reading the commands of the asynchronous scans attached to it,
+ * a scan creates its own pool unless given one to share, as by the scans of
+ * the devices of a fleet
+ *
+ * NOTE: liblightnvm only provides synchronous commands, the I/O threads
+ * provide the queue-depth, there is one I/O thread per in-flight command, not
+ * one per request. Commands of all attached scans count against `ncmds_max`,
+ * thus threads and commands in-flight are bounded by it across scans.
+ */
+struct pblk_aio_pool {
+	pthread_mutex_t lock;			///< Also of the attached scans
+	pthread_cond_t sub_cond;		///< Signals queued commands
+	struct pblk_aio *aios;			///< Attached scans
+	struct pblk_aio *rr;			///< Scan dequeued from next
+	int ncmds;				///< Commands of attached scans
+	int ncmds_max;
+	int nthreads;
+	int nidle;				///< Threads not reading a command
+	int stop;
+	pthread_t *threads;			///< ncmds_max threads
+};
+
+/**
+ * Asynchronous backend of the scan-engine
+ *
+ * Commands are queued per LUN and dispatched to the I/O threads of a pool,
+ * never having more than `qd` commands in-flight per LUN. Completed commands
+ * are handed back to the thread owning the scan, which invokes the
+ * completions, thus completions need no locking.
+ */
+struct pblk_aio {
+	struct pblk_scan *scan;
+	struct pblk_aio_pool *pool;
+	int pool_own;				///< Created by and for the scan
+	struct pblk_aio *next;			///< Attached to the same pool
+	int qd;					///< Max. commands in-flight per LUN
+	pthread_cond_t cpl_cond;		///< Signals completed commands
+	int nqueues;				///< One queue per LUN
+	struct pblk_aio_queue *queues;
+	int rr;					///< Round-robin queue cursor
+	struct pblk_scan_cmd *cpl;		///< Completed commands
+	struct pblk_scan_cmd *free;		///< Unused commands
+	int ncmds;				///< Number of allocated commands
+	int nqueued;				///< Queued or in-flight commands
+};
+
+static struct pblk_scan_cmd *pblk_scan_cmd_alloc(struct pblk_scan *scan)
+{
+	struct pblk_scan_cmd *cmd = NULL;
+
+	cmd = malloc(sizeof(*cmd));
+	if (!cmd)
+		return NULL;
+	memset(cmd, 0, sizeof(*cmd));
+
+	cmd->buf = pblk_buf_get(scan->pool,
+				scan->naddrs_max * scan->geo->sector_nbytes);
+	if (!cmd->buf) {
+		free(cmd);
+		return NULL;
+	}
+
+	return cmd;
+}
+
+static void pblk_scan_cmd_free(struct pblk_scan_cmd *cmd)
+{
+	if (!cmd)
+		return;
+
+	pblk_buf_put(cmd->buf);
+	free(cmd);
+}
+
+/**
+ * Read the addresses of the given command and update the result of every
+ * address. When a vectored command fails without telling which of its
+ * addresses failed, the addresses are re-read one at a time.
+ *
+ * The buffer is not cleared up front, as reads overwrite it, only the sectors
+ * of failed addresses are cleared.
+ */
+static void pblk_scan_cmd_exec(struct pblk_dev *dev, const struct nvm_geo *geo,
+			       struct pblk_scan_cmd *cmd)
+{
+	const size_t sector_nbytes = geo->sector_nbytes;
+	char *cbuf = cmd->dst ? cmd->dst : cmd->buf->data;
+	struct nvm_ret ret = { 0 };
+
+	cmd->ncmds = 1;
+	if (!pblk_dev_read(dev, cmd->addrs, cmd->naddrs, cbuf, &ret)) {
+		for (int i = 0; i < cmd->naddrs; ++i)
+			memset(cmd->ents[i].ret, 0, sizeof(ret));
+	} else if ((cmd->naddrs == 1) || ret.status) {
+		// Completion status: bit i is set when address i failed
+		for (int i = 0; i < cmd->naddrs; ++i) {
+			struct nvm_ret *aret = cmd->ents[i].ret;
+
+			memset(aret, 0, sizeof(*aret));
+			if (cmd->naddrs == 1) {
+				*aret = ret;
+			} else if (ret.status & (1ULL << i)) {
+				aret->status = 0x1;
+				aret->result = ret.result;
+			}
+		}
+	} else {
+		for (int i = 0; i < cmd->naddrs; ++i) {
+			char *buf = cbuf + i * sector_nbytes;
+
+			memset(cmd->ents[i].ret, 0, sizeof(ret));
+			pblk_dev_read(dev, &cmd->addrs[i], 1, buf,
+				      cmd->ents[i].ret);
+			++(cmd->ncmds);
+		}
+	}
+
+	for (int i = 0; i < cmd->naddrs; ++i) {
+		const struct nvm_ret *aret = cmd->ents[i].ret;
+
+		if (aret->status || aret->result)
+			memset(cbuf + i * sector_nbytes, 0, sector_nbytes);
+	}
+}
+
+/**
+ * Invoke the completions of the given, executed, command and reset it
+ */
+static void pblk_scan_cmd_complete(struct pblk_scan *scan,
+				   struct pblk_scan_cmd *cmd)
+{
+	const size_t sector_nbytes = scan->geo->sector_nbytes;
+	char *cbuf = cmd->dst ? cmd->dst : cmd->buf->data;
+
+	for (int i = 0; i < cmd->naddrs; ++i) {
+		struct pblk_scan_ent *ent = &cmd->ents[i];
+
+		if (ent->cb)
+			ent->cb(cbuf + i * sector_nbytes, ent->ret, ent->arg);
+	}
+
+	scan->ncmds += cmd->ncmds;
+	cmd->naddrs = 0;
+	cmd->ncmds = 0;
+	cmd->dst = NULL;
+}
+
+/**
+ * Create a pool of I/O threads for asynchronous scans, reading no more than
+ * `ncmds_max` commands at a time, threads are started as commands are queued
+ *
+ * @returns On success, the pool is returned. On error, NULL is returned and
+ * errno set to indicate the error.
+ */
+struct pblk_aio_pool *pblk_aio_pool_create(int ncmds_max)
+{
+	struct pblk_aio_pool *pool = NULL;
+
+	if (ncmds_max < 1) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pool = malloc(sizeof(*pool));
+	if (!pool) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(pool, 0, sizeof(*pool));
+
+	pool->threads = malloc(ncmds_max * sizeof(*pool->threads));
+	if (!pool->threads) {
+		free(pool);
+		errno = ENOMEM;
+		return NULL;
+	}
+	pool->ncmds_max = ncmds_max;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->sub_cond, NULL);
+
+	return pool;
+}
+
+/**
+ * Stop the threads of the given pool and release it, no scans may be attached
+ */
+void pblk_aio_pool_destroy(struct pblk_aio_pool *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->sub_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->nthreads; ++i)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->sub_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
+
+/**
+ * Dequeue a command from a LUN having less than `qd` commands in-flight,
+ * called with the lock held
+ */
+static struct pblk_scan_cmd *pblk_aio_dequeue(struct pblk_aio *aio, int *qid)
+{
+	for (int i = 0; i < aio->nqueues; ++i) {
+		const int q = (aio->rr + i) % aio->nqueues;
+		struct pblk_aio_queue *queue = &aio->queues[q];
+		struct pblk_scan_cmd *cmd = queue->head;
+
+		if ((!cmd) || (queue->inflight >= aio->qd))
+			continue;
+
+		queue->head = cmd->next;
+		if (!queue->head)
+			queue->tail = NULL;
+		++(queue->inflight);
+
+		aio->rr = (q + 1) % aio->nqueues;
+		*qid = q;
+
+		return cmd;
+	}
+
+	return NULL;
+}
+
+/**
+ * Dequeue a command of any of the scans attached to the given pool, starting
+ * with the scan after the one last dequeued from, called with the lock held
+ */
+static struct pblk_scan_cmd *pblk_aio_pool_dequeue(struct pblk_aio_pool *pool,
+						   struct pblk_aio **aio,
+						   int *qid)
+{
+	struct pblk_aio *bgn = pool->rr ? pool->rr : pool->aios;
+	struct pblk_aio *cur = bgn;
+
+	while (cur) {
+		struct pblk_scan_cmd *cmd = pblk_aio_dequeue(cur, qid);
+		struct pblk_aio *next = cur->next ? cur->next : pool->aios;
+
+		if (cmd) {
+			pool->rr = next;
+			*aio = cur;
+
+			return cmd;
+		}
+
+		cur = next == bgn ? NULL : next;
+	}
+
+	return NULL;
+}
+
+/**
+ * I/O thread, counted as idle from its creation until it dequeues a command
+ * and again once the command is read
+ */
+static void *pblk_aio_worker(void *arg)
+{
+	struct pblk_aio_pool *pool = arg;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->stop) {
+		struct pblk_scan_cmd *cmd = NULL;
+		struct pblk_aio *aio = NULL;
+		int qid;
+
+		cmd = pblk_aio_pool_dequeue(pool, &aio, &qid);
+		if (!cmd) {
+			pthread_cond_wait(&pool->sub_cond, &pool->lock);
+			continue;
+		}
+		--(pool->nidle);
+		pthread_mutex_unlock(&pool->lock);
+
+		pblk_scan_cmd_exec(aio->scan->dev, aio->scan->geo, cmd);
+
+		pthread_mutex_lock(&pool->lock);
+		++(pool->nidle);
+		--(aio->queues[qid].inflight);
+		cmd->next = aio->cpl;
+		aio->cpl = cmd;
+		pthread_cond_signal(&aio->cpl_cond);
+		pthread_cond_signal(&pool->sub_cond);	// LUN slot available
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/**
+ * Create the asynchronous backend of the given scan and attach it to `pool`,
+ * or to a pool of its own when NULL, reading no more commands at a time than
+ * `qd` per LUN and PBLK_AIO_NCMDS_MAX in all
+ */
+static struct pblk_aio *pblk_aio_create(struct pblk_scan *scan, int qd,
+					struct pblk_aio_pool *pool)
+{
+	const struct nvm_geo *geo = scan->geo;
+	struct pblk_aio *aio = NULL;
+
+	aio = malloc(sizeof(*aio));
+	if (!aio) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(aio, 0, sizeof(*aio));
+
+	aio->nqueues = geo->nchannels * geo->nluns;
+	aio->queues = malloc(sizeof(*aio->queues) * aio->nqueues);
+	if (!aio->queues) {
+		free(aio);
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(aio->queues, 0, sizeof(*aio->queues) * aio->nqueues);
+
+	if (!pool) {
+		int ncmds_max = PBLK_AIO_NCMDS_MAX;
+
+		if ((int64_t)qd * aio->nqueues < ncmds_max)
+			ncmds_max = qd * aio->nqueues;
+
+		pool = pblk_aio_pool_create(ncmds_max);
+		if (!pool) {
+			free(aio->queues);
+			free(aio);
+			return NULL;
+		}
+		aio->pool_own = 1;
+	}
+
+	aio->scan = scan;
+	aio->pool = pool;
+	aio->qd = qd;
+	pthread_cond_init(&aio->cpl_cond, NULL);
+
+	pthread_mutex_lock(&pool->lock);
+	aio->next = pool->aios;
+	pool->aios = aio;
+	pthread_mutex_unlock(&pool->lock);
+
+	return aio;
+}
+
+/**
+ * Invoke completions of completed commands, waiting for at least one
+ * completion when `wait` is set and commands are outstanding
+ */
+static void pblk_aio_reap(struct pblk_aio *aio, int wait)
+{
+	struct pblk_aio_pool *pool = aio->pool;
+	struct pblk_scan_cmd *cpl = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	while (wait && (!aio->cpl) && aio->nqueued)
+		pthread_cond_wait(&aio->cpl_cond, &pool->lock);
+	cpl = aio->cpl;
+	aio->cpl = NULL;
+	pthread_mutex_unlock(&pool->lock);
+
+	while (cpl) {
+		struct pblk_scan_cmd *cmd = cpl;
+
+		cpl = cpl->next;
+		pblk_scan_cmd_complete(aio->scan, cmd);
+
+		pthread_mutex_lock(&pool->lock);
+		--(aio->nqueued);
+		cmd->next = aio->free;
+		aio->free = cmd;
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+/**
+ * Queue the given command on the LUN of its first address, starting another
+ * I/O thread of the pool when none are idle, a thread being started is idle
+ * until it dequeues a command, thus submissions racing its start do not start
+ * more
+ *
+ * @returns 0 when queued, -1 when the command must be read synchronously
+ */
+static int pblk_aio_submit(struct pblk_aio *aio, struct pblk_scan_cmd *cmd)
+{
+	const struct nvm_geo *geo = aio->scan->geo;
+	const int qid = cmd->addrs[0].g.ch * geo->nluns + cmd->addrs[0].g.lun;
+	struct pblk_aio_queue *queue = &aio->queues[qid % aio->nqueues];
+	struct pblk_aio_pool *pool = aio->pool;
+	int err = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	if ((!pool->nidle) && (pool->nthreads < pool->ncmds_max)) {
+		if (pthread_create(&pool->threads[pool->nthreads], NULL,
+				   pblk_aio_worker, pool)) {
+			err = pool->nthreads ? 0 : -1;
+		} else {
+			++(pool->nthreads);
+			++(pool->nidle);
+		}
+	}
+
+	if (!err) {
+		cmd->next = NULL;
+		if (queue->tail)
+			queue->tail->next = cmd;
+		else
+			queue->head = cmd;
+		queue->tail = cmd;
+		++(aio->nqueued);
+
+		pthread_cond_signal(&pool->sub_cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return err;
+}
+
+/**
+ * Get an unused command, allocating or waiting for completions as needed,
+ * commands are allocated while the scan and its pool are below their bounds
+ */
+static struct pblk_scan_cmd *pblk_aio_get(struct pblk_aio *aio)
+{
+	struct pblk_aio_pool *pool = aio->pool;
+	struct pblk_scan_cmd *cmd = NULL;
+
+	pblk_aio_reap(aio, 0);
+
+	while (!cmd) {
+		int alloc = 0;
+
+		pthread_mutex_lock(&pool->lock);
+		cmd = aio->free;
+		if (cmd) {
+			aio->free = cmd->next;
+		} else if ((aio->ncmds < PBLK_AIO_NCMDS_MAX) &&
+			   (pool->ncmds < pool->ncmds_max)) {
+			++(aio->ncmds);
+			++(pool->ncmds);
+			alloc = 1;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		if (cmd)
+			break;
+
+		if (alloc) {
+			cmd = pblk_scan_cmd_alloc(aio->scan);
+			if (cmd)
+				break;
+
+			pthread_mutex_lock(&pool->lock);
+			--(aio->ncmds);
+			--(pool->ncmds);
+			pthread_mutex_unlock(&pool->lock);
+		}
+		if (!aio->nqueued)		// Nothing to wait for
+			return NULL;
+
+		pblk_aio_reap(aio, 1);
+	}
+
+	return cmd;
+}
+
+static void pblk_aio_destroy(struct pblk_aio *aio)
+{
+	struct pblk_aio_pool *pool;
+
+	if (!aio)
+		return;
+	pool = aio->pool;
+
+	while (aio->nqueued)
+		pblk_aio_reap(aio, 1);
+
+	pthread_mutex_lock(&pool->lock);
+	for (struct pblk_aio **cur = &pool->aios; *cur; cur = &(*cur)->next) {
+		if (*cur == aio) {
+			*cur = aio->next;
+			break;
+		}
+	}
+	if (pool->rr == aio)
+		pool->rr = NULL;
+	pool->ncmds -= aio->ncmds;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (aio->pool_own)
+		pblk_aio_pool_destroy(pool);
+
+	while (aio->free) {
+		struct pblk_scan_cmd *cmd = aio->free;
+
+		aio->free = cmd->next;
+		pblk_scan_cmd_free(cmd);
+	}
+
+	pthread_cond_destroy(&aio->cpl_cond);
+	free(aio->queues);
+	free(aio);
+}
+
+/**
+ * Initialize the given scan-engine for reading from the given device, with at
+ * most `qd` commands in-flight per LUN, and buffers of commands from `pool`.
+ * With `qd` larger than one, commands are read by the I/O threads of
+ * `aio_pool`, or by threads of the scan's own when NULL.
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_scan_init(struct pblk_scan *scan, struct pblk_dev *dev, int qd,
+		   struct pblk_buf_pool *pool, struct pblk_aio_pool *aio_pool)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(dev);
+	int naddrs_max = pblk_dev_get_read_naddrs_max(dev);
+
+	memset(scan, 0, sizeof(*scan));
+
+	// The completion status is a bitmap of failed addresses, thus commands
+	// cannot carry more addresses than it has bits
+	if ((naddrs_max < 1) || (naddrs_max > NVM_NADDR_MAX))
+		naddrs_max = NVM_NADDR_MAX;
+	if (naddrs_max > (int)(sizeof(((struct nvm_ret *)0)->status) * 8))
+		naddrs_max = sizeof(((struct nvm_ret *)0)->status) * 8;
+
+	scan->dev = dev;
+	scan->geo = geo;
+	scan->naddrs_max = naddrs_max;
+	scan->pool = pool;
+
+	if (qd > 1) {
+		scan->aio = pblk_aio_create(scan, qd, aio_pool);
+		if (!scan->aio)
+			return -1;
+	}
+
+	scan->cmd = pblk_scan_cmd_alloc(scan);
+	if (!scan->cmd) {
+		pblk_aio_destroy(scan->aio);
+		scan->aio = NULL;
+		return -1;
+	}
+	if (scan->aio) {
+		pthread_mutex_lock(&scan->aio->pool->lock);
+		++(scan->aio->ncmds);
+		++(scan->aio->pool->ncmds);
+		pthread_mutex_unlock(&scan->aio->pool->lock);
+	}
+
+	return 0;
+}
+
+/**
+ * Hand the gathered command to the backend and start gathering another
+ */
+static void pblk_scan_issue(struct pblk_scan *scan)
+{
+	struct pblk_scan_cmd *cmd = scan->cmd;
+
+	if (!cmd->naddrs)
+		return;
+
+	// Once a command is queued, getting another one cannot fail, at worst
+	// it waits for the queued command to complete
+	if (scan->aio && (!pblk_aio_submit(scan->aio, cmd))) {
+		scan->cmd = pblk_aio_get(scan->aio);
+		return;
+	}
+
+	pblk_scan_cmd_exec(scan->dev, scan->geo, cmd);
+	pblk_scan_cmd_complete(scan, cmd);
+}
+
+/**
+ * Read all gathered addresses and invoke their completions
+ *
+ * For an asynchronous scan, this waits for all outstanding commands.
+ */
+void pblk_scan_flush(struct pblk_scan *scan)
+{
+	pblk_scan_issue(scan);
+
+	if (scan->aio) {
+		while (scan->aio->nqueued)
+			pblk_aio_reap(scan->aio, 1);
+	}
+}
+
+void pblk_scan_term(struct pblk_scan *scan)
+{
+	if (scan->cmd)
+		pblk_scan_flush(scan);
+
+	pblk_aio_destroy(scan->aio);
+	scan->aio = NULL;
+
+	pblk_scan_cmd_free(scan->cmd);
+	scan->cmd = NULL;
+}
+
+/**
+ * Add a single-sector read of the given address to the scan, `ret` is updated
+ * with the result of reading the address and `cb` invoked upon completion
+ *
+ * With the asynchronous backend, completions of earlier commands may be
+ * invoked while adding.
+ */
+static void pblk_scan_gather(struct pblk_scan *scan, struct nvm_addr addr,
+			     struct nvm_ret *ret, pblk_scan_cb cb, void *arg,
+			     char *dst)
+{
+	struct pblk_scan_cmd *cmd = scan->cmd;
+
+	// A command reads into a single buffer, thus sectors read in place
+	// must follow each other in their destination
+	if (cmd->naddrs &&
+	    ((cmd->naddrs == scan->naddrs_max) || ((!cmd->dst) != (!dst)) ||
+	     (dst && (dst != cmd->dst + cmd->naddrs *
+				scan->geo->sector_nbytes)))) {
+		pblk_scan_issue(scan);
+		cmd = scan->cmd;
+	}
+
+	if (!cmd->naddrs)
+		cmd->dst = dst;
+	cmd->addrs[cmd->naddrs] = addr;
+	cmd->ents[cmd->naddrs].ret = ret;
+	cmd->ents[cmd->naddrs].cb = cb;
+	cmd->ents[cmd->naddrs].arg = arg;
+	++(cmd->naddrs);
+}
+
+void pblk_scan_add(struct pblk_scan *scan, struct nvm_addr addr,
+		   struct nvm_ret *ret, pblk_scan_cb cb, void *arg)
+{
+	pblk_scan_gather(scan, addr, ret, cb, arg, NULL);
+}
+
+/**
+ * Add a single-sector read of the given address to the scan, reading the
+ * sector directly into `dst`, which must stay valid until the scan is flushed
+ * and be allocated by nvm_buf_alloc
+ *
+ * Sectors added with consecutive destinations are read by one command, thus
+ * reading a range into a buffer costs no copies.
+ */
+void pblk_scan_add_dst(struct pblk_scan *scan, struct nvm_addr addr,
+		       struct nvm_ret *ret, char *dst)
+{
+	pblk_scan_gather(scan, addr, ret, NULL, NULL, dst);
+}
+
+static void pblk_smeta_cb(char *buf, const struct nvm_ret *ret, void *arg)
+{
+	if (!(ret->status || ret->result))
+		pblk_line_smeta_from_buf(buf, arg);
+}
+
+static void pblk_emeta_cb(char *buf, const struct nvm_ret *ret, void *arg)
+{
+	if (!(ret->status || ret->result))
+		pblk_line_emeta_from_buf(buf, arg);
+}
+
+void pblk_inst_lines_free(struct pblk_inst *inst)
+{
+	free(inst->line_states);
+	free(inst->line_flags);
+	free(inst->line_seq_nrs);
+	free(inst->lines);
+	inst->line_states = NULL;
+	inst->line_flags = NULL;
+	inst->line_seq_nrs = NULL;
+	inst->lines = NULL;
+	inst->nlines = 0;
+}
+
+/**
+ * Allocate zeroed storage for `nlines` lines of the given instance
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_inst_lines_alloc(struct pblk_inst *inst, int nlines)
+{
+	pblk_inst_lines_free(inst);
+
+	inst->line_states = calloc(nlines, sizeof(*inst->line_states));
+	inst->line_flags = calloc(nlines, sizeof(*inst->line_flags));
+	inst->line_seq_nrs = calloc(nlines, sizeof(*inst->line_seq_nrs));
+	inst->lines = calloc(nlines, sizeof(*inst->lines));
+	if (!(inst->line_states && inst->line_flags && inst->line_seq_nrs &&
+	      inst->lines)) {
+		pblk_inst_lines_free(inst);
+		errno = ENOMEM;
+		return -1;
+	}
+	inst->nlines = nlines;
+
+	return 0;
+}
+
+/**
+ * Fill lines of the given instance with: id, state [and addresses]
+ */
+static int pblk_inst_lines_setup(struct pblk *pblk, struct pblk_inst *inst)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+
+	if (inst->lun_bgn > inst->lun_end) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pblk_inst_lines_alloc(inst, geo->nblocks))
+		return -1;
+
+	for (int i = 0; i < inst->nlines; ++i) {
+		inst->line_states[i] = PBLK_LINE_STATE_UNKNOWN;
+
+		if (pblk_line_smeta_addr_calc(inst, i, geo))
+			inst->line_states[i] = PBLK_LINE_STATE_BAD;
+
+		if (pblk_line_emeta_addr_calc(inst, i, geo))
+			inst->line_states[i] = PBLK_LINE_STATE_BAD;
+	}
+
+	return 0;
+}
+
+/**
+ * Update pblk_line-state of the given instance from the line-meta read
+ *
+ * A line is free when its smeta sector is empty, by the device reporting an
+ * empty page or by reading as erased, unreadable when the read fails otherwise,
+ * and corrupt when the smeta has no valid header. Lines with a valid smeta are
+ * closed when their emeta was read, and open otherwise. Lines free by the
+ * chunk report are not read.
+ */
+void pblk_inst_lines_classify(struct pblk_inst *inst)
+{
+	for (int i = 0; i < inst->nlines; ++i) {
+		struct pblk_line *line = &inst->lines[i];
+		const int smeta_read = pblk_inst_line_smeta_read(inst, i);
+		const int emeta_read = pblk_inst_line_emeta_read(inst, i);
+
+		if (inst->line_states[i] == PBLK_LINE_STATE_BAD)
+			continue;
+
+		if (inst->line_flags[i] & PBLK_LINE_FLAG_SMETA_SKIPPED) {
+			inst->line_states[i] = PBLK_LINE_STATE_FREE;
+			continue;
+		}
+
+		if (!smeta_read) {
+			if (line->smeta_ret.result == PBLK_DEV_RESULT_EMPTY)
+				inst->line_states[i] = PBLK_LINE_STATE_FREE;
+			else
+				inst->line_states[i] =
+						PBLK_LINE_STATE_UNREADABLE;
+			continue;
+		}
+
+		if (pblk_line_smeta_hdr_check(&line->smeta)) {
+			if (pblk_buf_erased(&line->smeta, sizeof(line->smeta)))
+				inst->line_states[i] = PBLK_LINE_STATE_FREE;
+			else
+				inst->line_states[i] = PBLK_LINE_STATE_CORRUPT;
+			continue;
+		}
+
+		inst->line_seq_nrs[i] = line->smeta.seq_nr;
+
+		if (emeta_read)
+			inst->line_states[i] = PBLK_LINE_STATE_CLOSED;
+		else
+			inst->line_states[i] = PBLK_LINE_STATE_OPEN;
+	}
+}
+
+// Max. number of lines in a unit of work of the line-meta scan
+#define PBLK_SCAN_UNIT_NLINES 512
+
+/**
+ * Unit of work of the line-meta scan: lines of an instance having their smeta
+ * on the same LUN, their emeta is striped across the good LUNs of each line
+ */
+struct pblk_scan_unit {
+	struct pblk_inst *inst;
+	int tlun;				///< LUN holding the smeta
+	int ch;					///< Channel of the LUN
+	int nlines;				///< Number of lines in unit
+	int *lines;				///< Line indexes
+	int claimed;				///< Set by the worker taking it
+};
+
+struct pblk_scan_key {
+	int tlun;
+	int line;
+};
+
+static int pblk_scan_key_cmp(const void *a, const void *b)
+{
+	const struct pblk_scan_key *ka = a;
+	const struct pblk_scan_key *kb = b;
+
+	if (ka->tlun != kb->tlun)
+		return ka->tlun - kb->tlun;
+
+	return ka->line - kb->line;
+}
+
+/**
+ * Read the smeta of the lines of the given unit, and then the emeta of the
+ * lines having an smeta with a valid header, unless open by the chunk report.
+ * Free lines, which on a lightly used device are most lines, thus cost a
+ * single read, or none given a chunk report.
+ *
+ * Lines taken from a snapshot keep their emeta from it when their smeta still
+ * carries the id and seq_nr of the snapshot. Otherwise the line was erased,
+ * and possibly rewritten, since the snapshot, and it is read as any other.
+ */
+static void pblk_scan_unit_run(struct pblk_scan *scan,
+			       struct pblk_scan_unit *unit)
+{
+	struct pblk_inst *inst = unit->inst;
+
+	for (int i = 0; i < unit->nlines; ++i) {
+		struct pblk_line *line = &inst->lines[unit->lines[i]];
+
+		pblk_scan_add(scan, line->smeta_addr, &line->smeta_ret,
+			      pblk_smeta_cb, &line->smeta);
+	}
+	pblk_scan_flush(scan);
+
+	for (int i = 0; i < unit->nlines; ++i) {
+		const int id = unit->lines[i];
+		struct pblk_line *line = &inst->lines[id];
+		uint8_t *flags = &inst->line_flags[id];
+
+		if (*flags & PBLK_LINE_FLAG_CACHED) {
+			if (pblk_inst_line_smeta_read(inst, id) &&
+			    (!pblk_line_smeta_hdr_check(&line->smeta)) &&
+			    (line->smeta.header.id == (uint32_t)id) &&
+			    (line->smeta.seq_nr == inst->line_seq_nrs[id]))
+				continue;
+
+			*flags = 0;
+			memset(&line->emeta, 0, sizeof(line->emeta));
+			memset(&line->emeta_ret, 0, sizeof(line->emeta_ret));
+		}
+
+		if (line->smeta_ret.status || line->smeta_ret.result ||
+		    pblk_line_smeta_hdr_check(&line->smeta))
+			*flags |= PBLK_LINE_FLAG_EMETA_SKIPPED;
+		if (*flags & PBLK_LINE_FLAG_EMETA_SKIPPED)
+			continue;
+
+		pblk_scan_add(scan, line->emeta_addr, &line->emeta_ret,
+			      pblk_emeta_cb, &line->emeta);
+	}
+	pblk_scan_flush(scan);
+}
+
+static inline int pblk_scan_unit_claim(struct pblk_scan_unit *unit)
+{
+	return !__atomic_exchange_n(&unit->claimed, 1, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * Read smeta of all lines of all instances, and emeta of those with a valid
+ * smeta header, except for lines taken from a snapshot
+ *
+ * Lines are grouped into units by the LUN holding their smeta, and the units
+ * are processed by `pblk->jobs` workers, each with its own scan-engine and
+ * thereby DMA buffers. A worker first processes the units on the channels it
+ * is pinned to, then helps out with units of other channels. The pinning thus
+ * applies to smeta reads only, emeta reads are not LUN-local as emeta is
+ * striped onto the good LUNs of its line. The result of every read is stored
+ * in its line, thus the order of lines is unaffected.
+ */
+static int pblk_scan_lines(struct pblk *pblk)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	struct pblk_scan_unit *units = NULL;
+	struct pblk_scan_key *keys = NULL;
+	int *lines = NULL;
+	size_t nunits = 0;
+	size_t nlines = 0;
+	int jobs = pblk->jobs;
+	int err = 0;
+
+	for (int i = 0; i < pblk->ninsts; ++i)
+		nlines += pblk->insts[i].nlines;
+
+	units = malloc(sizeof(*units) * (nlines + 1));
+	keys = malloc(sizeof(*keys) * (nlines + 1));
+	lines = malloc(sizeof(*lines) * (nlines + 1));
+	if (!(units && keys && lines)) {
+		errno = ENOMEM;
+		err = -1;
+		goto scan_exit;
+	}
+
+	nlines = 0;
+	for (int i = 0; i < pblk->ninsts; ++i) {
+		struct pblk_inst *inst = &pblk->insts[i];
+		size_t nkeys = 0;
+
+		for (int j = 0; j < inst->nlines; ++j) {
+			struct pblk_line *line = &inst->lines[j];
+
+			if (inst->line_states[j] == PBLK_LINE_STATE_BAD)
+				continue;
+			if (inst->line_flags[j] & PBLK_LINE_FLAG_SMETA_SKIPPED)
+				continue;
+
+			keys[nkeys].tlun = line->smeta_addr.g.ch * geo->nluns +
+					   line->smeta_addr.g.lun;
+			keys[nkeys].line = j;
+			++nkeys;
+		}
+
+		qsort(keys, nkeys, sizeof(*keys), pblk_scan_key_cmp);
+
+		for (size_t k = 0; k < nkeys; ++k) {
+			struct pblk_scan_unit *unit = &units[nunits];
+
+			if (!k || (keys[k].tlun != unit[-1].tlun) ||
+			    (unit[-1].nlines == PBLK_SCAN_UNIT_NLINES)) {
+				unit->inst = inst;
+				unit->tlun = keys[k].tlun;
+				unit->ch = keys[k].tlun / geo->nluns;
+				unit->nlines = 0;
+				unit->lines = &lines[nlines];
+				unit->claimed = 0;
+				++nunits;
+			}
+
+			units[nunits - 1].lines[units[nunits - 1].nlines++] = \
+								keys[k].line;
+			++nlines;
+		}
+	}
+
+	if ((jobs < 1) || (nunits < 2))
+		jobs = 1;
+
+#ifdef _OPENMP
+	#pragma omp parallel num_threads(jobs)
+#endif
+	{
+		struct pblk_scan scan;
+		int tid = 0;
+		int nthreads = 1;
+
+#ifdef _OPENMP
+		tid = omp_get_thread_num();
+		nthreads = omp_get_num_threads();
+#endif
+
+		if (pblk_scan_init(&scan, pblk->dev, pblk->qd, pblk->bufs,
+				   pblk->aio_pool)) {
+			__atomic_store_n(&err, -1, __ATOMIC_RELAXED);
+		} else {
+			for (size_t u = 0; u < nunits; ++u) {
+				if ((units[u].ch % nthreads) != tid)
+					continue;
+				if (pblk_scan_unit_claim(&units[u]))
+					pblk_scan_unit_run(&scan, &units[u]);
+			}
+			for (size_t u = 0; u < nunits; ++u) {
+				if (pblk_scan_unit_claim(&units[u]))
+					pblk_scan_unit_run(&scan, &units[u]);
+			}
+
+			pblk_scan_term(&scan);
+		}
+	}
+
+	for (size_t u = 0; u < nunits; ++u) {
+		if (!units[u].claimed) {	// All workers failed to init
+			errno = ENOMEM;
+			err = -1;
+		}
+	}
+
+scan_exit:
+	free(units);
+	free(keys);
+	free(lines);
+
+	return err;
+}
+
+/**
+ * Skip the reads the chunk report makes needless on the lines of the given
+ * instance, except for lines taken from a snapshot: lines whose good blocks
+ * are all free are not read, and the emeta of lines with a block not yet
+ * closed is not read
+ */
+static void pblk_inst_lines_rprt(struct pblk *pblk, struct pblk_inst *inst)
+{
+	for (int i = 0; i < inst->nlines; ++i) {
+		int nfree = 0, nclosed = 0, nopen = 0;
+
+		if (inst->line_states[i] == PBLK_LINE_STATE_BAD)
+			continue;
+		if (inst->line_flags[i] & PBLK_LINE_FLAG_CACHED)
+			continue;
+
+		for (int vlun = 0; vlun < inst->nluns; ++vlun) {
+			if (pblk_inst_blk_bad(inst, vlun, i))
+				continue;
+
+			switch (pblk_inst_chunk(pblk, inst, vlun, i)->state) {
+			case PBLK_DEV_CHUNK_FREE:
+				++nfree;
+				break;
+			case PBLK_DEV_CHUNK_CLOSED:
+				++nclosed;
+				break;
+			case PBLK_DEV_CHUNK_OPEN:
+				++nopen;
+				break;
+			}
+		}
+
+		if (!(nopen || nclosed))
+			inst->line_flags[i] |= PBLK_LINE_FLAG_SMETA_SKIPPED |
+					       PBLK_LINE_FLAG_EMETA_SKIPPED;
+		else if (nopen || nfree)
+			inst->line_flags[i] |= PBLK_LINE_FLAG_EMETA_SKIPPED;
+	}
+}
+
+/**
+ * Fetch the chunk report of the device into `pblk->chunks`, when enabled and
+ * supported, otherwise lines are classified by reading them
+ */
+static void pblk_lines_rprt(struct pblk *pblk)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+
+	free(pblk->chunks);
+	pblk->chunks = NULL;
+
+	if (!pblk->chunk_rprt)
+		return;
+
+	pblk->chunks = malloc(pblk->tluns * geo->nblocks *
+			      sizeof(*pblk->chunks));
+	if (!pblk->chunks)
+		return;
+
+	if (pblk_dev_chunk_rprt(pblk->dev, pblk->chunks, NULL)) {
+		free(pblk->chunks);
+		pblk->chunks = NULL;
+		return;
+	}
+
+	for (int i = 0; i < pblk->ninsts; ++i) {
+		if (pblk->insts[i].lines)
+			pblk_inst_lines_rprt(pblk, &pblk->insts[i]);
+	}
+}
+
+static int pblk_init_lines_from(struct pblk *pblk,
+				const struct pblk_snap *snap, int *nreused)
+{
+	double t_bgn;
+	int err = 0;
+
+	for (int i = 0; i < pblk->ninsts; ++i) {
+		if (pblk_inst_lines_setup(pblk, &pblk->insts[i]))
+			err = -1;
+	}
+
+	for (int i = 0; snap && (i < pblk->ninsts); ++i) {
+		if (pblk->insts[i].lines)
+			pblk_snap_apply(snap, &pblk->insts[i]);
+	}
+
+	pblk_lines_rprt(pblk);
+
+	if (pblk_scan_lines(pblk)) {
+		for (int i = 0; i < pblk->ninsts; ++i)
+			pblk_inst_lines_free(&pblk->insts[i]);
+		return -1;
+	}
+
+	t_bgn = pblk_ts();
+	for (int i = 0; i < pblk->ninsts; ++i)
+		pblk_inst_lines_classify(&pblk->insts[i]);
+	pblk->classify_sec = pblk_ts() - t_bgn;
+
+	// The scan drops lines taken from the snapshot which have changed
+	for (int i = 0; snap && (i < pblk->ninsts); ++i) {
+		const struct pblk_inst *inst = &pblk->insts[i];
+
+		for (int j = 0; inst->lines && (j < inst->nlines); ++j)
+			*nreused += !!(inst->line_flags[j] &
+				       PBLK_LINE_FLAG_CACHED);
+	}
+
+	return err;
+}
+
+/**
+ * Scan for line meta of all instances of the given pblk, using `pblk->jobs`
+ * worker threads, each with `pblk->qd` commands in-flight per LUN
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error. Instances which could not be scanned have no lines.
+ */
+int pblk_init_lines(struct pblk *pblk)
+{
+	return pblk_init_lines_from(pblk, NULL, NULL);
+}
+
+/**
+ * Scan for line meta of all instances of the given pblk as `pblk_init_lines`
+ * does, but take the meta of lines which cannot have changed from the given
+ * snapshot, see `pblk_snap_apply`
+ *
+ * @returns On success, 0 is returned and the number of lines taken from the
+ * snapshot stored in `nreused`. On error, -1 is returned and errno set to
+ * indicate the error.
+ */
+int pblk_init_lines_incr(struct pblk *pblk, const struct pblk_snap *snap,
+			 int *nreused)
+{
+	*nreused = 0;
+
+	return pblk_init_lines_from(pblk, snap, nreused);
+}
+
+/**
+ * Release the storage of the given instance, the instance itself is not freed
+ */
+void pblk_term_instance(struct pblk_inst *inst)
+{
+	if (!inst)
+		return;
+
+	pblk_inst_lines_free(inst);
+	pblk_inst_maps_term(inst);
+	free(inst->line_good);
+	free(inst->luns);
+	inst->line_good = NULL;
+	inst->luns = NULL;
+	inst->nluns = 0;
+}
+
+int pblk_init_instance(struct pblk_inst *inst, int lun_bgn, int lun_end,
+		       struct pblk *pblk)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	struct pblk_bbt_map *map = NULL;
+	struct nvm_addr iaddr = { 0 };
+
+	iaddr.g.ch = lun_bgn / geo->nluns;
+
+	if ((lun_bgn < 0) || (lun_end >= pblk->tluns) || (lun_bgn > lun_end)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	inst->nluns = (lun_end - lun_bgn) + 1;
+	inst->lun_bgn = lun_bgn;
+	inst->lun_end = lun_end;
+
+	size_t vnchannels = inst->nluns / geo->nluns;
+
+	if (!vnchannels) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pblk_bbt_map_init(pblk))
+		return -1;
+	map = pblk->bbt_map;
+
+	inst->nwords = (inst->nluns + 63) / 64;
+	inst->luns = calloc(inst->nluns, sizeof(*inst->luns));
+	inst->line_good = calloc((size_t)map->nlines * inst->nwords,
+				 sizeof(*inst->line_good));
+	if (!(inst->luns && inst->line_good)) {
+		pblk_term_instance(inst);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (int vlun = 0; vlun < inst->nluns; ++vlun) {
+		size_t ch = vlun % vnchannels;
+		size_t lun = (vlun / vnchannels) % geo->nluns;
+
+		inst->luns[vlun] = iaddr;
+		inst->luns[vlun].g.ch += ch;
+		inst->luns[vlun].g.lun = lun;
+	}
+
+	// Project the good LUNs of the device onto the stripe order
+	for (int line = 0; line < map->nlines; ++line) {
+		const uint64_t *good = &map->good[line * map->nwords];
+		uint64_t *igood = &inst->line_good[line * inst->nwords];
+
+		for (int vlun = 0; vlun < inst->nluns; ++vlun) {
+			const int tlun = inst->luns[vlun].g.ch * geo->nluns +
+					 inst->luns[vlun].g.lun;
+
+			if (good[tlun / 64] & (1ULL << (tlun % 64)))
+				igood[vlun / 64] |= 1ULL << (vlun % 64);
+		}
+	}
+
+	if (pblk_inst_maps_init(inst, map->nlines)) {
+		pblk_term_instance(inst);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Initialize an instance covering LUNs [lun_bgn, lun_end] and append it to the
+ * instances of the given pblk, growing the instance array as needed
+ *
+ * @returns On success, a pointer to the added instance is returned. On error,
+ * NULL is returned and errno set to indicate the error.
+ */
+struct pblk_inst *pblk_add_instance(struct pblk *pblk, int lun_bgn,
+				    int lun_end)
+{
+	struct pblk_inst *inst;
+
+	if (pblk->ninsts == pblk->ninsts_max) {
+		int ninsts_max = pblk->ninsts_max ? pblk->ninsts_max * 2 : 4;
+		struct pblk_inst *insts;
+
+		insts = realloc(pblk->insts, ninsts_max * sizeof(*insts));
+		if (!insts) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		pblk->insts = insts;
+		pblk->ninsts_max = ninsts_max;
+	}
+
+	inst = &pblk->insts[pblk->ninsts];
+	memset(inst, 0, sizeof(*inst));
+
+	if (pblk_init_instance(inst, lun_bgn, lun_end, pblk))
+		return NULL;
+
+	++(pblk->ninsts);
+
+	return inst;
+}
+
+/**
+ * Read the first sector of the given LUNs, in vectored commands with
+ * `pblk->qd` in-flight
+ */
+static int pblk_instances_probe(struct pblk *pblk, const int *tluns,
+				int ntluns, struct pblk_line_smeta *smetas,
+				struct nvm_ret *rets)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	struct pblk_scan scan;
+
+	if (pblk_scan_init(&scan, pblk->dev, pblk->qd, pblk->bufs,
+			   pblk->aio_pool))
+		return -1;
+
+	for (int i = 0; i < ntluns; ++i) {
+		const int tlun = tluns[i];
+		struct nvm_addr lun_addr = { 0 };
+
+		lun_addr.g.lun = tlun % geo->nluns;
+		lun_addr.g.ch = (tlun / geo->nluns) % geo->nchannels;
+
+		pblk_scan_add(&scan, lun_addr, &rets[tlun], pblk_smeta_cb,
+			      &smetas[tlun]);
+	}
+	pblk_scan_term(&scan);
+
+	pblk->nprobes += ntluns;
+
+	return 0;
+}
+
+static inline int pblk_instances_probe_ok(struct pblk_line_smeta *smeta,
+					  const struct nvm_ret *ret)
+{
+	if (ret->status || ret->result)
+		return 0;
+
+	return !pblk_line_smeta_hdrf_check(smeta);
+}
+
+/**
+ * Add the instances found by the probes, in channel order, an instance starts
+ * at the channel of the first probed LUN holding a valid header and covers
+ * `window_wr_lun` LUNs, the channels it covers are skipped
+ *
+ * @returns The number of channels neither covered nor holding a header
+ */
+static int pblk_instances_add_probed(struct pblk *pblk,
+				     struct pblk_line_smeta *smetas,
+				     const struct nvm_ret *rets,
+				     const uint8_t *probed, uint8_t *covered)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	int nuncovered = 0;
+
+	for (size_t ch = 0; ch < geo->nchannels; ++ch) {
+		const int lun_bgn = ch * geo->nluns;
+		int tlun = -1;
+
+		if (covered[ch])
+			continue;
+
+		for (size_t lun = 0; lun < geo->nluns; ++lun) {
+			const int cand = lun_bgn + lun;
+
+			if (probed[cand] &&
+			    pblk_instances_probe_ok(&smetas[cand],
+						    &rets[cand])) {
+				tlun = cand;
+				break;
+			}
+		}
+
+		if ((tlun < 0) ||
+		    (!pblk_add_instance(pblk, lun_bgn,
+					(lun_bgn + smetas[tlun].window_wr_lun)
+					- 1))) {
+			++nuncovered;
+			continue;
+		}
+
+		for (size_t c = ch;
+		     (c < geo->nchannels) &&
+		     (c * geo->nluns < lun_bgn + smetas[tlun].window_wr_lun);
+		     ++c)
+			covered[c] = 1;
+	}
+
+	return nuncovered;
+}
+
+/**
+ * Initialize a pblk struct by scanning given device for instances
+ *
+ * Unless PBLK_INSTANCES_PROBE_ALL is given, the first LUN of every channel is
+ * probed, and the channels covered by the `window_wr_lun` of the instances
+ * found are skipped. Only for channels left are the remaining LUNs probed,
+ * thus a device fully covered by instances costs a read per channel. Probes
+ * are issued together, thus they run concurrently with `pblk->qd` > 1.
+ *
+ * NOTE: This does not take bbt info into account
+ */
+int pblk_init_instances(struct pblk *pblk, int flags)
+{
+	int err = 0;
+
+	struct pblk_dev *dev = pblk->dev;
+	const struct nvm_geo *geo = pblk_dev_get_geo(dev);
+
+	struct pblk_line_smeta *smetas = NULL;
+	struct nvm_ret *rets = NULL;
+	uint8_t *probed = NULL;
+	uint8_t *covered = NULL;
+	int *tluns = NULL;
+	int ntluns = 0;
+
+	pblk->tluns = geo->nchannels * geo->nluns;
+	pblk->nprobes = 0;
+
+	smetas = calloc(pblk->tluns, sizeof(*smetas));
+	rets = calloc(pblk->tluns, sizeof(*rets));
+	probed = calloc(pblk->tluns, sizeof(*probed));
+	covered = calloc(geo->nchannels, sizeof(*covered));
+	tluns = calloc(pblk->tluns, sizeof(*tluns));
+	if (!(smetas && rets && probed && covered && tluns)) {
+		errno = ENOMEM;
+		err = -1;
+		goto scan_exit;
+	}
+
+	if (flags & PBLK_INSTANCES_PROBE_ALL) {
+		// Read the first sector of all LUNs
+		for (int tlun = 0; tlun < pblk->tluns; ++tlun)
+			tluns[ntluns++] = tlun;
+
+		if (pblk_instances_probe(pblk, tluns, ntluns, smetas, rets)) {
+			err = -1;
+			goto scan_exit;
+		}
+
+		// TODO: This should account for bbt-info but it will only fail
+		// if all LUNs on the channel have died, due to the
+		// non-channel-sharing assumption of pblk-instances
+		for (int tlun = 0; tlun < pblk->tluns; ++tlun) {
+			struct pblk_line_smeta *smeta = &smetas[tlun];
+			int lun_bgn, lun_end;
+
+			if (!pblk_instances_probe_ok(smeta, &rets[tlun]))
+				continue;
+
+			lun_bgn = (tlun / geo->nluns) * geo->nluns;
+			lun_end = (lun_bgn + smeta->window_wr_lun) - 1;
+			if (!pblk_add_instance(pblk, lun_bgn, lun_end))
+				continue;
+		}
+
+		goto scan_exit;
+	}
+
+	// Read the first sector of the first LUN of all channels
+	for (size_t ch = 0; ch < geo->nchannels; ++ch) {
+		const int tlun = ch * geo->nluns;
+
+		tluns[ntluns++] = tlun;
+		probed[tlun] = 1;
+	}
+	if (pblk_instances_probe(pblk, tluns, ntluns, smetas, rets)) {
+		err = -1;
+		goto scan_exit;
+	}
+
+	if (!pblk_instances_add_probed(pblk, smetas, rets, probed, covered))
+		goto scan_exit;
+
+	// Read the first sector of the other LUNs of the channels left
+	ntluns = 0;
+	for (size_t ch = 0; ch < geo->nchannels; ++ch) {
+		if (covered[ch])
+			continue;
+
+		for (size_t lun = 1; lun < geo->nluns; ++lun) {
+			const int tlun = ch * geo->nluns + lun;
+
+			tluns[ntluns++] = tlun;
+			probed[tlun] = 1;
+		}
+	}
+	if (pblk_instances_probe(pblk, tluns, ntluns, smetas, rets)) {
+		err = -1;
+		goto scan_exit;
+	}
+
+	pblk_instances_add_probed(pblk, smetas, rets, probed, covered);
+
+scan_exit:
+	free(smetas);
+	free(rets);
+	free(probed);
+	free(covered);
+	free(tluns);
+
+	return err;
+}
+
+/**
+ * Initialize a buffer pool with slab classes for the commands and meta of a
+ * device of the given geometry: vectored commands of single sectors, and the
+ * meta of a line spanning all LUNs, sized by its emeta, the largest an
+ * instance can have. smeta is read into that buffer, thus has no class.
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_bufs_init(struct pblk_buf_pool *pool, const struct nvm_geo *geo)
+{
+	const int tluns = geo->nchannels * geo->nluns;
+	const size_t sec_per_pl = pblk_geo_sec_per_pl(geo);
+	size_t bufs_nbytes[2];
+	size_t emeta_nsec;
+
+	bufs_nbytes[0] = NVM_NADDR_MAX * geo->sector_nbytes;
+	emeta_nsec = (sizeof(struct pblk_line_emeta) + sec_per_pl *
+		      geo->npages * tluns * sizeof(uint64_t) +
+		      geo->sector_nbytes - 1) / geo->sector_nbytes;
+	emeta_nsec = ((emeta_nsec + sec_per_pl - 1) / sec_per_pl) * sec_per_pl;
+	if (emeta_nsec < pblk_geo_smeta_nsec(geo))
+		emeta_nsec = pblk_geo_smeta_nsec(geo);
+	bufs_nbytes[1] = emeta_nsec * geo->sector_nbytes;
+
+	if (bufs_nbytes[1] < bufs_nbytes[0])
+		bufs_nbytes[1] = bufs_nbytes[0];
+
+	return pblk_buf_pool_init(pool, geo, bufs_nbytes, 2);
+}
+
+/**
+ * Allocate and initialize dev and tluns, the bbts are fetched when the first
+ * instance is initialized
+ *
+ * Buffers come from a pool of the pblk's own, and asynchronous scans start
+ * I/O threads of their own. The caller may point `bufs` and `aio_pool` at
+ * pools shared with other pblks instead, `bufs` of a device of the same
+ * geometry.
+ */
+struct pblk *pblk_init(struct pblk_dev *dev, int flags)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(dev);
+	struct pblk *pblk = NULL;
+
+	pblk = malloc(sizeof(*pblk));
+	if (!pblk)
+		return NULL;
+	memset(pblk, 0, sizeof(*pblk));
+
+	pblk->dev = dev;
+	pblk->jobs = 1;
+	pblk->qd = 1;
+	pblk->chunk_rprt = 1;
+	pblk->tluns = geo->nchannels * geo->nluns;
+	pblk->bufs = &pblk->bufs_own;
+
+	if (pblk_bufs_init(&pblk->bufs_own, geo)) {
+		free(pblk);
+		return NULL;
+	}
+
+	return pblk;
+}
+
+/**
+ * Release the given pblk struct and all its instances, does not close dev
+ */
+void pblk_term(struct pblk *pblk)
+{
+	if (!pblk)
+		return;
+
+	for (int i = 0; i < pblk->ninsts; ++i)
+		pblk_term_instance(&pblk->insts[i]);
+	free(pblk->insts);
+	free(pblk->chunks);
+	pblk_bbt_map_term(pblk->bbt_map);
+	pblk_buf_pool_term(&pblk->bufs_own);
+	free(pblk);
+}
+
+/**
+ * Compute the line-relative sector at which smeta of the given line begins,
+ * that is, the first page of the first good LUN in stripe order
+ *
+ * @returns On success, the first sector of smeta. On error, -1 is returned,
+ * this happens when all blocks of the line are bad.
+ */
+int64_t pblk_line_smeta_ssec(const struct pblk_inst *inst, int line_id,
+			     const struct nvm_geo *geo)
+{
+	const struct pblk_line_map *map = &inst->line_maps[line_id];
+
+	if (!map->nluns)
+		return -1;
+
+	return pblk_line_map_paddr(map, 0, geo);
+}
+
+/**
+ * Compute the line-relative sector at which emeta of the given line begins,
+ * the last good sectors of the line holding emeta
+ *
+ * @returns On success, the first sector of emeta. On error, -1 is returned,
+ * this happens when the good blocks of the line cannot hold emeta.
+ */
+int64_t pblk_line_emeta_ssec(const struct pblk_inst *inst, int line_id,
+			     const struct nvm_geo *geo)
+{
+	const int64_t gsec = pblk_line_emeta_gsec(inst, line_id, geo);
+
+	if (gsec < 0)
+		return -1;
+
+	return pblk_line_map_paddr(&inst->line_maps[line_id], gsec, geo);
+}
+
+void pblk_meta_rd_term(struct pblk_meta_rd *rd)
+{
+	if (rd->rets)
+		pblk_scan_term(&rd->scan);
+	pblk_buf_put(rd->buf);
+	free(rd->rets);
+	free(rd->addrs);
+	memset(rd, 0, sizeof(*rd));
+}
+
+int pblk_meta_rd_init(struct pblk_meta_rd *rd, struct pblk *pblk,
+		      struct pblk_inst *inst)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+
+	memset(rd, 0, sizeof(*rd));
+
+	rd->inst = inst;
+	rd->pool = pblk->bufs;
+	rd->nsec = pblk_inst_emeta_nsec(inst, geo);
+	if (rd->nsec < pblk_geo_smeta_nsec(geo))
+		rd->nsec = pblk_geo_smeta_nsec(geo);
+
+	rd->buf = pblk_buf_get(rd->pool, rd->nsec * geo->sector_nbytes);
+	if (!rd->buf)
+		return -1;
+
+	rd->rets = malloc(sizeof(*rd->rets) * rd->nsec);
+	rd->addrs = malloc(sizeof(*rd->addrs) * rd->nsec);
+	if (!(rd->rets && rd->addrs)) {
+		pblk_meta_rd_term(rd);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (pblk_scan_init(&rd->scan, pblk->dev, pblk->qd, pblk->bufs,
+			   pblk->aio_pool)) {
+		free(rd->rets);
+		rd->rets = NULL;
+		pblk_meta_rd_term(rd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Read `nsec` good sectors of the given line in place into `rd->buf`, starting
+ * at good sector `gsec` and striped over the good LUNs as the line map gives
+ * them. When views of the buffer are held, the sectors are read into another
+ * buffer.
+ */
+static int pblk_meta_rd_secs(struct pblk_meta_rd *rd, int line_id,
+			     int64_t gsec, size_t nsec,
+			     const struct nvm_geo *geo)
+{
+	const struct pblk_line_map *map = &rd->inst->line_maps[line_id];
+	size_t nread;
+
+	if ((gsec < 0) || (nsec > rd->nsec)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pblk_buf_shared(rd->buf)) {
+		struct pblk_buf *buf = pblk_buf_get(rd->pool, rd->buf->nbytes);
+
+		if (!buf)
+			return -1;
+		pblk_buf_put(rd->buf);
+		rd->buf = buf;
+	}
+
+	rd->nbytes = nsec * geo->sector_nbytes;
+	nread = pblk_line_map_addrs(map, gsec, nsec, rd->addrs, geo);
+	for (size_t i = 0; i < nread; ++i) {
+		pblk_scan_add_dst(&rd->scan, rd->addrs[i], &rd->rets[i],
+				  rd->buf->data + i * geo->sector_nbytes);
+	}
+	pblk_scan_flush(&rd->scan);
+
+	// Sectors past the end of the line are not read, clear them only
+	memset(rd->buf->data + nread * geo->sector_nbytes, 0,
+	       (nsec - nread) * geo->sector_nbytes);
+
+	for (size_t i = 0; i < nread; ++i) {
+		if (rd->rets[i].status || rd->rets[i].result) {
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Read the complete smeta of the given line into `rd->buf`
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error. Errors are: EINVAL when all blocks of the line are
+ * bad, EIO when any of the smeta sectors failed to read.
+ */
+int pblk_meta_rd_smeta(struct pblk_meta_rd *rd, int line_id,
+		       const struct nvm_geo *geo)
+{
+	return pblk_meta_rd_secs(rd, line_id,
+				 rd->inst->line_maps[line_id].nluns ? 0 : -1,
+				 pblk_geo_smeta_nsec(geo), geo);
+}
+
+/**
+ * Read the complete emeta of the given line into `rd->buf`
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error. Errors are: EINVAL when the line cannot hold emeta,
+ * EIO when any of the emeta sectors failed to read.
+ */
+int pblk_meta_rd_emeta(struct pblk_meta_rd *rd, int line_id,
+		       const struct nvm_geo *geo)
+{
+	return pblk_meta_rd_secs(rd, line_id,
+				 pblk_line_emeta_gsec(rd->inst, line_id, geo),
+				 pblk_inst_emeta_nsec(rd->inst, geo), geo);
+}
+
+int pblk_l2p_init(struct pblk_l2p *l2p, uint64_t nlbas)
+{
+	memset(l2p, 0, sizeof(*l2p));
+
+	l2p->nlbas = nlbas;
+	l2p->npages = (nlbas + PBLK_L2P_PAGE_NENTS - 1) / PBLK_L2P_PAGE_NENTS;
+	l2p->pages = calloc(l2p->npages ? l2p->npages : 1,
+			    sizeof(*l2p->pages));
+	if (!l2p->pages) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return 0;
+}
+
+void pblk_l2p_term(struct pblk_l2p *l2p)
+{
+	for (size_t i = 0; i < l2p->npages; ++i)
+		free(l2p->pages[i]);
+	free(l2p->pages);
+	memset(l2p, 0, sizeof(*l2p));
+}
+
+/**
+ * Apply the lba-list of the given emeta view to the L2P, the i'th entry of
+ * the list is the LBA written to line-relative sector i
+ */
+int pblk_l2p_apply(struct pblk_l2p *l2p, const struct pblk_inst *inst,
+		   int line_id, const struct pblk_emeta_view *view,
+		   const struct nvm_geo *geo, struct pblk_l2p_line_stat *stat)
+{
+	const struct pblk_line_map *map = &inst->line_maps[line_id];
+	const uint64_t nsec = pblk_line_map_nsec(map, geo);
+
+	memset(stat, 0, sizeof(*stat));
+
+	for (uint64_t gsec = 0; gsec < nsec; ++gsec) {
+		const uint64_t paddr = pblk_line_map_paddr(map, gsec, geo);
+		uint64_t lba;
+
+		if (paddr >= view->nlbas)
+			break;
+
+		lba = view->lbas[paddr];
+		if (lba == PBLK_ADDR_EMPTY)
+			continue;
+
+		++(stat->nlbas);
+		if (lba >= l2p->nlbas) {
+			++(stat->nrange);
+			continue;
+		}
+		if (pblk_l2p_get(l2p, lba) != PBLK_ADDR_EMPTY)
+			++(stat->nupdated);
+
+		if (pblk_l2p_set(l2p, lba,
+				 pblk_line_map_addr(map, gsec, geo).ppa))
+			return -1;
+	}
+
+	return 0;
+}
+
+struct pblk_line_seq_key {
+	uint64_t seq_nr;
+	int line;
+};
+
+/**
+ * Ordering of lines by seq_nr, ties are broken by line id
+ */
+static int pblk_line_seq_key_cmp(const void *a, const void *b)
+{
+	const struct pblk_line_seq_key *ka = a;
+	const struct pblk_line_seq_key *kb = b;
+
+	if (ka->seq_nr != kb->seq_nr)
+		return ka->seq_nr < kb->seq_nr ? -1 : 1;
+
+	return ka->line - kb->line;
+}
+
+/**
+ * Get the ids of the closed lines of the given instance ordered by seq_nr
+ *
+ * @returns On success, an array of `*nlines` line ids which must be freed by
+ * the caller. On error, NULL is returned and errno set to indicate the error.
+ */
+int *pblk_inst_lines_by_seq(struct pblk_inst *inst, int *nlines)
+{
+	struct pblk_line_seq_key *keys = NULL;
+	int *lines = NULL;
+
+	keys = malloc(sizeof(*keys) * (inst->nlines + 1));
+	lines = malloc(sizeof(*lines) * (inst->nlines + 1));
+	if (!(keys && lines)) {
+		free(keys);
+		free(lines);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	*nlines = 0;
+	for (int i = 0; i < inst->nlines; ++i) {
+		if (inst->line_states[i] != PBLK_LINE_STATE_CLOSED)
+			continue;
+
+		keys[*nlines].seq_nr = inst->line_seq_nrs[i];
+		keys[*nlines].line = i;
+		++(*nlines);
+	}
+
+	qsort(keys, *nlines, sizeof(*keys), pblk_line_seq_key_cmp);
+
+	for (int i = 0; i < *nlines; ++i)
+		lines[i] = keys[i].line;
+
+	free(keys);
+
+	return lines;
+}
+
@@ -0,0 +1,1024 @@
+#ifndef __PBLK_H
+#define __PBLK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <liblightnvm.h>
+#include <pblk_crc.h>
+#include <pblk_dev.h>
+#include <pblk_buf.h>
+
+#define PBLK_META_VER 0x1
+#define PBLK_META_IDENT 0x70626c6b
+#define PBLK_ADDR_EMPTY (~0ULL)
+
+enum pblk_line_type {
+	PBLK_LINETYPE_FREE = 0,
+	PBLK_LINETYPE_LOG = 1,
+	PBLK_LINETYPE_DATA = 2,
+};
+
+const char *pblk_line_type_str(int ltype);
+
+struct pblk_line_header {
+	uint32_t crc;
+	uint32_t identifier;
+	uint32_t uuid[4];
+	uint16_t type;
+	uint16_t version;
+	uint32_t id;
+};
+
+struct pblk_line_smeta {
+	struct pblk_line_header header;
+	uint32_t crc;
+	uint32_t prev_id;
+	uint64_t seq_nr;
+	uint32_t window_wr_lun;
+	uint32_t rsvd[2];
+};
+
+struct pblk_line_emeta {
+	struct pblk_line_header header;
+	uint32_t crc;
+	uint32_t prev_id;
+	uint64_t seq_nr;
+	uint32_t window_wr_lun;
+	uint32_t next_id;
+	uint64_t nr_lbas;
+	uint64_t lbas[];
+};
+
+enum pblk_line_state {
+	PBLK_LINE_STATE_UNKNOWN = 0x0,		///< Not scanned
+	PBLK_LINE_STATE_OPEN = 0x1,
+	PBLK_LINE_STATE_FREE = 0x1 << 1,	///< smeta sector erased
+	PBLK_LINE_STATE_CLOSED = 0x1 << 2,
+	PBLK_LINE_STATE_BAD = 0x1 << 3,
+	PBLK_LINE_STATE_CORRUPT = 0x1 << 4,	///< smeta written, header invalid
+	PBLK_LINE_STATE_UNREADABLE = 0x1 << 5,	///< smeta read failed
+};
+
+const char *pblk_line_state_str(int lstate);
+
+/**
+ * Flags of a line, beyond its state, kept in snapshots
+ */
+enum pblk_line_flag {
+	PBLK_LINE_FLAG_CACHED = 0x1,		///< Meta taken from snapshot
+	PBLK_LINE_FLAG_CRC_CHECKED = 0x1 << 1,	///< CRC of meta verified
+	PBLK_LINE_FLAG_SMETA_CRC_BAD = 0x1 << 2,
+	PBLK_LINE_FLAG_EMETA_CRC_BAD = 0x1 << 3,
+	PBLK_LINE_FLAG_EMETA_SKIPPED = 0x1 << 4,	///< emeta not read
+	PBLK_LINE_FLAG_SMETA_SKIPPED = 0x1 << 5,	///< Free by chunk report
+};
+
+/**
+ * Meta of a line as read from the device, the id of a line is its index in
+ * `pblk_inst.lines` and its state is kept in `pblk_inst.line_states`
+ */
+struct pblk_line {
+	struct pblk_line_smeta smeta;
+	struct nvm_addr smeta_addr;
+	struct nvm_ret smeta_ret;
+
+	struct pblk_line_emeta emeta;
+	struct nvm_addr emeta_addr;
+	struct nvm_ret emeta_ret;
+};
+
+/**
+ * Map of the sectors of a line to device addresses
+ *
+ * A bad block takes its LUN out of every page of the line, the good sectors of
+ * a line are thus striped over the same good LUNs on every page. The map holds
+ * those LUNs in stripe order: good unit `i` of the line, a page across all
+ * planes, is page `i / nluns` of `luns[i % nluns]`, so consecutive good
+ * sectors spread over all good LUNs before the page advances.
+ */
+struct pblk_line_map {
+	int width;				///< LUNs in stripe, window_wr_lun
+	int nluns;				///< Good LUNs of the line
+	struct nvm_addr *luns;			///< Good LUNs, blk set to the line
+	uint16_t *vluns;			///< Stripe position of each good LUN
+};
+
+struct pblk_inst {
+	int lun_bgn;				///< LUN range begin
+	int lun_end;				///< LUN range end
+	int nluns;				///< Number of LUNs
+	struct nvm_addr *luns;			///< LUNs addresses
+	int nwords;				///< Words per line_good
+	uint64_t *line_good;			///< Good LUNs, in stripe order
+	struct pblk_line_map *line_maps;	///< Sector map of each line
+	int nlines;				///< Number of lines
+	uint8_t *line_states;			///< State of each line
+	uint8_t *line_flags;			///< Flags of each line
+	uint64_t *line_seq_nrs;			///< seq_nr of each line
+	struct pblk_line *lines;		///< Meta of each line
+};
+
+/**
+ * Good LUNs of every line of a device, built once from the bbts of all LUNs
+ *
+ * Bit `tlun` of the `nwords` words of a line is set when the block of the line
+ * is good on all planes of the LUN.
+ */
+struct pblk_bbt_map {
+	int tluns;				///< Number of LUNs
+	int nlines;				///< Number of lines
+	int nwords;				///< Words per line
+	uint64_t *good;				///< Good LUNs of each line
+	const struct nvm_bbt **bbts;		///< bbt of each LUN
+	struct nvm_bbt *cached;			///< bbts loaded from cache
+	int cached_hit;				///< Loaded from cache
+};
+
+struct pblk {
+	struct pblk_dev *dev;
+	const char *bbt_cache;			///< bbt cache dir, or NULL
+	struct pblk_bbt_map *bbt_map;		///< NULL until first used
+	int jobs;				///< Number of scan and wipe workers
+	int qd;					///< Reads in-flight per LUN
+	int chunk_rprt;				///< Use the chunk report if any
+	double classify_sec;			///< Seconds classifying last scan
+	struct pblk_dev_chunk *chunks;		///< Report of last scan, or NULL
+	int tluns;				///< Total number of luns
+	int nprobes;				///< LUNs read to find instances
+	int ninsts;				///< Number of pblk instances
+	int ninsts_max;				///< Allocated pblk instances
+	struct pblk_inst *insts;		///< pblk instances
+	struct pblk_buf_pool *bufs;		///< Buffers of commands and meta
+	struct pblk_aio_pool *aio_pool;		///< Shared I/O threads, or NULL
+	struct pblk_buf_pool bufs_own;		///< bufs unless shared
+};
+
+void pblk_instance_pr(const struct pblk_inst *inst);
+void pblk_line_header_pr(const struct pblk_line_header *header);
+void pblk_line_smeta_pr(const struct pblk_line_smeta *smeta);
+void pblk_line_emeta_pr(const struct pblk_line_emeta *emeta);
+void pblk_line_pr(const struct pblk_inst *inst, int id);
+
+int pblk_line_smeta_from_buf(char *buf, struct pblk_line_smeta *smeta);
+int pblk_line_emeta_from_buf(char *buf, struct pblk_line_emeta *emeta);
+
+int pblk_line_smeta_addr_calc(struct pblk_inst *inst, int id,
+			      const struct nvm_geo *geo);
+int pblk_line_emeta_addr_calc(struct pblk_inst *inst, int id,
+			      const struct nvm_geo *geo);
+
+/**
+ * Compute CRC of the given line_header
+ */
+static inline uint32_t pblk_line_header_crc(struct pblk_line_header *hdr)
+{
+	return pblk_crc32(0, ((unsigned char *)hdr) + sizeof(hdr->crc),
+		     sizeof(*hdr) - sizeof(hdr->crc)
+	) ^ (~(uint32_t)0);
+}
+
+/**
+ * Compute CRC of the given smeta
+ */
+static inline uint32_t pblk_line_smeta_crc(struct pblk_line_smeta *smeta,
+					   size_t len)
+{
+	return pblk_crc32(0, ((unsigned char *)smeta) +
+			sizeof(smeta->header) + sizeof(smeta->crc),
+			len -
+			sizeof(smeta->header) - sizeof(smeta->crc)
+	) ^ (~(uint32_t)0);
+}
+
+/**
+ * Compute CRC of the given emeta
+ */
+static inline uint32_t pblk_line_emeta_crc(struct pblk_line_emeta *emeta,
+					   size_t len)
+{
+	return pblk_crc32(0, ((unsigned char *)emeta) +
+			sizeof(emeta->header) + sizeof(emeta->crc),
+			len -
+			sizeof(emeta->header) - sizeof(emeta->crc)
+	) ^ (~(uint32_t)0);
+}
+
+/**
+ * Check whether the given smeta has a valid header
+ *
+ * @returns 0 When valid, some value otherwise
+ */
+static inline int pblk_line_smeta_hdr_check(struct pblk_line_smeta *smeta)
+{
+	uint32_t crc = pblk_line_header_crc(&smeta->header);
+
+	if (smeta->header.identifier != PBLK_META_IDENT)
+		return -1;
+
+	if (smeta->header.version != PBLK_META_VER)
+		return -1;
+
+	if (smeta->header.crc != crc)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Check whether the given emeta has a valid header
+ *
+ * @returns 0 When valid, some value otherwise
+ */
+static inline int pblk_line_emeta_hdr_check(struct pblk_line_emeta *emeta)
+{
+	uint32_t crc = pblk_line_header_crc(&emeta->header);
+
+	if (emeta->header.identifier != PBLK_META_IDENT)
+		return -1;
+
+	if (emeta->header.version != PBLK_META_VER)
+		return -1;
+
+	if (emeta->header.crc != crc)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Check whether the given bytes, read from a sector, are those of an erased
+ * sector, that is, all 0xff or all 0x00, as devices not reporting empty pages
+ * return either. Words are compared without branching, thus vectorized.
+ *
+ * @returns 1 When erased, 0 otherwise
+ */
+static inline int pblk_buf_erased(const void *buf, size_t nbytes)
+{
+	const unsigned char *bytes = buf;
+	uint64_t fill, diff = 0;
+	size_t i = 0;
+
+	if ((!nbytes) || ((bytes[0] != 0x00) && (bytes[0] != 0xff)))
+		return 0;
+
+	fill = bytes[0] ? ~0ULL : 0ULL;
+	for (; i + sizeof(fill) <= nbytes; i += sizeof(fill)) {
+		uint64_t word;
+
+		memcpy(&word, bytes + i, sizeof(word));
+		diff |= word ^ fill;
+	}
+	for (; i < nbytes; ++i)
+		diff |= bytes[i] ^ bytes[0];
+
+	return !diff;
+}
+
+/**
+ * Check whether the CRC of the given complete smeta of `len` bytes is valid
+ *
+ * @returns 0 When valid, some value otherwise
+ */
+static inline int pblk_line_smeta_crc_check(struct pblk_line_smeta *smeta,
+					    size_t len)
+{
+	return smeta->crc != pblk_line_smeta_crc(smeta, len);
+}
+
+/**
+ * Check whether the CRC of the given complete emeta of `len` bytes, that is,
+ * including the lba-list, is valid
+ *
+ * @returns 0 When valid, some value otherwise
+ */
+static inline int pblk_line_emeta_crc_check(struct pblk_line_emeta *emeta,
+					    size_t len)
+{
+	return emeta->crc != pblk_line_emeta_crc(emeta, len);
+}
+
+/**
+ * Check whether the given smeta has a valid "first" header
+ *
+ * @returns 0 When valid, some value otherwise
+ */
+static inline int pblk_line_smeta_hdrf_check(struct pblk_line_smeta *smeta)
+{
+	if (pblk_line_smeta_hdr_check(smeta))
+		return -1;
+
+	if (smeta->header.id != 0)
+		return -1;
+
+	if (smeta->prev_id != ~(uint32_t)0)
+		return -1;
+
+	if (smeta->seq_nr != 0)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Completion callback of a scan entry
+ *
+ * Invoked once for every address gathered by the scan-engine, with `buf`
+ * pointing to the sector read from the address and `ret` to the result of
+ * reading it, the content of `buf` is only valid when the read succeeded
+ */
+typedef void (*pblk_scan_cb)(char *buf, const struct nvm_ret *ret, void *arg);
+
+struct pblk_scan_cmd;
+struct pblk_aio;
+struct pblk_aio_pool;
+
+// Upper bound on commands, and thus on I/O threads, of an asynchronous scan
+#define PBLK_AIO_NCMDS_MAX 64
+
+struct pblk_aio_pool *pblk_aio_pool_create(int ncmds_max);
+void pblk_aio_pool_destroy(struct pblk_aio_pool *pool);
+
+/**
+ * Scan-engine gathering single-sector reads into vectored commands
+ *
+ * Addresses are added one at a time, when `naddrs_max` addresses are gathered
+ * they are read with a single command, and every address is completed with its
+ * own result. With a queue-depth larger than one, commands are read by the
+ * asynchronous backend and completions are invoked as commands complete.
+ */
+struct pblk_scan {
+	struct pblk_dev *dev;
+	const struct nvm_geo *geo;
+	int naddrs_max;				///< Max. addresses per command
+	struct pblk_scan_cmd *cmd;		///< Command being gathered
+	struct pblk_aio *aio;			///< NULL when synchronous
+	size_t ncmds;				///< Number of commands issued
+	struct pblk_buf_pool *pool;		///< Provider of command buffers
+};
+
+int pblk_scan_init(struct pblk_scan *scan, struct pblk_dev *dev, int qd,
+		   struct pblk_buf_pool *pool, struct pblk_aio_pool *aio_pool);
+void pblk_scan_flush(struct pblk_scan *scan);
+void pblk_scan_term(struct pblk_scan *scan);
+void pblk_scan_add(struct pblk_scan *scan, struct nvm_addr addr,
+		   struct nvm_ret *ret, pblk_scan_cb cb, void *arg);
+void pblk_scan_add_dst(struct pblk_scan *scan, struct nvm_addr addr,
+		       struct nvm_ret *ret, char *dst);
+
+int pblk_bbt_map_init(struct pblk *pblk);
+void pblk_bbt_map_term(struct pblk_bbt_map *map);
+
+void pblk_inst_lines_free(struct pblk_inst *inst);
+int pblk_inst_lines_alloc(struct pblk_inst *inst, int nlines);
+void pblk_inst_lines_classify(struct pblk_inst *inst);
+int pblk_init_lines(struct pblk *pblk);
+
+/**
+ * A snapshot of the lines of all instances of a device, mapped read-only
+ */
+struct pblk_snap {
+	void *map;				///< Mapping of the snapshot
+	size_t nbytes;				///< Size of the mapping
+	int ninsts;				///< Instances in the snapshot
+	uint64_t ts;				///< Time taken, epoch seconds
+};
+
+int pblk_snap_open(struct pblk_snap *snap, const char *path,
+		   const struct pblk *pblk);
+void pblk_snap_close(struct pblk_snap *snap);
+int pblk_snap_apply(const struct pblk_snap *snap, struct pblk_inst *inst);
+int pblk_snap_save(const struct pblk *pblk, const char *path);
+
+int pblk_init_lines_incr(struct pblk *pblk, const struct pblk_snap *snap,
+			 int *nreused);
+
+/**
+ * Result of wiping the blocks of a range of lines on one LUN
+ */
+struct pblk_wipe_lun {
+	int tlun;				///< LUN wiped
+	int nblks;				///< Blocks erased
+	int nblks_bad;				///< Blocks skipped, known bad
+	int nblks_failed;			///< Blocks failing to erase
+	double t_sec;				///< Time in commands of the LUN
+};
+
+/**
+ * Invoked when all blocks of a LUN are wiped, `ndone` of `nluns` are done,
+ * possibly from several workers at once
+ */
+typedef void (*pblk_wipe_cb)(const struct pblk_wipe_lun *lun, int ndone,
+			     int nluns, void *arg);
+
+int pblk_wipe(struct pblk *pblk, int lun_bgn, int lun_end, int line_bgn,
+	      int line_end, struct pblk_wipe_lun *luns, pblk_wipe_cb cb,
+	      void *cb_arg);
+
+void pblk_term_instance(struct pblk_inst *inst);
+int pblk_init_instance(struct pblk_inst *inst, int lun_bgn, int lun_end,
+		       struct pblk *pblk);
+struct pblk_inst *pblk_add_instance(struct pblk *pblk, int lun_bgn,
+				    int lun_end);
+
+enum pblk_instances_flag {
+	PBLK_INSTANCES_PROBE_ALL = 0x1,		///< Probe every LUN
+};
+
+int pblk_init_instances(struct pblk *pblk, int flags);
+
+int pblk_bufs_init(struct pblk_buf_pool *pool, const struct nvm_geo *geo);
+struct pblk *pblk_init(struct pblk_dev *dev, int flags);
+void pblk_term(struct pblk *pblk);
+
+/**
+ * Returns monotonic time in seconds
+ */
+static inline double pblk_ts(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Number of sectors written to a LUN before moving to the next LUN in stripe
+ * order, that is, a page across all planes
+ */
+static inline size_t pblk_geo_sec_per_pl(const struct nvm_geo *geo)
+{
+	return geo->nsectors * geo->nplanes;
+}
+
+/**
+ * Number of sectors in a line of the given instance, including those of bad
+ * blocks
+ */
+static inline size_t pblk_inst_sec_per_line(const struct pblk_inst *inst,
+					    const struct nvm_geo *geo)
+{
+	return pblk_geo_sec_per_pl(geo) * geo->npages * inst->nluns;
+}
+
+/**
+ * Number of sectors occupied by smeta, pblk writes it as a page across all
+ * planes
+ */
+static inline size_t pblk_geo_smeta_nsec(const struct nvm_geo *geo)
+{
+	return pblk_geo_sec_per_pl(geo);
+}
+
+/**
+ * Length in bytes of emeta, the fixed part followed by one LBA per sector of
+ * the line
+ */
+static inline size_t pblk_inst_emeta_len(const struct pblk_inst *inst,
+					 const struct nvm_geo *geo)
+{
+	return sizeof(struct pblk_line_emeta) +
+		pblk_inst_sec_per_line(inst, geo) * sizeof(uint64_t);
+}
+
+/**
+ * Number of sectors occupied by emeta, pblk rounds it up to whole pages
+ */
+static inline size_t pblk_inst_emeta_nsec(const struct pblk_inst *inst,
+					  const struct nvm_geo *geo)
+{
+	const size_t sec_per_pl = pblk_geo_sec_per_pl(geo);
+	const size_t nsec = (pblk_inst_emeta_len(inst, geo) +
+			     geo->sector_nbytes - 1) / geo->sector_nbytes;
+
+	return ((nsec + sec_per_pl - 1) / sec_per_pl) * sec_per_pl;
+}
+
+/**
+ * Check whether the block of the given line is bad on the LUN at position
+ * `vlun` in stripe order
+ */
+static inline int pblk_inst_blk_bad(const struct pblk_inst *inst, int vlun,
+				    int line_id)
+{
+	const uint64_t *good = &inst->line_good[line_id * inst->nwords];
+
+	return !(good[vlun / 64] & (1ULL << (vlun % 64)));
+}
+
+/**
+ * Check whether the smeta of the given line was read, it is not read for lines
+ * free by the chunk report
+ */
+static inline int pblk_inst_line_smeta_read(const struct pblk_inst *inst,
+					    int line_id)
+{
+	const struct nvm_ret *ret = &inst->lines[line_id].smeta_ret;
+
+	if (inst->line_flags[line_id] & PBLK_LINE_FLAG_SMETA_SKIPPED)
+		return 0;
+
+	return !(ret->status || ret->result);
+}
+
+/**
+ * Check whether the emeta of the given line was read, it is not read for lines
+ * without a valid smeta, nor for lines open by the chunk report
+ */
+static inline int pblk_inst_line_emeta_read(const struct pblk_inst *inst,
+					    int line_id)
+{
+	const struct nvm_ret *ret = &inst->lines[line_id].emeta_ret;
+
+	if (inst->line_flags[line_id] & PBLK_LINE_FLAG_EMETA_SKIPPED)
+		return 0;
+
+	return !(ret->status || ret->result);
+}
+
+/**
+ * Number of LUNs on which the block of the given line is good
+ */
+static inline int pblk_inst_line_ngood(const struct pblk_inst *inst,
+				       int line_id)
+{
+	const uint64_t *good = &inst->line_good[line_id * inst->nwords];
+	int ngood = 0;
+
+	for (int i = 0; i < inst->nwords; ++i)
+		ngood += __builtin_popcountll(good[i]);
+
+	return ngood;
+}
+
+/**
+ * Chunk of the block of the given line on the given LUN of the instance, by
+ * the chunk report of the last scan, which must be set
+ */
+static inline const struct pblk_dev_chunk *pblk_inst_chunk(
+					const struct pblk *pblk,
+					const struct pblk_inst *inst,
+					int vlun, int line_id)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	const struct nvm_addr lun = inst->luns[vlun];
+
+	return &pblk->chunks[(lun.g.ch * geo->nluns + lun.g.lun) *
+			     geo->nblocks + line_id];
+}
+
+/**
+ * Sectors of the given line holding data, that is, the sectors of its good
+ * blocks except those of smeta and emeta
+ */
+static inline uint64_t pblk_inst_line_data_nsec(const struct pblk_inst *inst,
+						int line_id,
+						const struct nvm_geo *geo)
+{
+	const uint64_t nsec = (uint64_t)pblk_inst_line_ngood(inst, line_id) *
+			      pblk_geo_sec_per_pl(geo) * geo->npages;
+	const uint64_t nsec_meta = pblk_geo_smeta_nsec(geo) +
+				   pblk_inst_emeta_nsec(inst, geo);
+
+	return nsec > nsec_meta ? nsec - nsec_meta : 0;
+}
+
+/**
+ * Compute the device address of the given line-relative sector
+ *
+ * Sectors of a line are striped as: sector, plane, LUN in stripe order, page.
+ */
+static inline struct nvm_addr pblk_line_paddr_to_addr(
+					const struct pblk_inst *inst,
+					int line_id, uint64_t paddr,
+					const struct nvm_geo *geo)
+{
+	const size_t sec_per_pl = pblk_geo_sec_per_pl(geo);
+	const uint64_t unit = paddr / sec_per_pl;
+	struct nvm_addr addr = inst->luns[unit % inst->nluns];
+
+	addr.g.blk = line_id;
+	addr.g.pg = unit / inst->nluns;
+	addr.g.pl = (paddr % sec_per_pl) / geo->nsectors;
+	addr.g.sec = paddr % geo->nsectors;
+
+	return addr;
+}
+
+int pblk_inst_maps_init(struct pblk_inst *inst, int nlines);
+void pblk_inst_maps_term(struct pblk_inst *inst);
+size_t pblk_line_map_addrs(const struct pblk_line_map *map, uint64_t gsec,
+			   size_t nsec, struct nvm_addr *addrs,
+			   const struct nvm_geo *geo);
+
+/**
+ * Number of good sectors of the line of the given map
+ */
+static inline uint64_t pblk_line_map_nsec(const struct pblk_line_map *map,
+					  const struct nvm_geo *geo)
+{
+	return (uint64_t)map->nluns * geo->npages * pblk_geo_sec_per_pl(geo);
+}
+
+/**
+ * Compute the line-relative sector of the good sector `gsec` of the given map,
+ * that is, its index in the emeta LBA list
+ */
+static inline uint64_t pblk_line_map_paddr(const struct pblk_line_map *map,
+					   uint64_t gsec,
+					   const struct nvm_geo *geo)
+{
+	const size_t sec_per_pl = pblk_geo_sec_per_pl(geo);
+	const uint64_t unit = gsec / sec_per_pl;
+
+	return ((unit / map->nluns) * map->width +
+		map->vluns[unit % map->nluns]) * sec_per_pl + gsec % sec_per_pl;
+}
+
+/**
+ * Compute the device address of the good sector `gsec` of the given map
+ */
+static inline struct nvm_addr pblk_line_map_addr(
+					const struct pblk_line_map *map,
+					uint64_t gsec,
+					const struct nvm_geo *geo)
+{
+	const size_t sec_per_pl = pblk_geo_sec_per_pl(geo);
+	const uint64_t unit = gsec / sec_per_pl;
+	struct nvm_addr addr = map->luns[unit % map->nluns];
+
+	addr.g.pg = unit / map->nluns;
+	addr.g.pl = (gsec % sec_per_pl) / geo->nsectors;
+	addr.g.sec = gsec % geo->nsectors;
+
+	return addr;
+}
+
+/**
+ * Good sector of the given line at which emeta begins, emeta occupies the
+ * good sectors from there to the end of the line
+ *
+ * @returns On success, the good sector. On error, -1 is returned, this
+ * happens when the good blocks of the line cannot hold emeta.
+ */
+static inline int64_t pblk_line_emeta_gsec(const struct pblk_inst *inst,
+					   int line_id,
+					   const struct nvm_geo *geo)
+{
+	const uint64_t nsec = pblk_line_map_nsec(&inst->line_maps[line_id], geo);
+	const uint64_t emeta_nsec = pblk_inst_emeta_nsec(inst, geo);
+
+	return nsec < emeta_nsec ? -1 : (int64_t)(nsec - emeta_nsec);
+}
+
+int64_t pblk_line_smeta_ssec(const struct pblk_inst *inst, int line_id,
+			     const struct nvm_geo *geo);
+int64_t pblk_line_emeta_ssec(const struct pblk_inst *inst, int line_id,
+			     const struct nvm_geo *geo);
+
+/**
+ * Context for reading the complete smeta and emeta of lines of an instance
+ *
+ * Sectors are read in place into `buf`, a pooled buffer, which is replaced by
+ * another when a view of it is still held at the next read.
+ */
+struct pblk_meta_rd {
+	struct pblk_inst *inst;
+	struct pblk_buf_pool *pool;		///< Provider of buf
+	size_t nsec;				///< Sectors in buf
+	size_t nbytes;				///< Bytes of meta last read
+	struct pblk_buf *buf;			///< Complete meta of a line
+	struct nvm_ret *rets;			///< Result of each sector
+	struct nvm_addr *addrs;			///< Address of each sector
+	struct pblk_scan scan;
+};
+
+int pblk_meta_rd_init(struct pblk_meta_rd *rd, struct pblk *pblk,
+		      struct pblk_inst *inst);
+void pblk_meta_rd_term(struct pblk_meta_rd *rd);
+int pblk_meta_rd_smeta(struct pblk_meta_rd *rd, int line_id,
+		       const struct nvm_geo *geo);
+int pblk_meta_rd_emeta(struct pblk_meta_rd *rd, int line_id,
+		       const struct nvm_geo *geo);
+
+/**
+ * Typed view of a complete smeta, in place in the buffer it was read into,
+ * the view holds a reference to the buffer until put
+ */
+struct pblk_smeta_view {
+	struct pblk_buf *buf;
+	struct pblk_line_smeta *smeta;		///< In buf
+	size_t nbytes;				///< Bytes of the complete smeta
+};
+
+/**
+ * Typed view of a complete emeta and its lba-list, in place in the buffer it
+ * was read into, the view holds a reference to the buffer until put
+ */
+struct pblk_emeta_view {
+	struct pblk_buf *buf;
+	struct pblk_line_emeta *emeta;		///< In buf
+	const uint64_t *lbas;			///< lba-list, in buf
+	uint64_t nlbas;				///< Entries of lbas
+	size_t nbytes;				///< Bytes of the complete emeta
+};
+
+int pblk_smeta_view_parse(struct pblk_smeta_view *view, struct pblk_buf *buf,
+			  size_t nbytes, int line_id);
+int pblk_emeta_view_parse(struct pblk_emeta_view *view, struct pblk_buf *buf,
+			  size_t nbytes, int line_id, uint64_t nlbas);
+void pblk_smeta_view_put(struct pblk_smeta_view *view);
+void pblk_emeta_view_put(struct pblk_emeta_view *view);
+
+// Number of entries in a page of the L2P table
+#define PBLK_L2P_PAGE_NENTS (1ULL << 20)
+
+/**
+ * Logical-to-physical map, entries are device addresses
+ *
+ * The table covers `nlbas` entries but is allocated in pages on first use,
+ * thus it never exceeds the size of the logical address space and is only as
+ * large as the touched part of it.
+ */
+struct pblk_l2p {
+	uint64_t nlbas;				///< Number of LBAs covered
+	size_t npages;				///< Number of pages
+	uint64_t **pages;			///< NULL until touched
+	uint64_t nmapped;			///< Number of mapped LBAs
+	uint64_t nbytes;			///< Bytes allocated for pages
+};
+
+int pblk_l2p_init(struct pblk_l2p *l2p, uint64_t nlbas);
+void pblk_l2p_term(struct pblk_l2p *l2p);
+
+/**
+ * Get the device address mapped to the given LBA
+ *
+ * @returns The device address, PBLK_ADDR_EMPTY when unmapped
+ */
+static inline uint64_t pblk_l2p_get(const struct pblk_l2p *l2p, uint64_t lba)
+{
+	const uint64_t *page = NULL;
+
+	if (lba >= l2p->nlbas)
+		return PBLK_ADDR_EMPTY;
+
+	page = l2p->pages[lba / PBLK_L2P_PAGE_NENTS];
+	if (!page)
+		return PBLK_ADDR_EMPTY;
+
+	return page[lba % PBLK_L2P_PAGE_NENTS];
+}
+
+/**
+ * Map the given LBA to the given device address
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+static inline int pblk_l2p_set(struct pblk_l2p *l2p, uint64_t lba,
+			       uint64_t ppa)
+{
+	uint64_t **page = NULL;
+	uint64_t *ent = NULL;
+
+	if (lba >= l2p->nlbas) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	page = &l2p->pages[lba / PBLK_L2P_PAGE_NENTS];
+	if (!*page) {
+		const uint64_t pbgn = lba - (lba % PBLK_L2P_PAGE_NENTS);
+		const uint64_t nents = l2p->nlbas - pbgn < PBLK_L2P_PAGE_NENTS ?
+					l2p->nlbas - pbgn : PBLK_L2P_PAGE_NENTS;
+		const size_t nbytes = nents * sizeof(uint64_t);
+
+		*page = malloc(nbytes);
+		if (!*page) {
+			errno = ENOMEM;
+			return -1;
+		}
+		memset(*page, 0xff, nbytes);	// PBLK_ADDR_EMPTY
+		l2p->nbytes += nbytes;
+	}
+
+	ent = &(*page)[lba % PBLK_L2P_PAGE_NENTS];
+	if (*ent == PBLK_ADDR_EMPTY)
+		++(l2p->nmapped);
+	*ent = ppa;
+
+	return 0;
+}
+
+/**
+ * Statistics of applying the lba-list of a line to the L2P
+ */
+struct pblk_l2p_line_stat {
+	uint64_t nlbas;				///< LBAs in lba-list
+	uint64_t nupdated;			///< Previously mapped LBAs
+	uint64_t nrange;			///< LBAs out of range
+};
+
+int pblk_l2p_apply(struct pblk_l2p *l2p, const struct pblk_inst *inst,
+		   int line_id, const struct pblk_emeta_view *view,
+		   const struct nvm_geo *geo, struct pblk_l2p_line_stat *stat);
+
+uint64_t pblk_l2p_lba_end(const struct pblk_l2p *l2p);
+
+// LBAs of a window of the LBA reader, one vector command of sectors
+#define PBLK_LBA_WIN_NLBAS 64
+
+/**
+ * Window of PBLK_LBA_WIN_NLBAS consecutive LBAs held by the LBA reader
+ */
+struct pblk_lba_win {
+	uint64_t win;				///< First LBA / PBLK_LBA_WIN_NLBAS
+	uint64_t failed;			///< Bitmap of sectors failing
+	char *data;				///< Sectors of the window
+	int prev;				///< More recently used, or -1
+	int next;				///< Less recently used, or -1
+	int hnext;				///< Next in hash bucket, or -1
+	int pending;				///< Read by the current flush
+};
+
+/**
+ * Reader of logical blocks of an instance, through an L2P rebuilt from emeta
+ *
+ * LBAs are read and cached in windows of PBLK_LBA_WIN_NLBAS. On a miss, the
+ * windows missing from the request and `ra_nwins` windows following it are
+ * read by a single flush of the scan, thus logically adjacent LBAs, which pblk
+ * stripes over the LUNs of a line, are read by vector commands in parallel.
+ * The cache holds `nwins` windows and evicts the least recently used.
+ * Unmapped LBAs read as zeroes.
+ */
+struct pblk_lba_rd {
+	const struct pblk_l2p *l2p;
+	const struct nvm_geo *geo;
+	struct pblk_scan scan;
+	struct pblk_buf *buf;			///< Sectors of all windows
+	struct pblk_lba_win *wins;
+	int nwins;				///< Windows in cache
+	int ra_nwins;				///< Windows read ahead of a miss
+	int *buckets;				///< Hash of win to window, or -1
+	int nbuckets;				///< Power of two
+	int mru;				///< Most recently used, or -1
+	int lru;				///< Least recently used, or -1
+	struct nvm_ret *rets;			///< Result of each window sector
+	uint64_t nhits;				///< Windows found in cache
+	uint64_t nmisses;			///< Windows read
+	uint64_t nsecs_read;			///< Sectors read
+	uint64_t nsecs_failed;			///< Sectors failing to read
+	uint64_t nflushes;			///< Scan flushes
+};
+
+int pblk_lba_rd_init(struct pblk_lba_rd *rd, struct pblk *pblk,
+		     const struct pblk_l2p *l2p, int ra_nlbas,
+		     size_t cache_nbytes);
+void pblk_lba_rd_term(struct pblk_lba_rd *rd);
+int pblk_lba_rd_read(struct pblk_lba_rd *rd, uint64_t slba, size_t nlbas,
+		     char *buf);
+
+int *pblk_inst_lines_by_seq(struct pblk_inst *inst, int *nlines);
+
+enum pblk_chain_err {
+	PBLK_CHAIN_ERR_GAP = 0x1,		///< No line with seq_nr - 1
+	PBLK_CHAIN_ERR_DUP = 0x2,		///< seq_nr of another line
+	PBLK_CHAIN_ERR_FORK = 0x3,		///< prev_id of several lines
+	PBLK_CHAIN_ERR_CYCLE = 0x4,		///< prev_id links form a cycle
+	PBLK_CHAIN_ERR_PREV = 0x5,		///< prev_id not seq_nr - 1
+	PBLK_CHAIN_ERR_NEXT = 0x6,		///< next_id not seq_nr + 1
+};
+
+/**
+ * Invoked for each error found in a chain, `other` is the line expected to
+ * be linked, the line sharing the seq_nr, or for forks, the number of lines
+ * linking to `line`
+ */
+typedef void (*pblk_chain_cb)(int err, int line, int other, void *arg);
+
+struct pblk_chain_stat {
+	int nlines;				///< Open and closed lines
+	uint64_t seq_nr_min;
+	uint64_t seq_nr_max;
+	int newest;				///< Line of seq_nr_max, or -1
+	int ngaps;
+	int ndups;
+	int nforks;
+	int ncycles;
+	int nprev_broken;
+	int nnext_broken;
+};
+
+int pblk_inst_chain_check(const struct pblk_inst *inst,
+			  struct pblk_chain_stat *stat, pblk_chain_cb cb,
+			  void *cb_arg);
+
+/**
+ * GC lists of pblk, a closed line is on one by its valid sector count
+ */
+enum pblk_gc_bucket {
+	PBLK_GC_FULL = 0x0,			///< No valid sectors
+	PBLK_GC_HIGH = 0x1,			///< Below a quarter of a line
+	PBLK_GC_MID = 0x2,			///< Below half a line
+	PBLK_GC_LOW = 0x3,			///< Below the sectors of the line
+	PBLK_GC_EMPTY = 0x4,			///< All sectors valid
+	PBLK_GC_NBUCKETS = 0x5,
+};
+
+const char *pblk_gc_bucket_str(int bucket);
+
+/**
+ * Valid sectors of a closed line
+ */
+struct pblk_vsc_line {
+	int id;
+	uint64_t seq_nr;
+	uint64_t nsec;				///< Data sectors of the line
+	uint64_t nlbas;				///< LBAs in lba-list
+	uint64_t vsc;				///< Valid sector count
+	int bucket;				///< pblk_gc_bucket, -1: unreadable
+};
+
+/**
+ * Valid sectors of the closed lines of an instance, lines are ordered by
+ * seq_nr
+ */
+struct pblk_vsc {
+	int nlines;				///< Closed lines
+	struct pblk_vsc_line *lines;
+	int nunreadable;			///< Lines without valid emeta
+	uint64_t nlbas;				///< LBA space covered
+	uint64_t nrange;			///< LBAs out of range
+	uint64_t nsec;				///< Data sectors of read lines
+	uint64_t vsc;				///< Valid sectors of read lines
+	int nbuckets[PBLK_GC_NBUCKETS];		///< Lines per GC list
+	double wa_mean;				///< Estimate at mean utilization
+	double wa_greedy;			///< Estimate for the GC victim
+	uint64_t bitmap_nbytes;			///< Size of the LBA bitmap
+};
+
+int pblk_inst_vsc(struct pblk *pblk, struct pblk_inst *inst,
+		  struct pblk_vsc *vsc);
+void pblk_vsc_term(struct pblk_vsc *vsc);
+
+/**
+ * How far an open line was written, its write pointer is found per LUN as
+ * the number of written pages of the block of the line on the LUN
+ */
+struct pblk_recov_line {
+	int id;
+	uint64_t seq_nr;
+	int nluns;				///< Good LUNs of the line
+	uint32_t *wps;				///< Written pages, per good LUN
+	uint32_t wp_min;			///< Of the least written LUN
+	uint32_t wp_max;			///< Of the most written LUN
+	uint64_t nsec;				///< Sectors written, with smeta
+	uint64_t nsec_data;			///< Data sectors of the line
+	uint64_t nprobes;			///< Pages read to find the wps
+};
+
+/**
+ * Write pointers of the open lines of an instance, and the reads pblk
+ * recovery issues to scan them
+ */
+struct pblk_recov {
+	int nlines;				///< Open lines
+	struct pblk_recov_line *lines;
+	int nrounds;				///< Rounds of the search
+	uint64_t nprobes;			///< Pages read by the search
+	uint64_t nprobes_linear;		///< Pages a linear scan reads
+	uint64_t nsec;				///< Sectors recovery reads
+	uint64_t nbytes;			///< Bytes recovery reads
+};
+
+int pblk_inst_recov(struct pblk *pblk, struct pblk_inst *inst,
+		    struct pblk_recov *recov);
+void pblk_recov_term(struct pblk_recov *recov);
+
+/**
+ * Metrics of the scans of a resident pblk, exported between scans
+ */
+struct pblk_metrics {
+	int ninsts;				///< Instances accounted
+	uint64_t nscans;			///< Scans completed
+	uint64_t nscans_failed;			///< Scans failing
+	uint64_t nread_errs;			///< Meta reads failed, all scans
+	int *inst_read_errs;			///< Per instance, last scan
+	int nreused;				///< Lines from snapshot, last scan
+	double scan_sec;			///< Duration of the last scan
+	time_t scan_time;			///< End of the last scan, epoch
+};
+
+int pblk_metrics_init(struct pblk_metrics *metrics, const struct pblk *pblk);
+void pblk_metrics_term(struct pblk_metrics *metrics);
+void pblk_metrics_scanned(struct pblk_metrics *metrics,
+			  const struct pblk *pblk, int err, double scan_sec,
+			  int nreused);
+int pblk_metrics_fmt(const struct pblk_metrics *metrics,
+		     const struct pblk *pblk, char **buf, size_t *nbytes);
+
+#endif /* __PBLK_H */
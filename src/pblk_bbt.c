@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <liblightnvm.h>
+#include <pblk.h>
+
+#define PBLK_BBT_CACHE_MAGIC 0x3254424b4c4250ULL	// "PBLKBT2"
+
+/**
+ * Header of an on-disk bbt cache file, followed by the `blks` of every LUN in
+ * tlun order
+ */
+struct pblk_bbt_cache_hdr {
+	uint64_t magic;
+	char name[64];				///< Name of the device
+	char ident[64];				///< wwid or serial, "" if unknown
+	uint32_t nchannels;
+	uint32_t nluns;
+	uint32_t nplanes;
+	uint32_t nblocks;
+	uint32_t npages;
+	uint32_t nsectors;
+	uint32_t sector_nbytes;
+	uint32_t rsvd;
+	uint64_t nblks;				///< blks per LUN
+};
+
+/**
+ * Read the identity of the device of the given name from sysfs: the wwid of
+ * the namespace, which the kernel derives from its EUI-64 or NGUID, or else
+ * the serial of its controller. liblightnvm does not report either.
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned, this happens
+ * for devices without sysfs attributes, such as emulated devices.
+ */
+static int pblk_bbt_cache_ident(const char *name, char *ident, size_t len)
+{
+	static const char *attrs[] = { "wwid", "device/serial" };
+
+	if ((!name) || (!*name) || strchr(name, '/'))
+		return -1;
+
+	for (size_t i = 0; i < sizeof(attrs) / sizeof(*attrs); ++i) {
+		char path[512];
+		size_t nbytes;
+		FILE *fp;
+
+		snprintf(path, sizeof(path), "/sys/block/%s/%s", name,
+			 attrs[i]);
+		fp = fopen(path, "r");
+		if (!fp)
+			continue;
+		nbytes = fread(ident, 1, len - 1, fp);
+		fclose(fp);
+
+		while (nbytes && ((ident[nbytes - 1] == '\n') ||
+				  (ident[nbytes - 1] == ' ')))
+			--nbytes;
+		ident[nbytes] = '\0';
+		if (nbytes)
+			return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * Fill the header identifying the cache of the given device, by its name and
+ * geometry, and by its wwid or serial when sysfs has them, such that another
+ * device given the same name does not take the cache
+ */
+static void pblk_bbt_cache_hdr_fill(struct pblk_bbt_cache_hdr *hdr,
+				    const char *name, const struct nvm_geo *geo)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = PBLK_BBT_CACHE_MAGIC;
+	strncpy(hdr->name, name ? name : "", sizeof(hdr->name) - 1);
+	if (pblk_bbt_cache_ident(name, hdr->ident, sizeof(hdr->ident)))
+		memset(hdr->ident, 0, sizeof(hdr->ident));
+	hdr->nchannels = geo->nchannels;
+	hdr->nluns = geo->nluns;
+	hdr->nplanes = geo->nplanes;
+	hdr->nblocks = geo->nblocks;
+	hdr->npages = geo->npages;
+	hdr->nsectors = geo->nsectors;
+	hdr->sector_nbytes = geo->sector_nbytes;
+	hdr->nblks = geo->nblocks * geo->nplanes;
+}
+
+/**
+ * Path of the cache file of the given device, the device name with '/'
+ * replaced, such that emulated devices named by their path are cached too
+ */
+static int pblk_bbt_cache_path(const char *dir, const char *name, char *path,
+			       size_t len)
+{
+	size_t off;
+
+	off = snprintf(path, len, "%s/", dir);
+	if (off >= len) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	for (const char *c = name ? name : "dev"; *c; ++c) {
+		if (off + 1 >= len) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		path[off++] = *c == '/' ? '_' : *c;
+	}
+
+	if (snprintf(path + off, len - off, ".bbt") >= (int)(len - off)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Load the bbts of all LUNs from the cache, the cache is used only when it
+ * was written for a device of the same name, identity and geometry
+ */
+static int pblk_bbt_cache_load(struct pblk_bbt_map *map, const char *path,
+			       const char *name, const struct nvm_geo *geo)
+{
+	struct pblk_bbt_cache_hdr expected, hdr;
+	uint8_t *blks = NULL;
+	FILE *fp;
+	size_t nbytes;
+
+	pblk_bbt_cache_hdr_fill(&expected, name, geo);
+	nbytes = map->tluns * expected.nblks;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return -1;
+
+	if ((fread(&hdr, sizeof(hdr), 1, fp) != 1) ||
+	    memcmp(&hdr, &expected, sizeof(hdr))) {
+		fclose(fp);
+		errno = ESTALE;
+		return -1;
+	}
+
+	map->cached = calloc(map->tluns, sizeof(*map->cached));
+	blks = malloc(nbytes);
+	if (!(map->cached && blks)) {
+		free(map->cached);
+		map->cached = NULL;
+		free(blks);
+		fclose(fp);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (fread(blks, 1, nbytes, fp) != nbytes) {
+		free(map->cached);
+		map->cached = NULL;
+		free(blks);
+		fclose(fp);
+		errno = ESTALE;
+		return -1;
+	}
+	fclose(fp);
+
+	for (int tlun = 0; tlun < map->tluns; ++tlun) {
+		struct nvm_bbt *bbt = &map->cached[tlun];
+
+		bbt->addr.g.ch = tlun / geo->nluns;
+		bbt->addr.g.lun = tlun % geo->nluns;
+		bbt->nblks = expected.nblks;
+		bbt->blks = blks + tlun * expected.nblks;
+		for (uint64_t i = 0; i < bbt->nblks; ++i) {
+			bbt->nbad += !!(bbt->blks[i] & NVM_BBT_BAD);
+			bbt->ngbad += !!(bbt->blks[i] & NVM_BBT_GBAD);
+			bbt->ndmrk += !!(bbt->blks[i] & NVM_BBT_DMRK);
+			bbt->nhmrk += !!(bbt->blks[i] & NVM_BBT_HMRK);
+		}
+
+		map->bbts[tlun] = bbt;
+	}
+
+	return 0;
+}
+
+/**
+ * Write the bbts of all LUNs to the cache, via a temporary file renamed into
+ * place, thus readers never see a partial cache
+ */
+static int pblk_bbt_cache_save(const struct pblk_bbt_map *map,
+			       const char *path, const char *name,
+			       const struct nvm_geo *geo)
+{
+	struct pblk_bbt_cache_hdr hdr;
+	char tmp[4096];
+	int err = 0;
+	FILE *fp;
+
+	pblk_bbt_cache_hdr_fill(&hdr, name, geo);
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) >=
+	    (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	fp = fopen(tmp, "wb");
+	if (!fp)
+		return -1;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		err = -1;
+	for (int tlun = 0; (!err) && (tlun < map->tluns); ++tlun) {
+		if (fwrite(map->bbts[tlun]->blks, 1, hdr.nblks, fp) != hdr.nblks)
+			err = -1;
+	}
+	if (fclose(fp))
+		err = -1;
+
+	if ((!err) && rename(tmp, path))
+		err = -1;
+	if (err)
+		unlink(tmp);
+
+	return err;
+}
+
+/**
+ * Mark the good LUNs of every line in the map, from the bbt of each LUN
+ *
+ * A LUN is good for a line when the block of the line is good on all planes.
+ * The bytes of the planes of a block are OR-reduced eight bytes at a time
+ * within a word, leaving the OR of each block in its first byte.
+ */
+static void pblk_bbt_map_lun(struct pblk_bbt_map *map, int tlun,
+			     const uint8_t *blks, size_t nplanes)
+{
+	uint64_t *good = &map->good[tlun / 64];
+	const uint64_t bit = 1ULL << (tlun % 64);
+	int line = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if ((nplanes <= 8) && (!(nplanes & (nplanes - 1)))) {
+		const int nlines_word = 8 / nplanes;
+
+		for (; line + nlines_word <= map->nlines; line += nlines_word) {
+			uint64_t word;
+
+			memcpy(&word, blks + line * nplanes, sizeof(word));
+			for (size_t shift = 8; shift < nplanes * 8; shift <<= 1)
+				word |= word >> shift;
+
+			for (int i = 0; i < nlines_word; ++i) {
+				if ((word >> (i * nplanes * 8)) & 0xff)
+					continue;
+
+				good[(line + i) * map->nwords] |= bit;
+			}
+		}
+	}
+#endif
+
+	for (; line < map->nlines; ++line) {
+		uint8_t broken = 0;
+
+		for (size_t pl = 0; pl < nplanes; ++pl)
+			broken |= blks[line * nplanes + pl];
+
+		if (!broken)
+			good[line * map->nwords] |= bit;
+	}
+}
+
+void pblk_bbt_map_term(struct pblk_bbt_map *map)
+{
+	if (!map)
+		return;
+
+	if (map->cached)
+		free(map->cached[0].blks);
+	free(map->cached);
+	free(map->bbts);
+	free(map->good);
+	free(map);
+}
+
+/**
+ * Build the bbt map of the device of the given pblk, once, loading the bbts
+ * from the on-disk cache when enabled and valid, fetching them from the
+ * device and updating the cache otherwise
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_bbt_map_init(struct pblk *pblk)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	const char *name = pblk_dev_get_name(pblk->dev);
+	struct pblk_bbt_map *map;
+	char path[4096];
+	int cached = 0;
+
+	if (pblk->bbt_map)
+		return 0;
+
+	map = calloc(1, sizeof(*map));
+	if (!map) {
+		errno = ENOMEM;
+		return -1;
+	}
+	map->tluns = pblk->tluns;
+	map->nlines = geo->nblocks;
+	map->nwords = (map->tluns + 63) / 64;
+	map->bbts = calloc(map->tluns, sizeof(*map->bbts));
+	map->good = calloc((size_t)map->nlines * map->nwords,
+			   sizeof(*map->good));
+	if (!(map->bbts && map->good)) {
+		pblk_bbt_map_term(map);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (pblk->bbt_cache &&
+	    pblk_bbt_cache_path(pblk->bbt_cache, name, path, sizeof(path))) {
+		pblk_bbt_map_term(map);
+		return -1;
+	}
+
+	if (pblk->bbt_cache && (!pblk_bbt_cache_load(map, path, name, geo)))
+		cached = 1;
+
+	for (int tlun = 0; (!cached) && (tlun < map->tluns); ++tlun) {
+		struct nvm_addr addr = { 0 };
+
+		addr.g.ch = tlun / geo->nluns;
+		addr.g.lun = tlun % geo->nluns;
+
+		map->bbts[tlun] = pblk_dev_bbt_get(pblk->dev, addr, NULL);
+		if (!map->bbts[tlun]) {
+			pblk_bbt_map_term(map);
+			return -1;
+		}
+	}
+
+	// Failing to update the cache only costs a fetch on the next run
+	if (pblk->bbt_cache && (!cached))
+		pblk_bbt_cache_save(map, path, name, geo);
+
+	for (int tlun = 0; tlun < map->tluns; ++tlun)
+		pblk_bbt_map_lun(map, tlun, map->bbts[tlun]->blks,
+				 geo->nplanes);
+
+	map->cached_hit = cached;
+	pblk->bbt_map = map;
+
+	return 0;
+}
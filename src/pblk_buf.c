@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <liblightnvm.h>
+#include <pblk_buf.h>
+
+static void pblk_buf_free(struct pblk_buf *buf)
+{
+	struct pblk_buf_pool *pool = buf->pool;
+
+	__atomic_sub_fetch(&pool->nbufs, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&pool->nbytes, buf->nbytes, __ATOMIC_RELAXED);
+
+	free(buf->data);
+	free(buf);
+}
+
+/**
+ * Initialize a pool with the given slab classes, sizes must be ascending
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_buf_pool_init(struct pblk_buf_pool *pool, const struct nvm_geo *geo,
+		       const size_t *class_nbytes, int nclasses)
+{
+	memset(pool, 0, sizeof(*pool));
+
+	if ((nclasses < 0) || (nclasses > PBLK_BUF_NCLASSES_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (int i = 1; i < nclasses; ++i) {
+		if (class_nbytes[i] < class_nbytes[i - 1]) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	pool->geo = *geo;
+	pool->nclasses = nclasses;
+	for (int i = 0; i < nclasses; ++i)
+		pool->classes[i].nbytes = class_nbytes[i];
+
+	return 0;
+}
+
+/**
+ * Release the unreferenced buffers of the given pool, all buffers must have
+ * been put
+ */
+void pblk_buf_pool_term(struct pblk_buf_pool *pool)
+{
+	for (int i = 0; i < pool->nclasses; ++i) {
+		struct pblk_buf_class *cls = &pool->classes[i];
+
+		for (int j = 0; j < PBLK_BUF_CLASS_NSLOTS; ++j) {
+			if (cls->slots[j])
+				pblk_buf_free(cls->slots[j]);
+		}
+	}
+	memset(pool, 0, sizeof(*pool));
+}
+
+static struct pblk_buf *pblk_buf_take(struct pblk_buf_class *cls)
+{
+	const unsigned int hint = __atomic_load_n(&cls->hint,
+						  __ATOMIC_RELAXED);
+
+	for (unsigned int i = 0; i < PBLK_BUF_CLASS_NSLOTS; ++i) {
+		struct pblk_buf **slot;
+		struct pblk_buf *buf;
+
+		slot = &cls->slots[(hint + PBLK_BUF_CLASS_NSLOTS - i) %
+				   PBLK_BUF_CLASS_NSLOTS];
+		if (!__atomic_load_n(slot, __ATOMIC_RELAXED))
+			continue;
+
+		buf = __atomic_exchange_n(slot, NULL, __ATOMIC_ACQUIRE);
+		if (buf)
+			return buf;
+	}
+
+	return NULL;
+}
+
+static int pblk_buf_give(struct pblk_buf_class *cls, struct pblk_buf *buf)
+{
+	const unsigned int hint = __atomic_load_n(&cls->hint,
+						  __ATOMIC_RELAXED);
+
+	for (unsigned int i = 1; i <= PBLK_BUF_CLASS_NSLOTS; ++i) {
+		const unsigned int s = (hint + i) % PBLK_BUF_CLASS_NSLOTS;
+		struct pblk_buf *empty = NULL;
+
+		if (__atomic_compare_exchange_n(&cls->slots[s], &empty, buf, 0,
+						__ATOMIC_RELEASE,
+						__ATOMIC_RELAXED)) {
+			__atomic_store_n(&cls->hint, s, __ATOMIC_RELAXED);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Get a buffer of at least `nbytes` from the given pool, holding a single
+ * reference. It is taken from the smallest class fitting `nbytes`, without
+ * locking, and allocated when the class has none. Its content is undefined.
+ *
+ * @returns On success, the buffer is returned. On error, NULL is returned and
+ * errno set to indicate the error.
+ */
+struct pblk_buf *pblk_buf_get(struct pblk_buf_pool *pool, size_t nbytes)
+{
+	struct pblk_buf *buf = NULL;
+	int cls = 0;
+
+	while ((cls < pool->nclasses) && (pool->classes[cls].nbytes < nbytes))
+		++cls;
+	if (cls == pool->nclasses)
+		cls = -1;
+
+	if (cls >= 0) {
+		buf = pblk_buf_take(&pool->classes[cls]);
+		nbytes = pool->classes[cls].nbytes;
+	}
+
+	if (!buf) {
+		buf = malloc(sizeof(*buf));
+		if (!buf) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		memset(buf, 0, sizeof(*buf));
+
+		buf->data = nvm_buf_alloc(&pool->geo, nbytes);
+		if (!buf->data) {
+			free(buf);
+			errno = ENOMEM;
+			return NULL;
+		}
+		buf->pool = pool;
+		buf->nbytes = nbytes;
+		buf->cls = cls;
+
+		__atomic_add_fetch(&pool->nbufs, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&pool->nbytes, nbytes, __ATOMIC_RELAXED);
+	}
+
+	buf->nrefs = 1;
+
+	return buf;
+}
+
+/**
+ * Put a reference to the given buffer, the last reference returns it to the
+ * slots of its class, or releases it when they are full
+ */
+void pblk_buf_put(struct pblk_buf *buf)
+{
+	if (!buf)
+		return;
+	if (__atomic_sub_fetch(&buf->nrefs, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	if ((buf->cls >= 0) &&
+	    (!pblk_buf_give(&buf->pool->classes[buf->cls], buf)))
+		return;
+
+	pblk_buf_free(buf);
+}
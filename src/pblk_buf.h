@@ -0,0 +1,70 @@
+#ifndef __PBLK_BUF_H
+#define __PBLK_BUF_H
+
+#include <stddef.h>
+#include <liblightnvm.h>
+
+#define PBLK_BUF_NCLASSES_MAX 4
+// Unreferenced buffers kept per class, more are released
+#define PBLK_BUF_CLASS_NSLOTS 64
+
+struct pblk_buf_pool;
+
+/**
+ * Buffer allocated by nvm_buf_alloc, thus usable for commands, shared by
+ * reference-counting and returned to its pool when the last reference is put
+ */
+struct pblk_buf {
+	struct pblk_buf_pool *pool;
+	char *data;				///< By nvm_buf_alloc
+	size_t nbytes;				///< Size of data
+	int cls;				///< Slab class, -1 when unpooled
+	int nrefs;				///< Updated atomically
+};
+
+/**
+ * Slab class of a pool, unreferenced buffers are kept in slots which are
+ * taken and filled by atomic exchange, thus without locking
+ */
+struct pblk_buf_class {
+	size_t nbytes;				///< Size of buffers of the class
+	struct pblk_buf *slots[PBLK_BUF_CLASS_NSLOTS];	///< NULL when empty
+	unsigned int hint;			///< Slot last filled
+};
+
+/**
+ * Pool of pblk_buf of a device, or of devices of the same geometry, shared by
+ * their threads, with slab classes of ascending size. Buffers larger than the
+ * largest class are not pooled.
+ */
+struct pblk_buf_pool {
+	struct nvm_geo geo;			///< Copy, outlives the devices
+	int nclasses;
+	struct pblk_buf_class classes[PBLK_BUF_NCLASSES_MAX];
+	int nbufs;				///< Buffers allocated
+	size_t nbytes;				///< Bytes allocated
+};
+
+int pblk_buf_pool_init(struct pblk_buf_pool *pool, const struct nvm_geo *geo,
+		       const size_t *class_nbytes, int nclasses);
+void pblk_buf_pool_term(struct pblk_buf_pool *pool);
+
+struct pblk_buf *pblk_buf_get(struct pblk_buf_pool *pool, size_t nbytes);
+void pblk_buf_put(struct pblk_buf *buf);
+
+static inline struct pblk_buf *pblk_buf_ref(struct pblk_buf *buf)
+{
+	__atomic_add_fetch(&buf->nrefs, 1, __ATOMIC_RELAXED);
+
+	return buf;
+}
+
+/**
+ * Check whether the given buffer is referenced by others than the caller
+ */
+static inline int pblk_buf_shared(const struct pblk_buf *buf)
+{
+	return __atomic_load_n(&buf->nrefs, __ATOMIC_ACQUIRE) > 1;
+}
+
+#endif /* __PBLK_BUF_H */
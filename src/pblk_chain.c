@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <liblightnvm.h>
+#include <pblk.h>
+
+#define PBLK_CHAIN_ID_NONE (~(uint32_t)0)
+
+/**
+ * Open-addressing index from seq_nr to line, sized to a power of two of at
+ * least twice the number of lines
+ */
+struct pblk_chain_idx {
+	uint64_t *seq_nrs;
+	int *lines;				///< -1 when the slot is free
+	size_t mask;
+};
+
+static int pblk_chain_idx_init(struct pblk_chain_idx *idx, int nlines)
+{
+	size_t nslots = 16;
+
+	while (nslots < (size_t)nlines * 2)
+		nslots <<= 1;
+
+	idx->mask = nslots - 1;
+	idx->seq_nrs = malloc(nslots * sizeof(*idx->seq_nrs));
+	idx->lines = malloc(nslots * sizeof(*idx->lines));
+	if (!(idx->seq_nrs && idx->lines)) {
+		free(idx->seq_nrs);
+		free(idx->lines);
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(idx->lines, 0xff, nslots * sizeof(*idx->lines));
+
+	return 0;
+}
+
+static void pblk_chain_idx_term(struct pblk_chain_idx *idx)
+{
+	free(idx->seq_nrs);
+	free(idx->lines);
+}
+
+static inline size_t pblk_chain_idx_slot(const struct pblk_chain_idx *idx,
+					 uint64_t seq_nr)
+{
+	size_t slot = (seq_nr * 0x9e3779b97f4a7c15ULL) >> 32;
+
+	for (slot &= idx->mask; idx->lines[slot] >= 0;
+	     slot = (slot + 1) & idx->mask) {
+		if (idx->seq_nrs[slot] == seq_nr)
+			break;
+	}
+
+	return slot;
+}
+
+/**
+ * Returns the line having the given seq_nr, -1 when there is none
+ */
+static inline int pblk_chain_idx_get(const struct pblk_chain_idx *idx,
+				     uint64_t seq_nr)
+{
+	return idx->lines[pblk_chain_idx_slot(idx, seq_nr)];
+}
+
+/**
+ * Insert the given line, returns the line already having its seq_nr, or -1
+ */
+static inline int pblk_chain_idx_put(struct pblk_chain_idx *idx,
+				     uint64_t seq_nr, int line)
+{
+	const size_t slot = pblk_chain_idx_slot(idx, seq_nr);
+
+	if (idx->lines[slot] >= 0)
+		return idx->lines[slot];
+
+	idx->seq_nrs[slot] = seq_nr;
+	idx->lines[slot] = line;
+
+	return -1;
+}
+
+enum pblk_chain_link_flag {
+	PBLK_CHAIN_MEMBER = 0x1,		///< Valid smeta of the line
+	PBLK_CHAIN_NEXT = 0x2,			///< Valid emeta of the line
+};
+
+/**
+ * Links of a line are used only when its meta has a valid header naming the
+ * line, lines with unreadable or foreign meta are not part of the chain
+ */
+static uint8_t pblk_chain_line_flags(const struct pblk_inst *inst, int i)
+{
+	const struct pblk_line *line = &inst->lines[i];
+	struct pblk_line_smeta smeta = line->smeta;
+	struct pblk_line_emeta emeta = line->emeta;
+	uint8_t flags = 0;
+
+	if (!(inst->line_states[i] &
+	      (PBLK_LINE_STATE_OPEN | PBLK_LINE_STATE_CLOSED)))
+		return 0;
+	if (pblk_line_smeta_hdr_check(&smeta) ||
+	    (smeta.header.id != (uint32_t)i))
+		return 0;
+	flags |= PBLK_CHAIN_MEMBER;
+
+	if ((inst->line_states[i] == PBLK_LINE_STATE_CLOSED) &&
+	    (!pblk_line_emeta_hdr_check(&emeta)) &&
+	    (emeta.header.id == (uint32_t)i))
+		flags |= PBLK_CHAIN_NEXT;
+
+	return flags;
+}
+
+/**
+ * Returns the line named by the given id, when it is a line of the chain,
+ * otherwise -1
+ */
+static inline int pblk_chain_link(const struct pblk_inst *inst,
+				  const uint8_t *flags, uint32_t id)
+{
+	if ((id == PBLK_CHAIN_ID_NONE) || (id >= (uint32_t)inst->nlines))
+		return -1;
+
+	return (flags[id] & PBLK_CHAIN_MEMBER) ? (int)id : -1;
+}
+
+static inline void pblk_chain_report(struct pblk_chain_stat *stat,
+				     pblk_chain_cb cb, void *cb_arg, int err,
+				     int line, int other)
+{
+	switch (err) {
+	case PBLK_CHAIN_ERR_GAP:
+		++stat->ngaps;
+		break;
+	case PBLK_CHAIN_ERR_DUP:
+		++stat->ndups;
+		break;
+	case PBLK_CHAIN_ERR_FORK:
+		++stat->nforks;
+		break;
+	case PBLK_CHAIN_ERR_CYCLE:
+		++stat->ncycles;
+		break;
+	case PBLK_CHAIN_ERR_PREV:
+		++stat->nprev_broken;
+		break;
+	case PBLK_CHAIN_ERR_NEXT:
+		++stat->nnext_broken;
+		break;
+	}
+
+	if (cb)
+		cb(err, line, other, cb_arg);
+}
+
+/**
+ * Verify the chain of the open and closed lines of the given instance, in
+ * which line seq_nr N names line seq_nr N - 1 by smeta prev_id, and line
+ * seq_nr N + 1 by emeta next_id. Lines are in the chain when their smeta
+ * header is valid, and next_id is verified when their emeta header is valid.
+ *
+ * An index from seq_nr to line is built in one pass, and every link is then
+ * verified by a lookup, thus the check is O(lines). Reported, through `cb`
+ * when given and counted in `stat`, are:
+ *
+ *  - gaps, a seq_nr without a line having the seq_nr before it, links across
+ *    a gap are not verified, as lines erased by GC leave gaps
+ *  - duplicates, lines sharing a seq_nr
+ *  - forks, lines named by the prev_id of more than one line
+ *  - cycles in the prev_id links
+ *  - prev_id or next_id not naming the line with the adjacent seq_nr
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_inst_chain_check(const struct pblk_inst *inst,
+			  struct pblk_chain_stat *stat, pblk_chain_cb cb,
+			  void *cb_arg)
+{
+	struct pblk_chain_idx idx;
+	int *nrefs = NULL;			///< prev_id references of lines
+	int *walk = NULL;			///< Walk visiting a line, 0: none
+	uint8_t *flags = NULL;			///< pblk_chain_link_flag of lines
+	int err = 0;
+
+	memset(stat, 0, sizeof(*stat));
+	stat->newest = -1;
+
+	if (pblk_chain_idx_init(&idx, inst->nlines))
+		return -1;
+
+	nrefs = calloc(inst->nlines + 1, sizeof(*nrefs));
+	walk = calloc(inst->nlines + 1, sizeof(*walk));
+	flags = calloc(inst->nlines + 1, sizeof(*flags));
+	if (!(nrefs && walk && flags)) {
+		errno = ENOMEM;
+		err = -1;
+		goto chain_exit;
+	}
+
+	for (int i = 0; i < inst->nlines; ++i) {
+		const uint64_t seq_nr = inst->line_seq_nrs[i];
+		int other;
+
+		flags[i] = pblk_chain_line_flags(inst, i);
+		if (!(flags[i] & PBLK_CHAIN_MEMBER))
+			continue;
+
+		if ((!stat->nlines) || (seq_nr < stat->seq_nr_min))
+			stat->seq_nr_min = seq_nr;
+		if ((!stat->nlines) || (seq_nr > stat->seq_nr_max)) {
+			stat->seq_nr_max = seq_nr;
+			stat->newest = i;
+		}
+		++stat->nlines;
+
+		other = pblk_chain_idx_put(&idx, seq_nr, i);
+		if (other >= 0)
+			pblk_chain_report(stat, cb, cb_arg, PBLK_CHAIN_ERR_DUP,
+					  i, other);
+	}
+
+	for (int i = 0; i < inst->nlines; ++i) {
+		const struct pblk_line *line = &inst->lines[i];
+		const uint64_t seq_nr = inst->line_seq_nrs[i];
+		const int prev = pblk_chain_link(inst, flags,
+						 line->smeta.prev_id);
+		int expected;
+
+		if (!(flags[i] & PBLK_CHAIN_MEMBER))
+			continue;
+
+		if (prev >= 0)
+			++nrefs[prev];
+
+		if (seq_nr != stat->seq_nr_min) {
+			expected = pblk_chain_idx_get(&idx, seq_nr - 1);
+			if (expected < 0)
+				pblk_chain_report(stat, cb, cb_arg,
+						  PBLK_CHAIN_ERR_GAP, i, -1);
+			else if (prev != expected)
+				pblk_chain_report(stat, cb, cb_arg,
+						  PBLK_CHAIN_ERR_PREV, i,
+						  expected);
+		}
+
+		if ((!(flags[i] & PBLK_CHAIN_NEXT)) ||
+		    (seq_nr == stat->seq_nr_max))
+			continue;
+
+		expected = pblk_chain_idx_get(&idx, seq_nr + 1);
+		if ((expected >= 0) &&
+		    (pblk_chain_link(inst, flags, line->emeta.next_id) !=
+		     expected))
+			pblk_chain_report(stat, cb, cb_arg, PBLK_CHAIN_ERR_NEXT,
+					  i, expected);
+	}
+
+	for (int i = 0; i < inst->nlines; ++i) {
+		if (nrefs[i] > 1)
+			pblk_chain_report(stat, cb, cb_arg, PBLK_CHAIN_ERR_FORK,
+					  i, nrefs[i]);
+	}
+
+	// Follow prev_id from every line not yet visited, a walk reaching a
+	// line visited by itself has found a cycle, each line is visited once
+	for (int i = 0; i < inst->nlines; ++i) {
+		int cur = i;
+
+		if ((!(flags[i] & PBLK_CHAIN_MEMBER)) || walk[i])
+			continue;
+
+		while ((cur >= 0) && (!walk[cur])) {
+			walk[cur] = i + 1;
+			cur = pblk_chain_link(inst, flags,
+					      inst->lines[cur].smeta.prev_id);
+		}
+
+		if ((cur >= 0) && (walk[cur] == i + 1))
+			pblk_chain_report(stat, cb, cb_arg, PBLK_CHAIN_ERR_CYCLE,
+					  cur, -1);
+	}
+
+chain_exit:
+	free(nrefs);
+	free(walk);
+	free(flags);
+	pblk_chain_idx_term(&idx);
+
+	return err;
+}
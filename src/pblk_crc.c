@@ -0,0 +1,251 @@
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <pblk_crc.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PBLK_CRC_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__linux__)
+#define PBLK_CRC_ARMV8 1
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/**
+ * zlib crc32, used for the tails not handled by the accelerated kernels and
+ * when the CPU supports none of them
+ */
+static uint32_t pblk_crc32_zlib(uint32_t crc, const unsigned char *buf,
+				size_t len)
+{
+	while (len) {
+		uInt chunk = len > (1U << 30) ? (1U << 30) : (uInt)len;
+
+		crc = crc32(crc, buf, chunk);
+		buf += chunk;
+		len -= chunk;
+	}
+
+	return crc;
+}
+
+static int pblk_crc32_zlib_supported(void)
+{
+	return 1;
+}
+
+#ifdef PBLK_CRC_X86
+/**
+ * Fold 64 bytes at a time using carry-less multiplication, as described in
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction"
+ * (Intel), with the bit-reflected constants for the CRC32 polynomial
+ *
+ * Operates on the raw (not inverted) crc register, `len` must be at least 64
+ * and a multiple of 16.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t pblk_crc32_pclmul_fold(uint32_t crc, const unsigned char *buf,
+				       size_t len)
+{
+	static const uint64_t k1k2[] __attribute__((aligned(16))) = {
+		0x0154442bd4, 0x01c6e41596
+	};
+	static const uint64_t k3k4[] __attribute__((aligned(16))) = {
+		0x01751997d0, 0x00ccaa009e
+	};
+	static const uint64_t k5k0[] __attribute__((aligned(16))) = {
+		0x0163cd6124, 0x0000000000
+	};
+	static const uint64_t poly[] __attribute__((aligned(16))) = {
+		0x01db710641, 0x01f7011641
+	};
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+
+	buf += 64;
+	len -= 64;
+
+	// Fold four 128-bit lanes in parallel
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		buf += 64;
+		len -= 64;
+	}
+
+	// Fold the four lanes into one
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// Fold the remaining 16 byte blocks
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)buf);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		buf += 16;
+		len -= 16;
+	}
+
+	// Fold 128 bits to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_load_si128((const __m128i *)poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t pblk_crc32_pclmul(uint32_t crc, const unsigned char *buf,
+				  size_t len)
+{
+	size_t nfold = len & ~(size_t)15;
+
+	if (len < 64)
+		return pblk_crc32_zlib(crc, buf, len);
+
+	crc = ~pblk_crc32_pclmul_fold(~crc, buf, nfold);
+
+	return pblk_crc32_zlib(crc, buf + nfold, len - nfold);
+}
+
+static int pblk_crc32_pclmul_supported(void)
+{
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("pclmul") &&
+	       __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+#ifdef PBLK_CRC_ARMV8
+/**
+ * CRC32 using the ARMv8 CRC32 instructions, eight bytes at a time
+ */
+__attribute__((target("+crc")))
+static uint32_t pblk_crc32_armv8(uint32_t crc, const unsigned char *buf,
+				 size_t len)
+{
+	crc = ~crc;
+
+	while (len && ((uintptr_t)buf & 7)) {
+		crc = __crc32b(crc, *buf++);
+		--len;
+	}
+
+	while (len >= 8) {
+		uint64_t val;
+
+		memcpy(&val, buf, sizeof(val));
+		crc = __crc32d(crc, val);
+		buf += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		crc = __crc32b(crc, *buf++);
+
+	return ~crc;
+}
+
+static int pblk_crc32_armv8_supported(void)
+{
+	return !!(getauxval(AT_HWCAP) & HWCAP_CRC32);
+}
+#endif
+
+const struct pblk_crc32_impl pblk_crc32_impls[] = {
+#ifdef PBLK_CRC_X86
+	{ "pclmul", pblk_crc32_pclmul, pblk_crc32_pclmul_supported },
+#endif
+#ifdef PBLK_CRC_ARMV8
+	{ "armv8", pblk_crc32_armv8, pblk_crc32_armv8_supported },
+#endif
+	{ "zlib", pblk_crc32_zlib, pblk_crc32_zlib_supported },
+};
+
+const int pblk_crc32_nimpls = sizeof(pblk_crc32_impls) /
+			      sizeof(pblk_crc32_impls[0]);
+
+static const struct pblk_crc32_impl *pblk_crc32_sel;
+static pthread_once_t pblk_crc32_sel_once = PTHREAD_ONCE_INIT;
+
+static void pblk_crc32_select(void)
+{
+	for (int i = 0; i < pblk_crc32_nimpls; ++i) {
+		if (pblk_crc32_impls[i].supported()) {
+			pblk_crc32_sel = &pblk_crc32_impls[i];
+			return;
+		}
+	}
+}
+
+const struct pblk_crc32_impl *pblk_crc32_impl(void)
+{
+	pthread_once(&pblk_crc32_sel_once, pblk_crc32_select);
+
+	return pblk_crc32_sel;
+}
+
+uint32_t pblk_crc32(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	return pblk_crc32_impl()->fn(crc, buf, len);
+}
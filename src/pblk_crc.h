@@ -0,0 +1,41 @@
+#ifndef __PBLK_CRC_H
+#define __PBLK_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * CRC32 function with the semantics of zlib `crc32`, that is, the given `crc`
+ * is the result of a previous call, or 0 for the first call
+ */
+typedef uint32_t (*pblk_crc32_fn)(uint32_t crc, const unsigned char *buf,
+				  size_t len);
+
+/**
+ * A CRC32 implementation and a probe for whether the CPU supports it
+ */
+struct pblk_crc32_impl {
+	const char *name;			///< Name of the implementation
+	pblk_crc32_fn fn;			///< The CRC32 function
+	int (*supported)(void);			///< Returns 1 when usable
+};
+
+/**
+ * Available implementations, the fastest first, the last is zlib `crc32`
+ */
+extern const struct pblk_crc32_impl pblk_crc32_impls[];
+extern const int pblk_crc32_nimpls;
+
+/**
+ * Returns the implementation used by `pblk_crc32`, selected on first use as
+ * the first supported entry of `pblk_crc32_impls`
+ */
+const struct pblk_crc32_impl *pblk_crc32_impl(void);
+
+/**
+ * Compute CRC32 of the given buffer, bit-exact with zlib `crc32`, using the
+ * fastest implementation supported by the CPU
+ */
+uint32_t pblk_crc32(uint32_t crc, const unsigned char *buf, size_t len);
+
+#endif /* __PBLK_CRC_H */
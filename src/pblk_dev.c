@@ -0,0 +1,1765 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <liblightnvm.h>
+#include <pblk_dev.h>
+
+//
+// liblightnvm backend
+//
+
+struct pblk_dev_lnvm {
+	struct nvm_dev *dev;
+	int owned;				///< Close dev when closing
+};
+
+static int pblk_dev_lnvm_init(struct pblk_dev *dev, struct nvm_dev *nvm_dev,
+			      int owned)
+{
+	struct pblk_dev_lnvm *lnvm = NULL;
+
+	lnvm = malloc(sizeof(*lnvm));
+	if (!lnvm) {
+		errno = ENOMEM;
+		return -1;
+	}
+	lnvm->dev = nvm_dev;
+	lnvm->owned = owned;
+
+	dev->priv = lnvm;
+	dev->name = nvm_dev_get_name(nvm_dev);
+	dev->geo = *nvm_dev_get_geo(nvm_dev);
+	dev->read_naddrs_max = nvm_dev_get_read_naddrs_max(nvm_dev);
+
+	return 0;
+}
+
+static int pblk_dev_lnvm_open(struct pblk_dev *dev, const char *path)
+{
+	struct nvm_dev *nvm_dev = nvm_dev_open(path);
+
+	if (!nvm_dev)
+		return -1;
+
+	if (pblk_dev_lnvm_init(dev, nvm_dev, 1)) {
+		nvm_dev_close(nvm_dev);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void pblk_dev_lnvm_close(struct pblk_dev *dev)
+{
+	struct pblk_dev_lnvm *lnvm = dev->priv;
+
+	if (lnvm->owned)
+		nvm_dev_close(lnvm->dev);
+	free(lnvm);
+}
+
+static const struct nvm_bbt *pblk_dev_lnvm_bbt_get(struct pblk_dev *dev,
+						   struct nvm_addr addr,
+						   struct nvm_ret *ret)
+{
+	struct pblk_dev_lnvm *lnvm = dev->priv;
+
+	return nvm_bbt_get(lnvm->dev, addr, ret);
+}
+
+static int pblk_dev_lnvm_bbt_mark(struct pblk_dev *dev,
+				  struct nvm_addr addrs[], int naddrs,
+				  uint16_t flags, struct nvm_ret *ret)
+{
+	struct pblk_dev_lnvm *lnvm = dev->priv;
+
+	return nvm_bbt_mark(lnvm->dev, addrs, naddrs, flags, ret);
+}
+
+static ssize_t pblk_dev_lnvm_read(struct pblk_dev *dev,
+				  struct nvm_addr addrs[], int naddrs,
+				  void *buf, struct nvm_ret *ret)
+{
+	struct pblk_dev_lnvm *lnvm = dev->priv;
+
+	return nvm_addr_read(lnvm->dev, addrs, naddrs, buf, NULL, 0x0, ret);
+}
+
+static ssize_t pblk_dev_lnvm_erase(struct pblk_dev *dev,
+				   struct nvm_addr addrs[], int naddrs,
+				   struct nvm_ret *ret)
+{
+	struct pblk_dev_lnvm *lnvm = dev->priv;
+	struct nvm_vblk *vblk = NULL;
+	ssize_t err;
+
+	// A virtual block erases the blocks on all planes, using the
+	// plane-mode of the device
+	vblk = nvm_vblk_alloc(lnvm->dev, addrs, naddrs);
+	if (!vblk)
+		return -1;
+
+	err = nvm_vblk_erase(vblk);
+	nvm_vblk_free(vblk);
+
+	return err < 0 ? -1 : 0;
+}
+
+#ifdef PBLK_HAVE_NVM_CMD_RPRT
+/**
+ * Fetch the chunk report of all LUNs by one log-page command, the write
+ * pointer of a chunk is reported in sectors of all planes
+ */
+static int pblk_dev_lnvm_chunk_rprt(struct pblk_dev *dev,
+				    struct pblk_dev_chunk *chunks,
+				    struct nvm_ret *ret)
+{
+	const struct nvm_geo *geo = &dev->geo;
+	const uint64_t sec_per_pg = geo->nplanes * geo->nsectors;
+	const uint64_t nchunks = geo->nchannels * geo->nluns * geo->nblocks;
+	struct pblk_dev_lnvm *lnvm = dev->priv;
+	struct nvm_spec_rprt *rprt = NULL;
+
+	rprt = nvm_cmd_rprt(lnvm->dev, NULL, 0x0, ret);
+	if (!rprt)
+		return -1;
+
+	if (rprt->nchunks != nchunks) {
+		nvm_buf_free(lnvm->dev, rprt);
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (uint64_t i = 0; i < nchunks; ++i) {
+		chunks[i].state = rprt->descr[i].cs;
+		chunks[i].wp = rprt->descr[i].wp / sec_per_pg;
+	}
+
+	nvm_buf_free(lnvm->dev, rprt);
+
+	return 0;
+}
+#endif
+
+// NOTE: Writing is left to pblk, thus the backend has no write
+static const struct pblk_dev_ops pblk_dev_lnvm_ops = {
+	.name = "lnvm",
+	.prefix = NULL,
+	.open = pblk_dev_lnvm_open,
+	.close = pblk_dev_lnvm_close,
+	.bbt_get = pblk_dev_lnvm_bbt_get,
+	.bbt_mark = pblk_dev_lnvm_bbt_mark,
+	.read = pblk_dev_lnvm_read,
+	.write = NULL,
+	.erase = pblk_dev_lnvm_erase,
+#ifdef PBLK_HAVE_NVM_CMD_RPRT
+	.chunk_rprt = pblk_dev_lnvm_chunk_rprt,
+#endif
+};
+
+//
+// Image file backend
+//
+// The image is a sparse file of: a header, the bad-block tables, a bitmap of
+// written sectors, and the sectors. Tables are ordered by LUN, entries by
+// block then plane. Sectors are ordered by channel, LUN, block, page, plane
+// then sector. Only written sectors take up space, when their content is not
+// all zeroes.
+//
+
+#define PBLK_IMG_MAGIC 0x31474d494b4c4250ULL	// "PBLKIMG1"
+#define PBLK_IMG_ALIGN 4096
+
+struct pblk_img_hdr {
+	uint64_t magic;
+	uint64_t nchannels;
+	uint64_t nluns;
+	uint64_t nplanes;
+	uint64_t nblocks;
+	uint64_t npages;
+	uint64_t nsectors;
+	uint64_t sector_nbytes;
+	uint64_t read_naddrs_max;
+	uint64_t bbt_ofz;			///< Offset of bad-block tables
+	uint64_t map_ofz;			///< Offset of written bitmap
+	uint64_t data_ofz;			///< Offset of sectors
+	uint64_t nbytes;			///< Size of the image
+};
+
+struct pblk_dev_img {
+	int fd;
+	char *map;				///< The mmap'd image
+	size_t map_nbytes;
+	uint8_t *bbt;				///< Bad-block tables
+	uint64_t *written;			///< Bitmap of written sectors
+	char *data;				///< Sectors
+	struct nvm_bbt *bbts;			///< Per-LUN views of `bbt`
+};
+
+static inline uint64_t pblk_img_align(uint64_t nbytes)
+{
+	return (nbytes + PBLK_IMG_ALIGN - 1) & ~(uint64_t)(PBLK_IMG_ALIGN - 1);
+}
+
+/**
+ * Compute the layout of an image emulating the given geometry
+ */
+static void pblk_img_hdr_fill(struct pblk_img_hdr *hdr,
+			      const struct nvm_geo *geo, int read_naddrs_max)
+{
+	const uint64_t tluns = geo->nchannels * geo->nluns;
+	const uint64_t nsecs = tluns * geo->nblocks * geo->npages *
+			       geo->nplanes * geo->nsectors;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = PBLK_IMG_MAGIC;
+	hdr->nchannels = geo->nchannels;
+	hdr->nluns = geo->nluns;
+	hdr->nplanes = geo->nplanes;
+	hdr->nblocks = geo->nblocks;
+	hdr->npages = geo->npages;
+	hdr->nsectors = geo->nsectors;
+	hdr->sector_nbytes = geo->sector_nbytes;
+	hdr->read_naddrs_max = read_naddrs_max;
+
+	hdr->bbt_ofz = PBLK_IMG_ALIGN;
+	hdr->map_ofz = hdr->bbt_ofz +
+		       pblk_img_align(tluns * geo->nblocks * geo->nplanes);
+	hdr->data_ofz = hdr->map_ofz +
+			pblk_img_align(((nsecs + 63) / 64) * sizeof(uint64_t));
+	hdr->nbytes = hdr->data_ofz + nsecs * geo->sector_nbytes;
+}
+
+int pblk_dev_img_create(const char *path, const struct nvm_geo *geo,
+			int read_naddrs_max)
+{
+	struct pblk_img_hdr hdr;
+	int fd;
+
+	if (!(geo->nchannels && geo->nluns && geo->nplanes && geo->nblocks &&
+	      geo->npages && geo->nsectors && geo->sector_nbytes)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pblk_img_hdr_fill(&hdr, geo, read_naddrs_max);
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+
+	if ((pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) ||
+	    ftruncate(fd, hdr.nbytes)) {
+		int err = errno;
+
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return close(fd);
+}
+
+static inline uint64_t pblk_img_sec(const struct nvm_geo *geo,
+				    struct nvm_addr addr)
+{
+	return ((((addr.g.ch * geo->nluns + addr.g.lun) * geo->nblocks +
+		  addr.g.blk) * geo->npages + addr.g.pg) * geo->nplanes +
+		addr.g.pl) * geo->nsectors + addr.g.sec;
+}
+
+static inline int pblk_img_addr_valid(const struct nvm_geo *geo,
+				      struct nvm_addr addr)
+{
+	return (addr.g.ch < geo->nchannels) && (addr.g.lun < geo->nluns) &&
+	       (addr.g.blk < geo->nblocks) && (addr.g.pg < geo->npages) &&
+	       (addr.g.pl < geo->nplanes) && (addr.g.sec < geo->nsectors);
+}
+
+static inline uint8_t *pblk_img_bbt_ent(struct pblk_dev *dev,
+					struct nvm_addr addr)
+{
+	const struct nvm_geo *geo = &dev->geo;
+	struct pblk_dev_img *img = dev->priv;
+
+	return &img->bbt[((addr.g.ch * geo->nluns + addr.g.lun) *
+			  geo->nblocks + addr.g.blk) * geo->nplanes +
+			 addr.g.pl];
+}
+
+static inline int pblk_img_written(struct pblk_dev_img *img, uint64_t sec)
+{
+	return (__atomic_load_n(&img->written[sec / 64], __ATOMIC_RELAXED) >>
+		(sec % 64)) & 0x1;
+}
+
+/**
+ * Fill the sizes of the given geometry derived from its counts, as for the
+ * geometries of emulated devices
+ */
+static void pblk_dev_geo_derive(struct nvm_geo *geo)
+{
+	geo->page_nbytes = geo->nsectors * geo->sector_nbytes;
+	geo->meta_nbytes = 16;
+	geo->vpg_nbytes = geo->nplanes * geo->page_nbytes;
+	geo->vblk_nbytes = geo->npages * geo->vpg_nbytes;
+	geo->tbytes = geo->nchannels * geo->nluns * geo->nblocks *
+		      geo->vblk_nbytes;
+}
+
+static void pblk_dev_img_close(struct pblk_dev *dev)
+{
+	struct pblk_dev_img *img = dev->priv;
+
+	if (!img)
+		return;
+
+	if (img->map)
+		munmap(img->map, img->map_nbytes);
+	if (img->fd >= 0)
+		close(img->fd);
+	free(img->bbts);
+	free((char *)dev->name);
+	free(img);
+}
+
+static int pblk_dev_img_open(struct pblk_dev *dev, const char *path)
+{
+	struct pblk_dev_img *img = NULL;
+	struct pblk_img_hdr hdr, expected;
+	struct nvm_geo *geo = &dev->geo;
+	struct stat st;
+	int prot = PROT_READ | PROT_WRITE;
+
+	img = malloc(sizeof(*img));
+	if (!img) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(img, 0, sizeof(*img));
+	dev->priv = img;
+
+	img->fd = open(path, O_RDWR);
+	if ((img->fd < 0) && (errno == EACCES || errno == EROFS)) {
+		img->fd = open(path, O_RDONLY);
+		prot = PROT_READ;
+	}
+	if (img->fd < 0)
+		goto failed;
+
+	if (pread(img->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+		errno = EINVAL;
+		goto failed;
+	}
+	if (hdr.magic != PBLK_IMG_MAGIC) {
+		errno = EINVAL;
+		goto failed;
+	}
+
+	memset(geo, 0, sizeof(*geo));
+	geo->nchannels = hdr.nchannels;
+	geo->nluns = hdr.nluns;
+	geo->nplanes = hdr.nplanes;
+	geo->nblocks = hdr.nblocks;
+	geo->npages = hdr.npages;
+	geo->nsectors = hdr.nsectors;
+	geo->sector_nbytes = hdr.sector_nbytes;
+	pblk_dev_geo_derive(geo);
+
+	// The layout is derived from the geometry, anything else is corrupt
+	pblk_img_hdr_fill(&expected, geo, hdr.read_naddrs_max);
+	if (memcmp(&hdr, &expected, sizeof(hdr)) ||
+	    fstat(img->fd, &st) || ((uint64_t)st.st_size < hdr.nbytes)) {
+		errno = EINVAL;
+		goto failed;
+	}
+
+	img->map_nbytes = hdr.nbytes;
+	img->map = mmap(NULL, img->map_nbytes, prot, MAP_SHARED, img->fd, 0);
+	if (img->map == MAP_FAILED) {
+		img->map = NULL;
+		goto failed;
+	}
+	img->bbt = (uint8_t *)(img->map + hdr.bbt_ofz);
+	img->written = (uint64_t *)(img->map + hdr.map_ofz);
+	img->data = img->map + hdr.data_ofz;
+
+	img->bbts = calloc(geo->nchannels * geo->nluns, sizeof(*img->bbts));
+	if (!img->bbts) {
+		errno = ENOMEM;
+		goto failed;
+	}
+	for (size_t tlun = 0; tlun < geo->nchannels * geo->nluns; ++tlun) {
+		struct nvm_bbt *bbt = &img->bbts[tlun];
+
+		bbt->addr.g.ch = tlun / geo->nluns;
+		bbt->addr.g.lun = tlun % geo->nluns;
+		bbt->nblks = geo->nblocks * geo->nplanes;
+		bbt->blks = img->bbt + tlun * bbt->nblks;
+	}
+
+	dev->name = strdup(path);
+	dev->read_naddrs_max = hdr.read_naddrs_max;
+
+	return 0;
+
+failed:
+	{
+		int err = errno;
+
+		pblk_dev_img_close(dev);
+		dev->priv = NULL;
+		errno = err;
+	}
+	return -1;
+}
+
+static const struct nvm_bbt *pblk_dev_img_bbt_get(struct pblk_dev *dev,
+						  struct nvm_addr addr,
+						  struct nvm_ret *ret)
+{
+	const struct nvm_geo *geo = &dev->geo;
+	struct pblk_dev_img *img = dev->priv;
+	struct nvm_bbt *bbt = NULL;
+
+	if ((addr.g.ch >= geo->nchannels) || (addr.g.lun >= geo->nluns)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	bbt = &img->bbts[addr.g.ch * geo->nluns + addr.g.lun];
+	bbt->nbad = bbt->ngbad = bbt->ndmrk = bbt->nhmrk = 0;
+	for (uint64_t i = 0; i < bbt->nblks; ++i) {
+		bbt->nbad += !!(bbt->blks[i] & NVM_BBT_BAD);
+		bbt->ngbad += !!(bbt->blks[i] & NVM_BBT_GBAD);
+		bbt->ndmrk += !!(bbt->blks[i] & NVM_BBT_DMRK);
+		bbt->nhmrk += !!(bbt->blks[i] & NVM_BBT_HMRK);
+	}
+
+	if (ret)
+		memset(ret, 0, sizeof(*ret));
+
+	return bbt;
+}
+
+static int pblk_dev_img_bbt_mark(struct pblk_dev *dev,
+				 struct nvm_addr addrs[], int naddrs,
+				 uint16_t flags, struct nvm_ret *ret)
+{
+	if (ret)
+		memset(ret, 0, sizeof(*ret));
+
+	for (int i = 0; i < naddrs; ++i) {
+		if (!pblk_img_addr_valid(&dev->geo, addrs[i])) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	for (int i = 0; i < naddrs; ++i)
+		*pblk_img_bbt_ent(dev, addrs[i]) = flags;
+
+	return 0;
+}
+
+static int pblk_img_blk_bad(struct pblk_dev *dev, struct nvm_addr addr)
+{
+	return *pblk_img_bbt_ent(dev, addr) != NVM_BBT_FREE;
+}
+
+/**
+ * Read the given sectors, sectors never written complete as empty, like
+ * reading an erased page of the device
+ */
+static ssize_t pblk_dev_img_read(struct pblk_dev *dev,
+				 struct nvm_addr addrs[], int naddrs,
+				 void *buf, struct nvm_ret *ret)
+{
+	const struct nvm_geo *geo = &dev->geo;
+	const size_t sector_nbytes = geo->sector_nbytes;
+	struct pblk_dev_img *img = dev->priv;
+	struct nvm_ret lret = { 0 };
+
+	for (int i = 0; i < naddrs; ++i) {
+		char *dst = (char *)buf + i * sector_nbytes;
+		uint64_t sec;
+
+		if (!pblk_img_addr_valid(geo, addrs[i])) {
+			lret.status |= 1ULL << (i % 64);
+			continue;
+		}
+
+		sec = pblk_img_sec(geo, addrs[i]);
+		if (!pblk_img_written(img, sec)) {
+			memset(dst, 0, sector_nbytes);
+			lret.status |= 1ULL << (i % 64);
+			lret.result = PBLK_DEV_RESULT_EMPTY;
+			continue;
+		}
+
+		memcpy(dst, img->data + sec * sector_nbytes, sector_nbytes);
+	}
+
+	if (ret)
+		*ret = lret;
+	if (lret.status) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Write the given sectors, sectors must be erased before they are written
+ * again and blocks marked bad cannot be written
+ */
+static ssize_t pblk_dev_img_write(struct pblk_dev *dev,
+				  struct nvm_addr addrs[], int naddrs,
+				  const void *buf, struct nvm_ret *ret)
+{
+	const struct nvm_geo *geo = &dev->geo;
+	const size_t sector_nbytes = geo->sector_nbytes;
+	struct pblk_dev_img *img = dev->priv;
+	struct nvm_ret lret = { 0 };
+
+	for (int i = 0; i < naddrs; ++i) {
+		const char *src = (const char *)buf + i * sector_nbytes;
+		uint64_t sec;
+		size_t nz;
+
+		if (!pblk_img_addr_valid(geo, addrs[i]) ||
+		    pblk_img_blk_bad(dev, addrs[i])) {
+			lret.status |= 1ULL << (i % 64);
+			continue;
+		}
+
+		sec = pblk_img_sec(geo, addrs[i]);
+		if (pblk_img_written(img, sec)) {
+			lret.status |= 1ULL << (i % 64);
+			continue;
+		}
+
+		// Erased sectors are holes, keep them so for zero content
+		for (nz = 0; (nz < sector_nbytes) && (!src[nz]); ++nz)
+			;
+		if (nz != sector_nbytes)
+			memcpy(img->data + sec * sector_nbytes, src,
+			       sector_nbytes);
+
+		__atomic_fetch_or(&img->written[sec / 64], 1ULL << (sec % 64),
+				  __ATOMIC_RELAXED);
+	}
+
+	if (ret)
+		*ret = lret;
+	if (lret.status) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+static ssize_t pblk_dev_img_erase(struct pblk_dev *dev,
+				  struct nvm_addr addrs[], int naddrs,
+				  struct nvm_ret *ret)
+{
+	const struct nvm_geo *geo = &dev->geo;
+	const uint64_t blk_nsecs = geo->npages * geo->nplanes * geo->nsectors;
+	struct pblk_dev_img *img = dev->priv;
+	struct nvm_ret lret = { 0 };
+
+	for (int i = 0; i < naddrs; ++i) {
+		struct nvm_addr addr = addrs[i];
+		uint64_t sec;
+		int bad = 0;
+
+		addr.g.pg = 0;
+		addr.g.sec = 0;
+		for (addr.g.pl = 0; addr.g.pl < geo->nplanes; ++addr.g.pl)
+			bad |= pblk_img_addr_valid(geo, addr) ?
+				pblk_img_blk_bad(dev, addr) : 1;
+		if (bad) {
+			lret.status |= 1ULL << (i % 64);
+			continue;
+		}
+
+		addr.g.pl = 0;
+		sec = pblk_img_sec(geo, addr);
+		for (uint64_t s = sec; s < sec + blk_nsecs; ++s)
+			__atomic_fetch_and(&img->written[s / 64],
+					   ~(1ULL << (s % 64)),
+					   __ATOMIC_RELAXED);
+
+		if (fallocate(img->fd,
+			      FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			      (img->data - img->map) +
+					sec * geo->sector_nbytes,
+			      blk_nsecs * geo->sector_nbytes))
+			memset(img->data + sec * geo->sector_nbytes, 0,
+			       blk_nsecs * geo->sector_nbytes);
+	}
+
+	if (ret)
+		*ret = lret;
+	if (lret.status) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Emulate the chunk report: blocks marked bad on any plane are offline, and
+ * the write pointer is past the last page with a sector written
+ */
+static int pblk_dev_img_chunk_rprt(struct pblk_dev *dev,
+				   struct pblk_dev_chunk *chunks,
+				   struct nvm_ret *ret)
+{
+	const struct nvm_geo *geo = &dev->geo;
+	const uint64_t sec_per_pg = geo->nplanes * geo->nsectors;
+	struct pblk_dev_img *img = dev->priv;
+	struct nvm_addr addr;
+	size_t i = 0;
+
+	addr.ppa = 0;
+	for (size_t tlun = 0; tlun < geo->nchannels * geo->nluns; ++tlun) {
+		addr.g.ch = tlun / geo->nluns;
+		addr.g.lun = tlun % geo->nluns;
+
+		for (size_t blk = 0; blk < geo->nblocks; ++blk, ++i) {
+			struct pblk_dev_chunk *chunk = &chunks[i];
+			uint64_t sec, nsec;
+			int bad = 0;
+
+			addr.g.blk = blk;
+			for (addr.g.pl = 0; addr.g.pl < geo->nplanes;
+			     ++addr.g.pl)
+				bad |= pblk_img_blk_bad(dev, addr);
+			addr.g.pl = 0;
+			if (bad) {
+				chunk->state = PBLK_DEV_CHUNK_OFFLINE;
+				chunk->wp = 0;
+				continue;
+			}
+
+			sec = pblk_img_sec(geo, addr);
+			for (nsec = geo->npages * sec_per_pg; nsec; --nsec) {
+				if (pblk_img_written(img, sec + nsec - 1))
+					break;
+			}
+
+			chunk->wp = (nsec + sec_per_pg - 1) / sec_per_pg;
+			if (!chunk->wp)
+				chunk->state = PBLK_DEV_CHUNK_FREE;
+			else if (chunk->wp == geo->npages)
+				chunk->state = PBLK_DEV_CHUNK_CLOSED;
+			else
+				chunk->state = PBLK_DEV_CHUNK_OPEN;
+		}
+	}
+
+	if (ret)
+		memset(ret, 0, sizeof(*ret));
+
+	return 0;
+}
+
+static const struct pblk_dev_ops pblk_dev_img_ops = {
+	.name = "img",
+	.prefix = PBLK_DEV_IMG_PREFIX,
+	.open = pblk_dev_img_open,
+	.close = pblk_dev_img_close,
+	.bbt_get = pblk_dev_img_bbt_get,
+	.bbt_mark = pblk_dev_img_bbt_mark,
+	.read = pblk_dev_img_read,
+	.write = pblk_dev_img_write,
+	.erase = pblk_dev_img_erase,
+	.chunk_rprt = pblk_dev_img_chunk_rprt,
+};
+
+//
+// Metadump backend
+//
+// A metadump holds the sectors, bad-block tables and chunk report read from a
+// device while capturing, see `pblk_dev_dump_start`, and serves them back
+// read-only. The file is: a header, the sectors in zlib-compressed chunks, the
+// bad-block tables and the chunk report each compressed as one stream, a
+// table of the chunks, and an index of the sectors sorted by address. Sectors
+// failing to read while capturing are in the index, with their result, but not
+// in a chunk.
+//
+
+#define PBLK_DUMP_MAGIC 0x31504d444b4c4250ULL	// "PBLKDMP1"
+#define PBLK_DUMP_VER 0x1
+#define PBLK_DUMP_CHUNK_NSECS 64		///< Sectors per chunk
+#define PBLK_DUMP_NSLOTS 16			///< Decompressed chunks cached
+#define PBLK_DUMP_CHUNK_NONE (~(uint32_t)0)
+
+struct pblk_dump_hdr {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t chunk_nsecs;
+	char name[64];				///< Name of the device captured
+	uint64_t nchannels;
+	uint64_t nluns;
+	uint64_t nplanes;
+	uint64_t nblocks;
+	uint64_t npages;
+	uint64_t nsectors;
+	uint64_t sector_nbytes;
+	uint64_t read_naddrs_max;
+	uint64_t ts;				///< Time of capture, epoch seconds
+	uint64_t nbbts;				///< LUNs with a bad-block table
+	uint64_t bbt_ofz;			///< Offset of bad-block tables
+	uint64_t bbt_nbytes;			///< Compressed size of tables
+	uint64_t rprt_ofz;			///< Offset of chunk report
+	uint64_t rprt_nbytes;			///< Compressed size, 0 if none
+	uint64_t nchunks;
+	uint64_t chunk_ofz;			///< Offset of chunk table
+	uint64_t nsecs;
+	uint64_t sec_ofz;			///< Offset of sector index
+	uint64_t nbytes;			///< Size of the metadump
+};
+
+struct pblk_dump_chunk {
+	uint64_t ofz;				///< Offset of compressed sectors
+	uint32_t nbytes;			///< Compressed size
+	uint32_t nsecs;
+};
+
+struct pblk_dump_sec {
+	uint64_t ppa;				///< nvm_addr of the sector
+	uint32_t result;			///< nvm_ret result, when failed
+	uint16_t failed;			///< Read failed, no content
+	uint16_t pos;				///< Sector in chunk
+	uint32_t chunk;				///< PBLK_DUMP_CHUNK_NONE if failed
+	uint32_t rsvd;
+};
+
+/**
+ * Capture of the reads of a device into a metadump, sectors are compressed
+ * into chunks and appended to the file as they are read
+ */
+struct pblk_dump_rec {
+	pthread_mutex_t lock;
+	char *path;				///< Path of the metadump
+	char *tmp_path;				///< Written, renamed when done
+	int fd;
+	int err;				///< errno of first failure
+	uint64_t ofz;				///< End of file
+	char *chunk;				///< Chunk being filled
+	uint32_t chunk_nsecs;			///< Sectors in chunk
+	char *zbuf;				///< Compressed chunk
+	size_t zbuf_nbytes;
+	struct pblk_dump_chunk *chunks;
+	uint64_t nchunks;
+	uint64_t nchunks_max;
+	struct pblk_dump_sec *secs;
+	uint64_t nsecs;
+	uint64_t nsecs_max;
+	uint8_t *bbts;				///< Tables of all LUNs
+	uint8_t *bbt_seen;			///< Tables captured, per LUN
+	struct pblk_dev_chunk *rprt;		///< Chunk report, or NULL
+	uint64_t nbytes_raw;			///< Sectors and tables captured
+};
+
+static inline size_t pblk_dump_bbt_nblks(const struct nvm_geo *geo)
+{
+	return geo->nblocks * geo->nplanes;
+}
+
+static int pblk_dump_pwrite(int fd, const void *buf, size_t nbytes,
+			    uint64_t ofz)
+{
+	while (nbytes) {
+		const ssize_t ret = pwrite(fd, buf, nbytes, ofz);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf = (const char *)buf + ret;
+		nbytes -= ret;
+		ofz += ret;
+	}
+
+	return 0;
+}
+
+static void pblk_dump_rec_fail(struct pblk_dump_rec *rec, int err)
+{
+	if (!rec->err)
+		rec->err = err;
+}
+
+static void pblk_dump_rec_free(struct pblk_dump_rec *rec)
+{
+	if (rec->fd >= 0)
+		close(rec->fd);
+	pthread_mutex_destroy(&rec->lock);
+	free(rec->path);
+	free(rec->tmp_path);
+	free(rec->chunk);
+	free(rec->zbuf);
+	free(rec->chunks);
+	free(rec->secs);
+	free(rec->bbts);
+	free(rec->bbt_seen);
+	free(rec->rprt);
+	free(rec);
+}
+
+/**
+ * Compress the chunk being filled and append it to the metadump
+ */
+static void pblk_dump_rec_flush(struct pblk_dump_rec *rec,
+				const struct nvm_geo *geo)
+{
+	uLongf zlen = rec->zbuf_nbytes;
+	struct pblk_dump_chunk *chunk;
+
+	if (!rec->chunk_nsecs)
+		return;
+
+	if (rec->nchunks == rec->nchunks_max) {
+		const uint64_t nmax = rec->nchunks_max ?
+				      rec->nchunks_max * 2 : 1024;
+		void *chunks = realloc(rec->chunks, nmax * sizeof(*chunk));
+
+		if (!chunks) {
+			pblk_dump_rec_fail(rec, ENOMEM);
+			return;
+		}
+		rec->chunks = chunks;
+		rec->nchunks_max = nmax;
+	}
+
+	if (compress2((Bytef *)rec->zbuf, &zlen, (const Bytef *)rec->chunk,
+		      rec->chunk_nsecs * geo->sector_nbytes,
+		      Z_DEFAULT_COMPRESSION) != Z_OK) {
+		pblk_dump_rec_fail(rec, EIO);
+		return;
+	}
+	if (pblk_dump_pwrite(rec->fd, rec->zbuf, zlen, rec->ofz)) {
+		pblk_dump_rec_fail(rec, errno);
+		return;
+	}
+
+	chunk = &rec->chunks[rec->nchunks++];
+	chunk->ofz = rec->ofz;
+	chunk->nbytes = zlen;
+	chunk->nsecs = rec->chunk_nsecs;
+
+	rec->ofz += zlen;
+	rec->chunk_nsecs = 0;
+}
+
+/**
+ * Capture the sectors of a read, a sector fails when its bit of `ret->status`
+ * is set, or every sector when the read fails without setting any
+ */
+static void pblk_dump_rec_read(struct pblk_dump_rec *rec,
+			       const struct nvm_geo *geo,
+			       const struct nvm_addr addrs[], int naddrs,
+			       const void *buf, const struct nvm_ret *ret,
+			       ssize_t err)
+{
+	pthread_mutex_lock(&rec->lock);
+
+	for (int i = 0; (!rec->err) && (i < naddrs); ++i) {
+		struct pblk_dump_sec *sec;
+		int failed = (ret->status >> (i % 64)) & 0x1;
+
+		if (err && (!ret->status))
+			failed = 1;
+
+		if (rec->nsecs == rec->nsecs_max) {
+			const uint64_t nmax = rec->nsecs_max ?
+					      rec->nsecs_max * 2 : 4096;
+			void *secs = realloc(rec->secs, nmax * sizeof(*sec));
+
+			if (!secs) {
+				pblk_dump_rec_fail(rec, ENOMEM);
+				break;
+			}
+			rec->secs = secs;
+			rec->nsecs_max = nmax;
+		}
+
+		sec = &rec->secs[rec->nsecs++];
+		memset(sec, 0, sizeof(*sec));
+		sec->ppa = addrs[i].ppa;
+		sec->chunk = PBLK_DUMP_CHUNK_NONE;
+
+		if (failed) {
+			sec->failed = 1;
+			sec->result = ret->result;
+			continue;
+		}
+
+		sec->chunk = rec->nchunks;
+		sec->pos = rec->chunk_nsecs;
+		memcpy(rec->chunk + rec->chunk_nsecs * geo->sector_nbytes,
+		       (const char *)buf + i * geo->sector_nbytes,
+		       geo->sector_nbytes);
+		rec->nbytes_raw += geo->sector_nbytes;
+
+		if (++rec->chunk_nsecs == PBLK_DUMP_CHUNK_NSECS)
+			pblk_dump_rec_flush(rec, geo);
+	}
+
+	pthread_mutex_unlock(&rec->lock);
+}
+
+static void pblk_dump_rec_bbt(struct pblk_dump_rec *rec,
+			      const struct nvm_geo *geo,
+			      const struct nvm_bbt *bbt)
+{
+	const size_t nblks = pblk_dump_bbt_nblks(geo);
+	const size_t tlun = bbt->addr.g.ch * geo->nluns + bbt->addr.g.lun;
+
+	if ((tlun >= geo->nchannels * geo->nluns) || (bbt->nblks != nblks))
+		return;
+
+	pthread_mutex_lock(&rec->lock);
+	if (!rec->bbt_seen[tlun]) {
+		memcpy(rec->bbts + tlun * nblks, bbt->blks, nblks);
+		rec->bbt_seen[tlun] = 1;
+		rec->nbytes_raw += nblks;
+	}
+	pthread_mutex_unlock(&rec->lock);
+}
+
+static void pblk_dump_rec_rprt(struct pblk_dump_rec *rec,
+			       const struct nvm_geo *geo,
+			       const struct pblk_dev_chunk *chunks)
+{
+	const size_t nbytes = geo->nchannels * geo->nluns * geo->nblocks *
+			      sizeof(*chunks);
+
+	pthread_mutex_lock(&rec->lock);
+	if (!rec->rprt) {
+		rec->rprt = malloc(nbytes);
+		if (rec->rprt) {
+			memcpy(rec->rprt, chunks, nbytes);
+			rec->nbytes_raw += nbytes;
+		}
+	}
+	pthread_mutex_unlock(&rec->lock);
+}
+
+static int pblk_dump_sec_cmp(const void *a, const void *b)
+{
+	const struct pblk_dump_sec *sa = a;
+	const struct pblk_dump_sec *sb = b;
+
+	if (sa->ppa != sb->ppa)
+		return sa->ppa < sb->ppa ? -1 : 1;
+	if (sa->failed != sb->failed)
+		return sa->failed - sb->failed;
+	if (sa->chunk != sb->chunk)
+		return sa->chunk < sb->chunk ? -1 : 1;
+
+	return sa->pos - sb->pos;
+}
+
+int pblk_dev_dump_start(struct pblk_dev *dev, const char *path)
+{
+	const struct nvm_geo *geo = &dev->geo;
+	const size_t tluns = geo->nchannels * geo->nluns;
+	struct pblk_dump_rec *rec = NULL;
+
+	if (dev->dump) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	rec = calloc(1, sizeof(*rec));
+	if (!rec) {
+		errno = ENOMEM;
+		return -1;
+	}
+	rec->fd = -1;
+	pthread_mutex_init(&rec->lock, NULL);
+
+	rec->zbuf_nbytes = compressBound(PBLK_DUMP_CHUNK_NSECS *
+					 geo->sector_nbytes);
+	rec->path = strdup(path);
+	rec->tmp_path = malloc(strlen(path) + 5);
+	rec->chunk = malloc(PBLK_DUMP_CHUNK_NSECS * geo->sector_nbytes);
+	rec->zbuf = malloc(rec->zbuf_nbytes);
+	rec->bbts = calloc(tluns, pblk_dump_bbt_nblks(geo));
+	rec->bbt_seen = calloc(tluns, 1);
+	if (!(rec->path && rec->tmp_path && rec->chunk && rec->zbuf &&
+	      rec->bbts && rec->bbt_seen)) {
+		pblk_dump_rec_free(rec);
+		errno = ENOMEM;
+		return -1;
+	}
+	sprintf(rec->tmp_path, "%s.tmp", path);
+
+	rec->fd = open(rec->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (rec->fd < 0) {
+		const int err = errno;
+
+		pblk_dump_rec_free(rec);
+		errno = err;
+		return -1;
+	}
+	rec->ofz = PBLK_IMG_ALIGN;
+
+	dev->dump = rec;
+
+	return 0;
+}
+
+void pblk_dev_dump_abort(struct pblk_dev *dev)
+{
+	struct pblk_dump_rec *rec = dev->dump;
+
+	if (!rec)
+		return;
+
+	dev->dump = NULL;
+	unlink(rec->tmp_path);
+	pblk_dump_rec_free(rec);
+}
+
+int pblk_dev_dump_finish(struct pblk_dev *dev,
+			 struct pblk_dev_dump_stat *stat)
+{
+	const struct nvm_geo *geo = &dev->geo;
+	const size_t nblks = pblk_dump_bbt_nblks(geo);
+	const size_t tluns = geo->nchannels * geo->nluns;
+	const size_t rprt_nbytes = tluns * geo->nblocks *
+				   sizeof(struct pblk_dev_chunk);
+	struct pblk_dump_rec *rec = dev->dump;
+	struct pblk_dump_hdr hdr;
+	uint8_t *bbts = NULL;
+	Bytef *zbbts = NULL;
+	Bytef *zrprt = NULL;
+	uLongf zlen, zrprt_nbytes = 0;
+	uint64_t nsecs = 0;
+	uint64_t nbbts = 0;
+
+	if (!rec) {
+		errno = EINVAL;
+		return -1;
+	}
+	dev->dump = NULL;
+
+	pblk_dump_rec_flush(rec, geo);
+
+	// Tables of the LUNs captured, each preceded by its LUN
+	bbts = malloc(tluns * (sizeof(uint32_t) + nblks) + 1);
+	zlen = compressBound(tluns * (sizeof(uint32_t) + nblks) + 1);
+	zbbts = malloc(zlen);
+	if (!(bbts && zbbts))
+		pblk_dump_rec_fail(rec, ENOMEM);
+
+	for (size_t tlun = 0; (!rec->err) && (tlun < tluns); ++tlun) {
+		uint8_t *dst = bbts + nbbts * (sizeof(uint32_t) + nblks);
+		const uint32_t tlun32 = tlun;
+
+		if (!rec->bbt_seen[tlun])
+			continue;
+
+		memcpy(dst, &tlun32, sizeof(tlun32));
+		memcpy(dst + sizeof(tlun32), rec->bbts + tlun * nblks, nblks);
+		++nbbts;
+	}
+
+	if ((!rec->err) &&
+	    (compress2(zbbts, &zlen, bbts,
+		       nbbts * (sizeof(uint32_t) + nblks),
+		       Z_DEFAULT_COMPRESSION) != Z_OK))
+		pblk_dump_rec_fail(rec, EIO);
+
+	if ((!rec->err) && rec->rprt) {
+		zrprt_nbytes = compressBound(rprt_nbytes);
+		zrprt = malloc(zrprt_nbytes);
+		if (!zrprt)
+			pblk_dump_rec_fail(rec, ENOMEM);
+		else if (compress2(zrprt, &zrprt_nbytes,
+				   (const Bytef *)rec->rprt, rprt_nbytes,
+				   Z_DEFAULT_COMPRESSION) != Z_OK)
+			pblk_dump_rec_fail(rec, EIO);
+	}
+
+	// A sector read more than once is kept once, preferring content
+	if (rec->nsecs)
+		qsort(rec->secs, rec->nsecs, sizeof(*rec->secs),
+		      pblk_dump_sec_cmp);
+	for (uint64_t i = 0; i < rec->nsecs; ++i) {
+		if (nsecs && (rec->secs[nsecs - 1].ppa == rec->secs[i].ppa))
+			continue;
+		rec->secs[nsecs++] = rec->secs[i];
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = PBLK_DUMP_MAGIC;
+	hdr.version = PBLK_DUMP_VER;
+	hdr.chunk_nsecs = PBLK_DUMP_CHUNK_NSECS;
+	strncpy(hdr.name, dev->name ? dev->name : "", sizeof(hdr.name) - 1);
+	hdr.nchannels = geo->nchannels;
+	hdr.nluns = geo->nluns;
+	hdr.nplanes = geo->nplanes;
+	hdr.nblocks = geo->nblocks;
+	hdr.npages = geo->npages;
+	hdr.nsectors = geo->nsectors;
+	hdr.sector_nbytes = geo->sector_nbytes;
+	hdr.read_naddrs_max = dev->read_naddrs_max;
+	hdr.ts = time(NULL);
+	hdr.nbbts = nbbts;
+	hdr.bbt_ofz = rec->ofz;
+	hdr.bbt_nbytes = zlen;
+	hdr.rprt_ofz = hdr.bbt_ofz + hdr.bbt_nbytes;
+	hdr.rprt_nbytes = zrprt_nbytes;
+	hdr.nchunks = rec->nchunks;
+	// Tables are mmap'd by readers, thus aligned to their entries
+	hdr.chunk_ofz = (hdr.rprt_ofz + hdr.rprt_nbytes + 7) & ~7ULL;
+	hdr.nsecs = nsecs;
+	hdr.sec_ofz = hdr.chunk_ofz + hdr.nchunks * sizeof(*rec->chunks);
+	hdr.nbytes = hdr.sec_ofz + hdr.nsecs * sizeof(*rec->secs);
+
+	if ((!rec->err) &&
+	    (pblk_dump_pwrite(rec->fd, zbbts, hdr.bbt_nbytes, hdr.bbt_ofz) ||
+	     pblk_dump_pwrite(rec->fd, zrprt, hdr.rprt_nbytes,
+			      hdr.rprt_ofz) ||
+	     pblk_dump_pwrite(rec->fd, rec->chunks,
+			      hdr.nchunks * sizeof(*rec->chunks),
+			      hdr.chunk_ofz) ||
+	     pblk_dump_pwrite(rec->fd, rec->secs,
+			      hdr.nsecs * sizeof(*rec->secs), hdr.sec_ofz) ||
+	     pblk_dump_pwrite(rec->fd, &hdr, sizeof(hdr), 0) ||
+	     fsync(rec->fd) || rename(rec->tmp_path, rec->path)))
+		pblk_dump_rec_fail(rec, errno);
+
+	free(bbts);
+	free(zbbts);
+	free(zrprt);
+
+	if (rec->err) {
+		const int err = rec->err;
+
+		unlink(rec->tmp_path);
+		pblk_dump_rec_free(rec);
+		errno = err;
+		return -1;
+	}
+
+	memset(stat, 0, sizeof(*stat));
+	stat->nsecs = nsecs;
+	for (uint64_t i = 0; i < nsecs; ++i)
+		stat->nsecs_failed += rec->secs[i].failed;
+	stat->nbbts = nbbts;
+	stat->rprt = !!hdr.rprt_nbytes;
+	stat->nbytes_raw = rec->nbytes_raw;
+	stat->nbytes = hdr.nbytes;
+
+	pblk_dump_rec_free(rec);
+
+	return 0;
+}
+
+/**
+ * A chunk decompressed by a reader, chunks map to slots by their number
+ */
+struct pblk_dump_slot {
+	pthread_mutex_t lock;
+	uint64_t chunk;				///< Chunk held, nchunks if none
+	char *buf;
+};
+
+struct pblk_dev_dump {
+	int fd;
+	char *map;				///< The mmap'd metadump
+	size_t map_nbytes;
+	const struct pblk_dump_chunk *chunks;
+	uint64_t nchunks;
+	const struct pblk_dump_sec *secs;
+	uint64_t nsecs;
+	uint8_t *bbt;				///< Decompressed tables
+	struct nvm_bbt *bbts;			///< Per LUN, NULL blks if none
+	struct pblk_dev_chunk *rprt;		///< Chunk report, or NULL
+	struct pblk_dump_slot slots[PBLK_DUMP_NSLOTS];
+};
+
+static void pblk_dev_dump_close(struct pblk_dev *dev)
+{
+	struct pblk_dev_dump *dump = dev->priv;
+
+	if (!dump)
+		return;
+
+	for (int i = 0; i < PBLK_DUMP_NSLOTS; ++i) {
+		pthread_mutex_destroy(&dump->slots[i].lock);
+		free(dump->slots[i].buf);
+	}
+	if (dump->map)
+		munmap(dump->map, dump->map_nbytes);
+	if (dump->fd >= 0)
+		close(dump->fd);
+	free(dump->bbt);
+	free(dump->bbts);
+	free(dump->rprt);
+	free((char *)dev->name);
+	free(dump);
+}
+
+/**
+ * Check that the tables of the given metadump lie within it and reference
+ * only chunks within it
+ */
+static int pblk_dump_valid(const struct pblk_dump_hdr *hdr, uint64_t nbytes)
+{
+	if ((hdr->bbt_ofz > nbytes) ||
+	    (hdr->bbt_nbytes > nbytes - hdr->bbt_ofz) ||
+	    (hdr->rprt_ofz > nbytes) ||
+	    (hdr->rprt_nbytes > nbytes - hdr->rprt_ofz) ||
+	    (hdr->chunk_ofz > nbytes) ||
+	    (hdr->nchunks > (nbytes - hdr->chunk_ofz) /
+			    sizeof(struct pblk_dump_chunk)) ||
+	    (hdr->sec_ofz > nbytes) ||
+	    (hdr->nsecs > (nbytes - hdr->sec_ofz) /
+			  sizeof(struct pblk_dump_sec)) ||
+	    (hdr->chunk_ofz % sizeof(uint64_t)) ||
+	    (hdr->sec_ofz % sizeof(uint64_t)))
+		return 0;
+
+	return 1;
+}
+
+static int pblk_dev_dump_open(struct pblk_dev *dev, const char *path)
+{
+	struct pblk_dev_dump *dump = NULL;
+	struct nvm_geo *geo = &dev->geo;
+	struct pblk_dump_hdr hdr;
+	const uint8_t *bbt_recs;
+	size_t tluns, nblks;
+	uLongf bbt_nbytes;
+	struct stat st;
+
+	dump = calloc(1, sizeof(*dump));
+	if (!dump) {
+		errno = ENOMEM;
+		return -1;
+	}
+	dump->fd = -1;
+	for (int i = 0; i < PBLK_DUMP_NSLOTS; ++i)
+		pthread_mutex_init(&dump->slots[i].lock, NULL);
+	dev->priv = dump;
+
+	dump->fd = open(path, O_RDONLY);
+	if (dump->fd < 0)
+		goto failed;
+
+	if ((pread(dump->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) ||
+	    (hdr.magic != PBLK_DUMP_MAGIC) || (hdr.version != PBLK_DUMP_VER) ||
+	    (hdr.chunk_nsecs != PBLK_DUMP_CHUNK_NSECS) ||
+	    fstat(dump->fd, &st) || ((uint64_t)st.st_size < hdr.nbytes) ||
+	    (!pblk_dump_valid(&hdr, hdr.nbytes)) ||
+	    (!(hdr.nchannels && hdr.nluns && hdr.nplanes && hdr.nblocks &&
+	       hdr.npages && hdr.nsectors && hdr.sector_nbytes))) {
+		errno = EINVAL;
+		goto failed;
+	}
+
+	memset(geo, 0, sizeof(*geo));
+	geo->nchannels = hdr.nchannels;
+	geo->nluns = hdr.nluns;
+	geo->nplanes = hdr.nplanes;
+	geo->nblocks = hdr.nblocks;
+	geo->npages = hdr.npages;
+	geo->nsectors = hdr.nsectors;
+	geo->sector_nbytes = hdr.sector_nbytes;
+	pblk_dev_geo_derive(geo);
+
+	dump->map_nbytes = hdr.nbytes;
+	dump->map = mmap(NULL, dump->map_nbytes, PROT_READ, MAP_SHARED,
+			 dump->fd, 0);
+	if (dump->map == MAP_FAILED) {
+		dump->map = NULL;
+		goto failed;
+	}
+	dump->chunks = (const void *)(dump->map + hdr.chunk_ofz);
+	dump->nchunks = hdr.nchunks;
+	dump->secs = (const void *)(dump->map + hdr.sec_ofz);
+	dump->nsecs = hdr.nsecs;
+
+	for (uint64_t i = 0; i < dump->nchunks; ++i) {
+		const struct pblk_dump_chunk *chunk = &dump->chunks[i];
+
+		if ((chunk->ofz > hdr.nbytes) ||
+		    (chunk->nbytes > hdr.nbytes - chunk->ofz) ||
+		    (chunk->nsecs > PBLK_DUMP_CHUNK_NSECS)) {
+			errno = EINVAL;
+			goto failed;
+		}
+	}
+	for (uint64_t i = 0; i < dump->nsecs; ++i) {
+		const struct pblk_dump_sec *sec = &dump->secs[i];
+
+		if ((!sec->failed) && ((sec->chunk >= dump->nchunks) ||
+				       (sec->pos >=
+					dump->chunks[sec->chunk].nsecs))) {
+			errno = EINVAL;
+			goto failed;
+		}
+	}
+
+	tluns = geo->nchannels * geo->nluns;
+	nblks = pblk_dump_bbt_nblks(geo);
+	bbt_nbytes = hdr.nbbts * (sizeof(uint32_t) + nblks);
+	dump->bbt = malloc(bbt_nbytes + 1);
+	dump->bbts = calloc(tluns, sizeof(*dump->bbts));
+	if (!(dump->bbt && dump->bbts)) {
+		errno = ENOMEM;
+		goto failed;
+	}
+	if ((hdr.nbbts > tluns) ||
+	    (uncompress(dump->bbt, &bbt_nbytes,
+			(const Bytef *)dump->map + hdr.bbt_ofz,
+			hdr.bbt_nbytes) != Z_OK) ||
+	    (bbt_nbytes != hdr.nbbts * (sizeof(uint32_t) + nblks))) {
+		errno = EINVAL;
+		goto failed;
+	}
+
+	bbt_recs = dump->bbt;
+	for (uint64_t i = 0; i < hdr.nbbts; ++i) {
+		const uint8_t *rec = bbt_recs + i * (sizeof(uint32_t) + nblks);
+		uint32_t tlun;
+
+		memcpy(&tlun, rec, sizeof(tlun));
+		if (tlun >= tluns) {
+			errno = EINVAL;
+			goto failed;
+		}
+		dump->bbts[tlun].addr.g.ch = tlun / geo->nluns;
+		dump->bbts[tlun].addr.g.lun = tlun % geo->nluns;
+		dump->bbts[tlun].nblks = nblks;
+		dump->bbts[tlun].blks = (uint8_t *)rec + sizeof(tlun);
+	}
+
+	if (hdr.rprt_nbytes) {
+		uLongf rprt_nbytes = tluns * geo->nblocks *
+				     sizeof(*dump->rprt);
+		const uLongf expected = rprt_nbytes;
+
+		dump->rprt = malloc(rprt_nbytes);
+		if (!dump->rprt) {
+			errno = ENOMEM;
+			goto failed;
+		}
+		if ((uncompress((Bytef *)dump->rprt, &rprt_nbytes,
+				(const Bytef *)dump->map + hdr.rprt_ofz,
+				hdr.rprt_nbytes) != Z_OK) ||
+		    (rprt_nbytes != expected)) {
+			errno = EINVAL;
+			goto failed;
+		}
+	}
+
+	for (int i = 0; i < PBLK_DUMP_NSLOTS; ++i) {
+		dump->slots[i].chunk = dump->nchunks;
+		dump->slots[i].buf = malloc(PBLK_DUMP_CHUNK_NSECS *
+					    geo->sector_nbytes);
+		if (!dump->slots[i].buf) {
+			errno = ENOMEM;
+			goto failed;
+		}
+	}
+
+	dev->name = strdup(path);
+	dev->read_naddrs_max = hdr.read_naddrs_max;
+
+	return 0;
+
+failed:
+	{
+		int err = errno;
+
+		pblk_dev_dump_close(dev);
+		dev->priv = NULL;
+		errno = err;
+	}
+	return -1;
+}
+
+static const struct nvm_bbt *pblk_dev_dump_bbt_get(struct pblk_dev *dev,
+						   struct nvm_addr addr,
+						   struct nvm_ret *ret)
+{
+	const struct nvm_geo *geo = &dev->geo;
+	struct pblk_dev_dump *dump = dev->priv;
+	struct nvm_bbt *bbt = NULL;
+
+	if ((addr.g.ch >= geo->nchannels) || (addr.g.lun >= geo->nluns)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	bbt = &dump->bbts[addr.g.ch * geo->nluns + addr.g.lun];
+	if (!bbt->blks) {
+		errno = ENODATA;
+		return NULL;
+	}
+
+	bbt->nbad = bbt->ngbad = bbt->ndmrk = bbt->nhmrk = 0;
+	for (uint64_t i = 0; i < bbt->nblks; ++i) {
+		bbt->nbad += !!(bbt->blks[i] & NVM_BBT_BAD);
+		bbt->ngbad += !!(bbt->blks[i] & NVM_BBT_GBAD);
+		bbt->ndmrk += !!(bbt->blks[i] & NVM_BBT_DMRK);
+		bbt->nhmrk += !!(bbt->blks[i] & NVM_BBT_HMRK);
+	}
+
+	if (ret)
+		memset(ret, 0, sizeof(*ret));
+
+	return bbt;
+}
+
+static const struct pblk_dump_sec *pblk_dump_sec_find(
+					const struct pblk_dev_dump *dump,
+					uint64_t ppa)
+{
+	uint64_t lo = 0, hi = dump->nsecs;
+
+	while (lo < hi) {
+		const uint64_t mid = lo + (hi - lo) / 2;
+
+		if (dump->secs[mid].ppa < ppa)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return ((lo < dump->nsecs) && (dump->secs[lo].ppa == ppa)) ?
+	       &dump->secs[lo] : NULL;
+}
+
+/**
+ * Copy the content of the given sector to `dst`, decompressing its chunk into
+ * the slot of the chunk unless it holds it already
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned.
+ */
+static int pblk_dump_sec_copy(struct pblk_dev_dump *dump,
+			      const struct nvm_geo *geo,
+			      const struct pblk_dump_sec *sec, char *dst)
+{
+	const struct pblk_dump_chunk *chunk = &dump->chunks[sec->chunk];
+	struct pblk_dump_slot *slot = &dump->slots[sec->chunk %
+						   PBLK_DUMP_NSLOTS];
+	int err = 0;
+
+	pthread_mutex_lock(&slot->lock);
+	if (slot->chunk != sec->chunk) {
+		uLongf nbytes = PBLK_DUMP_CHUNK_NSECS * geo->sector_nbytes;
+
+		if ((uncompress((Bytef *)slot->buf, &nbytes,
+				(const Bytef *)dump->map + chunk->ofz,
+				chunk->nbytes) != Z_OK) ||
+		    (nbytes != chunk->nsecs * geo->sector_nbytes)) {
+			slot->chunk = dump->nchunks;
+			err = -1;
+		} else {
+			slot->chunk = sec->chunk;
+		}
+	}
+	if (!err)
+		memcpy(dst, slot->buf + sec->pos * geo->sector_nbytes,
+		       geo->sector_nbytes);
+	pthread_mutex_unlock(&slot->lock);
+
+	return err;
+}
+
+/**
+ * Read the given sectors as captured, sectors which failed to read complete
+ * with the result they failed with, and sectors not captured fail with a zero
+ * result
+ */
+static ssize_t pblk_dev_dump_read(struct pblk_dev *dev,
+				  struct nvm_addr addrs[], int naddrs,
+				  void *buf, struct nvm_ret *ret)
+{
+	const struct nvm_geo *geo = &dev->geo;
+	const size_t sector_nbytes = geo->sector_nbytes;
+	struct pblk_dev_dump *dump = dev->priv;
+	struct nvm_ret lret = { 0 };
+
+	for (int i = 0; i < naddrs; ++i) {
+		char *dst = (char *)buf + i * sector_nbytes;
+		const struct pblk_dump_sec *sec;
+
+		sec = pblk_dump_sec_find(dump, addrs[i].ppa);
+		if (sec && (!sec->failed) &&
+		    (!pblk_dump_sec_copy(dump, geo, sec, dst)))
+			continue;
+
+		memset(dst, 0, sector_nbytes);
+		lret.status |= 1ULL << (i % 64);
+		if (sec && sec->failed)
+			lret.result = sec->result;
+	}
+
+	if (ret)
+		*ret = lret;
+	if (lret.status) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int pblk_dev_dump_bbt_mark(struct pblk_dev *dev,
+				  struct nvm_addr addrs[], int naddrs,
+				  uint16_t flags, struct nvm_ret *ret)
+{
+	errno = EROFS;
+	return -1;
+}
+
+static ssize_t pblk_dev_dump_erase(struct pblk_dev *dev,
+				   struct nvm_addr addrs[], int naddrs,
+				   struct nvm_ret *ret)
+{
+	errno = EROFS;
+	return -1;
+}
+
+static int pblk_dev_dump_chunk_rprt(struct pblk_dev *dev,
+				    struct pblk_dev_chunk *chunks,
+				    struct nvm_ret *ret)
+{
+	const struct nvm_geo *geo = &dev->geo;
+	struct pblk_dev_dump *dump = dev->priv;
+
+	if (!dump->rprt) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	memcpy(chunks, dump->rprt, geo->nchannels * geo->nluns *
+	       geo->nblocks * sizeof(*chunks));
+	if (ret)
+		memset(ret, 0, sizeof(*ret));
+
+	return 0;
+}
+
+// NOTE: A metadump is read-only, it has no write
+static const struct pblk_dev_ops pblk_dev_dump_ops = {
+	.name = "dump",
+	.prefix = PBLK_DEV_DUMP_PREFIX,
+	.open = pblk_dev_dump_open,
+	.close = pblk_dev_dump_close,
+	.bbt_get = pblk_dev_dump_bbt_get,
+	.bbt_mark = pblk_dev_dump_bbt_mark,
+	.read = pblk_dev_dump_read,
+	.write = NULL,
+	.erase = pblk_dev_dump_erase,
+	.chunk_rprt = pblk_dev_dump_chunk_rprt,
+};
+
+//
+// Backend independent part
+//
+
+static const struct pblk_dev_ops *pblk_dev_backends[] = {
+	&pblk_dev_img_ops,
+	&pblk_dev_dump_ops,
+	&pblk_dev_lnvm_ops,			// Default, must be last
+};
+
+static const struct pblk_dev_ops *pblk_dev_backend(const char *path)
+{
+	const int nbackends = sizeof(pblk_dev_backends) /
+			      sizeof(pblk_dev_backends[0]);
+
+	for (int i = 0; i < nbackends; ++i) {
+		const char *prefix = pblk_dev_backends[i]->prefix;
+
+		if ((!prefix) || (!strncmp(path, prefix, strlen(prefix))))
+			return pblk_dev_backends[i];
+	}
+
+	return NULL;
+}
+
+int pblk_dev_emulated(const char *path)
+{
+	return pblk_dev_backend(path) != &pblk_dev_lnvm_ops;
+}
+
+struct pblk_dev *pblk_dev_open(const char *path)
+{
+	const struct pblk_dev_ops *ops = pblk_dev_backend(path);
+	struct pblk_dev *dev = NULL;
+
+	dev = malloc(sizeof(*dev));
+	if (!dev) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(dev, 0, sizeof(*dev));
+	dev->ops = ops;
+
+	if (ops->open(dev, path + (ops->prefix ? strlen(ops->prefix) : 0))) {
+		free(dev);
+		return NULL;
+	}
+
+	return dev;
+}
+
+struct pblk_dev *pblk_dev_wrap(struct nvm_dev *nvm_dev)
+{
+	struct pblk_dev *dev = NULL;
+
+	dev = malloc(sizeof(*dev));
+	if (!dev) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(dev, 0, sizeof(*dev));
+	dev->ops = &pblk_dev_lnvm_ops;
+
+	if (pblk_dev_lnvm_init(dev, nvm_dev, 0)) {
+		free(dev);
+		return NULL;
+	}
+
+	return dev;
+}
+
+void pblk_dev_close(struct pblk_dev *dev)
+{
+	if (!dev)
+		return;
+
+	pblk_dev_dump_abort(dev);
+	dev->ops->close(dev);
+	free(dev);
+}
+
+static inline uint64_t pblk_dev_ts_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+const struct nvm_bbt *pblk_dev_bbt_get(struct pblk_dev *dev,
+				       struct nvm_addr addr,
+				       struct nvm_ret *ret)
+{
+	struct pblk_dev_stat *stat = dev->stat;
+	const struct nvm_bbt *bbt;
+	uint64_t t_bgn = 0;
+
+	if (stat)
+		t_bgn = pblk_dev_ts_ns();
+
+	bbt = dev->ops->bbt_get(dev, addr, ret);
+
+	if (stat)
+		pblk_hist_add(&stat->bbt_lat, pblk_dev_ts_ns() - t_bgn);
+	if (dev->dump && bbt)
+		pblk_dump_rec_bbt(dev->dump, &dev->geo, bbt);
+
+	return bbt;
+}
+
+int pblk_dev_bbt_mark(struct pblk_dev *dev, struct nvm_addr addrs[],
+		      int naddrs, uint16_t flags, struct nvm_ret *ret)
+{
+	return dev->ops->bbt_mark(dev, addrs, naddrs, flags, ret);
+}
+
+ssize_t pblk_dev_read(struct pblk_dev *dev, struct nvm_addr addrs[],
+		      int naddrs, void *buf, struct nvm_ret *ret)
+{
+	struct pblk_dev_stat *stat = dev->stat;
+	uint64_t t_bgn = 0;
+	ssize_t err;
+
+	if (stat)
+		t_bgn = pblk_dev_ts_ns();
+
+	if (dev->lat_us > 0) {
+		struct timespec lat;
+
+		lat.tv_sec = dev->lat_us / 1000000;
+		lat.tv_nsec = (dev->lat_us % 1000000) * 1000L;
+		nanosleep(&lat, NULL);
+	}
+
+	err = dev->ops->read(dev, addrs, naddrs, buf, ret);
+
+	if (dev->dump) {
+		struct nvm_ret lret = { 0 };
+
+		pblk_dump_rec_read(dev->dump, &dev->geo, addrs, naddrs, buf,
+				   ret ? ret : &lret, err);
+	}
+
+	if (stat) {
+		pblk_hist_add(&stat->rd_lat, pblk_dev_ts_ns() - t_bgn);
+		__atomic_fetch_add(&stat->rd_naddrs, naddrs, __ATOMIC_RELAXED);
+	}
+
+	return err;
+}
+
+ssize_t pblk_dev_write(struct pblk_dev *dev, struct nvm_addr addrs[],
+		       int naddrs, const void *buf, struct nvm_ret *ret)
+{
+	if (!dev->ops->write) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	return dev->ops->write(dev, addrs, naddrs, buf, ret);
+}
+
+ssize_t pblk_dev_erase(struct pblk_dev *dev, struct nvm_addr addrs[],
+		       int naddrs, struct nvm_ret *ret)
+{
+	return dev->ops->erase(dev, addrs, naddrs, ret);
+}
+
+int pblk_dev_chunk_rprt(struct pblk_dev *dev, struct pblk_dev_chunk *chunks,
+			struct nvm_ret *ret)
+{
+	if (!dev->ops->chunk_rprt) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	if (dev->ops->chunk_rprt(dev, chunks, ret))
+		return -1;
+
+	if (dev->dump)
+		pblk_dump_rec_rprt(dev->dump, &dev->geo, chunks);
+
+	return 0;
+}
@@ -0,0 +1,221 @@
+#ifndef __PBLK_DEV_H
+#define __PBLK_DEV_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <liblightnvm.h>
+#include <pblk_hist.h>
+
+// Path prefix of devices emulated by an image file
+#define PBLK_DEV_IMG_PREFIX "file:"
+
+// Path prefix of devices replayed from a metadump
+#define PBLK_DEV_DUMP_PREFIX "dump:"
+
+// Result of reading a sector which has not been written, as by the device
+#define PBLK_DEV_RESULT_EMPTY 0x2ff
+
+struct pblk_dev;
+struct pblk_dump_rec;
+
+/**
+ * State of a chunk, the block of a LUN on all planes, as by the chunk report
+ * of an OCSSD 2.0 device
+ */
+enum pblk_dev_chunk_state {
+	PBLK_DEV_CHUNK_FREE = 0x1,
+	PBLK_DEV_CHUNK_CLOSED = 0x1 << 1,
+	PBLK_DEV_CHUNK_OPEN = 0x1 << 2,
+	PBLK_DEV_CHUNK_OFFLINE = 0x1 << 3,
+};
+
+struct pblk_dev_chunk {
+	uint32_t state;				///< PBLK_DEV_CHUNK_*
+	uint32_t wp;				///< Pages written
+};
+
+/**
+ * Statistics of the commands issued to a device, collected when set on the
+ * device with `pblk_dev_set_stat`
+ */
+struct pblk_dev_stat {
+	struct pblk_hist rd_lat;		///< Latency of reads in nsec
+	struct pblk_hist bbt_lat;		///< Latency of bbt_get in nsec
+	uint64_t rd_naddrs;			///< Sectors read
+};
+
+/**
+ * Operations of a device backend, modelled after the liblightnvm calls used
+ * by nvm_pblk
+ *
+ * Vectored commands set bit i of `ret->status` when address i fails.
+ */
+struct pblk_dev_ops {
+	const char *name;
+	const char *prefix;			///< Path prefix, NULL for default
+
+	int (*open)(struct pblk_dev *dev, const char *path);
+	void (*close)(struct pblk_dev *dev);
+
+	const struct nvm_bbt *(*bbt_get)(struct pblk_dev *dev,
+					 struct nvm_addr addr,
+					 struct nvm_ret *ret);
+	int (*bbt_mark)(struct pblk_dev *dev, struct nvm_addr addrs[],
+			int naddrs, uint16_t flags, struct nvm_ret *ret);
+
+	ssize_t (*read)(struct pblk_dev *dev, struct nvm_addr addrs[],
+			int naddrs, void *buf, struct nvm_ret *ret);
+	ssize_t (*write)(struct pblk_dev *dev, struct nvm_addr addrs[],
+			 int naddrs, const void *buf, struct nvm_ret *ret);
+	ssize_t (*erase)(struct pblk_dev *dev, struct nvm_addr addrs[],
+			 int naddrs, struct nvm_ret *ret);
+
+	int (*chunk_rprt)(struct pblk_dev *dev, struct pblk_dev_chunk *chunks,
+			  struct nvm_ret *ret);	///< NULL when unsupported
+};
+
+/**
+ * A device as seen by pblk, either an open-channel device accessed through
+ * liblightnvm or an emulation of one
+ */
+struct pblk_dev {
+	const struct pblk_dev_ops *ops;
+	const char *name;			///< Name of the device
+	struct nvm_geo geo;
+	int read_naddrs_max;			///< Max. addresses per read
+	int lat_us;				///< Latency added to each read
+	struct pblk_dev_stat *stat;		///< NULL when not collected
+	struct pblk_dump_rec *dump;		///< NULL when not capturing
+	void *priv;				///< Backend state
+};
+
+/**
+ * Open the device at the given path, the backend is chosen by the prefix of
+ * the path, e.g. "file:/tmp/ocssd.img" opens an image file
+ *
+ * @returns On success, a device is returned. On error, NULL is returned and
+ * errno set to indicate the error.
+ */
+struct pblk_dev *pblk_dev_open(const char *path);
+
+/**
+ * Wrap a liblightnvm device opened elsewhere, e.g. by the liblightnvm CLI,
+ * closing the returned device does not close the given one
+ */
+struct pblk_dev *pblk_dev_wrap(struct nvm_dev *nvm_dev);
+
+void pblk_dev_close(struct pblk_dev *dev);
+
+/**
+ * Returns 1 when the given path is handled by a backend other than
+ * liblightnvm, 0 otherwise
+ */
+int pblk_dev_emulated(const char *path);
+
+/**
+ * Create a sparse image file, emulating a device with the given geometry,
+ * having no bad blocks and no sectors written
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_dev_img_create(const char *path, const struct nvm_geo *geo,
+			int read_naddrs_max);
+
+/**
+ * Content of a metadump written by `pblk_dev_dump_finish`
+ */
+struct pblk_dev_dump_stat {
+	uint64_t nsecs;				///< Sectors captured
+	uint64_t nsecs_failed;			///< Of which failed to read
+	uint64_t nbbts;				///< Bad-block tables captured
+	int rprt;				///< Chunk report captured
+	uint64_t nbytes_raw;			///< Size of content captured
+	uint64_t nbytes;			///< Size of the metadump
+};
+
+/**
+ * Start capturing every sector, bad-block table and chunk report read from the
+ * given device into a metadump at the given path, which replays them when
+ * opened with the PBLK_DEV_DUMP_PREFIX
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_dev_dump_start(struct pblk_dev *dev, const char *path);
+
+/**
+ * Stop capturing and write the metadump, replacing any file at its path
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_dev_dump_finish(struct pblk_dev *dev,
+			 struct pblk_dev_dump_stat *stat);
+
+/**
+ * Stop capturing and discard the metadump
+ */
+void pblk_dev_dump_abort(struct pblk_dev *dev);
+
+static inline const struct nvm_geo *pblk_dev_get_geo(const struct pblk_dev *dev)
+{
+	return &dev->geo;
+}
+
+static inline const char *pblk_dev_get_name(const struct pblk_dev *dev)
+{
+	return dev->name;
+}
+
+static inline int pblk_dev_get_read_naddrs_max(const struct pblk_dev *dev)
+{
+	return dev->read_naddrs_max;
+}
+
+static inline void pblk_dev_set_lat(struct pblk_dev *dev, int lat_us)
+{
+	dev->lat_us = lat_us;
+}
+
+/**
+ * Collect statistics of the commands issued to the device into the given
+ * struct, or stop collecting them when NULL
+ */
+static inline void pblk_dev_set_stat(struct pblk_dev *dev,
+				     struct pblk_dev_stat *stat)
+{
+	dev->stat = stat;
+}
+
+const struct nvm_bbt *pblk_dev_bbt_get(struct pblk_dev *dev,
+				       struct nvm_addr addr,
+				       struct nvm_ret *ret);
+
+int pblk_dev_bbt_mark(struct pblk_dev *dev, struct nvm_addr addrs[],
+		      int naddrs, uint16_t flags, struct nvm_ret *ret);
+
+ssize_t pblk_dev_read(struct pblk_dev *dev, struct nvm_addr addrs[],
+		      int naddrs, void *buf, struct nvm_ret *ret);
+
+ssize_t pblk_dev_write(struct pblk_dev *dev, struct nvm_addr addrs[],
+		       int naddrs, const void *buf, struct nvm_ret *ret);
+
+/**
+ * Erase the blocks of the given addresses, on all planes
+ */
+ssize_t pblk_dev_erase(struct pblk_dev *dev, struct nvm_addr addrs[],
+		       int naddrs, struct nvm_ret *ret);
+
+/**
+ * Report the state and write pointer of the chunks of all LUNs into
+ * `chunks`, holding nchannels * nluns * nblocks entries ordered by LUN then
+ * block, by a few log-page reads instead of reading the chunks
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error, ENOTSUP when the device has no chunk report.
+ */
+int pblk_dev_chunk_rprt(struct pblk_dev *dev, struct pblk_dev_chunk *chunks,
+			struct nvm_ret *ret);
+
+#endif /* __PBLK_DEV_H */
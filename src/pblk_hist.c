@@ -0,0 +1,54 @@
+#include <string.h>
+#include <pblk_hist.h>
+
+void pblk_hist_reset(struct pblk_hist *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+}
+
+/**
+ * Smallest value counted in the given bucket
+ */
+static uint64_t pblk_hist_bucket_min(int bucket)
+{
+	const int sub = 1 << PBLK_HIST_SUB_BITS;
+	int shift;
+
+	if (bucket < sub)
+		return bucket;
+
+	shift = (bucket >> PBLK_HIST_SUB_BITS) - 1;
+
+	return ((uint64_t)sub + (bucket & (sub - 1))) << shift;
+}
+
+uint64_t pblk_hist_pct(const struct pblk_hist *hist, double pct)
+{
+	uint64_t rank, seen = 0;
+
+	if (!hist->n)
+		return 0;
+
+	rank = (uint64_t)((pct / 100.0) * hist->n + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > hist->n)
+		rank = hist->n;
+
+	for (int i = 0; i < PBLK_HIST_NBUCKETS; ++i) {
+		uint64_t lo, hi, mid;
+
+		seen += hist->counts[i];
+		if (seen < rank)
+			continue;
+
+		lo = pblk_hist_bucket_min(i);
+		hi = i + 1 < PBLK_HIST_NBUCKETS ?
+			pblk_hist_bucket_min(i + 1) : hist->max + 1;
+		mid = lo + (hi - lo - 1) / 2;
+
+		return mid < hist->max ? mid : hist->max;
+	}
+
+	return hist->max;
+}
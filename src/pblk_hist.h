@@ -0,0 +1,65 @@
+#ifndef __PBLK_HIST_H
+#define __PBLK_HIST_H
+
+#include <stdint.h>
+
+// Sub-buckets per power of two, 16 gives a relative error below 6.25%
+#define PBLK_HIST_SUB_BITS 4
+#define PBLK_HIST_NBUCKETS (64 << PBLK_HIST_SUB_BITS)
+
+/**
+ * Log-linear histogram of latencies in nanoseconds
+ *
+ * Values are counted in buckets of exponentially growing width, each power of
+ * two is split into 2^PBLK_HIST_SUB_BITS buckets. Adding values is lock-free,
+ * thus a histogram can be shared by the workers of a scan.
+ */
+struct pblk_hist {
+	uint64_t counts[PBLK_HIST_NBUCKETS];
+	uint64_t n;				///< Number of values
+	uint64_t sum;				///< Sum of values
+	uint64_t max;				///< Largest value
+};
+
+static inline int pblk_hist_bucket(uint64_t val)
+{
+	const int sub = 1 << PBLK_HIST_SUB_BITS;
+	int shift;
+
+	if (val < (uint64_t)sub)
+		return val;
+
+	shift = (63 - __builtin_clzll(val)) - PBLK_HIST_SUB_BITS;
+
+	return ((shift + 1) << PBLK_HIST_SUB_BITS) +
+		((val >> shift) & (sub - 1));
+}
+
+static inline void pblk_hist_add(struct pblk_hist *hist, uint64_t val)
+{
+	uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&hist->counts[pblk_hist_bucket(val)], 1,
+			   __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->n, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->sum, val, __ATOMIC_RELAXED);
+
+	while (val > max) {
+		if (__atomic_compare_exchange_n(&hist->max, &max, val, 0,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+			break;
+	}
+}
+
+void pblk_hist_reset(struct pblk_hist *hist);
+
+/**
+ * Value at the given percentile, e.g. 99.9, as the middle of the bucket
+ * holding it, never larger than the largest value added
+ *
+ * @returns The value, 0 when the histogram is empty
+ */
+uint64_t pblk_hist_pct(const struct pblk_hist *hist, double pct);
+
+#endif /* __PBLK_HIST_H */
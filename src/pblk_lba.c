@@ -0,0 +1,303 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <liblightnvm.h>
+#include <pblk.h>
+
+/**
+ * One past the highest mapped LBA of the given L2P, 0 when none is mapped
+ */
+uint64_t pblk_l2p_lba_end(const struct pblk_l2p *l2p)
+{
+	for (size_t i = l2p->npages; i-- > 0;) {
+		const uint64_t pbgn = i * PBLK_L2P_PAGE_NENTS;
+		const uint64_t *page = l2p->pages[i];
+
+		if (!page)
+			continue;
+
+		for (uint64_t lba = l2p->nlbas - pbgn < PBLK_L2P_PAGE_NENTS ?
+				    l2p->nlbas : pbgn + PBLK_L2P_PAGE_NENTS;
+		     lba-- > pbgn;) {
+			if (page[lba - pbgn] != PBLK_ADDR_EMPTY)
+				return lba + 1;
+		}
+	}
+
+	return 0;
+}
+
+void pblk_lba_rd_term(struct pblk_lba_rd *rd)
+{
+	if (rd->rets)
+		pblk_scan_term(&rd->scan);
+	if (rd->buf)
+		pblk_buf_put(rd->buf);
+	free(rd->rets);
+	free(rd->buckets);
+	free(rd->wins);
+	memset(rd, 0, sizeof(*rd));
+}
+
+/**
+ * Initialize a reader of the LBAs mapped by the given L2P, which must outlive
+ * the reader, reading `ra_nlbas` ahead of a miss and caching `cache_nbytes`
+ *
+ * Both are rounded to windows of PBLK_LBA_WIN_NLBAS, the cache holds at least
+ * one window and the read-ahead is bounded by the cache.
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_lba_rd_init(struct pblk_lba_rd *rd, struct pblk *pblk,
+		     const struct pblk_l2p *l2p, int ra_nlbas,
+		     size_t cache_nbytes)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	const size_t win_nbytes = PBLK_LBA_WIN_NLBAS * geo->sector_nbytes;
+
+	memset(rd, 0, sizeof(*rd));
+	rd->l2p = l2p;
+	rd->geo = geo;
+	rd->mru = -1;
+	rd->lru = -1;
+
+	rd->nwins = cache_nbytes / win_nbytes;
+	if (rd->nwins < 1)
+		rd->nwins = 1;
+	rd->ra_nwins = (ra_nlbas + PBLK_LBA_WIN_NLBAS - 1) / PBLK_LBA_WIN_NLBAS;
+	if (rd->ra_nwins > rd->nwins - 1)
+		rd->ra_nwins = rd->nwins - 1;
+
+	for (rd->nbuckets = 1; rd->nbuckets < rd->nwins * 2;)
+		rd->nbuckets *= 2;
+
+	rd->wins = calloc(rd->nwins, sizeof(*rd->wins));
+	rd->buckets = malloc(rd->nbuckets * sizeof(*rd->buckets));
+	rd->rets = malloc((size_t)rd->nwins * PBLK_LBA_WIN_NLBAS *
+			  sizeof(*rd->rets));
+	if (!(rd->wins && rd->buckets && rd->rets)) {
+		pblk_lba_rd_term(rd);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	rd->buf = pblk_buf_get(pblk->bufs, rd->nwins * win_nbytes);
+	if (!rd->buf) {
+		pblk_lba_rd_term(rd);
+		return -1;
+	}
+
+	for (int i = 0; i < rd->nbuckets; ++i)
+		rd->buckets[i] = -1;
+
+	// Unused windows are chained least recently used, to be taken first
+	for (int i = 0; i < rd->nwins; ++i) {
+		struct pblk_lba_win *win = &rd->wins[i];
+
+		win->win = UINT64_MAX;
+		win->data = rd->buf->data + i * win_nbytes;
+		win->prev = i - 1;
+		win->next = i + 1 < rd->nwins ? i + 1 : -1;
+		win->hnext = -1;
+	}
+	rd->mru = 0;
+	rd->lru = rd->nwins - 1;
+
+	if (pblk_scan_init(&rd->scan, pblk->dev, pblk->qd, pblk->bufs,
+			   pblk->aio_pool)) {
+		free(rd->rets);
+		rd->rets = NULL;
+		pblk_lba_rd_term(rd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int *pblk_lba_rd_bucket(struct pblk_lba_rd *rd, uint64_t win)
+{
+	return &rd->buckets[(win * 0x9e3779b97f4a7c15ULL >> 32) &
+			    (rd->nbuckets - 1)];
+}
+
+static int pblk_lba_rd_lookup(struct pblk_lba_rd *rd, uint64_t win)
+{
+	int i = *pblk_lba_rd_bucket(rd, win);
+
+	while ((i >= 0) && (rd->wins[i].win != win))
+		i = rd->wins[i].hnext;
+
+	return i;
+}
+
+/**
+ * Move the given window to the front of the LRU list
+ */
+static void pblk_lba_rd_touch(struct pblk_lba_rd *rd, int i)
+{
+	struct pblk_lba_win *win = &rd->wins[i];
+
+	if (rd->mru == i)
+		return;
+
+	rd->wins[win->prev].next = win->next;
+	if (win->next >= 0)
+		rd->wins[win->next].prev = win->prev;
+	else
+		rd->lru = win->prev;
+
+	win->prev = -1;
+	win->next = rd->mru;
+	rd->wins[rd->mru].prev = i;
+	rd->mru = i;
+}
+
+/**
+ * Copy a sector read into its window, found by its result in `rd->rets`
+ */
+static void pblk_lba_rd_cb(char *buf, const struct nvm_ret *ret, void *arg)
+{
+	struct pblk_lba_rd *rd = arg;
+	const size_t sec = ret - rd->rets;
+	const size_t nbytes = rd->geo->sector_nbytes;
+
+	memcpy(rd->wins[sec / PBLK_LBA_WIN_NLBAS].data +
+	       (sec % PBLK_LBA_WIN_NLBAS) * nbytes, buf, nbytes);
+}
+
+/**
+ * Take the least recently used window for `win`, dropping what it held, and
+ * add reads of the mapped sectors of `win` to the scan
+ *
+ * Sectors are not read in place, as unmapped LBAs would split the commands,
+ * but gathered into full commands and copied on completion.
+ */
+static void pblk_lba_rd_load(struct pblk_lba_rd *rd, uint64_t win)
+{
+	const int i = rd->lru;
+	struct pblk_lba_win *ent = &rd->wins[i];
+	struct nvm_ret *rets = &rd->rets[i * PBLK_LBA_WIN_NLBAS];
+	int *bucket;
+
+	if (ent->win != UINT64_MAX) {
+		for (bucket = pblk_lba_rd_bucket(rd, ent->win); *bucket != i;)
+			bucket = &rd->wins[*bucket].hnext;
+		*bucket = ent->hnext;
+	}
+
+	ent->win = win;
+	ent->failed = 0;
+	ent->pending = 1;
+	bucket = pblk_lba_rd_bucket(rd, win);
+	ent->hnext = *bucket;
+	*bucket = i;
+	pblk_lba_rd_touch(rd, i);
+
+	memset(ent->data, 0, PBLK_LBA_WIN_NLBAS * rd->geo->sector_nbytes);
+	memset(rets, 0, PBLK_LBA_WIN_NLBAS * sizeof(*rets));
+
+	for (int j = 0; j < PBLK_LBA_WIN_NLBAS; ++j) {
+		const uint64_t lba = win * PBLK_LBA_WIN_NLBAS + j;
+		struct nvm_addr addr;
+
+		addr.ppa = pblk_l2p_get(rd->l2p, lba);
+		if (addr.ppa == PBLK_ADDR_EMPTY)
+			continue;
+
+		pblk_scan_add(&rd->scan, addr, &rets[j], pblk_lba_rd_cb, rd);
+		++rd->nsecs_read;
+	}
+	++rd->nmisses;
+}
+
+/**
+ * Complete the read of the given window, recording the sectors which failed
+ * to read and clearing them
+ */
+static void pblk_lba_rd_loaded(struct pblk_lba_rd *rd, int i)
+{
+	struct pblk_lba_win *ent = &rd->wins[i];
+	const struct nvm_ret *rets = &rd->rets[i * PBLK_LBA_WIN_NLBAS];
+
+	ent->pending = 0;
+	for (int j = 0; j < PBLK_LBA_WIN_NLBAS; ++j) {
+		if (!(rets[j].status || rets[j].result))
+			continue;
+
+		ent->failed |= 1ULL << j;
+		memset(ent->data + j * rd->geo->sector_nbytes, 0,
+		       rd->geo->sector_nbytes);
+		++rd->nsecs_failed;
+	}
+}
+
+/**
+ * Read `nlbas` LBAs starting at `slba` into `buf`
+ *
+ * Sectors failing to read are returned as zeroes, as are unmapped LBAs, and
+ * the remaining LBAs are still read.
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error. Errors are: EIO when any of the sectors failed to
+ * read.
+ */
+int pblk_lba_rd_read(struct pblk_lba_rd *rd, uint64_t slba, size_t nlbas,
+		     char *buf)
+{
+	const size_t nbytes = rd->geo->sector_nbytes;
+	const uint64_t elba = slba + nlbas;
+	int failed = 0;
+
+	for (uint64_t lba = slba; lba < elba;) {
+		const uint64_t win = lba / PBLK_LBA_WIN_NLBAS;
+		const uint64_t off = lba % PBLK_LBA_WIN_NLBAS;
+		const uint64_t n = PBLK_LBA_WIN_NLBAS - off < elba - lba ?
+				   PBLK_LBA_WIN_NLBAS - off : elba - lba;
+		int i = pblk_lba_rd_lookup(rd, win);
+
+		if (i >= 0) {
+			++rd->nhits;
+		} else {
+			const uint64_t wend = (elba + PBLK_LBA_WIN_NLBAS - 1) /
+					      PBLK_LBA_WIN_NLBAS + rd->ra_nwins;
+
+			// The windows of the rest of the request and those read
+			// ahead of it, as many as the cache holds, by one flush
+			for (uint64_t w = win; (w < wend) &&
+			     (w - win < (uint64_t)rd->nwins); ++w) {
+				const int j = pblk_lba_rd_lookup(rd, w);
+
+				if (j >= 0)
+					pblk_lba_rd_touch(rd, j);
+				else
+					pblk_lba_rd_load(rd, w);
+			}
+			pblk_scan_flush(&rd->scan);
+			++rd->nflushes;
+
+			for (int j = 0; j < rd->nwins; ++j) {
+				if (rd->wins[j].pending)
+					pblk_lba_rd_loaded(rd, j);
+			}
+
+			i = pblk_lba_rd_lookup(rd, win);
+		}
+
+		pblk_lba_rd_touch(rd, i);
+		memcpy(buf + (lba - slba) * nbytes,
+		       rd->wins[i].data + off * nbytes, n * nbytes);
+		failed |= !!((rd->wins[i].failed >> off) &
+			     (n < 64 ? (1ULL << n) - 1 : ~0ULL));
+
+		lba += n;
+	}
+
+	if (failed) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
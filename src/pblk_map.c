@@ -0,0 +1,104 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <liblightnvm.h>
+#include <pblk.h>
+
+void pblk_inst_maps_term(struct pblk_inst *inst)
+{
+	free(inst->line_maps);
+	inst->line_maps = NULL;
+}
+
+/**
+ * Build the sector maps of `nlines` lines of the given instance from its good
+ * LUNs, the maps of all lines are stored in a single allocation
+ *
+ * The stripe of a line is the `window_wr_lun` LUNs pblk writes it over, which
+ * are the LUNs of the instance as instances are probed by it.
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_inst_maps_init(struct pblk_inst *inst, int nlines)
+{
+	const size_t nluns = (size_t)nlines * inst->nluns;
+	struct nvm_addr *luns;
+	uint16_t *vluns;
+
+	pblk_inst_maps_term(inst);
+
+	if (inst->nluns > UINT16_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	inst->line_maps = malloc(nlines * sizeof(*inst->line_maps) +
+				 nluns * (sizeof(*luns) + sizeof(*vluns)));
+	if (!inst->line_maps) {
+		errno = ENOMEM;
+		return -1;
+	}
+	luns = (void *)&inst->line_maps[nlines];
+	vluns = (void *)&luns[nluns];
+
+	for (int line = 0; line < nlines; ++line) {
+		const uint64_t *good = &inst->line_good[line * inst->nwords];
+		struct pblk_line_map *map = &inst->line_maps[line];
+
+		map->width = inst->nluns;
+		map->nluns = 0;
+		map->luns = &luns[line * inst->nluns];
+		map->vluns = &vluns[line * inst->nluns];
+
+		for (int i = 0; i < inst->nwords; ++i) {
+			for (uint64_t word = good[i]; word; word &= word - 1) {
+				const int vlun = i * 64 + __builtin_ctzll(word);
+
+				map->luns[map->nluns] = inst->luns[vlun];
+				map->luns[map->nluns].g.blk = line;
+				map->vluns[map->nluns] = vlun;
+				++map->nluns;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Compute the device addresses of `nsec` good sectors of the given map,
+ * starting at good sector `gsec`, a page across all planes at a time
+ *
+ * @returns The number of addresses computed, less than `nsec` when the line
+ * ends before.
+ */
+size_t pblk_line_map_addrs(const struct pblk_line_map *map, uint64_t gsec,
+			   size_t nsec, struct nvm_addr *addrs,
+			   const struct nvm_geo *geo)
+{
+	const size_t sec_per_pl = pblk_geo_sec_per_pl(geo);
+	const uint64_t lim = pblk_line_map_nsec(map, geo);
+	uint64_t unit = gsec / sec_per_pl;
+	size_t off = gsec % sec_per_pl;
+	size_t n = 0;
+
+	if (gsec >= lim)
+		return 0;
+	if (nsec > lim - gsec)
+		nsec = lim - gsec;
+
+	for (; n < nsec; ++unit, off = 0) {
+		struct nvm_addr addr = map->luns[unit % map->nluns];
+
+		addr.g.pg = unit / map->nluns;
+		for (; (off < sec_per_pl) && (n < nsec); ++off, ++n) {
+			addrs[n] = addr;
+			addrs[n].g.pl = off / geo->nsectors;
+			addrs[n].g.sec = off % geo->nsectors;
+		}
+	}
+
+	return n;
+}
@@ -0,0 +1,353 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <liblightnvm.h>
+#include <pblk.h>
+
+/**
+ * Initialize metrics for the instances of the given pblk, which must not
+ * change while the metrics are used
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_metrics_init(struct pblk_metrics *metrics, const struct pblk *pblk)
+{
+	memset(metrics, 0, sizeof(*metrics));
+
+	metrics->inst_read_errs = calloc(pblk->ninsts + 1,
+					 sizeof(*metrics->inst_read_errs));
+	if (!metrics->inst_read_errs) {
+		errno = ENOMEM;
+		return -1;
+	}
+	metrics->ninsts = pblk->ninsts;
+
+	return 0;
+}
+
+void pblk_metrics_term(struct pblk_metrics *metrics)
+{
+	free(metrics->inst_read_errs);
+	memset(metrics, 0, sizeof(*metrics));
+}
+
+/**
+ * Meta reads of the given instance failing in the last scan: of the smeta of
+ * unreadable lines, and of the emeta of lines with a valid smeta, where an
+ * empty emeta is that of an open line. Lines taken from a snapshot were not
+ * read.
+ */
+static int pblk_metrics_inst_read_errs(const struct pblk_inst *inst)
+{
+	int nerrs = 0;
+
+	for (int i = 0; inst->lines && (i < inst->nlines); ++i) {
+		const struct pblk_line *line = &inst->lines[i];
+
+		if (inst->line_flags[i] & PBLK_LINE_FLAG_CACHED)
+			continue;
+
+		switch (inst->line_states[i]) {
+		case PBLK_LINE_STATE_UNREADABLE:
+			++nerrs;
+			break;
+		case PBLK_LINE_STATE_OPEN:
+			nerrs += (line->emeta_ret.status ||
+				  line->emeta_ret.result) &&
+				 (line->emeta_ret.result !=
+				  PBLK_DEV_RESULT_EMPTY);
+			break;
+		}
+	}
+
+	return nerrs;
+}
+
+/**
+ * Account a scan of the lines of the given pblk, failed when `err` is set
+ */
+void pblk_metrics_scanned(struct pblk_metrics *metrics,
+			  const struct pblk *pblk, int err, double scan_sec,
+			  int nreused)
+{
+	metrics->scan_sec = scan_sec;
+	metrics->scan_time = time(NULL);
+	metrics->nreused = nreused;
+
+	if (err) {
+		++metrics->nscans_failed;
+		return;
+	}
+	++metrics->nscans;
+
+	for (int i = 0; i < metrics->ninsts; ++i) {
+		metrics->inst_read_errs[i] =
+			pblk_metrics_inst_read_errs(&pblk->insts[i]);
+		metrics->nread_errs += metrics->inst_read_errs[i];
+	}
+}
+
+/**
+ * Print a label value, escaped as the exposition format requires
+ */
+static void pblk_metrics_label_pr(FILE *fp, const char *val)
+{
+	for (; *val; ++val) {
+		switch (*val) {
+		case '\\':
+			fputs("\\\\", fp);
+			break;
+		case '"':
+			fputs("\\\"", fp);
+			break;
+		case '\n':
+			fputs("\\n", fp);
+			break;
+		default:
+			fputc(*val, fp);
+			break;
+		}
+	}
+}
+
+static void pblk_metrics_hdr_pr(FILE *fp, const char *name, const char *type,
+				const char *help)
+{
+	fprintf(fp, "# HELP %s %s\n", name, help);
+	fprintf(fp, "# TYPE %s %s\n", name, type);
+}
+
+/**
+ * Print the name and labels of a sample of the given instance, the value is
+ * printed by the caller
+ */
+static void pblk_metrics_inst_pr(FILE *fp, const char *name,
+				 const struct pblk *pblk,
+				 const struct pblk_inst *inst)
+{
+	fprintf(fp, "%s{dev=\"", name);
+	pblk_metrics_label_pr(fp, pblk_dev_get_name(pblk->dev));
+	fprintf(fp, "\",lun_bgn=\"%d\",lun_end=\"%d\"", inst->lun_bgn,
+		inst->lun_end);
+}
+
+#define PBLK_METRICS_NSTATES 7
+
+/**
+ * Lines per state, degraded lines, bad blocks and LUNs of which every block
+ * is bad, of the given instance
+ */
+struct pblk_metrics_inst {
+	int nlines[PBLK_METRICS_NSTATES];	///< By pblk_metrics_states
+	int ndegraded;
+	uint64_t nbad_blks;
+	int nbad_luns;
+};
+
+static const char *pblk_metrics_states[PBLK_METRICS_NSTATES] = {
+	"unknown", "open", "closed", "bad", "free", "corrupt", "unreadable"
+};
+
+static void pblk_metrics_inst_calc(const struct pblk_inst *inst,
+				   struct pblk_metrics_inst *mi)
+{
+	memset(mi, 0, sizeof(*mi));
+
+	for (int i = 0; i < inst->nlines; ++i) {
+		const int ngood = pblk_inst_line_ngood(inst, i);
+
+		switch (inst->line_states[i]) {
+		case PBLK_LINE_STATE_OPEN:
+			++mi->nlines[1];
+			break;
+		case PBLK_LINE_STATE_CLOSED:
+			++mi->nlines[2];
+			break;
+		case PBLK_LINE_STATE_BAD:
+			++mi->nlines[3];
+			break;
+		case PBLK_LINE_STATE_FREE:
+			++mi->nlines[4];
+			break;
+		case PBLK_LINE_STATE_CORRUPT:
+			++mi->nlines[5];
+			break;
+		case PBLK_LINE_STATE_UNREADABLE:
+			++mi->nlines[6];
+			break;
+		default:
+			++mi->nlines[0];
+			break;
+		}
+
+		mi->nbad_blks += inst->nluns - ngood;
+		if (ngood && (ngood != inst->nluns))
+			++mi->ndegraded;
+	}
+
+	for (int vlun = 0; vlun < inst->nluns; ++vlun) {
+		int nbad = 0;
+
+		for (int i = 0; i < inst->nlines; ++i)
+			nbad += pblk_inst_blk_bad(inst, vlun, i);
+
+		mi->nbad_luns += nbad == inst->nlines;
+	}
+}
+
+/**
+ * Format the given metrics, and the lines of the instances of the given pblk,
+ * in the Prometheus text exposition format, into a buffer allocated by
+ * open_memstream which the caller must free
+ *
+ * Instances which were not scanned have no line samples.
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_metrics_fmt(const struct pblk_metrics *metrics,
+		     const struct pblk *pblk, char **buf, size_t *nbytes)
+{
+	struct pblk_metrics_inst *mis = NULL;
+	const char *dev_name = pblk_dev_get_name(pblk->dev);
+	FILE *fp;
+
+	mis = calloc(metrics->ninsts + 1, sizeof(*mis));
+	if (!mis) {
+		errno = ENOMEM;
+		return -1;
+	}
+	for (int i = 0; i < metrics->ninsts; ++i) {
+		if (pblk->insts[i].lines)
+			pblk_metrics_inst_calc(&pblk->insts[i], &mis[i]);
+	}
+
+	fp = open_memstream(buf, nbytes);
+	if (!fp) {
+		free(mis);
+		return -1;
+	}
+
+	pblk_metrics_hdr_pr(fp, "pblk_instances", "gauge",
+			    "pblk instances found on the device");
+	fprintf(fp, "pblk_instances{dev=\"");
+	pblk_metrics_label_pr(fp, dev_name);
+	fprintf(fp, "\"} %d\n", metrics->ninsts);
+
+	pblk_metrics_hdr_pr(fp, "pblk_lines", "gauge",
+			    "Lines of an instance by state");
+	for (int i = 0; i < metrics->ninsts; ++i) {
+		if (!pblk->insts[i].lines)
+			continue;
+
+		for (int s = 0; s < PBLK_METRICS_NSTATES; ++s) {
+			pblk_metrics_inst_pr(fp, "pblk_lines", pblk,
+					     &pblk->insts[i]);
+			fprintf(fp, ",state=\"%s\"} %d\n",
+				pblk_metrics_states[s], mis[i].nlines[s]);
+		}
+	}
+
+	pblk_metrics_hdr_pr(fp, "pblk_open_lines", "gauge",
+			    "Open lines of an instance, recovered on start");
+	for (int i = 0; i < metrics->ninsts; ++i) {
+		if (!pblk->insts[i].lines)
+			continue;
+
+		pblk_metrics_inst_pr(fp, "pblk_open_lines", pblk,
+				     &pblk->insts[i]);
+		fprintf(fp, "} %d\n", mis[i].nlines[1]);
+	}
+
+	pblk_metrics_hdr_pr(fp, "pblk_degraded_lines", "gauge",
+			    "Lines of an instance with some bad blocks");
+	for (int i = 0; i < metrics->ninsts; ++i) {
+		if (!pblk->insts[i].lines)
+			continue;
+
+		pblk_metrics_inst_pr(fp, "pblk_degraded_lines", pblk,
+				     &pblk->insts[i]);
+		fprintf(fp, "} %d\n", mis[i].ndegraded);
+	}
+
+	pblk_metrics_hdr_pr(fp, "pblk_bad_blocks", "gauge",
+			    "Bad blocks of the lines of an instance");
+	for (int i = 0; i < metrics->ninsts; ++i) {
+		if (!pblk->insts[i].lines)
+			continue;
+
+		pblk_metrics_inst_pr(fp, "pblk_bad_blocks", pblk,
+				     &pblk->insts[i]);
+		fprintf(fp, "} %lu\n", (unsigned long)mis[i].nbad_blks);
+	}
+
+	pblk_metrics_hdr_pr(fp, "pblk_bad_luns", "gauge",
+			    "LUNs of an instance without a good block");
+	for (int i = 0; i < metrics->ninsts; ++i) {
+		if (!pblk->insts[i].lines)
+			continue;
+
+		pblk_metrics_inst_pr(fp, "pblk_bad_luns", pblk,
+				     &pblk->insts[i]);
+		fprintf(fp, "} %d\n", mis[i].nbad_luns);
+	}
+
+	pblk_metrics_hdr_pr(fp, "pblk_scan_read_errors", "gauge",
+			    "Meta reads of an instance failing, last scan");
+	for (int i = 0; i < metrics->ninsts; ++i) {
+		if (!pblk->insts[i].lines)
+			continue;
+
+		pblk_metrics_inst_pr(fp, "pblk_scan_read_errors", pblk,
+				     &pblk->insts[i]);
+		fprintf(fp, "} %d\n", metrics->inst_read_errs[i]);
+	}
+
+	pblk_metrics_hdr_pr(fp, "pblk_read_errors_total", "counter",
+			    "Meta reads failing, all scans");
+	fprintf(fp, "pblk_read_errors_total{dev=\"");
+	pblk_metrics_label_pr(fp, dev_name);
+	fprintf(fp, "\"} %lu\n", (unsigned long)metrics->nread_errs);
+
+	pblk_metrics_hdr_pr(fp, "pblk_scans_total", "counter",
+			    "Scans of the lines of the device");
+	fprintf(fp, "pblk_scans_total{dev=\"");
+	pblk_metrics_label_pr(fp, dev_name);
+	fprintf(fp, "\"} %lu\n", (unsigned long)metrics->nscans);
+
+	pblk_metrics_hdr_pr(fp, "pblk_scans_failed_total", "counter",
+			    "Scans of the lines of the device failing");
+	fprintf(fp, "pblk_scans_failed_total{dev=\"");
+	pblk_metrics_label_pr(fp, dev_name);
+	fprintf(fp, "\"} %lu\n", (unsigned long)metrics->nscans_failed);
+
+	pblk_metrics_hdr_pr(fp, "pblk_scan_duration_seconds", "gauge",
+			    "Duration of the last scan");
+	fprintf(fp, "pblk_scan_duration_seconds{dev=\"");
+	pblk_metrics_label_pr(fp, dev_name);
+	fprintf(fp, "\"} %.6f\n", metrics->scan_sec);
+
+	pblk_metrics_hdr_pr(fp, "pblk_scan_lines_reused", "gauge",
+			    "Lines taken from the snapshot by the last scan");
+	fprintf(fp, "pblk_scan_lines_reused{dev=\"");
+	pblk_metrics_label_pr(fp, dev_name);
+	fprintf(fp, "\"} %d\n", metrics->nreused);
+
+	pblk_metrics_hdr_pr(fp, "pblk_scan_timestamp_seconds", "gauge",
+			    "End of the last scan, seconds since the epoch");
+	fprintf(fp, "pblk_scan_timestamp_seconds{dev=\"");
+	pblk_metrics_label_pr(fp, dev_name);
+	fprintf(fp, "\"} %lu\n", (unsigned long)metrics->scan_time);
+
+	free(mis);
+
+	if (fclose(fp)) {
+		free(*buf);
+		*buf = NULL;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,368 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <liblightnvm.h>
+#include <pblk.h>
+#include <pblk_mkimg.h>
+
+/**
+ * Pseudo-random numbers, seeded, thus images are reproducible
+ */
+static inline uint64_t pblk_mkimg_rand(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return z ^ (z >> 31);
+}
+
+/**
+ * Gathers sectors into vectored writes of at most NVM_NADDR_MAX addresses
+ */
+struct pblk_mkimg_wr {
+	struct pblk_dev *dev;
+	size_t sector_nbytes;
+	int naddrs;
+	struct nvm_addr addrs[NVM_NADDR_MAX];
+	char *buf;
+	size_t nsectors;			///< Sectors written
+};
+
+static int pblk_mkimg_wr_flush(struct pblk_mkimg_wr *wr)
+{
+	struct nvm_ret ret = { 0 };
+	int naddrs = wr->naddrs;
+
+	if (!naddrs)
+		return 0;
+
+	wr->naddrs = 0;
+	if (pblk_dev_write(wr->dev, wr->addrs, naddrs, wr->buf, &ret) < 0)
+		return -1;
+	wr->nsectors += naddrs;
+
+	return 0;
+}
+
+static int pblk_mkimg_wr_add(struct pblk_mkimg_wr *wr,
+			     struct nvm_addr addr, const char *sec)
+{
+	wr->addrs[wr->naddrs] = addr;
+	memcpy(wr->buf + wr->naddrs * wr->sector_nbytes, sec,
+	       wr->sector_nbytes);
+
+	if (++(wr->naddrs) == NVM_NADDR_MAX)
+		return pblk_mkimg_wr_flush(wr);
+
+	return 0;
+}
+
+/**
+ * Mark blocks bad at random, never those of line 0 as instances are discovered
+ * by the smeta written at the first block of their first LUN
+ */
+static int pblk_mkimg_bbt_mark(struct pblk_dev *dev,
+			       const struct pblk_mkimg_opts *opts,
+			       uint64_t *rnd, size_t *nbad)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(dev);
+
+	*nbad = 0;
+	if (!opts->bad_pct)
+		return 0;
+
+	for (size_t ch = 0; ch < geo->nchannels; ++ch) {
+		for (size_t lun = 0; lun < geo->nluns; ++lun) {
+			for (size_t blk = 1; blk < geo->nblocks; ++blk) {
+				struct nvm_addr addr = { 0 };
+				struct nvm_ret ret = { 0 };
+
+				if ((int)(pblk_mkimg_rand(rnd) % 100) >=
+				    opts->bad_pct)
+					continue;
+
+				addr.g.ch = ch;
+				addr.g.lun = lun;
+				addr.g.blk = blk;
+				addr.g.pl = pblk_mkimg_rand(rnd) % geo->nplanes;
+
+				if (pblk_dev_bbt_mark(dev, &addr, 1,
+						      NVM_BBT_BAD, &ret))
+					return -1;
+				++(*nbad);
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Write a line as pblk does: smeta in the first good unit, data sectors
+ * following it and, for closed lines, emeta in the last good units
+ *
+ * Data sectors hold their LBA in the first eight bytes. Open lines are written
+ * up to half of the line and have no emeta.
+ */
+static int pblk_mkimg_line_write(struct pblk_mkimg_wr *wr,
+				 struct pblk_inst *inst, int line_id,
+				 int prev_id, int next_id, uint64_t seq_nr,
+				 int closed, uint64_t nlbas, uint64_t *rnd,
+				 char *smeta_buf, char *emeta_buf)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(wr->dev);
+	const size_t sec_per_pl = pblk_geo_sec_per_pl(geo);
+	const size_t sec_per_line = pblk_inst_sec_per_line(inst, geo);
+	const size_t smeta_nsec = pblk_geo_smeta_nsec(geo);
+	const size_t emeta_nsec = pblk_inst_emeta_nsec(inst, geo);
+	const size_t emeta_nbytes = emeta_nsec * geo->sector_nbytes;
+	const int64_t smeta_ssec = pblk_line_smeta_ssec(inst, line_id, geo);
+	const int64_t emeta_ssec = pblk_line_emeta_ssec(inst, line_id, geo);
+	const int64_t emeta_gsec = pblk_line_emeta_gsec(inst, line_id, geo);
+	const struct pblk_line_map *map = &inst->line_maps[line_id];
+	const uint64_t data_lim = closed ? (uint64_t)emeta_ssec :
+					   sec_per_line / 2;
+	struct pblk_line_smeta *smeta = (void *)smeta_buf;
+	struct pblk_line_emeta *emeta = (void *)emeta_buf;
+	char *data = wr->buf + NVM_NADDR_MAX * geo->sector_nbytes;
+
+	memset(smeta_buf, 0, smeta_nsec * geo->sector_nbytes);
+	smeta->header.identifier = PBLK_META_IDENT;
+	smeta->header.version = PBLK_META_VER;
+	smeta->header.type = PBLK_LINETYPE_DATA;
+	smeta->header.id = line_id;
+	smeta->header.crc = pblk_line_header_crc(&smeta->header);
+	smeta->prev_id = prev_id;
+	smeta->seq_nr = seq_nr;
+	smeta->window_wr_lun = inst->nluns;
+	smeta->crc = pblk_line_smeta_crc(smeta,
+					 smeta_nsec * geo->sector_nbytes);
+
+	memset(emeta_buf, 0, emeta_nbytes);
+	emeta->header = smeta->header;
+	emeta->prev_id = prev_id;
+	emeta->seq_nr = seq_nr;
+	emeta->window_wr_lun = inst->nluns;
+	emeta->next_id = next_id;
+
+	for (uint64_t paddr = 0; paddr < sec_per_line; ++paddr) {
+		const int vlun = (paddr / sec_per_pl) % inst->nluns;
+		struct nvm_addr addr;
+		uint64_t lba;
+
+		emeta->lbas[paddr] = PBLK_ADDR_EMPTY;
+
+		if (pblk_inst_blk_bad(inst, vlun, line_id))
+			continue;
+		if (paddr >= data_lim)
+			continue;
+
+		addr = pblk_line_paddr_to_addr(inst, line_id, paddr, geo);
+
+		if ((int64_t)(paddr / sec_per_pl) == smeta_ssec / sec_per_pl) {
+			if (pblk_mkimg_wr_add(wr, addr, smeta_buf +
+					      (paddr % sec_per_pl) *
+					      geo->sector_nbytes))
+				return -1;
+			continue;
+		}
+
+		lba = pblk_mkimg_rand(rnd) % nlbas;
+		emeta->lbas[paddr] = lba;
+		++(emeta->nr_lbas);
+
+		memset(data, 0, geo->sector_nbytes);
+		memcpy(data, &lba, sizeof(lba));
+		if (pblk_mkimg_wr_add(wr, addr, data))
+			return -1;
+	}
+
+	if (!closed)
+		return pblk_mkimg_wr_flush(wr);
+
+	emeta->crc = pblk_line_emeta_crc(emeta, emeta_nbytes);
+
+	// emeta occupies the good sectors from emeta_gsec to the end of the line
+	for (size_t i = 0; i < emeta_nsec; ++i) {
+		const struct nvm_addr addr = pblk_line_map_addr(map,
+							emeta_gsec + i, geo);
+
+		if (pblk_mkimg_wr_add(wr, addr, emeta_buf +
+				      i * geo->sector_nbytes))
+			return -1;
+	}
+
+	return pblk_mkimg_wr_flush(wr);
+}
+
+/**
+ * Write the lines of an instance, in a seeded order of line ids starting with
+ * line 0, chaining them by prev_id / next_id and numbering them by seq_nr
+ *
+ * The first `nbad_next` lines name themselves as next_id instead, breaking the
+ * chain for its checks to find.
+ */
+static int pblk_mkimg_inst_write(struct pblk *pblk, struct pblk_inst *inst,
+				 const struct pblk_mkimg_opts *opts,
+				 uint64_t *rnd, size_t *nlines_written,
+				 size_t *nsectors)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	const size_t sec_per_line = pblk_inst_sec_per_line(inst, geo);
+	const size_t smeta_nsec = pblk_geo_smeta_nsec(geo);
+	const size_t emeta_nsec = pblk_inst_emeta_nsec(inst, geo);
+	const int nlines = opts->nlines_closed + opts->nlines_open;
+	const uint64_t nlbas = sec_per_line * (opts->nlines_closed ?
+					       opts->nlines_closed : 1);
+	struct pblk_mkimg_wr wr = { 0 };
+	char *smeta_buf = NULL;
+	char *emeta_buf = NULL;
+	int *order = NULL;
+	int norder = 0;
+	int err = 0;
+
+	smeta_buf = malloc(smeta_nsec * geo->sector_nbytes);
+	emeta_buf = malloc(emeta_nsec * geo->sector_nbytes);
+	wr.buf = malloc((NVM_NADDR_MAX + 1) * geo->sector_nbytes);
+	order = malloc(geo->nblocks * sizeof(*order));
+	if (!(smeta_buf && emeta_buf && wr.buf && order)) {
+		errno = ENOMEM;
+		err = -1;
+		goto exit;
+	}
+	wr.dev = pblk->dev;
+	wr.sector_nbytes = geo->sector_nbytes;
+
+	// Lines able to hold smeta and emeta, shuffled except for line 0
+	for (int id = 0; id < (int)geo->nblocks; ++id) {
+		if ((pblk_line_smeta_ssec(inst, id, geo) < 0) ||
+		    (pblk_line_emeta_ssec(inst, id, geo) < 0))
+			continue;
+		order[norder++] = id;
+	}
+	for (int i = norder - 1; i > 1; --i) {
+		int j = 1 + pblk_mkimg_rand(rnd) % i;
+		int tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	if ((!norder) || (order[0] != 0) || (norder < nlines)) {
+		errno = ENOSPC;
+		err = -1;
+		goto exit;
+	}
+
+	for (int i = 0; i < nlines; ++i) {
+		const int prev_id = i ? order[i - 1] : ~0;
+		const int next_id = i < opts->nbad_next ? order[i] :
+				    i + 1 < norder ? order[i + 1] : ~0;
+
+		if (pblk_mkimg_line_write(&wr, inst, order[i], prev_id,
+					  next_id, i, i < opts->nlines_closed,
+					  nlbas, rnd, smeta_buf, emeta_buf)) {
+			err = -1;
+			goto exit;
+		}
+	}
+
+	*nlines_written = nlines;
+	*nsectors = wr.nsectors;
+
+exit:
+	free(smeta_buf);
+	free(emeta_buf);
+	free(wr.buf);
+	free(order);
+
+	return err;
+}
+
+void pblk_mkimg_opts_default(struct pblk_mkimg_opts *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+
+	opts->geo.nchannels = 4;
+	opts->geo.nluns = 4;
+	opts->geo.nplanes = 2;
+	opts->geo.nblocks = 64;
+	opts->geo.npages = 16;
+	opts->geo.nsectors = 4;
+	opts->geo.sector_nbytes = 4096;
+	opts->read_naddrs_max = NVM_NADDR_MAX;
+	opts->ninsts = 2;
+	opts->nlines_closed = 20;
+	opts->nlines_open = 1;
+	opts->bad_pct = 0;
+	opts->nbad_next = 0;
+	opts->seed = 1;
+}
+
+int pblk_mkimg(const char *path, const struct pblk_mkimg_opts *opts,
+	       struct pblk_mkimg_stat *stat)
+{
+	struct nvm_geo geo = opts->geo;
+	char dev_path[4096];
+	struct pblk_dev *dev = NULL;
+	struct pblk *pblk = NULL;
+	uint64_t rnd = opts->seed;
+	int inst_nch;
+	int err = -1;
+
+	memset(stat, 0, sizeof(*stat));
+
+	if ((!opts->ninsts) || (geo.nchannels % opts->ninsts) ||
+	    (opts->bad_pct > 100) || (!opts->read_naddrs_max) ||
+	    (opts->read_naddrs_max > NVM_NADDR_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+	geo.page_nbytes = geo.nsectors * geo.sector_nbytes;
+	geo.meta_nbytes = 16;
+
+	if (pblk_dev_img_create(path, &geo, opts->read_naddrs_max))
+		return -1;
+
+	snprintf(dev_path, sizeof(dev_path), "%s%s", PBLK_DEV_IMG_PREFIX, path);
+	dev = pblk_dev_open(dev_path);
+	if (!dev)
+		return -1;
+
+	if (pblk_mkimg_bbt_mark(dev, opts, &rnd, &stat->nblocks_bad))
+		goto exit;
+
+	pblk = pblk_init(dev, 0x0);
+	if (!pblk)
+		goto exit;
+
+	inst_nch = geo.nchannels / opts->ninsts;
+	for (int i = 0; i < opts->ninsts; ++i) {
+		const int lun_bgn = i * inst_nch * geo.nluns;
+		const int lun_end = lun_bgn + inst_nch * geo.nluns - 1;
+		struct pblk_inst *inst;
+		size_t nlines = 0, nsectors = 0;
+
+		inst = pblk_add_instance(pblk, lun_bgn, lun_end);
+		if (!inst)
+			goto exit;
+
+		if (pblk_mkimg_inst_write(pblk, inst, opts, &rnd, &nlines,
+					  &nsectors))
+			goto exit;
+
+		stat->nlines += nlines;
+		stat->nsectors += nsectors;
+	}
+
+	err = 0;
+
+exit:
+	pblk_term(pblk);
+	pblk_dev_close(dev);
+
+	return err;
+}
@@ -0,0 +1,42 @@
+#ifndef __PBLK_MKIMG_H
+#define __PBLK_MKIMG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <liblightnvm.h>
+
+/**
+ * Options of the image generator, the defaults give a small device of 16
+ * LUNs hosting two pblk instances
+ */
+struct pblk_mkimg_opts {
+	struct nvm_geo geo;
+	int read_naddrs_max;
+	int ninsts;				///< Instances, dividing nchannels
+	int nlines_closed;			///< Closed lines per instance
+	int nlines_open;			///< Open lines per instance
+	int bad_pct;				///< Probability of a bad block
+	int nbad_next;				///< Closed lines with a wrong next_id
+	uint64_t seed;
+};
+
+struct pblk_mkimg_stat {
+	size_t nblocks_bad;			///< Blocks marked bad
+	size_t nlines;				///< Lines written
+	size_t nsectors;			///< Sectors written
+};
+
+void pblk_mkimg_opts_default(struct pblk_mkimg_opts *opts);
+
+/**
+ * Create an image file at the given path, to be opened as "file:<path>",
+ * holding pblk instances laid out as described by the given options
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error. Errors are: EINVAL when ninsts does not divide
+ * nchannels, ENOSPC when an instance has too few good lines.
+ */
+int pblk_mkimg(const char *path, const struct pblk_mkimg_opts *opts,
+	       struct pblk_mkimg_stat *stat);
+
+#endif /* __PBLK_MKIMG_H */
@@ -0,0 +1,294 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <liblightnvm.h>
+#include <pblk_out.h>
+
+#define PBLK_OUT_BUF_NBYTES (1 << 20)
+#define PBLK_OUT_REC_NBYTES_MAX 2048		///< Bound of a formatted record
+
+int pblk_out_fmt_parse(const char *str)
+{
+	if (!str || !strcmp(str, "yaml"))
+		return PBLK_OUT_FMT_YAML;
+	if (!strcmp(str, "jsonl"))
+		return PBLK_OUT_FMT_JSONL;
+	if (!strcmp(str, "bin"))
+		return PBLK_OUT_FMT_BIN;
+
+	errno = EINVAL;
+	return -1;
+}
+
+static void pblk_out_str(struct pblk_out *out, const char *str)
+{
+	const size_t len = strlen(str);
+
+	memcpy(out->buf + out->len, str, len);
+	out->len += len;
+}
+
+static void pblk_out_u64(struct pblk_out *out, uint64_t val)
+{
+	char digits[20];
+	int ndigits = 0;
+
+	do {
+		digits[ndigits++] = '0' + (val % 10);
+		val /= 10;
+	} while (val);
+
+	while (ndigits)
+		out->buf[out->len++] = digits[--ndigits];
+}
+
+static void pblk_out_i64(struct pblk_out *out, int64_t val)
+{
+	if (val < 0) {
+		out->buf[out->len++] = '-';
+		pblk_out_u64(out, -(uint64_t)val);
+		return;
+	}
+
+	pblk_out_u64(out, val);
+}
+
+/**
+ * Append `,"key":val`, the key carries its own separator
+ */
+static void pblk_out_kv(struct pblk_out *out, const char *key, uint64_t val)
+{
+	pblk_out_str(out, key);
+	pblk_out_u64(out, val);
+}
+
+static void pblk_out_ret(struct pblk_out *out, const char *key,
+			 const struct nvm_ret *ret)
+{
+	pblk_out_str(out, key);
+	if (!(ret->status || ret->result)) {
+		pblk_out_str(out, "null");
+		return;
+	}
+
+	pblk_out_kv(out, "{\"result\":", ret->result);
+	pblk_out_kv(out, ",\"status\":", ret->status);
+	pblk_out_str(out, "}");
+}
+
+static void pblk_out_header(struct pblk_out *out,
+			    const struct pblk_line_header *header)
+{
+	pblk_out_kv(out, "\"header\":{\"crc\":", header->crc);
+	pblk_out_kv(out, ",\"identifier\":", header->identifier);
+	pblk_out_kv(out, ",\"uuid\":[", header->uuid[0]);
+	for (int i = 1; i < 4; ++i)
+		pblk_out_kv(out, ",", header->uuid[i]);
+	pblk_out_str(out, "],\"type\":\"");
+	pblk_out_str(out, pblk_line_type_str(header->type));
+	pblk_out_kv(out, "\",\"version\":", header->version);
+	pblk_out_kv(out, ",\"id\":", header->id);
+	pblk_out_str(out, "}");
+}
+
+static void pblk_out_line_jsonl(struct pblk_out *out,
+				const struct pblk_inst *inst, int id)
+{
+	const struct pblk_line *line = &inst->lines[id];
+	const int smeta_read = pblk_inst_line_smeta_read(inst, id);
+	const int emeta_read = pblk_inst_line_emeta_read(inst, id);
+
+	pblk_out_str(out, "{\"lun_bgn\":");
+	pblk_out_i64(out, inst->lun_bgn);
+	pblk_out_str(out, ",\"lun_end\":");
+	pblk_out_i64(out, inst->lun_end);
+	pblk_out_kv(out, ",\"id\":", id);
+	pblk_out_str(out, ",\"state\":\"");
+	pblk_out_str(out, pblk_line_state_str(inst->line_states[id]));
+	pblk_out_str(out, "\"");
+
+	if (inst->line_states[id] == PBLK_LINE_STATE_BAD) {
+		pblk_out_str(out, "}\n");
+		return;
+	}
+
+	pblk_out_kv(out, ",\"smeta_addr\":", line->smeta_addr.ppa);
+	pblk_out_kv(out, ",\"emeta_addr\":", line->emeta_addr.ppa);
+	if (inst->line_flags[id] & PBLK_LINE_FLAG_SMETA_SKIPPED)
+		pblk_out_str(out, ",\"smeta_ret\":\"skipped\"");
+	else
+		pblk_out_ret(out, ",\"smeta_ret\":", &line->smeta_ret);
+	if (inst->line_flags[id] & PBLK_LINE_FLAG_EMETA_SKIPPED)
+		pblk_out_str(out, ",\"emeta_ret\":\"skipped\"");
+	else
+		pblk_out_ret(out, ",\"emeta_ret\":", &line->emeta_ret);
+
+	pblk_out_str(out, ",\"smeta\":");
+	if (smeta_read) {
+		const struct pblk_line_smeta *smeta = &line->smeta;
+
+		pblk_out_str(out, "{");
+		pblk_out_header(out, &smeta->header);
+		pblk_out_kv(out, ",\"crc\":", smeta->crc);
+		pblk_out_kv(out, ",\"prev_id\":", smeta->prev_id);
+		pblk_out_kv(out, ",\"seq_nr\":", smeta->seq_nr);
+		pblk_out_kv(out, ",\"window_wr_lun\":", smeta->window_wr_lun);
+		pblk_out_str(out, "}");
+	} else {
+		pblk_out_str(out, "null");
+	}
+
+	pblk_out_str(out, ",\"emeta\":");
+	if (emeta_read) {
+		const struct pblk_line_emeta *emeta = &line->emeta;
+
+		pblk_out_str(out, "{");
+		pblk_out_header(out, &emeta->header);
+		pblk_out_kv(out, ",\"crc\":", emeta->crc);
+		pblk_out_kv(out, ",\"prev_id\":", emeta->prev_id);
+		pblk_out_kv(out, ",\"seq_nr\":", emeta->seq_nr);
+		pblk_out_kv(out, ",\"window_wr_lun\":", emeta->window_wr_lun);
+		pblk_out_kv(out, ",\"next_id\":", emeta->next_id);
+		pblk_out_kv(out, ",\"nr_lbas\":", emeta->nr_lbas);
+		pblk_out_str(out, "}");
+	} else {
+		pblk_out_str(out, "null");
+	}
+
+	pblk_out_str(out, "}\n");
+}
+
+static void pblk_out_line_bin(struct pblk_out *out,
+			      const struct pblk_inst *inst, int id)
+{
+	const struct pblk_line *line = &inst->lines[id];
+	struct pblk_out_bin_rec rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.lun_bgn = inst->lun_bgn;
+	rec.lun_end = inst->lun_end;
+	rec.id = id;
+	rec.state = inst->line_states[id];
+	rec.flags = inst->line_flags[id];
+
+	if (rec.state != PBLK_LINE_STATE_BAD) {
+		rec.smeta_ppa = line->smeta_addr.ppa;
+		rec.emeta_ppa = line->emeta_addr.ppa;
+		rec.smeta_status = line->smeta_ret.status;
+		rec.emeta_status = line->emeta_ret.status;
+		rec.smeta_result = line->smeta_ret.result;
+		rec.emeta_result = line->emeta_ret.result;
+		if (pblk_inst_line_smeta_read(inst, id))
+			rec.smeta = line->smeta;
+		if (pblk_inst_line_emeta_read(inst, id))
+			memcpy(rec.emeta, &line->emeta, sizeof(rec.emeta));
+	}
+
+	memcpy(out->buf + out->len, &rec, sizeof(rec));
+	out->len += sizeof(rec);
+}
+
+/**
+ * Write the buffered records
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error, the error is kept and returned by later calls.
+ */
+int pblk_out_flush(struct pblk_out *out)
+{
+	size_t off = 0;
+
+	while ((!out->err) && (off < out->len)) {
+		ssize_t nbytes = write(out->fd, out->buf + off, out->len - off);
+
+		if (nbytes < 0) {
+			if (errno == EINTR)
+				continue;
+			out->err = errno;
+			break;
+		}
+		off += nbytes;
+	}
+	out->len = 0;
+
+	if (out->err) {
+		errno = out->err;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Append the record of the given line, writing the buffer when it is close
+ * to full, thus memory use does not grow with the number of lines
+ */
+void pblk_out_line(struct pblk_out *out, const struct pblk_inst *inst, int id)
+{
+	if (out->len + PBLK_OUT_REC_NBYTES_MAX > out->cap)
+		pblk_out_flush(out);
+
+	switch (out->fmt) {
+	case PBLK_OUT_FMT_JSONL:
+		pblk_out_line_jsonl(out, inst, id);
+		break;
+	case PBLK_OUT_FMT_BIN:
+		pblk_out_line_bin(out, inst, id);
+		break;
+	default:
+		pblk_line_pr(inst, id);
+		break;
+	}
+}
+
+/**
+ * Initialize a writer of records in the given format to the given fd, the
+ * binary format starts with a pblk_out_bin_hdr
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_out_init(struct pblk_out *out, int fmt, int fd)
+{
+	memset(out, 0, sizeof(*out));
+	out->fmt = fmt;
+	out->fd = fd;
+	out->cap = PBLK_OUT_BUF_NBYTES;
+	out->buf = malloc(out->cap);
+	if (!out->buf) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (fmt == PBLK_OUT_FMT_BIN) {
+		struct pblk_out_bin_hdr hdr;
+
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.magic = PBLK_OUT_BIN_MAGIC;
+		hdr.version = PBLK_OUT_BIN_VER;
+		hdr.rec_nbytes = sizeof(struct pblk_out_bin_rec);
+
+		memcpy(out->buf, &hdr, sizeof(hdr));
+		out->len = sizeof(hdr);
+	}
+
+	return 0;
+}
+
+/**
+ * Write the buffered records and release the writer
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate that a write failed.
+ */
+int pblk_out_term(struct pblk_out *out)
+{
+	int err = pblk_out_flush(out);
+
+	free(out->buf);
+	out->buf = NULL;
+
+	return err;
+}
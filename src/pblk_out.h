@@ -0,0 +1,66 @@
+#ifndef __PBLK_OUT_H
+#define __PBLK_OUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pblk.h>
+
+enum pblk_out_fmt {
+	PBLK_OUT_FMT_YAML = 0x0,		///< pblk_line_pr, to stdout
+	PBLK_OUT_FMT_JSONL = 0x1,		///< A JSON object per line
+	PBLK_OUT_FMT_BIN = 0x2,			///< A pblk_out_bin_rec per line
+};
+
+#define PBLK_OUT_BIN_MAGIC 0x3154554f4b4c4250ULL	// "PBLKOUT1"
+#define PBLK_OUT_BIN_VER 0x1
+
+/**
+ * Header of the binary format, followed by one record per line. Fields are
+ * in host byte order.
+ */
+struct pblk_out_bin_hdr {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t rec_nbytes;			///< Size of a record
+};
+
+struct pblk_out_bin_rec {
+	int32_t lun_bgn;			///< Instance of the line
+	int32_t lun_end;
+	uint32_t id;
+	uint8_t state;				///< pblk_line_state
+	uint8_t flags;				///< pblk_line_flag
+	uint16_t rsvd;
+	uint64_t smeta_ppa;
+	uint64_t emeta_ppa;
+	uint64_t smeta_status;
+	uint64_t emeta_status;
+	uint32_t smeta_result;
+	uint32_t emeta_result;
+	struct pblk_line_smeta smeta;		///< Zero when not read
+	char emeta[sizeof(struct pblk_line_emeta)];	///< Zero when not read
+};
+
+/**
+ * Buffered writer of line records, records are formatted into a large
+ * buffer which is written when full
+ */
+struct pblk_out {
+	int fmt;				///< pblk_out_fmt
+	int fd;					///< Written to
+	char *buf;
+	size_t len;				///< Bytes buffered
+	size_t cap;				///< Size of buf
+	int err;				///< errno of a failed write
+};
+
+int pblk_out_fmt_parse(const char *str);
+
+int pblk_out_init(struct pblk_out *out, int fmt, int fd);
+int pblk_out_term(struct pblk_out *out);
+
+void pblk_out_line(struct pblk_out *out, const struct pblk_inst *inst,
+		   int id);
+int pblk_out_flush(struct pblk_out *out);
+
+#endif /* __PBLK_OUT_H */
@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <liblightnvm.h>
+#include <pblk.h>
+
+/**
+ * Binary search for the write pointer of the block of an open line on one
+ * LUN: pages below `lo` are written, pages from `hi` are not
+ */
+struct pblk_recov_probe {
+	struct pblk_recov_line *line;
+	int pos;				///< Position in line->wps
+	struct nvm_addr addr;			///< Block of the line on the LUN
+	uint32_t lo;
+	uint32_t hi;
+	uint32_t mid;				///< Page being read
+	struct nvm_ret ret;
+};
+
+/**
+ * A page is written unless reading it reports an empty page, pages failing
+ * otherwise are taken as written, as recovery must read them
+ */
+static void pblk_recov_probe_cb(char *buf, const struct nvm_ret *ret,
+				void *arg)
+{
+	struct pblk_recov_probe *probe = arg;
+
+	if ((ret->status || ret->result) &&
+	    (ret->result == PBLK_DEV_RESULT_EMPTY))
+		probe->hi = probe->mid;
+	else
+		probe->lo = probe->mid + 1;
+
+	++(probe->line->nprobes);
+}
+
+void pblk_recov_term(struct pblk_recov *recov)
+{
+	for (int i = 0; recov->lines && (i < recov->nlines); ++i)
+		free(recov->lines[i].wps);
+	free(recov->lines);
+	memset(recov, 0, sizeof(*recov));
+}
+
+/**
+ * Find the write pointer of every open line of the given instance, that is,
+ * the number of written pages of the block of the line on each good LUN
+ *
+ * The pages of a LUN are written in order, thus the write pointer is found by
+ * a binary search over the pages. The searches of all LUNs of all open lines
+ * advance in lockstep, each round reads one page of every unfinished search
+ * in vectored commands spread over the LUNs, with `pblk->qd` in-flight per
+ * LUN, thus log2(npages) rounds suffice.
+ *
+ * Given the chunk report of the last scan, the write pointers are taken from it
+ * and nothing is read.
+ *
+ * Recovery of an open line by pblk reads every written sector, which is
+ * reported as the recovery read volume.
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_inst_recov(struct pblk *pblk, struct pblk_inst *inst,
+		    struct pblk_recov *recov)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	const size_t sec_per_pl = pblk_geo_sec_per_pl(geo);
+	struct pblk_recov_probe *probes = NULL;
+	struct pblk_scan scan;
+	int nprobes = 0;
+	int err = 0;
+
+	memset(recov, 0, sizeof(*recov));
+
+	for (int i = 0; i < inst->nlines; ++i) {
+		if (inst->line_states[i] == PBLK_LINE_STATE_OPEN)
+			++recov->nlines;
+	}
+
+	recov->lines = calloc(recov->nlines + 1, sizeof(*recov->lines));
+	probes = calloc((size_t)recov->nlines * inst->nluns + 1,
+			sizeof(*probes));
+	if (!(recov->lines && probes)) {
+		errno = ENOMEM;
+		err = -1;
+		goto recov_exit;
+	}
+
+	for (int i = 0, l = 0; i < inst->nlines; ++i) {
+		struct pblk_recov_line *line = &recov->lines[l];
+
+		if (inst->line_states[i] != PBLK_LINE_STATE_OPEN)
+			continue;
+		++l;
+
+		line->id = i;
+		line->seq_nr = inst->line_seq_nrs[i];
+		line->nsec_data = pblk_inst_line_data_nsec(inst, i, geo);
+		line->wps = calloc(inst->nluns, sizeof(*line->wps));
+		if (!line->wps) {
+			errno = ENOMEM;
+			err = -1;
+			goto recov_exit;
+		}
+
+		for (int vlun = 0; vlun < inst->nluns; ++vlun) {
+			struct pblk_recov_probe *probe = &probes[nprobes];
+
+			if (pblk_inst_blk_bad(inst, vlun, i))
+				continue;
+
+			probe->line = line;
+			probe->pos = line->nluns++;
+			probe->addr.g.ch = inst->luns[vlun].g.ch;
+			probe->addr.g.lun = inst->luns[vlun].g.lun;
+			probe->addr.g.blk = i;
+			probe->hi = geo->npages;
+			if (pblk->chunks) {
+				const uint32_t wp =
+					pblk_inst_chunk(pblk, inst, vlun, i)->wp;
+
+				probe->lo = wp < geo->npages ? wp : geo->npages;
+				probe->hi = probe->lo;
+			}
+			++nprobes;
+		}
+	}
+
+	if (pblk_scan_init(&scan, pblk->dev, pblk->qd, pblk->bufs,
+			   pblk->aio_pool)) {
+		err = -1;
+		goto recov_exit;
+	}
+
+	for (;;) {
+		int nactive = 0;
+
+		for (int p = 0; p < nprobes; ++p) {
+			struct pblk_recov_probe *probe = &probes[p];
+			struct nvm_addr addr = probe->addr;
+
+			if (probe->lo >= probe->hi)
+				continue;
+
+			probe->mid = probe->lo + (probe->hi - probe->lo) / 2;
+			addr.g.pg = probe->mid;
+			pblk_scan_add(&scan, addr, &probe->ret,
+				      pblk_recov_probe_cb, probe);
+			++nactive;
+		}
+		if (!nactive)
+			break;
+
+		pblk_scan_flush(&scan);
+		++recov->nrounds;
+	}
+	pblk_scan_term(&scan);
+
+	for (int p = 0; p < nprobes; ++p) {
+		const struct pblk_recov_probe *probe = &probes[p];
+		struct pblk_recov_line *line = probe->line;
+		const uint32_t wp = probe->lo;
+
+		line->wps[probe->pos] = wp;
+		if ((!probe->pos) || (wp < line->wp_min))
+			line->wp_min = wp;
+		if ((!probe->pos) || (wp > line->wp_max))
+			line->wp_max = wp;
+		line->nsec += wp * sec_per_pl;
+
+		// A linear scan reads up to and including the first empty page
+		recov->nprobes_linear += wp < geo->npages ? wp + 1 : wp;
+	}
+
+	for (int i = 0; i < recov->nlines; ++i) {
+		recov->nprobes += recov->lines[i].nprobes;
+		recov->nsec += recov->lines[i].nsec;
+	}
+	recov->nbytes = recov->nsec * geo->sector_nbytes;
+
+recov_exit:
+	if (err)
+		pblk_recov_term(recov);
+	free(probes);
+
+	return err;
+}
@@ -0,0 +1,290 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <liblightnvm.h>
+#include <pblk.h>
+
+#define PBLK_SNAP_MAGIC 0x31504e534b4c4250ULL	// "PBLKSNP1"
+#define PBLK_SNAP_VER 0x1
+
+/**
+ * Header of a snapshot file, followed by `ninsts` instance records and by the
+ * line records of each instance
+ */
+struct pblk_snap_hdr {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t line_nbytes;			///< Size of a line record
+	char name[64];				///< Name of the device
+	uint32_t nchannels;
+	uint32_t nluns;
+	uint32_t nplanes;
+	uint32_t nblocks;
+	uint32_t npages;
+	uint32_t nsectors;
+	uint32_t sector_nbytes;
+	uint32_t ninsts;
+	uint64_t ts;				///< Time of save, epoch seconds
+};
+
+struct pblk_snap_inst {
+	int32_t lun_bgn;
+	int32_t lun_end;
+	int32_t nlines;
+	int32_t rsvd;
+	uint64_t lines_ofz;			///< Offset of first line record
+};
+
+struct pblk_snap_line {
+	uint8_t state;				///< pblk_line_state
+	uint8_t flags;				///< pblk_line_flag
+	uint8_t rsvd[6];
+	uint64_t seq_nr;
+	struct pblk_line line;			///< smeta, emeta and results
+};
+
+static void pblk_snap_hdr_fill(struct pblk_snap_hdr *hdr, const char *name,
+			       const struct nvm_geo *geo)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = PBLK_SNAP_MAGIC;
+	hdr->version = PBLK_SNAP_VER;
+	hdr->line_nbytes = sizeof(struct pblk_snap_line);
+	strncpy(hdr->name, name ? name : "", sizeof(hdr->name) - 1);
+	hdr->nchannels = geo->nchannels;
+	hdr->nluns = geo->nluns;
+	hdr->nplanes = geo->nplanes;
+	hdr->nblocks = geo->nblocks;
+	hdr->npages = geo->npages;
+	hdr->nsectors = geo->nsectors;
+	hdr->sector_nbytes = geo->sector_nbytes;
+}
+
+/**
+ * Map the snapshot at the given path, it is usable only when taken of a
+ * device with the name and geometry of the device of the given pblk
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error. ESTALE when the snapshot is of another device or
+ * malformed.
+ */
+int pblk_snap_open(struct pblk_snap *snap, const char *path,
+		   const struct pblk *pblk)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	struct pblk_snap_hdr expected;
+	const struct pblk_snap_hdr *hdr;
+	const struct pblk_snap_inst *insts;
+	struct stat st;
+	int fd;
+
+	memset(snap, 0, sizeof(*snap));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(*hdr)) {
+		close(fd);
+		errno = ESTALE;
+		return -1;
+	}
+
+	snap->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (snap->map == MAP_FAILED) {
+		snap->map = NULL;
+		return -1;
+	}
+	snap->nbytes = st.st_size;
+
+	hdr = snap->map;
+	pblk_snap_hdr_fill(&expected, pblk_dev_get_name(pblk->dev), geo);
+	expected.ninsts = hdr->ninsts;
+	expected.ts = hdr->ts;
+	if (memcmp(hdr, &expected, sizeof(*hdr)))
+		goto stale;
+
+	if (sizeof(*hdr) + hdr->ninsts * sizeof(*insts) > snap->nbytes)
+		goto stale;
+
+	insts = (const void *)(hdr + 1);
+	for (uint32_t i = 0; i < hdr->ninsts; ++i) {
+		const uint64_t nbytes = (uint64_t)insts[i].nlines *
+					hdr->line_nbytes;
+
+		if ((insts[i].nlines < 0) ||
+		    (insts[i].lines_ofz + nbytes > snap->nbytes))
+			goto stale;
+	}
+
+	snap->ninsts = hdr->ninsts;
+	snap->ts = hdr->ts;
+
+	return 0;
+
+stale:
+	pblk_snap_close(snap);
+	errno = ESTALE;
+	return -1;
+}
+
+void pblk_snap_close(struct pblk_snap *snap)
+{
+	if (snap->map)
+		munmap(snap->map, snap->nbytes);
+	memset(snap, 0, sizeof(*snap));
+}
+
+/**
+ * Take the meta of closed lines from the snapshot, marking them
+ * PBLK_LINE_FLAG_CACHED, the scan then only reads their smeta sector and
+ * keeps them when its id and seq_nr are still those of the snapshot
+ *
+ * Lines are rescanned when they were not closed, that is, open, free or
+ * unreadable, when they had the highest seq_nr of the instance, and when
+ * the address of their meta changed due to grown bad blocks.
+ *
+ * @returns The number of lines taken from the snapshot
+ */
+int pblk_snap_apply(const struct pblk_snap *snap, struct pblk_inst *inst)
+{
+	const struct pblk_snap_hdr *hdr = snap->map;
+	const struct pblk_snap_inst *insts = (const void *)(hdr + 1);
+	const struct pblk_snap_line *recs = NULL;
+	uint64_t seq_nr_max = 0;
+	int nreused = 0;
+
+	for (int i = 0; i < snap->ninsts; ++i) {
+		if ((insts[i].lun_bgn != inst->lun_bgn) ||
+		    (insts[i].lun_end != inst->lun_end) ||
+		    (insts[i].nlines != inst->nlines))
+			continue;
+
+		recs = (const void *)((const char *)snap->map +
+				      insts[i].lines_ofz);
+		break;
+	}
+	if (!recs)
+		return 0;
+
+	for (int i = 0; i < inst->nlines; ++i) {
+		if (!(recs[i].state & (PBLK_LINE_STATE_OPEN |
+				       PBLK_LINE_STATE_CLOSED)))
+			continue;
+		if (recs[i].seq_nr > seq_nr_max)
+			seq_nr_max = recs[i].seq_nr;
+	}
+
+	for (int i = 0; i < inst->nlines; ++i) {
+		const struct pblk_line *rline = &recs[i].line;
+		struct pblk_line *line = &inst->lines[i];
+
+		if (inst->line_states[i] == PBLK_LINE_STATE_BAD)
+			continue;
+		if (recs[i].state != PBLK_LINE_STATE_CLOSED)
+			continue;
+		if (recs[i].seq_nr == seq_nr_max)
+			continue;
+		if ((rline->smeta_addr.ppa != line->smeta_addr.ppa) ||
+		    (rline->emeta_addr.ppa != line->emeta_addr.ppa))
+			continue;
+
+		line->smeta = rline->smeta;
+		line->smeta_ret = rline->smeta_ret;
+		line->emeta = rline->emeta;
+		line->emeta_ret = rline->emeta_ret;
+		inst->line_flags[i] = recs[i].flags | PBLK_LINE_FLAG_CACHED;
+		inst->line_seq_nrs[i] = recs[i].seq_nr;
+		++nreused;
+	}
+
+	return nreused;
+}
+
+/**
+ * Save the lines of all instances of the given pblk to a snapshot at the
+ * given path, via a temporary file renamed into place
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_snap_save(const struct pblk *pblk, const char *path)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	struct pblk_snap_hdr hdr;
+	uint64_t ofz;
+	char tmp[4096];
+	int err = 0;
+	FILE *fp;
+
+	pblk_snap_hdr_fill(&hdr, pblk_dev_get_name(pblk->dev), geo);
+	hdr.ninsts = pblk->ninsts;
+	hdr.ts = time(NULL);
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) >=
+	    (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	fp = fopen(tmp, "wb");
+	if (!fp)
+		return -1;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		err = -1;
+
+	ofz = sizeof(hdr) + pblk->ninsts * sizeof(struct pblk_snap_inst);
+	for (int i = 0; (!err) && (i < pblk->ninsts); ++i) {
+		const struct pblk_inst *inst = &pblk->insts[i];
+		struct pblk_snap_inst rec = { 0 };
+
+		rec.lun_bgn = inst->lun_bgn;
+		rec.lun_end = inst->lun_end;
+		rec.nlines = inst->lines ? inst->nlines : 0;
+		rec.lines_ofz = ofz;
+		ofz += rec.nlines * sizeof(struct pblk_snap_line);
+
+		if (fwrite(&rec, sizeof(rec), 1, fp) != 1)
+			err = -1;
+	}
+
+	for (int i = 0; (!err) && (i < pblk->ninsts); ++i) {
+		const struct pblk_inst *inst = &pblk->insts[i];
+
+		for (int j = 0; (!err) && inst->lines && (j < inst->nlines);
+		     ++j) {
+			struct pblk_snap_line rec;
+
+			memset(&rec, 0, sizeof(rec));
+			rec.state = inst->line_states[j];
+			rec.flags = inst->line_flags[j] &
+				    ~PBLK_LINE_FLAG_CACHED;
+			rec.seq_nr = inst->line_seq_nrs[j];
+			rec.line = inst->lines[j];
+
+			if (fwrite(&rec, sizeof(rec), 1, fp) != 1)
+				err = -1;
+		}
+	}
+
+	if (fclose(fp))
+		err = -1;
+	if ((!err) && rename(tmp, path))
+		err = -1;
+	if (err)
+		unlink(tmp);
+
+	return err;
+}
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <math.h>
+#include <liblightnvm.h>
+#include <pblk.h>
+
+const char *pblk_gc_bucket_str(int bucket)
+{
+	switch (bucket) {
+	case PBLK_GC_FULL:
+		return "full";
+	case PBLK_GC_HIGH:
+		return "high";
+	case PBLK_GC_MID:
+		return "mid";
+	case PBLK_GC_LOW:
+		return "low";
+	case PBLK_GC_EMPTY:
+		return "empty";
+
+	default:
+		return "unreadable";
+	}
+}
+
+/**
+ * GC list of a line having `vsc` valid of its `nsec` data sectors, using the
+ * thresholds of pblk, a quarter and half of the sectors of a full line
+ */
+static int pblk_gc_bucket(uint64_t vsc, uint64_t nsec, uint64_t sec_per_line)
+{
+	if (!vsc)
+		return PBLK_GC_FULL;
+	if (vsc < sec_per_line / 4)
+		return PBLK_GC_HIGH;
+	if (vsc < sec_per_line / 2)
+		return PBLK_GC_MID;
+	if (vsc < nsec)
+		return PBLK_GC_LOW;
+
+	return PBLK_GC_EMPTY;
+}
+
+/**
+ * Write amplification of GC reclaiming lines at utilization `u`, moving `u`
+ * sectors for every `1 - u` sectors freed
+ */
+static double pblk_gc_wa(double u)
+{
+	return u < 1.0 ? 1.0 / (1.0 - u) : INFINITY;
+}
+
+/**
+ * Compute the valid sectors of the closed lines of the given instance
+ *
+ * The emeta of closed lines is read newest first, by seq_nr, and within a
+ * line its lba-list is walked from the last sector, thus the first sector
+ * seen for an LBA holds its current data and every later one is invalid.
+ * Seen LBAs are kept in a bitmap of the LBA space, a single pass over the
+ * lba-lists suffices, and memory is a bit per LBA.
+ *
+ * Lines whose emeta is unreadable, invalid or fails its CRC have no valid
+ * sector count, their LBAs are not known to be overwritten, thus the valid
+ * sectors of older lines are overestimated. Open lines have no lba-list and
+ * are not accounted either.
+ *
+ * @returns On success, 0 is returned. On error, -1 is returned and errno set
+ * to indicate the error.
+ */
+int pblk_inst_vsc(struct pblk *pblk, struct pblk_inst *inst,
+		  struct pblk_vsc *vsc)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	const uint64_t sec_per_line = pblk_inst_sec_per_line(inst, geo);
+	struct pblk_meta_rd rd;
+	uint64_t *bitmap = NULL;
+	uint64_t vsc_victim = 0, nsec_victim = 0;
+	int *lines = NULL;
+	int err = 0;
+
+	memset(vsc, 0, sizeof(*vsc));
+
+	lines = pblk_inst_lines_by_seq(inst, &vsc->nlines);
+	if (!lines)
+		return -1;
+
+	vsc->lines = calloc(vsc->nlines + 1, sizeof(*vsc->lines));
+	vsc->nlbas = inst->nlines * sec_per_line;
+	vsc->bitmap_nbytes = ((vsc->nlbas + 63) / 64) * sizeof(*bitmap);
+	bitmap = calloc(1, vsc->bitmap_nbytes + sizeof(*bitmap));
+	if (!(vsc->lines && bitmap)) {
+		errno = ENOMEM;
+		err = -1;
+		goto vsc_exit;
+	}
+
+	if (pblk_meta_rd_init(&rd, pblk, inst)) {
+		err = -1;
+		goto vsc_exit;
+	}
+
+	for (int i = vsc->nlines - 1; i >= 0; --i) {
+		struct pblk_vsc_line *vline = &vsc->lines[i];
+		struct pblk_emeta_view view;
+
+		vline->id = lines[i];
+		vline->seq_nr = inst->line_seq_nrs[vline->id];
+		vline->nsec = pblk_inst_line_data_nsec(inst, vline->id, geo);
+		vline->bucket = -1;
+
+		if (pblk_meta_rd_emeta(&rd, vline->id, geo) ||
+		    pblk_emeta_view_parse(&view, rd.buf, rd.nbytes, vline->id,
+					  sec_per_line)) {
+			++vsc->nunreadable;
+			continue;
+		}
+		if (pblk_line_emeta_crc_check(view.emeta, view.nbytes)) {
+			pblk_emeta_view_put(&view);
+			++vsc->nunreadable;
+			continue;
+		}
+
+		for (uint64_t paddr = view.nlbas; paddr-- > 0;) {
+			const uint64_t lba = view.lbas[paddr];
+			uint64_t *word;
+			uint64_t bit;
+
+			if (lba == PBLK_ADDR_EMPTY)
+				continue;
+
+			++vline->nlbas;
+			if (lba >= vsc->nlbas) {
+				++vsc->nrange;
+				continue;
+			}
+
+			word = &bitmap[lba / 64];
+			bit = 1ULL << (lba % 64);
+			if (*word & bit)
+				continue;
+
+			*word |= bit;
+			++vline->vsc;
+		}
+		pblk_emeta_view_put(&view);
+
+		vline->bucket = pblk_gc_bucket(vline->vsc, vline->nsec,
+					       sec_per_line);
+		++vsc->nbuckets[vline->bucket];
+		vsc->nsec += vline->nsec;
+		vsc->vsc += vline->vsc;
+
+		// GC picks the line with the fewest valid sectors
+		if ((!nsec_victim) ||
+		    (vline->vsc * nsec_victim < vsc_victim * vline->nsec)) {
+			vsc_victim = vline->vsc;
+			nsec_victim = vline->nsec;
+		}
+	}
+
+	vsc->wa_mean = pblk_gc_wa(vsc->nsec ? (double)vsc->vsc / vsc->nsec :
+				  0.0);
+	vsc->wa_greedy = pblk_gc_wa(nsec_victim ?
+				    (double)vsc_victim / nsec_victim : 0.0);
+
+	pblk_meta_rd_term(&rd);
+
+vsc_exit:
+	if (err)
+		pblk_vsc_term(vsc);
+	free(bitmap);
+	free(lines);
+
+	return err;
+}
+
+void pblk_vsc_term(struct pblk_vsc *vsc)
+{
+	free(vsc->lines);
+	memset(vsc, 0, sizeof(*vsc));
+}
@@ -0,0 +1,288 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <liblightnvm.h>
+#include <pblk.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+ * Unit of work of a wipe: the LUNs of one channel. Their blocks are erased
+ * line by line, thus a vectored erase spans the LUNs of the channel.
+ */
+struct pblk_wipe_unit {
+	int ch;					///< Channel of the LUNs
+	int tlun_bgn;				///< First LUN of the unit
+	int tlun_end;				///< Last LUN of the unit
+	int claimed;				///< Set by the worker taking it
+};
+
+/**
+ * Progress of a LUN of a wipe, it is done once the block of its last good
+ * line is erased
+ */
+struct pblk_wipe_prog {
+	int line_last;				///< Last good line, or before bgn
+	int reported;				///< Set once passed to the callback
+};
+
+struct pblk_wipe_ctx {
+	struct pblk *pblk;
+	int lun_bgn;				///< First LUN of the wipe
+	int line_bgn;
+	int line_end;
+	struct pblk_wipe_lun *luns;		///< Result of each LUN
+	struct pblk_wipe_prog *progs;		///< Progress of each LUN
+	pblk_wipe_cb cb;
+	void *cb_arg;
+	int nluns;
+	int ndone;				///< LUNs done, updated atomically
+};
+
+/**
+ * Erase the given blocks with one vectored command, when it fails, the
+ * failing blocks are found from the command status, or by erasing the blocks
+ * one at a time when the device does not report them
+ *
+ * The time of the command is charged once to each LUN it spans, regardless
+ * of the number of its blocks in the command.
+ */
+static void pblk_wipe_exec(struct pblk_wipe_ctx *ctx, struct nvm_addr *addrs,
+			   int *owners, int naddrs)
+{
+	struct nvm_ret ret = { 0 };
+	double t_bgn, t_cmd;
+	ssize_t err;
+
+	if (!naddrs)
+		return;
+
+	t_bgn = pblk_ts();
+	err = pblk_dev_erase(ctx->pblk->dev, addrs, naddrs, &ret);
+	t_cmd = pblk_ts() - t_bgn;
+
+	for (int i = 0; i < naddrs; ++i) {
+		int seen = 0;
+
+		for (int j = 0; (j < i) && (!seen); ++j)
+			seen = owners[j] == owners[i];
+		if (!seen)
+			ctx->luns[owners[i]].t_sec += t_cmd;
+	}
+
+	for (int i = 0; i < naddrs; ++i) {
+		struct pblk_wipe_lun *lun = &ctx->luns[owners[i]];
+
+		if (!err) {
+			++lun->nblks;
+			continue;
+		}
+
+		if (ret.status) {
+			if (ret.status & (1ULL << i))
+				++lun->nblks_failed;
+			else
+				++lun->nblks;
+			continue;
+		}
+
+		t_bgn = pblk_ts();
+		if (pblk_dev_erase(ctx->pblk->dev, &addrs[i], 1, NULL))
+			++lun->nblks_failed;
+		else
+			++lun->nblks;
+		lun->t_sec += pblk_ts() - t_bgn;
+	}
+}
+
+/**
+ * Pass the LUNs of the given unit which are done to the callback, that is,
+ * those having the block of their last good line erased, given that blocks
+ * are erased line by line up to and including that of `tlun` on `line`
+ */
+static void pblk_wipe_unit_report(struct pblk_wipe_ctx *ctx,
+				  const struct pblk_wipe_unit *unit, int line,
+				  int tlun)
+{
+	for (int t = unit->tlun_bgn; t <= unit->tlun_end; ++t) {
+		struct pblk_wipe_prog *prog = &ctx->progs[t - ctx->lun_bgn];
+		int ndone;
+
+		if (prog->reported)
+			continue;
+		if ((prog->line_last > line) ||
+		    ((prog->line_last == line) && (t > tlun)))
+			continue;
+
+		prog->reported = 1;
+		ndone = __atomic_add_fetch(&ctx->ndone, 1, __ATOMIC_RELAXED);
+		if (ctx->cb)
+			ctx->cb(&ctx->luns[t - ctx->lun_bgn], ndone,
+				ctx->nluns, ctx->cb_arg);
+	}
+}
+
+static void pblk_wipe_unit_run(struct pblk_wipe_ctx *ctx,
+			       const struct pblk_wipe_unit *unit)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(ctx->pblk->dev);
+	const struct pblk_bbt_map *map = ctx->pblk->bbt_map;
+	int naddrs_max = NVM_NADDR_MAX / geo->nplanes;
+	struct nvm_addr addrs[NVM_NADDR_MAX];
+	int owners[NVM_NADDR_MAX];
+	int naddrs = 0;
+
+	if (naddrs_max < 1)
+		naddrs_max = 1;
+
+	// Bad blocks are counted upfront, thus a LUN is done with its last
+	// good block
+	for (int tlun = unit->tlun_bgn; tlun <= unit->tlun_end; ++tlun) {
+		const int owner = tlun - ctx->lun_bgn;
+
+		ctx->progs[owner].line_last = ctx->line_bgn - 1;
+		for (int line = ctx->line_bgn; line <= ctx->line_end; ++line) {
+			const uint64_t *good = &map->good[line * map->nwords];
+
+			if (good[tlun / 64] & (1ULL << (tlun % 64)))
+				ctx->progs[owner].line_last = line;
+			else
+				++ctx->luns[owner].nblks_bad;
+		}
+	}
+
+	for (int line = ctx->line_bgn; line <= ctx->line_end; ++line) {
+		const uint64_t *good = &map->good[line * map->nwords];
+
+		for (int tlun = unit->tlun_bgn; tlun <= unit->tlun_end; ++tlun) {
+			const int owner = tlun - ctx->lun_bgn;
+			struct nvm_addr addr = { 0 };
+
+			if (!(good[tlun / 64] & (1ULL << (tlun % 64))))
+				continue;
+
+			addr.g.ch = tlun / geo->nluns;
+			addr.g.lun = tlun % geo->nluns;
+			addr.g.blk = line;
+
+			addrs[naddrs] = addr;
+			owners[naddrs] = owner;
+			if (++naddrs == naddrs_max) {
+				pblk_wipe_exec(ctx, addrs, owners, naddrs);
+				naddrs = 0;
+				pblk_wipe_unit_report(ctx, unit, line, tlun);
+			}
+		}
+	}
+	pblk_wipe_exec(ctx, addrs, owners, naddrs);
+	pblk_wipe_unit_report(ctx, unit, ctx->line_end, unit->tlun_end);
+}
+
+/**
+ * Erase the blocks of lines [line_bgn, line_end] on LUNs [lun_bgn, lun_end],
+ * skipping blocks known to be bad
+ *
+ * The LUNs are grouped by channel, and the channels are wiped by `pblk->jobs`
+ * workers. Within a channel, blocks are erased by vectored commands spanning
+ * its LUNs, thus LUNs erase concurrently even with a single worker. The
+ * result of each LUN is stored in `luns`, having an entry per LUN in the
+ * range, and `cb`, when given, is invoked as each LUN is done, that is, once
+ * the block of its last good line is erased.
+ *
+ * @returns On success, 0 is returned, blocks failing to erase are counted in
+ * `luns`. On error, -1 is returned and errno set to indicate the error.
+ */
+int pblk_wipe(struct pblk *pblk, int lun_bgn, int lun_end, int line_bgn,
+	      int line_end, struct pblk_wipe_lun *luns, pblk_wipe_cb cb,
+	      void *cb_arg)
+{
+	const struct nvm_geo *geo = pblk_dev_get_geo(pblk->dev);
+	struct pblk_wipe_unit *units = NULL;
+	struct pblk_wipe_prog *progs = NULL;
+	struct pblk_wipe_ctx ctx;
+	int nunits = 0;
+	int jobs = pblk->jobs;
+
+	if ((lun_bgn < 0) || (lun_end >= pblk->tluns) || (lun_bgn > lun_end) ||
+	    (line_bgn < 0) || (line_end >= (int)geo->nblocks) ||
+	    (line_bgn > line_end)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pblk_bbt_map_init(pblk))
+		return -1;
+
+	units = calloc(pblk->tluns, sizeof(*units));
+	progs = calloc((lun_end - lun_bgn) + 1, sizeof(*progs));
+	if (!(units && progs)) {
+		free(units);
+		free(progs);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (int tlun = lun_bgn; tlun <= lun_end; ++tlun) {
+		const int ch = tlun / geo->nluns;
+
+		if ((!nunits) || (units[nunits - 1].ch != ch)) {
+			units[nunits].ch = ch;
+			units[nunits].tlun_bgn = tlun;
+			++nunits;
+		}
+		units[nunits - 1].tlun_end = tlun;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.pblk = pblk;
+	ctx.lun_bgn = lun_bgn;
+	ctx.line_bgn = line_bgn;
+	ctx.line_end = line_end;
+	ctx.luns = luns;
+	ctx.progs = progs;
+	ctx.cb = cb;
+	ctx.cb_arg = cb_arg;
+	ctx.nluns = (lun_end - lun_bgn) + 1;
+
+	memset(luns, 0, sizeof(*luns) * ctx.nluns);
+	for (int i = 0; i < ctx.nluns; ++i)
+		luns[i].tlun = lun_bgn + i;
+
+	if ((jobs < 1) || (nunits < 2))
+		jobs = 1;
+	if (jobs > nunits)
+		jobs = nunits;
+
+#ifdef _OPENMP
+	#pragma omp parallel num_threads(jobs)
+#endif
+	{
+		int tid = 0;
+		int nthreads = 1;
+
+#ifdef _OPENMP
+		tid = omp_get_thread_num();
+		nthreads = omp_get_num_threads();
+#endif
+
+		for (int u = 0; u < nunits; ++u) {
+			if ((units[u].ch % nthreads) != tid)
+				continue;
+			if (!__atomic_exchange_n(&units[u].claimed, 1,
+						 __ATOMIC_ACQ_REL))
+				pblk_wipe_unit_run(&ctx, &units[u]);
+		}
+		for (int u = 0; u < nunits; ++u) {
+			if (!__atomic_exchange_n(&units[u].claimed, 1,
+						 __ATOMIC_ACQ_REL))
+				pblk_wipe_unit_run(&ctx, &units[u]);
+		}
+	}
+
+	free(progs);
+	free(units);
+
+	return 0;
+}
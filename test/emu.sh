@@ -0,0 +1,304 @@
+#!/usr/bin/env bash
+#
+# Run nvm_pblk against an emulated device, no open-channel SSD needed
+#
+# Usage: emu.sh [bin_dir]
+#
+BIN_DIR="$1"
+if [ -z "$BIN_DIR" ]; then
+	BIN_DIR="."
+fi
+
+NVM_PBLK="$BIN_DIR/nvm_pblk"
+NVM_PBLK_MKIMG="$BIN_DIR/nvm_pblk_mkimg"
+
+IMG_PATH="/tmp/nvm_pblk_emu.img"
+DEV_PATH="file:$IMG_PATH"
+
+rm -f $IMG_PATH
+MKIMG_OUT=$($NVM_PBLK_MKIMG --ninsts 2 --nlines-closed 20 --nlines-open 1 \
+	--bad-pct 3 --seed 7 $IMG_PATH)
+if [ "$?" -ne 0 ]; then
+	echo "# FAILED: creating image($IMG_PATH)"
+	exit 1
+fi
+echo "$MKIMG_OUT"
+
+INSTANCES_OUT=$($NVM_PBLK instances $DEV_PATH)
+if [ "$?" -ne 0 ]; then
+	echo "# FAILED: instances"
+	exit 1
+fi
+NINSTS=$(echo "$INSTANCES_OUT" | grep -c "pblk_instance:")
+if [ "$NINSTS" -ne 2 ]; then
+	echo "# FAILED: expected 2 instances, found $NINSTS"
+	exit 1
+fi
+
+FULL_OUT=$($NVM_PBLK instances $DEV_PATH --discovery full | grep -v "^#")
+FAST_OUT=$($NVM_PBLK instances $DEV_PATH --discovery fast | grep -v "^#")
+if [ "$FULL_OUT" != "$FAST_OUT" ]; then
+	echo "# FAILED: fast discovery differs from full discovery"
+	exit 1
+fi
+echo "# OK: discovery"
+
+# Output must not depend on the number of workers nor on the queue-depth,
+# timings aside
+for CMD in lines_all check_all l2p_all; do
+	REF_OUT=""
+	for OPTS in "" "--jobs 4" "--qd 8" "--jobs 4 --qd 8 --lat-us 50"; do
+		OUT=$($NVM_PBLK $CMD $DEV_PATH $OPTS)
+		RC=$?
+		OUT=$(echo "$OUT" | grep -v -E "sec|gbps")
+		if [ "$RC" -ne 0 ]; then
+			echo "# FAILED: $CMD $OPTS"
+			exit 1
+		fi
+		if [ -z "$REF_OUT" ]; then
+			REF_OUT="$OUT"
+		elif [ "$OUT" != "$REF_OUT" ]; then
+			echo "# FAILED: $CMD output differs with '$OPTS'"
+			exit 1
+		fi
+	done
+	echo "# OK: $CMD"
+done
+
+CHECK_OUT=$($NVM_PBLK check_all $DEV_PATH)
+if echo "$CHECK_OUT" | grep -q -E "HAZARD: .*(crc mismatch|read failed)"; then
+	echo "# FAILED: CRC mismatch on image written by nvm_pblk_mkimg"
+	exit 1
+fi
+
+# The emeta header of closed lines is read from the first emeta sector, thus
+# the next_id of every closed line is verified
+NBROKEN=$(echo "$CHECK_OUT" | grep -c "nnext_broken: 0")
+if [ "$NBROKEN" -ne 2 ]; then
+	echo "# FAILED: next_id chain broken on image written by nvm_pblk_mkimg"
+	exit 1
+fi
+LINES_OUT=$($NVM_PBLK lines_all $DEV_PATH --format=jsonl 2> /dev/null)
+NCLOSED=$(echo "$LINES_OUT" | grep -c '"state":"PBLK_LINE_STATE_CLOSED"')
+NEMETA=$(echo "$LINES_OUT" | grep -c '"emeta":{"header":{[^}]*"identifier":1885498475')
+if [ "$NCLOSED" -eq 0 ] || [ "$NCLOSED" -ne "$NEMETA" ]; then
+	echo "# FAILED: $NCLOSED closed lines, $NEMETA with an emeta header"
+	exit 1
+fi
+
+BAD_IMG_PATH="/tmp/nvm_pblk_emu_bad_next.img"
+rm -f $BAD_IMG_PATH
+$NVM_PBLK_MKIMG --ninsts 2 --nlines-closed 20 --nlines-open 1 --bad-pct 3 \
+	--seed 7 --bad-next 2 $BAD_IMG_PATH > /dev/null
+BAD_OUT=$($NVM_PBLK check_all file:$BAD_IMG_PATH)
+NBROKEN=$(echo "$BAD_OUT" | grep -c "nnext_broken: 2")
+NHAZARDS=$(echo "$BAD_OUT" | grep -c "HAZARD: .*next_id")
+rm -f $BAD_IMG_PATH
+if [ "$NBROKEN" -ne 2 ] || [ "$NHAZARDS" -ne 4 ]; then
+	echo "# FAILED: $NBROKEN instances, $NHAZARDS hazards for broken next_id"
+	exit 1
+fi
+echo "# OK: chain"
+
+# Lines not written by nvm_pblk_mkimg are free and their emeta is not read
+LINES_OUT=$($NVM_PBLK lines_all $DEV_PATH --format=jsonl --no-chunk-rprt \
+	2> /dev/null)
+NFREE=$(echo "$LINES_OUT" | grep -c '"state":"PBLK_LINE_STATE_FREE"')
+NSKIPPED=$(echo "$LINES_OUT" | grep -c '"emeta_ret":"skipped"')
+NOTHER=$(echo "$LINES_OUT" | grep -c -E 'STATE_(UNKNOWN|CORRUPT|UNREADABLE)')
+if [ "$NFREE" -eq 0 ] || [ "$NFREE" -ne "$NSKIPPED" ] || [ "$NOTHER" -ne 0 ]; then
+	echo "# FAILED: $NFREE free lines, $NSKIPPED skipped, $NOTHER other"
+	exit 1
+fi
+echo "# OK: free lines"
+
+NCLOSED=$($NVM_PBLK l2p_all $DEV_PATH | grep "nlines_applied: 20" | wc -l)
+if [ "$NCLOSED" -ne 2 ]; then
+	echo "# FAILED: expected 20 closed lines applied per instance"
+	exit 1
+fi
+echo "# OK: l2p_all"
+
+# Sectors valid by the lba-lists are the LBAs mapped by the rebuilt L2P
+NVSC=$($NVM_PBLK vsc_all $DEV_PATH -b | grep "^  vsc:" | awk '{print $2}')
+NMAPPED=$($NVM_PBLK l2p_all $DEV_PATH -b | grep "nlbas_mapped:" | \
+	awk '{print $2}')
+if [ "$NVSC" != "$NMAPPED" ]; then
+	echo "# FAILED: valid sectors($NVSC) differ from mapped LBAs($NMAPPED)"
+	exit 1
+fi
+echo "# OK: vsc_all"
+
+# Open lines are written to half of the line, the middle page of every block
+NHALF=$($NVM_PBLK recov_all $DEV_PATH -b | grep -c "wp_min: 8, wp_max: 8,")
+if [ "$NHALF" -ne 2 ]; then
+	echo "# FAILED: expected 2 open lines written to page 8, found $NHALF"
+	exit 1
+fi
+echo "# OK: recov_all"
+
+# The chunk report classifies lines and finds write pointers as reads do
+for CMD in lines_all recov_all; do
+	REF_OUT=$($NVM_PBLK $CMD $DEV_PATH --no-chunk-rprt | \
+		grep -E "state:|wps:" | sed "s/nprobes: [0-9]*//")
+	OUT=$($NVM_PBLK $CMD $DEV_PATH | \
+		grep -E "state:|wps:" | sed "s/nprobes: [0-9]*//")
+	if [ "$OUT" != "$REF_OUT" ]; then
+		echo "# FAILED: $CMD differs by the chunk report"
+		exit 1
+	fi
+done
+LINES_OUT=$($NVM_PBLK lines_all $DEV_PATH --format=jsonl 2> /dev/null)
+NFREE=$(echo "$LINES_OUT" | grep -c '"state":"PBLK_LINE_STATE_FREE"')
+NSKIPPED=$(echo "$LINES_OUT" | grep -c '"smeta_ret":"skipped"')
+if [ "$NFREE" -eq 0 ] || [ "$NFREE" -ne "$NSKIPPED" ]; then
+	echo "# FAILED: $NFREE free lines, $NSKIPPED not read by the report"
+	exit 1
+fi
+echo "# OK: chunk report"
+
+# Every line dumped as YAML is dumped as a JSON record
+NYAML=$($NVM_PBLK lines_all $DEV_PATH | grep -c -E "^line_[0-9]+:")
+NJSONL=$($NVM_PBLK lines_all $DEV_PATH --format=jsonl 2> /dev/null | wc -l)
+if [ "$NYAML" -ne "$NJSONL" ]; then
+	echo "# FAILED: $NYAML lines as yaml, $NJSONL as jsonl"
+	exit 1
+fi
+echo "# OK: jsonl"
+
+# A run taking lines from a snapshot must report as a full scan does
+SNAP_PATH="/tmp/nvm_pblk_emu.snap"
+rm -f $SNAP_PATH
+REF_OUT=$($NVM_PBLK check_all $DEV_PATH | grep -v -E "sec|gbps|nbytes|reused")
+$NVM_PBLK check_all $DEV_PATH --snapshot $SNAP_PATH > /dev/null
+OUT=$($NVM_PBLK check_all $DEV_PATH --snapshot $SNAP_PATH)
+if ! echo "$OUT" | grep -q "Reused 40 lines from snapshot"; then
+	echo "# FAILED: expected 40 lines reused from snapshot"
+	exit 1
+fi
+OUT=$(echo "$OUT" | grep -v -E "sec|gbps|nbytes|reused|snapshot")
+if [ "$OUT" != "$REF_OUT" ]; then
+	echo "# FAILED: check_all output differs with '--snapshot'"
+	exit 1
+fi
+rm -f $SNAP_PATH
+
+# Lines erased since the snapshot, as by garbage collection, are caught by
+# their smeta and read again, here those of lines 1 to 10 of a copy
+SNAP_IMG_PATH="/tmp/nvm_pblk_emu_snap.img"
+cp $IMG_PATH $SNAP_IMG_PATH
+$NVM_PBLK check_all file:$SNAP_IMG_PATH --snapshot $SNAP_PATH > /dev/null
+$NVM_PBLK wipe file:$SNAP_IMG_PATH --lines 1-10 > /dev/null
+REF_OUT=$($NVM_PBLK check_all file:$SNAP_IMG_PATH | \
+	grep -v -E "sec|gbps|nbytes|reused")
+OUT=$($NVM_PBLK check_all file:$SNAP_IMG_PATH --snapshot $SNAP_PATH)
+rm -f $SNAP_IMG_PATH $SNAP_PATH
+if ! echo "$OUT" | grep -q "Reused 31 lines from snapshot"; then
+	echo "# FAILED: expected 31 lines reused from a snapshot of wiped lines"
+	exit 1
+fi
+OUT=$(echo "$OUT" | grep -v -E "sec|gbps|nbytes|reused|snapshot")
+if [ "$OUT" != "$REF_OUT" ]; then
+	echo "# FAILED: check_all output differs with a stale '--snapshot'"
+	exit 1
+fi
+echo "# OK: snapshot"
+
+# A fleet of the image twice, and a missing device, reports both copies alike,
+# also when the copies share I/O threads
+for OPTS in "--jobs 2" "--jobs 2 --qd 4"; do
+	FLEET_OUT=$($NVM_PBLK fleet $DEV_PATH $DEV_PATH file:/nonexistent $OPTS)
+	if [ "$?" -eq 0 ]; then
+		echo "# FAILED: fleet with a missing device must fail"
+		exit 1
+	fi
+	NINSTS=$(echo "$FLEET_OUT" | grep -c "nlines_closed: 20,")
+	NFAILED=$(echo "$FLEET_OUT" | grep "ndevs_failed:" | awk '{print $2}')
+	if [ "$NINSTS" -ne 4 ] || [ "$NFAILED" -ne 1 ]; then
+		echo "# FAILED: fleet '$OPTS' found $NINSTS instances," \
+			"$NFAILED failed devices"
+		exit 1
+	fi
+done
+echo "# OK: fleet"
+
+# The exporter serves the lines of the last of its two scans, over TCP by bash
+EXPORT_PORT=19477
+$NVM_PBLK export $DEV_PATH --listen tcp:127.0.0.1:$EXPORT_PORT --interval 1 \
+	--scans 2 > /dev/null &
+EXPORT_PID=$!
+for i in $(seq 50); do
+	sleep 0.1
+	exec 3<>/dev/tcp/127.0.0.1/$EXPORT_PORT 2> /dev/null && break
+done
+printf "GET /metrics HTTP/1.0\r\n\r\n" >&3
+METRICS_OUT=$(cat <&3)
+exec 3<&-
+wait $EXPORT_PID
+if [ "$?" -ne 0 ]; then
+	echo "# FAILED: export"
+	exit 1
+fi
+NCLOSED=$(echo "$METRICS_OUT" | grep -c '^pblk_lines{.*state="closed"} 20')
+NOPEN=$(echo "$METRICS_OUT" | grep -c '^pblk_open_lines{.*} 1')
+if [ "$NCLOSED" -ne 2 ] || [ "$NOPEN" -ne 2 ]; then
+	echo "# FAILED: export served $NCLOSED/$NOPEN instances with 20/1 lines"
+	exit 1
+fi
+echo "# OK: export"
+
+# Every command reads a metadump of the image as it reads the image
+DUMP_PATH="/tmp/nvm_pblk_emu.dump"
+rm -f $DUMP_PATH
+$NVM_PBLK metadump $DEV_PATH --out $DUMP_PATH > /dev/null
+if [ "$?" -ne 0 ]; then
+	echo "# FAILED: metadump"
+	exit 1
+fi
+for CMD in instances lines_all check_all l2p_all vsc_all recov_all; do
+	REF_OUT=$($NVM_PBLK $CMD $DEV_PATH)
+	REF_RC=$?
+	OUT=$($NVM_PBLK $CMD dump:$DUMP_PATH)
+	RC=$?
+	if [ "$REF_RC" -ne 0 ] || [ "$RC" -ne 0 ]; then
+		echo "# FAILED: $CMD on the image or on the metadump"
+		exit 1
+	fi
+	REF_OUT=$(echo "$REF_OUT" | grep -v -E "sec|gbps|name|Total")
+	OUT=$(echo "$OUT" | grep -v -E "sec|gbps|name|Total")
+	if [ "$OUT" != "$REF_OUT" ]; then
+		echo "# FAILED: $CMD output differs on the metadump"
+		exit 1
+	fi
+done
+rm -f $DUMP_PATH
+echo "# OK: metadump"
+
+# LBAs read through the L2P hold their LBA, or are unmapped and read as zeroes,
+# alike with and without read-ahead and with a cache of a few windows
+LBA_PATH="/tmp/nvm_pblk_emu.lbas"
+$NVM_PBLK read_lba $DEV_PATH 0 7 --lbas 0-2047 --out $LBA_PATH.ra -b \
+	> /dev/null
+$NVM_PBLK read_lba $DEV_PATH 0 7 --lbas 0-2047 --out $LBA_PATH --ra 0 \
+	--cache-mb 1 -b > /dev/null
+if [ "$?" -ne 0 ] || ! cmp -s $LBA_PATH $LBA_PATH.ra; then
+	echo "# FAILED: read_lba"
+	exit 1
+fi
+NBAD=$(od -A n -v -t u8 -w4096 $LBA_PATH | awk '{
+	zero = 1
+	for (i = 1; i <= NF; ++i)
+		if ($i != 0)
+			zero = 0
+	if ((!zero) && ($1 != NR - 1))
+		++nbad
+} END { print nbad + 0 }')
+if [ "$NBAD" -ne 0 ]; then
+	echo "# FAILED: read_lba read $NBAD sectors of other LBAs"
+	exit 1
+fi
+rm -f $LBA_PATH $LBA_PATH.ra
+echo "# OK: read_lba"
+
+rm -f $IMG_PATH
+echo "# PASSED"